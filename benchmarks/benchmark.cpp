@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bilateral.h"
+#include "clahe.h"
+#include "color-convert.h"
+#include "demosaic.h"
+#include "edge-preserving.h"
+#include "equalize.h"
+#include "fused-denoise.h"
+#include "image.h"
+#include "isp-pipeline.h"
+#include "linear-filter.h"
+#include "median.h"
+#include "metrics.h"
+#include "nlm.h"
+#include "synthetic.h"
+#include "thread-pool.h"
+#include "white-balance.h"
+
+using namespace imgcore;
+
+// Every operator new of the process is counted, so a case that allocates
+// per call (a temporary vector, a std::function task) shows up in the
+// report next to the image buffers counted by imageAllocations().
+namespace {
+std::atomic<uint64_t> heapAllocationCount{0};
+std::atomic<uint64_t> heapAllocationBytes{0};
+}  // namespace
+
+// All out of line: once either side is inlined, GCC pairs the malloc()
+// behind operator new with the operator delete call site (or free() with
+// new) and reports a -Wmismatched-new-delete that is not one.
+__attribute__((noinline)) void* operator new(size_t size) {
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    heapAllocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+// One operator configuration on one prepared input. `run` receives the pool
+// for the thread count under test, or null for a single thread.
+struct BenchCase {
+    std::string op;
+    std::string variant;
+    bool threaded = false;
+    std::function<void(ThreadPool*)> run;
+};
+
+struct BenchResult {
+    std::string op;
+    std::string variant;
+    int width = 0;
+    int height = 0;
+    int threads = 1;
+    int runs = 0;
+    double msMedian = 0;
+    double msMin = 0;
+    // Per call, measured over the timed runs after a warm-up call.
+    double heapAllocations = 0;
+    double heapBytes = 0;
+    double imageAllocations = 0;
+    double imageBytes = 0;
+
+    double megapixelsPerSecond() const { return width * static_cast<double>(height) / (msMedian * 1e3); }
+    double nsPerPixel() const { return msMedian * 1e6 / (width * static_cast<double>(height)); }
+    std::string key() const {
+        std::ostringstream k;
+        k << op << "|" << variant << "|" << width << "x" << height << "|" << threads;
+        return k.str();
+    }
+};
+
+struct BenchOptions {
+    std::vector<std::pair<int, int>> resolutions{{640, 480}, {1920, 1080}};
+    std::vector<int> threads;
+    double minSeconds = 0.2;
+    int minRuns = 3;
+    std::string filter;
+    std::string jsonPath;
+    std::string label;
+    std::string baselinePath;
+    double tolerance = 0.10;
+};
+
+// Deterministic inputs of one resolution; bordered copies are made once, so
+// the kernels never pad per call.
+struct Inputs {
+    RgbImage rgb;
+    RgbImage rgbNoisy;
+    GrayImage gray;
+    GrayImage grayNoisy;
+    GrayImage grayImpulse;
+    GrayImage bayer;
+
+    Inputs(int width, int height) {
+        syntheticScene(rgb, width, height, 1);
+        syntheticScene(gray, width, height, 2);
+
+        RgbImage noisyRgb = rgb;
+        addGaussianNoise(noisyRgb, 10.0, 3);
+        rgbNoisy = padded(noisyRgb, 8, BorderMode::Replicate);
+
+        GrayImage noisy = gray;
+        addGaussianNoise(noisy, 10.0, 4);
+        grayNoisy = padded(noisy, 8, BorderMode::Replicate);
+
+        GrayImage impulse = gray;
+        addImpulseNoise(impulse, 0.05, 5);
+        grayImpulse = padded(impulse, 8, BorderMode::Replicate);
+
+        GrayImage mosaicked;
+        mosaic(rgb, mosaicked, CfaPattern::GRBG);
+        bayer = padded(mosaicked, 5, BorderMode::Reflect);
+    }
+};
+
+// The cases for one resolution. Each case owns its output buffers, so after
+// the warm-up call every kernel runs on reused memory.
+std::vector<BenchCase> buildCases(const Inputs& in) {
+    std::vector<BenchCase> cases;
+    auto add = [&](const std::string& op, const std::string& variant, bool threaded,
+                   std::function<void(ThreadPool*)> run) { cases.push_back({op, variant, threaded, std::move(run)}); };
+
+    auto rgbOut = std::make_shared<RgbImage>();
+    auto grayOut = std::make_shared<GrayImage>();
+
+    const std::pair<const char*, DemosaicMethod> methods[] = {
+        {"bilinear", DemosaicMethod::Bilinear}, {"mhc", DemosaicMethod::Malvar}, {"ahd", DemosaicMethod::AHD}};
+    for (const auto& m : methods) {
+        const DemosaicMethod method = m.second;
+        add("demosaic", m.first, method == DemosaicMethod::AHD,
+            [&in, rgbOut, method](ThreadPool* pool) { demosaic(in.bayer, *rgbOut, CfaPattern::GRBG, method, pool); });
+    }
+
+    for (int radius : {1, 2, 3, 5}) {
+        const GrayImage& src = radius == 1 ? in.grayImpulse : in.grayNoisy;
+        add("median", "gray r=" + std::to_string(radius), false,
+            [&src, grayOut, radius](ThreadPool*) { medianFilter(src, *grayOut, radius); });
+    }
+    add("median", "rgb r=1", false, [&in, rgbOut](ThreadPool*) { medianFilter(in.rgbNoisy, *rgbOut, 1); });
+
+    for (int radius : {2, 3, 5}) {
+        auto weights = std::make_shared<BilateralWeights>(radius, radius / 2.0 + 0.5, 25.0);
+        add("bilateral", "gray r=" + std::to_string(radius), false,
+            [&in, grayOut, weights](ThreadPool*) { bilateralFilter(in.grayNoisy, *grayOut, *weights); });
+    }
+    auto radius3Weights = std::make_shared<BilateralWeights>(3, 2.0, 25.0);
+    add("bilateral", "rgb r=3", false,
+        [&in, rgbOut, radius3Weights](ThreadPool*) { bilateralFilter(in.rgbNoisy, *rgbOut, *radius3Weights); });
+    add("bilateral", "grid gray s=8", false,
+        [&in, grayOut](ThreadPool*) { bilateralGrid(in.grayNoisy, *grayOut, 8.0, 25.0); });
+    auto grayEdge = std::make_shared<EdgePreservingWorkspace<unsigned char, 1>>();
+    auto rgbEdge = std::make_shared<EdgePreservingWorkspace<unsigned char, 3>>();
+    add("guided", "gray r=8", true, [&in, grayOut, grayEdge](ThreadPool* pool) {
+        guidedFilter(in.grayNoisy, *grayOut, 8, 20.0, pool, grayEdge.get());
+    });
+    add("guided", "rgb r=8", true, [&in, rgbOut, rgbEdge](ThreadPool* pool) {
+        guidedFilter(in.rgbNoisy, *rgbOut, 8, 20.0, pool, rgbEdge.get());
+    });
+    add("domain", "gray sigma-s=40", true, [&in, grayOut, grayEdge](ThreadPool* pool) {
+        domainTransformFilter(in.grayNoisy, *grayOut, 40.0, 8.0, 3, pool, grayEdge.get());
+    });
+    add("domain", "rgb sigma-s=40", true, [&in, rgbOut, rgbEdge](ThreadPool* pool) {
+        domainTransformFilter(in.rgbNoisy, *rgbOut, 40.0, 8.0, 3, pool, rgbEdge.get());
+    });
+    add("fused", "median r=1 + bilateral r=3", false, [&in, grayOut, radius3Weights](ThreadPool*) {
+        medianBilateralFused(in.grayImpulse, *grayOut, 1, *radius3Weights);
+    });
+
+    for (int size : {3, 9, 25}) {
+        add("box", "size=" + std::to_string(size), false,
+            [&in, grayOut, size](ThreadPool*) { boxFilter(in.grayNoisy, *grayOut, size); });
+    }
+    for (int size : {5, 15}) {
+        const double sigma = size / 5.0;
+        add("gaussian", "float size=" + std::to_string(size), false,
+            [&in, grayOut, size, sigma](ThreadPool*) { gaussianFilter(in.grayNoisy, *grayOut, size, sigma); });
+        add("gaussian", "fixed size=" + std::to_string(size), false,
+            [&in, grayOut, size, sigma](ThreadPool*) { gaussianFilterFixed(in.grayNoisy, *grayOut, size, sigma); });
+    }
+    add("gaussian", "recursive sigma=4", false,
+        [&in, grayOut](ThreadPool*) { *grayOut = gaussianFilterRecursive(in.grayNoisy, 4.0); });
+
+    struct NlmCase {
+        const char* name;
+        int search;
+        NlmWeights weights;
+    };
+    for (const NlmCase& c : {NlmCase{"t=7 s=11 float", 11, NlmWeights::Float},
+                             NlmCase{"t=7 s=21 float", 21, NlmWeights::Float},
+                             NlmCase{"t=7 s=21 fixed", 21, NlmWeights::Fixed}}) {
+        NlmParams params;
+        params.searchSize = c.search;
+        params.weights = c.weights;
+        add("nlm", std::string("gray ") + c.name, true,
+            [&in, grayOut, params](ThreadPool* pool) { nlMeansDenoise(in.grayNoisy, *grayOut, params, pool); });
+    }
+    NlmParams lumaGuided;
+    lumaGuided.weights = NlmWeights::Fixed;
+    lumaGuided.color = NlmColor::LumaGuided;
+    add("nlm", "rgb t=7 s=21 fixed luma-guided", true,
+        [&in, rgbOut, lumaGuided](ThreadPool* pool) { nlMeansDenoise(in.rgbNoisy, *rgbOut, lumaGuided, pool); });
+
+    add("equalize", "bucket-fill raster", false,
+        [&in, grayOut](ThreadPool*) { equalizeBucketFill(in.gray, *grayOut); });
+    add("equalize", "bucket-fill local-mean", false,
+        [&in, grayOut](ThreadPool*) { equalizeBucketFill(in.gray, *grayOut, 0, TieBreak::LocalMean); });
+    add("clahe", "8x8 clip=4", true, [&in, grayOut](ThreadPool* pool) {
+        ClaheParams params;
+        params.clipLimit = 4.0;
+        clahe(in.gray, *grayOut, params, pool);
+    });
+
+    const std::pair<const char*, WhiteBalanceEstimator> estimators[] = {
+        {"gray-world", WhiteBalanceEstimator::GrayWorld},
+        {"white-patch", WhiteBalanceEstimator::WhitePatch},
+        {"gray-edge", WhiteBalanceEstimator::GrayEdge}};
+    for (const auto& e : estimators) {
+        WhiteBalanceParams params;
+        params.estimator = e.second;
+        add("awb", e.first, true, [&in, rgbOut, params](ThreadPool* pool) {
+            WhiteBalanceReport report;
+            whiteBalance(in.rgb, *rgbOut, params, &report, pool);
+        });
+    }
+    auto stream = std::make_shared<StreamingWhiteBalance>();
+    add("awb", "stream row-step=8", true, [&in, rgbOut, stream](ThreadPool* pool) {
+        // The trajectory would grow with every timed call.
+        if (stream->trajectory().size() > 1000) *stream = StreamingWhiteBalance();
+        stream->process(in.rgb, *rgbOut, pool);
+    });
+
+    auto yuv = std::make_shared<YuvPlanes>();
+    rgbToYuv(in.rgb, *yuv);
+    auto planesOut = std::make_shared<YuvPlanes>();
+    add("color", "rgb-to-yuv", false, [&in, planesOut](ThreadPool*) { rgbToYuv(in.rgb, *planesOut); });
+    add("color", "yuv-to-rgb", false, [yuv, rgbOut](ThreadPool*) { yuvToRgb(yuv->y, yuv->u, yuv->v, *rgbOut); });
+
+    add("metrics", "psnr rgb", true,
+        [&in](ThreadPool* pool) { measurePsnr<3>(in.rgb, in.rgbNoisy, ImageRegion{}, pool); });
+    auto grayWorkspace = std::make_shared<MetricsWorkspace<1>>();
+    add("metrics", "ssim gray", true, [&in, grayWorkspace](ThreadPool* pool) {
+        measureSsim<1>(in.gray, in.grayNoisy, SsimParams{}, ImageRegion{}, pool, grayWorkspace.get());
+    });
+    auto rgbWorkspace = std::make_shared<MetricsWorkspace<3>>();
+    add("metrics", "ms-ssim rgb", true, [&in, rgbWorkspace](ThreadPool* pool) {
+        measureMsSsim<3>(in.rgb, in.rgbNoisy, SsimParams{}, pool, rgbWorkspace.get());
+    });
+
+    // The camera pipeline two ways with the same output: stage by stage on
+    // whole frames (what an imgpipe chain does), and tiled.
+    IspParams ispParams;
+    ispParams.demosaic = DemosaicMethod::AHD;
+    struct WholeFrame {
+        RgbImage rgb, balanced, denoised;
+        YuvPlanes yuv;
+        GrayImage y;
+    };
+    auto whole = std::make_shared<WholeFrame>();
+    auto ispWeights = std::make_shared<BilateralWeights>(ispParams.bilateralRadius, ispParams.sigmaSpatial,
+                                                         ispParams.sigmaRange);
+    add("isp", "ahd whole-frame stages", true, [&in, rgbOut, whole, ispWeights, ispParams](ThreadPool* pool) {
+        demosaic(in.bayer, whole->rgb, ispParams.pattern, ispParams.demosaic, pool);
+        // Sized with the median's border first, so the balance writes in place.
+        whole->balanced.resize(whole->rgb.width(), whole->rgb.height(), ispParams.medianRadius);
+        whiteBalance(whole->rgb, whole->balanced, ispParams.whiteBalance, nullptr, pool);
+        whole->balanced.fillBorder(BorderMode::Replicate);
+        medianBilateralFused(whole->balanced, whole->denoised, ispParams.medianRadius, *ispWeights);
+        rgbToYuv(whole->denoised, whole->yuv);
+        clahe(whole->yuv.y, whole->y, ispParams.clahe, pool);
+        yuvToRgb(whole->y, whole->yuv.u, whole->yuv.v, *rgbOut);
+    });
+    auto isp = std::make_shared<IspPipeline>(ispParams);
+    add("isp", "ahd tiled 1024x52", true,
+        [&in, rgbOut, isp](ThreadPool* pool) { isp->process(in.bayer, *rgbOut, pool); });
+    return cases;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+BenchResult measure(const BenchCase& c, int width, int height, int threads, const BenchOptions& options) {
+    std::unique_ptr<ThreadPool> pool;
+    // The calling thread works while it waits, so T threads need T - 1 workers.
+    if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+    c.run(pool.get());  // warm-up: caches, lazily built tables, output buffers
+
+    const uint64_t heapCount0 = heapAllocationCount.load();
+    const uint64_t heapBytes0 = heapAllocationBytes.load();
+    const uint64_t imageCount0 = imageAllocations().count.load();
+    const uint64_t imageBytes0 = imageAllocations().bytes.load();
+    std::vector<double> times;
+    times.reserve(1024);
+    const auto begin = std::chrono::steady_clock::now();
+    while (times.size() < 1024 &&
+           (static_cast<int>(times.size()) < options.minRuns || millisecondsSince(begin) < options.minSeconds * 1e3)) {
+        const auto start = std::chrono::steady_clock::now();
+        c.run(pool.get());
+        times.push_back(millisecondsSince(start));
+    }
+
+    BenchResult r;
+    r.op = c.op;
+    r.variant = c.variant;
+    r.width = width;
+    r.height = height;
+    r.threads = threads;
+    r.runs = static_cast<int>(times.size());
+    const double runs = r.runs;
+    // The growth of `times` is reserved up front, so it adds nothing here.
+    r.heapAllocations = (heapAllocationCount.load() - heapCount0) / runs;
+    r.heapBytes = (heapAllocationBytes.load() - heapBytes0) / runs;
+    r.imageAllocations = (imageAllocations().count.load() - imageCount0) / runs;
+    r.imageBytes = (imageAllocations().bytes.load() - imageBytes0) / runs;
+    std::sort(times.begin(), times.end());
+    r.msMedian = times[times.size() / 2];
+    r.msMin = times.front();
+    return r;
+}
+
+void printRow(const BenchResult& r) {
+    std::ostringstream name;
+    name << r.op << " " << r.variant;
+    std::ostringstream size;
+    size << r.width << "x" << r.height;
+    std::cout << std::left << std::setw(40) << name.str() << std::setw(11) << size.str() << std::right
+              << std::setw(3) << r.threads << std::fixed << std::setprecision(3) << std::setw(11) << r.msMedian
+              << std::setprecision(1) << std::setw(9) << r.megapixelsPerSecond() << std::setprecision(2)
+              << std::setw(10) << r.nsPerPixel() << std::setprecision(1) << std::setw(8) << r.heapAllocations
+              << std::setw(7) << r.imageAllocations << std::endl;
+}
+
+void writeJson(std::ostream& out, const std::vector<BenchResult>& results, const BenchOptions& options) {
+    out << "{\n  \"label\": \"" << options.label << "\",\n";
+#ifdef __AVX2__
+    out << "  \"simd\": \"avx2\",\n";
+#else
+    out << "  \"simd\": \"scalar\",\n";
+#endif
+    out << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"minSeconds\": " << options.minSeconds << ",\n";
+    out << "  \"results\": [";
+    out << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        // One result per line, which is what readBaseline() expects.
+        out << (i ? ",\n    {" : "\n    {");
+        out << "\"operator\": \"" << r.op << "\", \"variant\": \"" << r.variant << "\", \"width\": " << r.width
+            << ", \"height\": " << r.height << ", \"threads\": " << r.threads << ", \"runs\": " << r.runs
+            << ", \"msMedian\": " << r.msMedian << ", \"msMin\": " << r.msMin
+            << ", \"megapixelsPerSecond\": " << r.megapixelsPerSecond() << ", \"nsPerPixel\": " << r.nsPerPixel()
+            << ", \"heapAllocations\": " << r.heapAllocations << ", \"heapBytes\": " << r.heapBytes
+            << ", \"imageAllocations\": " << r.imageAllocations << ", \"imageBytes\": " << r.imageBytes << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+std::string jsonField(const std::string& line, const std::string& name) {
+    const std::string tag = "\"" + name + "\": ";
+    size_t pos = line.find(tag);
+    if (pos == std::string::npos) return "";
+    pos += tag.size();
+    if (line[pos] == '"') {
+        const size_t end = line.find('"', pos + 1);
+        return line.substr(pos + 1, end - pos - 1);
+    }
+    const size_t end = line.find_first_of(",}", pos);
+    return line.substr(pos, end - pos);
+}
+
+// Results of an earlier run written by writeJson().
+std::vector<BenchResult> readBaseline(const std::string& path) {
+    std::vector<BenchResult> results;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find("\"operator\"") == std::string::npos) continue;
+        BenchResult r;
+        r.op = jsonField(line, "operator");
+        r.variant = jsonField(line, "variant");
+        r.width = std::atoi(jsonField(line, "width").c_str());
+        r.height = std::atoi(jsonField(line, "height").c_str());
+        r.threads = std::atoi(jsonField(line, "threads").c_str());
+        r.msMedian = std::atof(jsonField(line, "msMedian").c_str());
+        r.heapAllocations = std::atof(jsonField(line, "heapAllocations").c_str());
+        r.imageAllocations = std::atof(jsonField(line, "imageAllocations").c_str());
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Lists the cases that got slower than `tolerance` allows or started to
+// allocate; returns how many did.
+int compareWithBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline,
+                        double tolerance) {
+    int regressions = 0;
+    int matched = 0;
+    for (const BenchResult& r : results) {
+        auto old = std::find_if(baseline.begin(), baseline.end(),
+                                [&](const BenchResult& b) { return b.key() == r.key(); });
+        if (old == baseline.end() || old->msMedian <= 0) continue;
+        ++matched;
+        const double ratio = r.msMedian / old->msMedian;
+        const bool slower = ratio > 1.0 + tolerance;
+        // Averages over the runs, so a one-off allocation in a long run is noise.
+        const bool allocates =
+            r.heapAllocations + r.imageAllocations >= old->heapAllocations + old->imageAllocations + 0.5;
+        if (!slower && !allocates) continue;
+        ++regressions;
+        std::cout << "REGRESSION " << r.op << " " << r.variant << " " << r.width << "x" << r.height << " t"
+                  << r.threads << ": " << std::fixed << std::setprecision(3) << old->msMedian << " -> " << r.msMedian
+                  << " ms (x" << std::setprecision(2) << ratio << ")";
+        if (allocates) std::cout << ", allocations " << old->heapAllocations + old->imageAllocations << " -> "
+                                 << r.heapAllocations + r.imageAllocations;
+        std::cout << std::endl;
+    }
+    std::cout << matched << " cases compared with the baseline, " << regressions << " regressed" << std::endl;
+    return regressions;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parseArgs(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--resolutions") {
+            options.resolutions.clear();
+            for (const std::string& item : splitList(value)) {
+                int w = 0, h = 0;
+                if (std::sscanf(item.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                    std::cerr << "Bad resolution " << item << std::endl;
+                    return false;
+                }
+                options.resolutions.push_back({w, h});
+            }
+        } else if (arg == "--threads") {
+            options.threads.clear();
+            for (const std::string& item : splitList(value)) {
+                options.threads.push_back(std::max(1, std::atoi(item.c_str())));
+            }
+        } else if (arg == "--min-time") {
+            options.minSeconds = std::atof(value.c_str());
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--json") {
+            options.jsonPath = value;
+        } else if (arg == "--label") {
+            options.label = value;
+        } else if (arg == "--baseline") {
+            options.baselinePath = value;
+        } else if (arg == "--tolerance") {
+            options.tolerance = std::atof(value.c_str());
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.threads.empty()) {
+        const int hardware = std::max(1u, std::thread::hardware_concurrency());
+        options.threads = {1};
+        if (hardware > 1) options.threads.push_back(hardware);
+    }
+    return true;
+}
+
+}  // namespace
+
+// Usage: benchmark [--resolutions 640x480,1920x1080] [--threads 1,4] [--min-time seconds]
+//                  [--filter text] [--json out.json] [--label revision]
+//                  [--baseline old.json] [--tolerance 0.10]
+// Every operator runs on deterministic synthetic inputs at each resolution;
+// operators that take a ThreadPool also run at each thread count. --filter
+// keeps the cases whose "operator variant" contains the text. With
+// --baseline, cases that got slower than the tolerance (or started to
+// allocate) are listed and the exit status is 1.
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArgs(argc, argv, options)) return -1;
+
+    std::cout << std::left << std::setw(40) << "case" << std::setw(11) << "size" << std::right << std::setw(3)
+              << "T" << std::setw(11) << "ms" << std::setw(9) << "MP/s" << std::setw(10) << "ns/px" << std::setw(8)
+              << "heap" << std::setw(7) << "image" << std::endl;
+    std::vector<BenchResult> results;
+    for (const auto& resolution : options.resolutions) {
+        const Inputs inputs(resolution.first, resolution.second);
+        for (const BenchCase& c : buildCases(inputs)) {
+            if (!options.filter.empty() && (c.op + " " + c.variant).find(options.filter) == std::string::npos) continue;
+            for (int threads : options.threads) {
+                if (threads > 1 && !c.threaded) continue;
+                results.push_back(measure(c, resolution.first, resolution.second, threads, options));
+                printRow(results.back());
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream json(options.jsonPath);
+        writeJson(json, results, options);
+        if (!json) {
+            std::cerr << "Could not write " << options.jsonPath << std::endl;
+            return -1;
+        }
+    }
+    if (!options.baselinePath.empty()) {
+        const std::vector<BenchResult> baseline = readBaseline(options.baselinePath);
+        if (baseline.empty()) {
+            std::cerr << "No results in " << options.baselinePath << std::endl;
+            return -1;
+        }
+        return compareWithBaseline(results, baseline, options.tolerance) ? 1 : 0;
+    }
+    return 0;
+}
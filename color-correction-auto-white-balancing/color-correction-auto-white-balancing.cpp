@@ -3,63 +3,101 @@
 #include <fstream>
 #include <algorithm>
 #include <iomanip>
+#include <array>
+#include <cstdlib>
+
+#include "image.h"
+#include "raw-io.h"
+#include "batch.h"
+#include "thread-pool.h"
+#include "white-balance.h"
 
 using namespace std;
+using namespace imgcore;
 
 const int WIDTH = 768;
 const int HEIGHT = 512;
-const int CHANNELS = 3;
-const int TOTAL_PIXELS = WIDTH * HEIGHT;
-const int TOTAL_BYTES = TOTAL_PIXELS * CHANNELS;
 
-int main() {
-    vector<unsigned char> imgData(TOTAL_BYTES);
-    ifstream inFile("sea.raw", ios::binary);
-    inFile.read(reinterpret_cast<char*>(imgData.data()), TOTAL_BYTES);
-    inFile.close();
+// --batch --stream 1: the frames are treated as a video in file order. The
+// gains come from StreamingWhiteBalance (--row-step, --smoothing, --drift)
+// and the per-frame gain trajectory is written to outDir/awb_trajectory.csv.
+int runStreamMode(BatchOptions& options, const WhiteBalanceParams& params) {
+    StreamingWhiteBalanceParams streamParams;
+    streamParams.estimate = params;
+    streamParams.rowStep = static_cast<int>(options.option("row-step", 8.0));
+    streamParams.smoothing = options.option("smoothing", streamParams.smoothing);
+    streamParams.driftThreshold = options.option("drift", streamParams.driftThreshold);
+    // One reader and one compute worker keep the frames in order; the
+    // frame itself is split over the pool.
+    options.readers = 1;
+    options.workers = 1;
+    ThreadPool pool;
+    StreamingWhiteBalance awb(streamParams);
+    auto process = [&](const RgbImage& in, RgbImage& out, int) { awb.process(in, out, &pool); };
+    BatchReport report = runBatch<RgbImage, RgbImage>(options, "_awb", process);
+    report.print(cout);
+    cout << "LUT rebuilds: " << awb.lutRebuilds() << " of " << awb.trajectory().size() << " frames" << endl;
+
+    ofstream csv(options.outputDir + "/awb_trajectory.csv");
+    awb.writeTrajectoryCsv(csv);
+    return report.failed || !csv ? -1 : 0;
+}
 
-    double sumR = 0, sumG = 0, sumB = 0;
-    for (int i = 0; i < TOTAL_BYTES; i += 3) {
-        sumR += imgData[i];
-        sumG += imgData[i + 1];
-        sumB += imgData[i + 2];
+// --batch: white balance of every frame (--estimator grayworld|whitepatch|
+// grayedge, --percentile for whitepatch), written as <stem>_awb.raw.
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    WhiteBalanceParams params;
+    if (!parseWhiteBalanceEstimator(options.option("estimator", "grayworld"), params.estimator)) {
+        cerr << "Unknown white balance estimator" << endl;
+        return -1;
     }
+    params.percentile = options.option("percentile", params.percentile);
+    if (options.option("stream", 0.0) != 0.0) return runStreamMode(options, params);
 
-    double muR = sumR / TOTAL_PIXELS;
-    double muG = sumG / TOTAL_PIXELS;
-    double muB = sumB / TOTAL_PIXELS;
-    double mu = (muR + muG + muB) / 3.0;
+    auto process = [params](const RgbImage& in, RgbImage& out, int) { whiteBalance(in, out, params); };
+    BatchReport report = runBatch<RgbImage, RgbImage>(options, "_awb", process);
+    report.print(cout);
+    return report.failed ? -1 : 0;
+}
 
-    double alphaR = mu / muR;
-    double alphaG = mu / muG;
-    double alphaB = mu / muB;
+// Usage: color-correction-auto-white-balancing [grayworld|whitepatch|grayedge] [percentile];
+// gray-world is the default, white-patch takes the 99th percentile unless given.
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
 
-    vector<unsigned char> outData(TOTAL_BYTES);
-    for (int i = 0; i < TOTAL_BYTES; i += 3) {
-        outData[i]     = static_cast<unsigned char>(min(255.0, imgData[i] * alphaR));
-        outData[i + 1] = static_cast<unsigned char>(min(255.0, imgData[i + 1] * alphaG));
-        outData[i + 2] = static_cast<unsigned char>(min(255.0, imgData[i + 2] * alphaB));
+    WhiteBalanceParams params;
+    if (argc > 1 && !parseWhiteBalanceEstimator(argv[1], params.estimator)) {
+        cerr << "Unknown white balance estimator " << argv[1] << endl;
+        return -1;
     }
+    if (argc > 2) params.percentile = atof(argv[2]);
 
-    double sumR_after = 0, sumG_after = 0, sumB_after = 0;
-    for (int i = 0; i < TOTAL_BYTES; i += 3) {
-        sumR_after += outData[i];
-        sumG_after += outData[i + 1];
-        sumB_after += outData[i + 2];
-    }
+    RgbImage imgData(WIDTH, HEIGHT);
+    if (!readRaw("sea.raw", imgData)) return -1;
 
-    double muR_after = sumR_after / TOTAL_PIXELS;
-    double muG_after = sumG_after / TOTAL_PIXELS;
-    double muB_after = sumB_after / TOTAL_PIXELS;
+    RgbImage outData(WIDTH, HEIGHT);
+    ThreadPool pool;
+    WhiteBalanceReport report;
+    whiteBalance(imgData, outData, params, &report, &pool);
 
+    const array<double, 3>& before = report.meansBefore;
+    const array<double, 3>& after = report.meansAfter;
+    const array<double, 3>& gain = report.gains.gain;
     cout << fixed << setprecision(4);
-    cout << "Means Before(R, G, B): " << muR << ", " << muG << ", " << muB << endl;
-    cout << "Target Mean(Global mu): " << mu << endl;
-    cout << "Means After(R, G, B): " << muR_after << ", " << muG_after << ", " << muB_after << endl;
+    cout << "Means Before(R, G, B): " << before[0] << ", " << before[1] << ", " << before[2] << endl;
+    if (params.estimator == WhiteBalanceEstimator::WhitePatch) {
+        cout << "Target White: " << report.gains.target << endl;
+    } else if (params.estimator == WhiteBalanceEstimator::GrayEdge) {
+        cout << "Target Edge Mean: " << report.gains.target << endl;
+    } else {
+        cout << "Target Mean(Global mu): " << report.gains.target << endl;
+    }
+    cout << "Gains(R, G, B): " << gain[0] << ", " << gain[1] << ", " << gain[2] << endl;
+    cout << "Means After(R, G, B): " << after[0] << ", " << after[1] << ", " << after[2] << endl;
 
-    ofstream outFile("sea_awb.raw", ios::binary);
-    outFile.write(reinterpret_cast<char*>(outData.data()), TOTAL_BYTES);
-    outFile.close();
+    if (!writeRaw("sea_awb.raw", outData)) return -1;
 
     return 0;
-}
\ No newline at end of file
+}
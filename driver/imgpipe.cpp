@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+#include "metrics.h"
+#include "operators.h"
+#include "pixel.h"
+#include "profile.h"
+#include "raw-io.h"
+#include "thread-pool.h"
+
+using namespace imgcore;
+
+namespace {
+
+struct DriverOptions {
+    std::string input;
+    std::string output;
+    std::string reference;  // clean frame the result is scored against
+    std::string trace;      // Chrome trace-event JSON of the runs
+    bool profile = false;   // print the per-scope profile summary
+    int width = 0;
+    int height = 0;
+    int channels = 1;
+    PixelDepth depth = PixelDepth::U8;
+    int threads = 0;  // 0 = hardware threads
+    int repeat = 1;
+    std::vector<std::pair<std::string, OperatorOptions>> steps;
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " [--rgb] [--depth 8|16|float] [--threads N] [--repeat N] [--reference clean.raw]\n"
+              << "       [--profile] [--trace trace.json]\n"
+              << "       <input.raw> <width> <height> <op> [key=value ...] [<op> ...] -o <output.raw>\n\n"
+              << "Operators (input layout, defaults):" << std::endl;
+    printOperatorCatalog(std::cerr);
+}
+
+bool parseDepth(const std::string& name, PixelDepth& depth) {
+    if (name == "8") depth = PixelDepth::U8;
+    else if (name == "16") depth = PixelDepth::U16;
+    else if (name == "float") depth = PixelDepth::Float;
+    else return false;
+    return true;
+}
+
+bool parseArgs(int argc, char** argv, DriverOptions& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--rgb") {
+            options.channels = 3;
+            continue;
+        }
+        if (arg == "--profile") {
+            options.profile = true;
+            continue;
+        }
+        if (arg.rfind("-", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            const std::string value = argv[++i];
+            if (arg == "-o" || arg == "--output") {
+                options.output = value;
+            } else if (arg == "--reference") {
+                options.reference = value;
+            } else if (arg == "--trace") {
+                options.trace = value;
+            } else if (arg == "--depth") {
+                if (!parseDepth(value, options.depth)) {
+                    std::cerr << "Invalid depth " << value << " (8, 16 or float)" << std::endl;
+                    return false;
+                }
+            } else if (arg == "--threads") {
+                options.threads = std::max(1, std::atoi(value.c_str()));
+            } else if (arg == "--repeat") {
+                options.repeat = std::max(1, std::atoi(value.c_str()));
+            } else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (positional.size() < 3) {
+            positional.push_back(arg);
+            continue;
+        }
+        // Anything past input, width and height is an operator or, when it
+        // contains '=', a setting of the operator before it.
+        const size_t eq = arg.find('=');
+        if (eq == std::string::npos) {
+            options.steps.push_back({arg, {}});
+        } else if (options.steps.empty()) {
+            std::cerr << "Setting " << arg << " comes before any operator" << std::endl;
+            return false;
+        } else {
+            options.steps.back().second[arg.substr(0, eq)] = arg.substr(eq + 1);
+        }
+    }
+    if (positional.size() < 3 || options.output.empty()) {
+        printUsage(argv[0]);
+        return false;
+    }
+    options.input = positional[0];
+    options.width = std::atoi(positional[1].c_str());
+    options.height = std::atoi(positional[2].c_str());
+    if (options.width <= 0 || options.height <= 0) {
+        std::cerr << "Invalid dimensions " << positional[1] << "x" << positional[2] << std::endl;
+        return false;
+    }
+    if (options.threads == 0) options.threads = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+template <int C>
+void printQuality(const Image<unsigned char, C>& clean, const Image<unsigned char, C>& result, ThreadPool* pool) {
+    const PsnrResult<C> psnr = measurePsnr<C>(clean, result, ImageRegion{}, pool);
+    const SsimResult<C> ssim = measureSsim<C>(clean, result, SsimParams{}, ImageRegion{}, pool);
+    std::cout << "PSNR " << std::setprecision(2) << psnr.psnr() << " dB, SSIM " << std::setprecision(4)
+              << ssim.ssim() << ", MS-SSIM " << measureMsSsim<C>(clean, result, SsimParams{}, pool) << std::endl;
+}
+
+template <typename T, int C>
+bool scoreImage(const std::string& filename, const Image<T, C>& result, ThreadPool* pool) {
+    Image<T, C> clean(result.width(), result.height());
+    if (!readRaw(filename, clean)) return false;
+    if constexpr (std::is_same_v<T, unsigned char>) {
+        printQuality(clean, result, pool);
+    } else {
+        // The metrics take 8-bit samples, so wider frames are scored after
+        // rounding both to 8 bits.
+        const float scale = 255.0f / PixelTraits<T>::maxValue;
+        Image<unsigned char, C> clean8, result8;
+        convertPixels(clean, clean8, scale);
+        convertPixels(result, result8, scale);
+        printQuality(clean8, result8, pool);
+    }
+    return true;
+}
+
+// Scores `result` against the clean frame in `filename`, which must have
+// the result's size, layout and depth.
+bool scoreAgainst(const std::string& filename, const Frame& result, ThreadPool* pool) {
+    return result.visit([&](const auto& img) { return scoreImage(filename, img, pool); });
+}
+
+}  // namespace
+
+// Runs a chain of image-core operators on one raw frame in a single
+// process, frame to frame in memory, e.g. a camera pipeline:
+//
+//   imgpipe sailboats_cfa.raw 512 768 demosaic method=ahd awb median
+//           bilateral sigma-s=30 clahe clip=4 -o sailboats_isp.raw
+//
+// The input is a single plane (gray or Bayer) unless --rgb is given, of
+// 8-bit samples unless --depth selects native-endian 16-bit ones or 32-bit
+// floats in [0, 1]; the output has the input's depth and the layout that
+// follows from the chain. Prints the time of every step (of
+// the last run with --repeat) and, with --reference, the PSNR, SSIM and
+// MS-SSIM of the result against a clean frame. --profile adds the summary
+// of every profiled scope over all runs (operators, their tiles and the
+// pool threads' busy share); --trace writes the same scopes as Chrome
+// trace-event JSON.
+int main(int argc, char** argv) {
+    DriverOptions options;
+    if (!parseArgs(argc, argv, options)) return -1;
+
+    OperatorChain chain;
+    for (const auto& step : options.steps) {
+        if (!chain.add(step.first, step.second)) return -1;
+    }
+    if (chain.outputChannels(options.channels, options.depth, std::cerr) == 0) return -1;
+
+    // The input carries the first step's border, so it is read in place.
+    Frame input;
+    input.channels = options.channels;
+    input.depth = options.depth;
+    input.resize(options.width, options.height, chain.inputBorder());
+    if (!input.visit([&](auto& img) { return readRaw(options.input, img); })) return -1;
+
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) pool = std::make_unique<ThreadPool>(options.threads - 1);
+
+    const bool profiling = options.profile || !options.trace.empty();
+    if (profiling) {
+        nameProfileThread("main");
+        setProfiling(true);
+    }
+    const Frame* result = &input;
+    double total = 0.0;
+    for (int run = 0; run < options.repeat; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        ProfileScope scope("run", "chain");
+        scope.pixels(static_cast<uint64_t>(options.width) * options.height);
+        result = &chain.run(input, pool.get());
+        total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    setProfiling(false);
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (int i = 0; i < chain.size(); ++i) {
+        std::cout << std::left << std::setw(12) << chain.stepName(i) << std::right << std::setw(10)
+                  << chain.stepMilliseconds(i) << " ms" << std::endl;
+    }
+    std::cout << std::left << std::setw(12) << "total" << std::right << std::setw(10) << total / options.repeat
+              << " ms (" << options.width << "x" << options.height << ", " << options.threads << " threads)"
+              << std::endl;
+    if (options.profile) {
+        std::cout << std::endl;
+        printProfileSummary(std::cout);
+    }
+    if (!options.trace.empty() && !writeChromeTrace(options.trace)) {
+        std::cerr << "Cannot write " << options.trace << std::endl;
+        return -1;
+    }
+
+    if (!options.reference.empty() && !scoreAgainst(options.reference, *result, pool.get())) return -1;
+
+    return result->visit([&](const auto& img) { return writeRaw(options.output, img); }) ? 0 : -1;
+}
@@ -0,0 +1,311 @@
+#include "batch.h"
+
+#include <glob.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void printBatchUsage(const char* program) {
+    std::cerr << "Usage: " << program << " --batch <dir|glob> <width> <height> <outDir>"
+              << " [--readers N] [--workers N] [--writers N] [--in-flight N] [--trace trace.json]"
+              << " [--<option> value ...]" << std::endl;
+}
+
+// Counters one stage's threads add to; busy time excludes queue waits.
+struct StageCounters {
+    std::atomic<int> frames{0};
+    std::atomic<int64_t> busyNanos{0};
+    std::atomic<size_t> bytes{0};
+
+    void add(Clock::time_point start, size_t frameBytes) {
+        frames.fetch_add(1, std::memory_order_relaxed);
+        busyNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+                            std::memory_order_relaxed);
+        bytes.fetch_add(frameBytes, std::memory_order_relaxed);
+    }
+};
+
+// A queue plus occupancy samples taken by its consumers.
+struct SampledQueue {
+    BoundedQueue<int> queue;
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> occupancySum{0};
+    std::atomic<size_t> maxOccupancy{0};
+
+    explicit SampledQueue(size_t capacity) : queue(capacity) {}
+
+    bool pop(int& slot) {
+        const size_t occupancy = queue.size();
+        samples.fetch_add(1, std::memory_order_relaxed);
+        occupancySum.fetch_add(occupancy, std::memory_order_relaxed);
+        size_t seen = maxOccupancy.load(std::memory_order_relaxed);
+        while (occupancy > seen && !maxOccupancy.compare_exchange_weak(seen, occupancy, std::memory_order_relaxed)) {
+        }
+        return queue.pop(slot);
+    }
+
+    BatchQueueReport report(const std::string& name) const {
+        BatchQueueReport r;
+        r.name = name;
+        r.capacity = queue.capacity();
+        const uint64_t n = samples.load();
+        r.meanOccupancy = n ? static_cast<double>(occupancySum.load()) / n : 0.0;
+        r.maxOccupancy = maxOccupancy.load();
+        return r;
+    }
+};
+
+BatchStageReport stageReport(const std::string& name, int threads, const StageCounters& counters) {
+    BatchStageReport r;
+    r.name = name;
+    r.threads = threads;
+    r.frames = counters.frames.load();
+    r.busySeconds = counters.busyNanos.load() * 1e-9;
+    r.bytes = counters.bytes.load();
+    return r;
+}
+
+}  // namespace
+
+int BatchOptions::computeWorkers() const {
+    if (workers > 0) return workers;
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+int BatchOptions::slots() const {
+    if (inFlight > 0) return inFlight;
+    return 2 * (std::max(readers, 1) + computeWorkers() + std::max(writers, 1));
+}
+
+std::string BatchOptions::option(const std::string& name, const std::string& fallback) const {
+    auto it = extra.find(name);
+    return it != extra.end() ? it->second : fallback;
+}
+
+double BatchOptions::option(const std::string& name, double fallback) const {
+    auto it = extra.find(name);
+    return it != extra.end() ? std::atof(it->second.c_str()) : fallback;
+}
+
+bool wantsBatch(int argc, char** argv) {
+    return argc > 1 && std::string(argv[1]) == "--batch";
+}
+
+std::vector<std::string> listBatchInputs(const std::string& spec) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    std::error_code ec;
+    if (fs::is_directory(spec, ec)) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(spec, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == ".raw") files.push_back(entry.path().string());
+        }
+    } else {
+        glob_t matches;
+        if (glob(spec.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) files.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool parseBatchArgs(int argc, char** argv, BatchOptions& options) {
+    if (argc < 6 || !wantsBatch(argc, argv)) {
+        printBatchUsage(argv[0]);
+        return false;
+    }
+    options.inputs = listBatchInputs(argv[2]);
+    options.width = std::atoi(argv[3]);
+    options.height = std::atoi(argv[4]);
+    options.outputDir = argv[5];
+    for (int i = 6; i < argc; i += 2) {
+        std::string name = argv[i];
+        if (name.rfind("--", 0) != 0 || i + 1 >= argc) {
+            std::cerr << "Expected --<option> <value>, got " << name << std::endl;
+            printBatchUsage(argv[0]);
+            return false;
+        }
+        name = name.substr(2);
+        const std::string value = argv[i + 1];
+        if (name == "readers") options.readers = std::atoi(value.c_str());
+        else if (name == "workers") options.workers = std::atoi(value.c_str());
+        else if (name == "writers") options.writers = std::atoi(value.c_str());
+        else if (name == "in-flight") options.inFlight = std::atoi(value.c_str());
+        else if (name == "trace") options.tracePath = value;
+        else options.extra[name] = value;
+    }
+    if (options.width <= 0 || options.height <= 0) {
+        std::cerr << "Invalid dimensions " << argv[3] << "x" << argv[4] << std::endl;
+        return false;
+    }
+    if (options.inputs.empty()) {
+        std::cerr << "No .raw inputs match " << argv[2] << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(options.outputDir, ec);
+    if (!std::filesystem::is_directory(options.outputDir)) {
+        std::cerr << "Cannot create output directory " << options.outputDir << std::endl;
+        return false;
+    }
+    return true;
+}
+
+BatchReport runBatchPipeline(const BatchOptions& options, const std::string& outputSuffix,
+                             const BatchCallbacks& callbacks) {
+    const int readers = std::max(options.readers, 1);
+    const int workers = options.computeWorkers();
+    const int writers = std::max(options.writers, 1);
+    const int slots = options.slots();
+    const int frames = static_cast<int>(options.inputs.size());
+
+    // Slots circulate free -> read -> compute -> write -> free; each queue
+    // can hold every slot, so a push never blocks.
+    SampledQueue freeSlots(slots), toCompute(slots), toWrite(slots);
+    for (int s = 0; s < slots; ++s) freeSlots.queue.push(s);
+    std::vector<int> frameOfSlot(slots, -1);
+
+    StageCounters readStats, computeStats, writeStats;
+    std::atomic<int> nextFrame{0};
+    std::atomic<int> failed{0};
+    std::atomic<int> readersLeft{readers};
+    std::atomic<int> workersLeft{workers};
+
+    auto outputPath = [&](int frame) {
+        std::filesystem::path in(options.inputs[frame]);
+        return (std::filesystem::path(options.outputDir) / (in.stem().string() + outputSuffix + ".raw")).string();
+    };
+
+    const bool tracing = !options.tracePath.empty();
+    if (tracing) {
+        clearProfile();
+        setProfiling(true);
+    }
+
+    auto reader = [&](int index) {
+        nameProfileThread("reader", index);
+        for (;;) {
+            const int frame = nextFrame.fetch_add(1, std::memory_order_relaxed);
+            if (frame >= frames) break;
+            int slot = 0;
+            freeSlots.pop(slot);
+            const Clock::time_point start = Clock::now();
+            ProfileScope scope("read", "batch");
+            size_t bytes = 0;
+            if (!callbacks.read(slot, options.inputs[frame], bytes)) {
+                failed.fetch_add(1, std::memory_order_relaxed);
+                freeSlots.queue.push(slot);
+                continue;
+            }
+            readStats.add(start, bytes);
+            scope.reads(bytes);
+            frameOfSlot[slot] = frame;
+            toCompute.queue.push(slot);
+        }
+        if (readersLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) toCompute.queue.close();
+    };
+    auto worker = [&](int index) {
+        nameProfileThread("compute", index);
+        int slot = 0;
+        while (toCompute.pop(slot)) {
+            const Clock::time_point start = Clock::now();
+            {
+                ProfileScope scope("compute", "batch");
+                callbacks.compute(slot, index);
+            }
+            computeStats.add(start, 0);
+            toWrite.queue.push(slot);
+        }
+        if (workersLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) toWrite.queue.close();
+    };
+    auto writer = [&](int index) {
+        nameProfileThread("writer", index);
+        int slot = 0;
+        while (toWrite.pop(slot)) {
+            const Clock::time_point start = Clock::now();
+            ProfileScope scope("write", "batch");
+            size_t bytes = 0;
+            if (callbacks.write(slot, outputPath(frameOfSlot[slot]), bytes)) writeStats.add(start, bytes);
+            else failed.fetch_add(1, std::memory_order_relaxed);
+            scope.writes(bytes);
+            freeSlots.queue.push(slot);
+        }
+    };
+
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i) threads.emplace_back(reader, i);
+    for (int i = 0; i < workers; ++i) threads.emplace_back(worker, i);
+    for (int i = 0; i < writers; ++i) threads.emplace_back(writer, i);
+    for (std::thread& t : threads) t.join();
+
+    if (tracing) {
+        setProfiling(false);
+        if (!writeChromeTrace(options.tracePath)) std::cerr << "Cannot write " << options.tracePath << std::endl;
+    }
+
+    BatchReport report;
+    report.wallSeconds = secondsSince(start);
+    report.frames = writeStats.frames.load();
+    report.failed = failed.load();
+    report.slotBytes = callbacks.slotBytes;
+    report.stages = {stageReport("read", readers, readStats), stageReport("compute", workers, computeStats),
+                     stageReport("write", writers, writeStats)};
+    report.queues = {freeSlots.report("free slots"), toCompute.report("to compute"), toWrite.report("to write")};
+    report.profiled = tracing;
+    return report;
+}
+
+void BatchReport::print(std::ostream& out) const {
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << "Batch: " << frames << " frames written, " << failed << " failed, " << wallSeconds << " s, "
+        << (wallSeconds > 0 ? frames / wallSeconds : 0.0) << " frames/s, " << slotBytes / (1024.0 * 1024.0)
+        << " MiB of frame slots" << std::endl;
+
+    const BatchStageReport* bottleneck = nullptr;
+    double worst = -1;
+    for (const BatchStageReport& s : stages) {
+        // Utilisation: the share of the stage's thread time spent working.
+        const double utilisation = wallSeconds > 0 && s.threads > 0 ? s.busySeconds / (s.threads * wallSeconds) : 0;
+        const double perThread = s.busySeconds > 0 ? s.frames * s.threads / s.busySeconds : 0;
+        out << "  " << std::left << std::setw(8) << s.name << std::right << s.threads << " threads, " << s.frames
+            << " frames, " << 100 * utilisation << "% busy, " << perThread << " frames/s at full load";
+        if (s.bytes) out << ", " << (s.busySeconds > 0 ? s.bytes / s.busySeconds * s.threads / 1e6 : 0) << " MB/s";
+        out << std::endl;
+        if (utilisation > worst) {
+            worst = utilisation;
+            bottleneck = &s;
+        }
+    }
+    for (const BatchQueueReport& q : queues) {
+        out << "  queue " << std::left << std::setw(11) << q.name << std::right << "mean " << q.meanOccupancy
+            << " / max " << q.maxOccupancy << " of " << q.capacity << std::endl;
+    }
+    if (bottleneck) {
+        const bool io = bottleneck->name != "compute";
+        out << "  bottleneck: " << bottleneck->name << (io ? " (I/O-bound)" : " (compute-bound)") << std::endl;
+    }
+    if (profiled) printProfileSummary(out);
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace imgcore
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+#include "raw-io.h"
+
+namespace imgcore {
+
+// Fixed-capacity multi-producer multi-consumer queue (Vyukov's bounded
+// ring): every cell carries a sequence number, so a push or pop is one CAS
+// on a position counter and no lock is taken. The blocking push()/pop()
+// spin briefly, then back off to short sleeps. Capacity is rounded up to a
+// power of two.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cells_(roundUp(capacity)), mask_(cells_.size() - 1) {
+        for (size_t i = 0; i < cells_.size(); ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    size_t capacity() const { return cells_.size(); }
+
+    // Approximate while other threads are pushing or popping.
+    size_t size() const {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_relaxed);
+        return tail >= head ? tail - head : 0;
+    }
+
+    bool tryPush(const T& value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const T& value) {
+        for (int attempt = 0; !tryPush(value); ++attempt) backoff(attempt);
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool pop(T& value) {
+        for (int attempt = 0;; ++attempt) {
+            if (tryPop(value)) return true;
+            if (closed_.load(std::memory_order_acquire)) return tryPop(value);
+            backoff(attempt);
+        }
+    }
+
+    // Producers are done; pop() fails once the remaining items are taken.
+    void close() { closed_.store(true, std::memory_order_release); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence{0};
+        T value{};
+    };
+
+    static size_t roundUp(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    static void backoff(int attempt) {
+        if (attempt < 64) return;
+        if (attempt < 128) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::vector<Cell> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<bool> closed_{false};
+};
+
+// A batch run over many same-sized raw frames:
+//   <tool> --batch <dir|glob> <width> <height> <outDir>
+//          [--readers N] [--workers N] [--writers N] [--in-flight N] [--trace trace.json]
+//          [--<tool option> value ...]
+// A directory means every *.raw file in it. Outputs are written to
+// outDir/<input stem><suffix>.raw.
+struct BatchOptions {
+    std::vector<std::string> inputs;
+    std::string outputDir;
+    int width = 0;
+    int height = 0;
+    int readers = 1;
+    int workers = 0;   // <= 0 picks std::thread::hardware_concurrency()
+    int writers = 1;
+    int inFlight = 0;  // frame slots in total; <= 0 picks 2 * (readers + workers + writers)
+    // Border given to every input frame and how it is filled after reading.
+    int inputBorder = 0;
+    BorderMode inputBorderMode = BorderMode::Replicate;
+    // --trace: Chrome trace-event JSON of the run (every frame's read,
+    // compute and write, and the operators inside them); empty for none.
+    std::string tracePath;
+    // Remaining "--name value" pairs, for the tool to interpret.
+    std::map<std::string, std::string> extra;
+
+    int computeWorkers() const;
+    int slots() const;
+    std::string option(const std::string& name, const std::string& fallback) const;
+    double option(const std::string& name, double fallback) const;
+};
+
+// True when argv asks for batch mode (argv[1] == "--batch").
+bool wantsBatch(int argc, char** argv);
+
+// Parses the batch command line into `options` and expands the inputs.
+// Prints usage or the problem and returns false on error.
+bool parseBatchArgs(int argc, char** argv, BatchOptions& options);
+
+// Every *.raw file of a directory, or the matches of a glob pattern, sorted.
+std::vector<std::string> listBatchInputs(const std::string& spec);
+
+struct BatchStageReport {
+    std::string name;
+    int threads = 0;
+    int frames = 0;
+    double busySeconds = 0;  // summed over the stage's threads
+    size_t bytes = 0;
+};
+
+struct BatchQueueReport {
+    std::string name;
+    size_t capacity = 0;
+    double meanOccupancy = 0;  // sampled whenever an item is taken
+    size_t maxOccupancy = 0;
+};
+
+struct BatchReport {
+    int frames = 0;
+    int failed = 0;
+    double wallSeconds = 0;
+    size_t slotBytes = 0;  // memory held by the frame slots, fixed for the run
+    std::vector<BatchStageReport> stages;  // read, compute, write
+    std::vector<BatchQueueReport> queues;  // free slots, to compute, to write
+    bool profiled = false;                 // the run was traced (BatchOptions::tracePath)
+
+    // Per-stage throughput and utilisation, queue occupancy, and the stage
+    // with the highest utilisation named as the bottleneck; after a traced
+    // run, the profile summary of its scopes.
+    void print(std::ostream& out) const;
+};
+
+// Per-slot callbacks of a batch run. Slots are indices into buffers the
+// caller owns; a slot is used by one stage at a time.
+struct BatchCallbacks {
+    std::function<bool(int slot, const std::string& path, size_t& bytes)> read;
+    std::function<void(int slot, int worker)> compute;
+    std::function<bool(int slot, const std::string& path, size_t& bytes)> write;
+    size_t slotBytes = 0;
+};
+
+// Runs the reader -> compute -> writer pipeline over options.inputs with
+// options.slots() frame slots, so memory stays constant for any batch length.
+BatchReport runBatchPipeline(const BatchOptions& options, const std::string& outputSuffix,
+                             const BatchCallbacks& callbacks);
+
+// Typed front end: every slot owns one In and one Out frame of the batch
+// dimensions. `process(in, out, worker)` runs on compute worker `worker`
+// (in [0, options.computeWorkers())), so callers can keep per-worker scratch.
+template <typename In, typename Out>
+BatchReport runBatch(const BatchOptions& options, const std::string& outputSuffix,
+                     const std::function<void(const In&, Out&, int worker)>& process) {
+    const int slots = options.slots();
+    std::vector<In> inputs;
+    std::vector<Out> outputs;
+    inputs.reserve(slots);
+    outputs.reserve(slots);
+    for (int i = 0; i < slots; ++i) {
+        inputs.emplace_back(options.width, options.height, options.inputBorder);
+        outputs.emplace_back(options.width, options.height);
+    }
+
+    auto frameBytes = [](const auto& img) {
+        using Img = std::decay_t<decltype(img)>;
+        return img.sampleCount() * sizeof(typename Img::value_type);
+    };
+
+    BatchCallbacks callbacks;
+    callbacks.slotBytes = slots > 0 ? (frameBytes(inputs[0]) + frameBytes(outputs[0])) * slots : 0;
+    callbacks.read = [&](int slot, const std::string& path, size_t& bytes) {
+        if (!readRaw(path, inputs[slot])) return false;
+        if (options.inputBorder > 0) inputs[slot].fillBorder(options.inputBorderMode);
+        bytes = frameBytes(inputs[slot]);
+        return true;
+    };
+    callbacks.compute = [&](int slot, int worker) { process(inputs[slot], outputs[slot], worker); };
+    callbacks.write = [&](int slot, const std::string& path, size_t& bytes) {
+        bytes = frameBytes(outputs[slot]);
+        return writeRaw(path, outputs[slot]);
+    };
+    return runBatchPipeline(options, outputSuffix, callbacks);
+}
+
+}  // namespace imgcore
@@ -0,0 +1,259 @@
+#include "bilateral.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+BilateralWeights::BilateralWeights(int radius, double sigmaSpatial, double sigmaRange, int levels)
+    : radius(radius) {
+    const int size = 2 * radius + 1;
+    const double twoSigmaSpatialSq = 2 * sigmaSpatial * sigmaSpatial;
+    const double twoSigmaRangeSq = 2 * sigmaRange * sigmaRange;
+    spatial.resize(size * size);
+    for (int m = -radius; m <= radius; ++m) {
+        for (int n = -radius; n <= radius; ++n) {
+            spatial[(m + radius) * size + (n + radius)] = static_cast<float>(std::exp(-(m * m + n * n) / twoSigmaSpatialSq));
+        }
+    }
+    // sigma_range is in 8-bit levels whatever the table size.
+    const double step = 255.0 / (levels - 1);
+    range.resize(levels);
+    for (int d = 0; d < levels; ++d) {
+        range[d] = static_cast<float>(std::exp(-(d * step) * (d * step) / twoSigmaRangeSq));
+    }
+}
+
+namespace {
+
+// sum / weight as T; `bias` is the 0.5 of rounding for the integer types.
+template <typename T>
+inline T finishBilateral(float sum, float weight, float bias) {
+    float v = sum / weight;
+    if constexpr (PixelTraits<T>::integer) v += bias;
+    return static_cast<T>(v > PixelTraits<T>::maxValue ? PixelTraits<T>::maxValue : v);
+}
+
+// Range table entry of |a - b|: the level difference for the integer
+// types, the difference quantised to the table's steps for float.
+template <typename T>
+inline int rangeIndex(T a, T b) {
+    if constexpr (PixelTraits<T>::integer) return std::abs(static_cast<int>(a) - static_cast<int>(b));
+    else return pixelBin<float>(std::abs(a - b));
+}
+
+}  // namespace
+
+template <typename T, int C>
+void bilateralRow(const T* const* rows, T* out, int width, const BilateralWeights& weights, bool roundToNearest) {
+    const int radius = weights.radius;
+    const int size = 2 * radius + 1;
+    // Interleaved channels are filtered independently, so a row is simply a
+    // run of width * C samples whose horizontal neighbours sit C apart.
+    const int samples = width * C;
+    const float bias = roundToNearest ? 0.5f : 0.0f;
+    const float* range = weights.range.data();
+    const T* center = rows[radius];
+
+    int s = 0;
+#ifdef __AVX2__
+    if constexpr (std::is_same_v<T, unsigned char>) {
+        for (; s + 8 <= samples; s += 8) {
+            __m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(center + s)));
+            __m256 sum = _mm256_setzero_ps();
+            __m256 wsum = _mm256_setzero_ps();
+            for (int m = -radius; m <= radius; ++m) {
+                const unsigned char* nrow = rows[m + radius] + s;
+                const float* ws = &weights.spatial[(m + radius) * size + radius];
+                for (int n = -radius; n <= radius; ++n) {
+                    __m256i nb = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(nrow + n * C)));
+                    __m256i d = _mm256_abs_epi32(_mm256_sub_epi32(c, nb));
+                    __m256 w = _mm256_mul_ps(_mm256_i32gather_ps(range, d, 4), _mm256_set1_ps(ws[n]));
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(w, _mm256_cvtepi32_ps(nb)));
+                    wsum = _mm256_add_ps(wsum, w);
+                }
+            }
+            __m256 v = _mm256_add_ps(_mm256_div_ps(sum, wsum), _mm256_set1_ps(bias));
+            __m256i vi = _mm256_cvttps_epi32(_mm256_min_ps(v, _mm256_set1_ps(255.0f)));
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(vi), _mm256_extracti128_si256(vi, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + s), _mm_packus_epi16(packed, packed));
+        }
+    }
+#endif
+    for (; s < samples; ++s) {
+        const T c = center[s];
+        float sum = 0.0f;
+        float wsum = 0.0f;
+        for (int m = -radius; m <= radius; ++m) {
+            const T* nrow = rows[m + radius] + s;
+            const float* ws = &weights.spatial[(m + radius) * size + radius];
+            for (int n = -radius; n <= radius; ++n) {
+                const T nb = nrow[n * C];
+                float w = ws[n] * range[rangeIndex(c, nb)];
+                sum += w * nb;
+                wsum += w;
+            }
+        }
+        out[s] = finishBilateral<T>(sum, wsum, bias);
+    }
+}
+
+template <typename T, int C>
+void bilateralFilter(const Image<T, C>& src, Image<T, C>& dst, const BilateralWeights& weights,
+                     bool roundToNearest) {
+    ProfileScope scope("bilateral");
+    scope.image(src);
+    const int radius = weights.radius;
+    Image<T, C> paddedCopy;
+    const Image<T, C>* in = &src;
+    if (src.border() < radius) {
+        paddedCopy = padded(src, radius);
+        in = &paddedCopy;
+    }
+    dst.resize(src.width(), src.height(), dst.border());
+
+    std::vector<const T*> rows(2 * radius + 1);
+    for (int y = 0; y < src.height(); ++y) {
+        for (int m = -radius; m <= radius; ++m) rows[m + radius] = in->row(y + m);
+        bilateralRow<T, C>(rows.data(), dst.row(y), src.width(), weights, roundToNearest);
+    }
+}
+
+namespace {
+
+// Grid cells are indexed (gy, gx, gz) with the range axis innermost so the
+// trilinear slice touches two short contiguous runs per corner pair.
+struct Grid {
+    int w, h, d;
+    std::vector<float> value, weight;
+
+    Grid(int w, int h, int d) : w(w), h(h), d(d), value(static_cast<size_t>(w) * h * d), weight(value.size()) {}
+    size_t index(int gy, int gx, int gz) const { return (static_cast<size_t>(gy) * w + gx) * d + gz; }
+};
+
+// Binomial [1 4 6 4 1] / 16 along one axis, i.e. a Gaussian with sigma of one cell.
+void blurAxis(std::vector<float>& data, std::vector<float>& tmp, size_t stride, int length) {
+    static const float taps[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    const size_t n = data.size();
+    for (size_t i = 0; i < n; ++i) {
+        const int coord = static_cast<int>((i / stride) % length);
+        float acc = 0.0f;
+        for (int k = -2; k <= 2; ++k) {
+            if (coord + k < 0 || coord + k >= length) continue;
+            acc += taps[k + 2] * data[i + k * static_cast<ptrdiff_t>(stride)];
+        }
+        tmp[i] = acc;
+    }
+    data.swap(tmp);
+}
+
+// Range coordinate of a sample in cells. Float samples outside [0, 1] (and
+// NaN) sit on the nearest end of the range axis instead of outside the grid.
+template <typename T>
+double rangeCell(T v, double scale) {
+    const double top = static_cast<double>(PixelTraits<T>::maxValue);
+    return (v > 0 ? std::min(static_cast<double>(v), top) : 0.0) * scale;
+}
+
+}  // namespace
+
+template <typename T, int C>
+void bilateralGrid(const Image<T, C>& src, Image<T, C>& dst, double sigmaSpatial, double sigmaRange) {
+    ProfileScope scope("bilateral grid");
+    scope.image(src);
+    // The range axis is in 8-bit levels, like sigmaRange.
+    const double toLevels = 255.0 / PixelTraits<T>::maxValue;
+    const int width = src.width();
+    const int height = src.height();
+    const double cellXY = std::max(1.0, sigmaSpatial);
+    const double cellZ = std::max(1.0, sigmaRange);
+    const double zScale = toLevels / cellZ;
+    // Two empty cells on each side keep the 5-tap blur inside the grid.
+    const int pad = 2;
+    Grid grid(static_cast<int>((width - 1) / cellXY) + 1 + 2 * pad,
+              static_cast<int>((height - 1) / cellXY) + 1 + 2 * pad,
+              static_cast<int>(255 / cellZ) + 1 + 2 * pad);
+    std::vector<float> tmp(grid.value.size());
+    dst.resize(width, height, dst.border());
+
+    for (int c = 0; c < C; ++c) {
+        std::fill(grid.value.begin(), grid.value.end(), 0.0f);
+        std::fill(grid.weight.begin(), grid.weight.end(), 0.0f);
+
+        for (int y = 0; y < height; ++y) {
+            const T* in = src.row(y);
+            const int gy = static_cast<int>(y / cellXY + 0.5) + pad;
+            for (int x = 0; x < width; ++x) {
+                const T v = in[x * C + c];
+                const size_t idx = grid.index(gy, static_cast<int>(x / cellXY + 0.5) + pad,
+                                              static_cast<int>(rangeCell(v, zScale) + 0.5) + pad);
+                grid.value[idx] += v;
+                grid.weight[idx] += 1.0f;
+            }
+        }
+
+        const size_t strides[3] = {1, static_cast<size_t>(grid.d), static_cast<size_t>(grid.d) * grid.w};
+        const int lengths[3] = {grid.d, grid.w, grid.h};
+        for (int axis = 0; axis < 3; ++axis) {
+            blurAxis(grid.value, tmp, strides[axis], lengths[axis]);
+            blurAxis(grid.weight, tmp, strides[axis], lengths[axis]);
+        }
+
+        for (int y = 0; y < height; ++y) {
+            const T* in = src.row(y);
+            T* out = dst.row(y);
+            const double fy = y / cellXY + pad;
+            const int y0 = static_cast<int>(fy);
+            const float ty = static_cast<float>(fy - y0);
+            for (int x = 0; x < width; ++x) {
+                const double fx = x / cellXY + pad;
+                const double fz = rangeCell(in[x * C + c], zScale) + pad;
+                const int x0 = static_cast<int>(fx);
+                const int z0 = static_cast<int>(fz);
+                const float tx = static_cast<float>(fx - x0);
+                const float tz = static_cast<float>(fz - z0);
+
+                float value = 0.0f, weight = 0.0f;
+                for (int dy = 0; dy <= 1; ++dy) {
+                    for (int dx = 0; dx <= 1; ++dx) {
+                        const float wxy = (dy ? ty : 1 - ty) * (dx ? tx : 1 - tx);
+                        const size_t idx = grid.index(y0 + dy, x0 + dx, z0);
+                        value += wxy * ((1 - tz) * grid.value[idx] + tz * grid.value[idx + 1]);
+                        weight += wxy * ((1 - tz) * grid.weight[idx] + tz * grid.weight[idx + 1]);
+                    }
+                }
+                out[x * C + c] = weight > 0.0f ? finishBilateral<T>(value, weight, 0.5f) : in[x * C + c];
+            }
+        }
+    }
+}
+
+template void bilateralRow<unsigned char, 1>(const unsigned char* const*, unsigned char*, int,
+                                              const BilateralWeights&, bool);
+template void bilateralRow<unsigned char, 3>(const unsigned char* const*, unsigned char*, int,
+                                              const BilateralWeights&, bool);
+template void bilateralRow<uint16_t, 1>(const uint16_t* const*, uint16_t*, int, const BilateralWeights&, bool);
+template void bilateralRow<uint16_t, 3>(const uint16_t* const*, uint16_t*, int, const BilateralWeights&, bool);
+template void bilateralRow<float, 1>(const float* const*, float*, int, const BilateralWeights&, bool);
+template void bilateralRow<float, 3>(const float* const*, float*, int, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<float, 1>&, Image<float, 1>&, const BilateralWeights&, bool);
+template void bilateralFilter(const Image<float, 3>&, Image<float, 3>&, const BilateralWeights&, bool);
+template void bilateralGrid(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, double, double);
+template void bilateralGrid(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, double, double);
+template void bilateralGrid(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, double, double);
+template void bilateralGrid(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, double, double);
+template void bilateralGrid(const Image<float, 1>&, Image<float, 1>&, double, double);
+template void bilateralGrid(const Image<float, 3>&, Image<float, 3>&, double, double);
+
+}  // namespace imgcore
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include "image.h"
+#include "pixel.h"
+
+namespace imgcore {
+
+// Weights for one (radius, sigma_spatial, sigma_range) configuration. Build
+// it once per configuration; every pixel then only does table lookups.
+// sigma_range is in 8-bit levels for every pixel type, so one setting
+// smooths an 8-bit, a 16-bit and a float frame alike; `levels` sizes the
+// range table and must be PixelTraits<T>::levels of the frames filtered
+// (65536 for uint16_t and float).
+struct BilateralWeights {
+    BilateralWeights(int radius, double sigmaSpatial, double sigmaRange, int levels = 256);
+
+    int radius;
+    // exp(-(m^2 + n^2) / 2 sigma_spatial^2), row-major over the (2r+1)^2 taps
+    std::vector<float> spatial;
+    // exp(-d^2 / 2 sigma_range^2) for every possible |centre - neighbour|,
+    // d scaled from the table's steps to 8-bit levels
+    std::vector<float> range;
+};
+
+// Brute-force bilateral filter over a (2r+1)^2 window, each channel filtered
+// independently. Rows are processed tap by tap with the range weight looked
+// up per sample (AVX2 gathers when available). `src` should carry a border
+// of at least `radius` (see padded()); otherwise a replicated copy is made.
+// With roundToNearest false the result is truncated instead of rounded.
+template <typename T, int C>
+void bilateralFilter(const Image<T, C>& src, Image<T, C>& dst, const BilateralWeights& weights,
+                     bool roundToNearest = true);
+
+// One output row of the filter above, for streaming callers that keep their
+// own row buffers. rows[k] points at the first visible sample of input row
+// y - radius + k and must be readable `radius` pixels to either side.
+template <typename T, int C>
+void bilateralRow(const T* const* rows, T* out, int width, const BilateralWeights& weights,
+                  bool roundToNearest = true);
+
+// Bilateral grid approximation (Paris & Durand): splat into a grid with
+// sigma_spatial x sigma_range cells, blur it, and slice trilinearly. The
+// cost per pixel does not depend on the spatial extent, so this is the mode
+// for large radii. The speed costs quality: the differential checks measure
+// 3-4 dB of PSNR against the exact filter on noisy frames, and the
+// bilateral-filtering sample scores 26.05 dB against the exact 27.87 dB.
+// Float samples outside [0, 1] are splatted at the nearest end of the
+// range axis.
+template <typename T, int C>
+void bilateralGrid(const Image<T, C>& src, Image<T, C>& dst, double sigmaSpatial, double sigmaRange);
+
+}  // namespace imgcore
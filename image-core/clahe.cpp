@@ -0,0 +1,247 @@
+#include "clahe.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace imgcore {
+
+namespace {
+
+constexpr int BAND_ROWS = 16;
+
+// Round half to even like cvRound; lrint alone is a libm call per value.
+inline int roundEven(float v) {
+#if defined(__AVX2__) || defined(__SSE2__)
+    return _mm_cvtss_si32(_mm_set_ss(v));
+#else
+    return static_cast<int>(std::lrint(v));
+#endif
+}
+
+template <typename T>
+void tileHistogram(const Image<T, 1>& in, int x0, int y0, int tileW, int tileH, std::vector<int>& hist) {
+    std::fill(hist.begin(), hist.end(), 0);
+    for (int y = y0; y < y0 + tileH; ++y) {
+        const T* p = in.row(y) + x0;
+        for (int x = 0; x < tileW; ++x) ++hist[p[x]];
+    }
+}
+
+// 8-bit tiles are small next to the histogram latency chain, so four
+// interleaved sub-histograms keep repeated values from stalling on the
+// same counter.
+template <>
+void tileHistogram(const GrayImage& in, int x0, int y0, int tileW, int tileH, std::vector<int>& hist) {
+    int sub[4][256] = {};
+    for (int y = y0; y < y0 + tileH; ++y) {
+        const unsigned char* p = in.row(y) + x0;
+        int x = 0;
+        for (; x + 4 <= tileW; x += 4) {
+            ++sub[0][p[x]];
+            ++sub[1][p[x + 1]];
+            ++sub[2][p[x + 2]];
+            ++sub[3][p[x + 3]];
+        }
+        for (; x < tileW; ++x) ++sub[0][p[x]];
+    }
+    for (int v = 0; v < 256; ++v) hist[v] = sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+}
+
+// Clip, redistribute and integrate one histogram into a LUT. The even
+// share and the strided remainder are added during the prefix sum, so a
+// 65536-bin histogram costs two passes rather than four.
+template <typename T>
+void buildLut(std::vector<int>& hist, int clipLimit, float lutScale, T* lut) {
+    const int bins = static_cast<int>(hist.size());
+    int batch = 0, residual = 0, step = 1;
+    if (clipLimit > 0) {
+        int clipped = 0;
+        for (int v = 0; v < bins; ++v) {
+            const int excess = std::max(hist[v] - clipLimit, 0);
+            clipped += excess;
+            hist[v] -= excess;
+        }
+        batch = clipped / bins;
+        residual = clipped - batch * bins;
+        if (residual != 0) step = std::max(bins / residual, 1);
+    }
+    const float maxValue = std::numeric_limits<T>::max();
+    int nextResidual = residual != 0 ? 0 : bins;
+    int sum = 0;
+    for (int v = 0; v < bins; ++v) {
+        sum += hist[v] + batch;
+        if (v == nextResidual) {
+            ++sum;
+            nextResidual = --residual > 0 ? v + step : bins;
+        }
+        lut[v] = static_cast<T>(roundEven(std::min(sum * lutScale, maxValue)));
+    }
+}
+
+// `left`, `right`, `weight` and `rest` are the per-column blend tables of
+// ClaheLuts.
+template <typename T>
+void blendRow(const T* in, T* out, int width, const T* top, const T* bottom, float ya, const int32_t* left,
+              const int32_t* right, const float* weight, const float* rest) {
+    const float ya1 = 1.0f - ya;
+    const int maxValue = std::numeric_limits<T>::max();
+    int x = 0;
+#ifdef __AVX2__
+    const __m256i mask = _mm256_set1_epi32(static_cast<int>(maxValue));
+    const __m256 wTop = _mm256_set1_ps(ya1);
+    const __m256 wBottom = _mm256_set1_ps(ya);
+    const int* topBase = reinterpret_cast<const int*>(top);
+    const int* bottomBase = reinterpret_cast<const int*>(bottom);
+    auto gather = [&](const int* base, __m256i index) {
+        return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_i32gather_epi32(base, index, sizeof(T)), mask));
+    };
+    for (; x + 8 <= width; x += 8) {
+        __m256i v;
+        if constexpr (sizeof(T) == 1) v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x)));
+        else v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x)));
+        const __m256i i1 = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + x)), v);
+        const __m256i i2 = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(right + x)), v);
+        const __m256 xa = _mm256_loadu_ps(weight + x);
+        const __m256 xa1 = _mm256_loadu_ps(rest + x);
+        const __m256 upper = _mm256_add_ps(_mm256_mul_ps(gather(topBase, i1), xa1), _mm256_mul_ps(gather(topBase, i2), xa));
+        const __m256 lower =
+            _mm256_add_ps(_mm256_mul_ps(gather(bottomBase, i1), xa1), _mm256_mul_ps(gather(bottomBase, i2), xa));
+        const __m256i res = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(upper, wTop), _mm256_mul_ps(lower, wBottom)));
+        const __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(res), _mm256_extracti128_si256(res, 1));
+        if constexpr (sizeof(T) == 1) _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(packed, packed));
+        else _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), packed);
+    }
+#endif
+    for (; x < width; ++x) {
+        const int v = in[x];
+        const int i1 = left[x] + v;
+        const int i2 = right[x] + v;
+        // Kept as separate products and sums so the SIMD path rounds the same way.
+        const float a = top[i1] * rest[x];
+        const float b = top[i2] * weight[x];
+        const float c = bottom[i1] * rest[x];
+        const float d = bottom[i2] * weight[x];
+        const float upper = a + b;
+        const float lower = c + d;
+        const float e = upper * ya1;
+        const float f = lower * ya;
+        out[x] = static_cast<T>(std::clamp(roundEven(e + f), 0, maxValue));
+    }
+}
+
+}  // namespace
+
+template <typename T>
+void ClaheLuts<T>::build(const Image<T, 1>& src, const ClaheParams& params, ThreadPool* pool) {
+    ProfileScope scope("clahe luts");
+    scope.pixels(src.pixelCount()).reads(src.sampleCount() * sizeof(T));
+    width_ = src.width();
+    height_ = src.height();
+    tilesX_ = std::max(params.tilesX, 1);
+    tilesY_ = std::max(params.tilesY, 1);
+    bins_ = static_cast<int>(std::numeric_limits<T>::max()) + 1;
+    if (width_ == 0 || height_ == 0) return;
+
+    // Extend to a multiple of the grid so every tile has the same area. Like
+    // OpenCV, once either side needs it both sides grow by tiles - size % tiles,
+    // which adds a whole tile on a side that already divided evenly.
+    const bool extend = width_ % tilesX_ != 0 || height_ % tilesY_ != 0;
+    const int padX = extend ? tilesX_ - width_ % tilesX_ : 0;
+    const int padY = extend ? tilesY_ - height_ % tilesY_ : 0;
+    if (extend) {
+        extended_.resize(width_, height_, std::max(padX, padY));
+        extended_.copyFrom(src);
+        extended_.fillBorder(BorderMode::Reflect);
+    }
+    const Image<T, 1>& lutSource = extend ? extended_ : src;
+
+    tileW_ = (width_ + padX) / tilesX_;
+    tileH_ = (height_ + padY) / tilesY_;
+    const int tileArea = tileW_ * tileH_;
+    const int clipLimit = params.clipLimit > 0.0
+        ? std::max(static_cast<int>(params.clipLimit * tileArea / bins_), 1)
+        : 0;
+    const float lutScale = static_cast<float>(bins_ - 1) / tileArea;
+
+    const int tiles = tilesX_ * tilesY_;
+    values_.assign(static_cast<size_t>(tiles) * bins_ + 4 / sizeof(T), 0);
+    auto lutTile = [&](int t, std::vector<int>& hist) {
+        hist.resize(bins_);
+        tileHistogram(lutSource, (t % tilesX_) * tileW_, (t / tilesX_) * tileH_, tileW_, tileH_, hist);
+        buildLut(hist, clipLimit, lutScale, values_.data() + static_cast<size_t>(t) * bins_);
+    };
+    const size_t slots = pool ? pool->slots() : 1;
+    if (hist_.size() < slots) hist_.resize(slots);
+    if (pool) {
+        pool->parallelFor(0, tiles, 1, [&](int begin, int end, int slot) {
+            for (int t = begin; t < end; ++t) lutTile(t, hist_[slot]);
+        });
+    } else {
+        for (int t = 0; t < tiles; ++t) lutTile(t, hist_[0]);
+    }
+
+    // Where each column sits between tile centres.
+    left_.resize(width_);
+    right_.resize(width_);
+    weight_.resize(width_);
+    rest_.resize(width_);
+    const float inv = 1.0f / tileW_;
+    for (int x = 0; x < width_; ++x) {
+        const float txf = x * inv - 0.5f;
+        const int t1 = static_cast<int>(std::floor(txf));
+        weight_[x] = txf - t1;
+        rest_[x] = 1.0f - weight_[x];
+        left_[x] = std::max(t1, 0) * bins_;
+        right_[x] = std::min(t1 + 1, tilesX_ - 1) * bins_;
+    }
+}
+
+template <typename T>
+void ClaheLuts<T>::applyRow(const T* in, T* out, int y) const {
+    const float tyf = y * (1.0f / tileH_) - 0.5f;
+    const int t1 = static_cast<int>(std::floor(tyf));
+    const T* top = tile(std::max(t1, 0) * tilesX_);
+    const T* bottom = tile(std::min(t1 + 1, tilesY_ - 1) * tilesX_);
+    blendRow(in, out, width_, top, bottom, tyf - t1, left_.data(), right_.data(), weight_.data(), rest_.data());
+}
+
+template <typename T>
+void clahe(const Image<T, 1>& src, Image<T, 1>& dst, const ClaheParams& params, ThreadPool* pool) {
+    ProfileScope scope("clahe");
+    scope.image(src);
+    const int height = src.height();
+    dst.resize(src.width(), height, dst.border());
+    if (src.empty()) return;
+
+    ClaheLuts<T> luts;
+    luts.build(src, params, pool);
+    auto blendRows = [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) luts.applyRow(src.row(y), dst.row(y), y);
+    };
+    if (pool) {
+        const int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+        pool->parallelFor(0, bands, 1, [&](int begin, int end, int) {
+            blendRows(begin * BAND_ROWS, std::min(end * BAND_ROWS, height));
+        });
+    } else {
+        blendRows(0, height);
+    }
+}
+
+template class ClaheLuts<unsigned char>;
+template class ClaheLuts<uint16_t>;
+template void clahe(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, const ClaheParams&, ThreadPool*);
+template void clahe(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, const ClaheParams&, ThreadPool*);
+
+}  // namespace imgcore
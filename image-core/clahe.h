@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+struct ClaheParams {
+    double clipLimit = 40.0;  // relative to the mean bin count, as in cv::createCLAHE
+    int tilesX = 8;           // tile grid columns
+    int tilesY = 8;           // tile grid rows
+};
+
+// Contrast-limited adaptive histogram equalization following OpenCV's
+// definition: each tile's histogram is clipped at max(clipLimit * tileArea
+// / bins, 1), the excess is spread evenly (remainder at a fixed stride),
+// and every pixel blends the LUTs of its four nearest tile centres
+// bilinearly. When the frame is not a multiple of the grid, the LUTs come
+// from a copy extended right/bottom with Reflect. Tile LUTs and output row
+// bands run on `pool` when given; the blend gathers eight LUT entries per
+// step with AVX2 when available. T is unsigned char (256 bins) or uint16_t
+// (65536 bins).
+template <typename T>
+void clahe(const Image<T, 1>& src, Image<T, 1>& dst, const ClaheParams& params = {}, ThreadPool* pool = nullptr);
+
+// The two halves of clahe(), for callers that produce or consume the plane
+// in pieces: build() reads the whole frame into the tile LUTs, after which
+// applyRow() maps any row of that frame on its own, so a pipeline can
+// finish the frame band by band. Buffers are kept across frames of the
+// same geometry.
+template <typename T>
+class ClaheLuts {
+public:
+    void build(const Image<T, 1>& src, const ClaheParams& params = {}, ThreadPool* pool = nullptr);
+    // Row y of clahe(src) from row y of `src`, the frame build() read.
+    void applyRow(const T* in, T* out, int y) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+private:
+    const T* tile(int index) const { return values_.data() + static_cast<size_t>(index) * bins_; }
+
+    int width_ = 0, height_ = 0;
+    int tilesX_ = 1, tilesY_ = 1;
+    int tileW_ = 1, tileH_ = 1;
+    int bins_ = 0;
+    // Tile (tx, ty) at (ty * tilesX + tx) * bins. Four spare bytes at the
+    // end let the blend gather 32 bits at the last entry.
+    std::vector<T> values_;
+    // Per column: LUT offsets of the tiles left and right of it within a
+    // tile row, the weight of the right one and 1 minus that weight.
+    std::vector<int32_t> left_, right_;
+    std::vector<float> weight_, rest_;
+    Image<T, 1> extended_;
+    std::vector<std::vector<int>> hist_;  // one per pool slot
+};
+
+}  // namespace imgcore
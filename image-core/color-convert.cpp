@@ -0,0 +1,274 @@
+#include "color-convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+namespace {
+
+// Forward coefficients in Q15. U and V rows sum to zero, so grey stays at 128.
+constexpr int Y_R = 9798, Y_G = 19235, Y_B = 3736;
+constexpr int U_R = -4820, U_G = -9464, U_B = 14284;
+constexpr int V_R = 20145, V_G = -16869, V_B = -3276;
+constexpr int FWD_SHIFT = 15;
+constexpr int CHROMA_BIAS = 128 << FWD_SHIFT;
+
+// Inverse coefficients in Q13 (2.032 does not fit a signed 16-bit Q15).
+constexpr int R_V = 9339, G_U = -3236, G_V = -4760, B_U = 16646;
+constexpr int INV_SHIFT = 13;
+constexpr int INV_ONE = 1 << INV_SHIFT;
+
+inline unsigned char clampByte(int v) { return static_cast<unsigned char>(std::clamp(v, 0, 255)); }
+
+#ifdef __AVX2__
+// pshufb masks between 16 interleaved RGB pixels (three 16-byte chunks) and
+// 16-byte channel planes. gather[c][k] pulls channel c out of chunk k;
+// scatter[k][c] places channel c into chunk k.
+struct RgbShuffles {
+    __m128i gather[3][3];
+    __m128i scatter[3][3];
+
+    RgbShuffles() {
+        alignas(16) signed char m[16];
+        for (int c = 0; c < 3; ++c) {
+            for (int k = 0; k < 3; ++k) {
+                for (int i = 0; i < 16; ++i) {
+                    const int src = 3 * i + c;
+                    m[i] = static_cast<signed char>(src / 16 == k ? src % 16 : -128);
+                }
+                gather[c][k] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+                for (int j = 0; j < 16; ++j) {
+                    const int dst = 16 * k + j;
+                    m[j] = static_cast<signed char>(dst % 3 == c ? dst / 3 : -128);
+                }
+                scatter[k][c] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+            }
+        }
+    }
+};
+
+// Two 16-bit inputs per 32-bit lane times a coefficient pair; with a second
+// pair the result is a three- or four-term dot product in 32 bits. The
+// unpacks are in-lane and packs_epi32 undoes them, so pixel order survives.
+inline __m256i dot(__m256i a, __m256i b, __m256i c, __m256i d, __m256i coefAB, __m256i coefCD, __m256i bias,
+                   int shift) {
+    auto half = [&](__m256i ab, __m256i cd) {
+        const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(ab, coefAB), _mm256_madd_epi16(cd, coefCD));
+        return _mm256_srai_epi32(_mm256_add_epi32(sum, bias), shift);
+    };
+    const __m256i lo = half(_mm256_unpacklo_epi16(a, b), _mm256_unpacklo_epi16(c, d));
+    const __m256i hi = half(_mm256_unpackhi_epi16(a, b), _mm256_unpackhi_epi16(c, d));
+    return _mm256_packs_epi32(lo, hi);
+}
+
+inline __m256i coefPair(int a, int b) {
+    return _mm256_set1_epi32(static_cast<int>((static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(a) & 0xFFFF)));
+}
+
+inline __m128i toBytes(__m256i v) {
+    return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+#endif
+
+}  // namespace
+
+void rgbToYuvRow(const unsigned char* rgb, unsigned char* yRow, unsigned char* uRow, unsigned char* vRow,
+                 int width) {
+    int x = 0;
+#ifdef __AVX2__
+    static const RgbShuffles shuffles;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i noBias = _mm256_setzero_si256();
+    const __m256i chromaBias = _mm256_set1_epi32(CHROMA_BIAS);
+    const __m256i yRG = coefPair(Y_R, Y_G), yB = coefPair(Y_B, 0);
+    const __m256i uRG = coefPair(U_R, U_G), uB = coefPair(U_B, 0);
+    const __m256i vRG = coefPair(V_R, V_G), vB = coefPair(V_B, 0);
+    for (; x + 16 <= width; x += 16) {
+        const unsigned char* p = rgb + 3 * x;
+        __m128i chunk[3];
+        for (int k = 0; k < 3; ++k) chunk[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * k));
+        __m256i ch[3];
+        for (int c = 0; c < 3; ++c) {
+            const __m128i bytes = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(chunk[0], shuffles.gather[c][0]),
+                             _mm_shuffle_epi8(chunk[1], shuffles.gather[c][1])),
+                _mm_shuffle_epi8(chunk[2], shuffles.gather[c][2]));
+            ch[c] = _mm256_cvtepu8_epi16(bytes);
+        }
+        const __m256i yv = dot(ch[0], ch[1], ch[2], zero, yRG, yB, noBias, FWD_SHIFT);
+        const __m256i uv = dot(ch[0], ch[1], ch[2], zero, uRG, uB, chromaBias, FWD_SHIFT);
+        const __m256i vv = dot(ch[0], ch[1], ch[2], zero, vRG, vB, chromaBias, FWD_SHIFT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(yRow + x), toBytes(yv));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(uRow + x), toBytes(uv));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(vRow + x), toBytes(vv));
+    }
+#endif
+    for (; x < width; ++x) {
+        const int r = rgb[3 * x], g = rgb[3 * x + 1], b = rgb[3 * x + 2];
+        yRow[x] = clampByte((Y_R * r + Y_G * g + Y_B * b) >> FWD_SHIFT);
+        uRow[x] = clampByte((U_R * r + U_G * g + U_B * b + CHROMA_BIAS) >> FWD_SHIFT);
+        vRow[x] = clampByte((V_R * r + V_G * g + V_B * b + CHROMA_BIAS) >> FWD_SHIFT);
+    }
+}
+
+void yuvToRgbRow(const unsigned char* yRow, const unsigned char* uRow, const unsigned char* vRow,
+                 unsigned char* rgb, int width) {
+    int x = 0;
+#ifdef __AVX2__
+    static const RgbShuffles shuffles;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i noBias = _mm256_setzero_si256();
+    const __m256i offset = _mm256_set1_epi16(128);
+    const __m256i rYV = coefPair(INV_ONE, R_V);
+    const __m256i gYU = coefPair(INV_ONE, G_U), gV = coefPair(G_V, 0);
+    const __m256i bYU = coefPair(INV_ONE, B_U);
+    for (; x + 16 <= width; x += 16) {
+        auto load = [x](const unsigned char* p) {
+            return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x)));
+        };
+        const __m256i yv = load(yRow);
+        const __m256i uv = _mm256_sub_epi16(load(uRow), offset);
+        const __m256i vv = _mm256_sub_epi16(load(vRow), offset);
+        __m128i ch[3];
+        ch[0] = toBytes(dot(yv, vv, zero, zero, rYV, zero, noBias, INV_SHIFT));
+        ch[1] = toBytes(dot(yv, uv, vv, zero, gYU, gV, noBias, INV_SHIFT));
+        ch[2] = toBytes(dot(yv, uv, zero, zero, bYU, zero, noBias, INV_SHIFT));
+        unsigned char* p = rgb + 3 * x;
+        for (int k = 0; k < 3; ++k) {
+            const __m128i chunk = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(ch[0], shuffles.scatter[k][0]),
+                             _mm_shuffle_epi8(ch[1], shuffles.scatter[k][1])),
+                _mm_shuffle_epi8(ch[2], shuffles.scatter[k][2]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16 * k), chunk);
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        const int yv = yRow[x] * INV_ONE;
+        const int u = uRow[x] - 128;
+        const int v = vRow[x] - 128;
+        rgb[3 * x] = clampByte((yv + R_V * v) >> INV_SHIFT);
+        rgb[3 * x + 1] = clampByte((yv + G_U * u + G_V * v) >> INV_SHIFT);
+        rgb[3 * x + 2] = clampByte((yv + B_U * u) >> INV_SHIFT);
+    }
+}
+
+void rgbToYuv(const RgbImage& rgb, YuvPlanes& yuv) {
+    ProfileScope scope("rgb to yuv");
+    scope.image(rgb);
+    const int width = rgb.width();
+    const int height = rgb.height();
+    yuv.y.resize(width, height, yuv.y.border());
+    yuv.u.resize(width, height, yuv.u.border());
+    yuv.v.resize(width, height, yuv.v.border());
+    for (int row = 0; row < height; ++row) {
+        rgbToYuvRow(rgb.row(row), yuv.y.row(row), yuv.u.row(row), yuv.v.row(row), width);
+    }
+}
+
+void yuvToRgb(const GrayImage& y, const GrayImage& u, const GrayImage& v, RgbImage& rgb,
+              const unsigned char* yLut) {
+    ProfileScope scope("yuv to rgb");
+    const int width = y.width();
+    const int height = y.height();
+    rgb.resize(width, height, rgb.border());
+    scope.image(y, rgb).reads(u.sampleCount() + v.sampleCount());
+    // The mapped luma of one row stays in L1 between the lookup and the
+    // conversion that consumes it.
+    std::vector<unsigned char> mapped(yLut ? width : 0);
+    for (int row = 0; row < height; ++row) {
+        const unsigned char* luma = y.row(row);
+        if (yLut) {
+            for (int x = 0; x < width; ++x) mapped[x] = yLut[luma[x]];
+            luma = mapped.data();
+        }
+        yuvToRgbRow(luma, u.row(row), v.row(row), rgb.row(row), width);
+    }
+}
+
+namespace {
+
+// Half the range of T, the zero of U and V.
+template <typename T>
+constexpr float chromaZero() {
+    return PixelTraits<T>::integer ? (PixelTraits<T>::maxValue + 1.0f) / 2.0f : 0.5f;
+}
+
+// Floored for the integer types like the fixed-point 8-bit conversions.
+template <typename T>
+T finishConversion(float v) {
+    if constexpr (PixelTraits<T>::integer) v = std::floor(v);
+    return clampPixel<T>(v);
+}
+
+template <typename T>
+void wideRgbToYuv(const Image<T, 3>& rgb, BasicYuvPlanes<T>& yuv) {
+    ProfileScope scope("rgb to yuv");
+    scope.image(rgb);
+    const int width = rgb.width();
+    const int height = rgb.height();
+    yuv.y.resize(width, height, yuv.y.border());
+    yuv.u.resize(width, height, yuv.u.border());
+    yuv.v.resize(width, height, yuv.v.border());
+    const float zero = chromaZero<T>();
+    for (int row = 0; row < height; ++row) {
+        const T* in = rgb.row(row);
+        T* y = yuv.y.row(row);
+        T* u = yuv.u.row(row);
+        T* v = yuv.v.row(row);
+        for (int x = 0; x < width; ++x) {
+            const float r = in[3 * x], g = in[3 * x + 1], b = in[3 * x + 2];
+            const float luma = 0.299f * r + 0.587f * g + 0.114f * b;
+            y[x] = finishConversion<T>(luma);
+            u[x] = finishConversion<T>(0.492f * (b - luma) + zero);
+            v[x] = finishConversion<T>(0.877f * (r - luma) + zero);
+        }
+    }
+}
+
+template <typename T>
+void wideYuvToRgb(const Image<T, 1>& y, const Image<T, 1>& u, const Image<T, 1>& v, Image<T, 3>& rgb) {
+    ProfileScope scope("yuv to rgb");
+    const int width = y.width();
+    const int height = y.height();
+    rgb.resize(width, height, rgb.border());
+    scope.image(y, rgb).reads((u.sampleCount() + v.sampleCount()) * sizeof(T));
+    const float zero = chromaZero<T>();
+    for (int row = 0; row < height; ++row) {
+        const T* yr = y.row(row);
+        const T* ur = u.row(row);
+        const T* vr = v.row(row);
+        T* out = rgb.row(row);
+        for (int x = 0; x < width; ++x) {
+            const float luma = yr[x], cu = ur[x] - zero, cv = vr[x] - zero;
+            out[3 * x] = finishConversion<T>(luma + 1.140f * cv);
+            out[3 * x + 1] = finishConversion<T>(luma - 0.395f * cu - 0.581f * cv);
+            out[3 * x + 2] = finishConversion<T>(luma + 2.032f * cu);
+        }
+    }
+}
+
+}  // namespace
+
+void rgbToYuv(const RgbImage16& rgb, YuvPlanes16& yuv) { wideRgbToYuv(rgb, yuv); }
+
+void rgbToYuv(const RgbImageF& rgb, YuvPlanesF& yuv) { wideRgbToYuv(rgb, yuv); }
+
+void yuvToRgb(const GrayImage16& y, const GrayImage16& u, const GrayImage16& v, RgbImage16& rgb) {
+    wideYuvToRgb(y, u, v, rgb);
+}
+
+void yuvToRgb(const GrayImageF& y, const GrayImageF& u, const GrayImageF& v, RgbImageF& rgb) {
+    wideYuvToRgb(y, u, v, rgb);
+}
+
+}  // namespace imgcore
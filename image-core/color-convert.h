@@ -0,0 +1,53 @@
+#pragma once
+
+#include "image.h"
+#include "pixel.h"
+
+namespace imgcore {
+
+// BT.601 analog YUV as three planes, U and V offset by half the range
+// (128, 32768 or 0.5).
+template <typename T>
+struct BasicYuvPlanes {
+    Image<T, 1> y, u, v;
+};
+using YuvPlanes = BasicYuvPlanes<unsigned char>;
+using YuvPlanes16 = BasicYuvPlanes<uint16_t>;
+using YuvPlanesF = BasicYuvPlanes<float>;
+
+// Interleaved RGB to planar YUV:
+//   Y = 0.299 R + 0.587 G + 0.114 B
+//   U = 0.492 (B - Y) + 128
+//   V = 0.877 (R - Y) + 128
+// The coefficients are Q15 integers that are folded per output, so U and V
+// come straight from R, G and B. Each result is floored and then clamped
+// to [0, 255]. With AVX2, 16 pixels are deinterleaved per step by byte
+// shuffles and computed with 16-bit multiply-adds.
+void rgbToYuv(const RgbImage& rgb, YuvPlanes& yuv);
+
+// Planar YUV back to interleaved RGB:
+//   R = Y + 1.140 V',  G = Y - 0.395 U' - 0.581 V',  B = Y + 2.032 U'
+// with U' = U - 128 and V' = V - 128, in Q13 and floored like rgbToYuv.
+// The planes are passed separately, so several luma variants can share
+// one pair of chroma planes. When `yLut` is given, Y is first mapped
+// through it (256 entries) in the same pass, so a point operator on luma
+// never materialises its own plane.
+void yuvToRgb(const GrayImage& y, const GrayImage& u, const GrayImage& v, RgbImage& rgb,
+              const unsigned char* yLut = nullptr);
+
+// One row of each conversion above, for streaming callers that convert a
+// band or a tile at a time; the images above are converted row by row with
+// exactly these.
+void rgbToYuvRow(const unsigned char* rgb, unsigned char* y, unsigned char* u, unsigned char* v, int width);
+void yuvToRgbRow(const unsigned char* y, const unsigned char* u, const unsigned char* v, unsigned char* rgb,
+                 int width);
+
+// The same conversions for 16-bit and float frames, with the decimal
+// coefficients above in float: 16-bit results are floored and clamped like
+// the 8-bit ones, float results are clamped to [0, 1].
+void rgbToYuv(const RgbImage16& rgb, YuvPlanes16& yuv);
+void rgbToYuv(const RgbImageF& rgb, YuvPlanesF& yuv);
+void yuvToRgb(const GrayImage16& y, const GrayImage16& u, const GrayImage16& v, RgbImage16& rgb);
+void yuvToRgb(const GrayImageF& y, const GrayImageF& u, const GrayImageF& v, RgbImageF& rgb);
+
+}  // namespace imgcore
@@ -0,0 +1,849 @@
+#include "demosaic.h"
+
+#include <algorithm>
+#include <cctype>
+#include <type_traits>
+#include <vector>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+bool parseCfaPattern(const std::string& name, CfaPattern& pattern) {
+    std::string upper(name);
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return std::toupper(c); });
+    if (upper == "RGGB") pattern = CfaPattern::RGGB;
+    else if (upper == "BGGR") pattern = CfaPattern::BGGR;
+    else if (upper == "GRBG") pattern = CfaPattern::GRBG;
+    else if (upper == "GBRG") pattern = CfaPattern::GBRG;
+    else return false;
+    return true;
+}
+
+namespace {
+
+enum Site { RED, GREEN_ON_RED_ROW, GREEN_ON_BLUE_ROW, BLUE };
+
+// Site types of the top-left quad: quad[row parity][column parity].
+void quadSites(CfaPattern pattern, Site quad[2][2]) {
+    switch (pattern) {
+    case CfaPattern::RGGB: quad[0][0] = RED; quad[0][1] = GREEN_ON_RED_ROW; quad[1][0] = GREEN_ON_BLUE_ROW; quad[1][1] = BLUE; break;
+    case CfaPattern::BGGR: quad[0][0] = BLUE; quad[0][1] = GREEN_ON_BLUE_ROW; quad[1][0] = GREEN_ON_RED_ROW; quad[1][1] = RED; break;
+    case CfaPattern::GRBG: quad[0][0] = GREEN_ON_RED_ROW; quad[0][1] = RED; quad[1][0] = BLUE; quad[1][1] = GREEN_ON_BLUE_ROW; break;
+    case CfaPattern::GBRG: quad[0][0] = GREEN_ON_BLUE_ROW; quad[0][1] = BLUE; quad[1][0] = RED; quad[1][1] = GREEN_ON_RED_ROW; break;
+    }
+}
+
+// The four interpolants a demosaic needs at every column of one row:
+// horiz = the colour found left/right, vert = the colour found up/down,
+// cross = green at a red/blue site, diag = the opposite colour at a
+// red/blue site. Which of them a pixel uses depends only on its site type.
+struct RowInterpolants {
+    std::vector<unsigned char> horiz, vert, cross, diag;
+
+    explicit RowInterpolants(int width) { resize(width); }
+
+    void resize(int width) {
+        horiz.resize(width);
+        vert.resize(width);
+        cross.resize(width);
+        diag.resize(width);
+    }
+
+    // Bilinear: every interpolant is floor(mean) of its neighbours.
+    void computeBilinear(const unsigned char* up, const unsigned char* mid, const unsigned char* down, int width) {
+        int x = 0;
+#ifdef __AVX2__
+        const __m256i one = _mm256_set1_epi8(1);
+        for (; x + 16 <= width; x += 16) {
+            auto load8 = [](const unsigned char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+            auto load16 = [](const unsigned char* p) {
+                return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+            };
+            // floor((a + b) / 2) = avg_epu8(a, b) - ((a ^ b) & 1)
+            auto floorAvg = [&](__m128i a, __m128i b) {
+                __m256i wa = _mm256_castsi128_si256(a), wb = _mm256_castsi128_si256(b);
+                __m256i r = _mm256_sub_epi8(_mm256_avg_epu8(wa, wb), _mm256_and_si256(_mm256_xor_si256(wa, wb), one));
+                return _mm256_castsi256_si128(r);
+            };
+            auto pack16 = [](__m256i v) {
+                return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            };
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&horiz[x]), floorAvg(load8(mid + x - 1), load8(mid + x + 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&vert[x]), floorAvg(load8(up + x), load8(down + x)));
+            __m256i c = _mm256_add_epi16(_mm256_add_epi16(load16(up + x), load16(down + x)),
+                                         _mm256_add_epi16(load16(mid + x - 1), load16(mid + x + 1)));
+            __m256i d = _mm256_add_epi16(_mm256_add_epi16(load16(up + x - 1), load16(up + x + 1)),
+                                         _mm256_add_epi16(load16(down + x - 1), load16(down + x + 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&cross[x]), pack16(_mm256_srli_epi16(c, 2)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&diag[x]), pack16(_mm256_srli_epi16(d, 2)));
+        }
+#endif
+        for (; x < width; ++x) {
+            horiz[x] = static_cast<unsigned char>((mid[x - 1] + mid[x + 1]) >> 1);
+            vert[x] = static_cast<unsigned char>((up[x] + down[x]) >> 1);
+            cross[x] = static_cast<unsigned char>((up[x] + down[x] + mid[x - 1] + mid[x + 1]) >> 2);
+            diag[x] = static_cast<unsigned char>((up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]) >> 2);
+        }
+    }
+
+    // Malvar-He-Cutler: bilinear plus a Laplacian correction from the centre
+    // sample, with the paper's 5x5 kernels scaled to sixteenths. rows[k] is
+    // Bayer row y - 2 + k.
+    void computeMalvar(const unsigned char* const* rows, int width) {
+        const unsigned char* u2 = rows[0];
+        const unsigned char* u1 = rows[1];
+        const unsigned char* m = rows[2];
+        const unsigned char* d1 = rows[3];
+        const unsigned char* d2 = rows[4];
+        int x = 0;
+#ifdef __AVX2__
+        auto load16 = [](const unsigned char* p) {
+            return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        };
+        auto finish = [](__m256i v, unsigned char* out) {
+            v = _mm256_srai_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(8)), 4);
+            __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+        };
+        auto mul = [](__m256i v, short k) { return _mm256_mullo_epi16(v, _mm256_set1_epi16(k)); };
+        for (; x + 16 <= width; x += 16) {
+            __m256i c = load16(m + x);
+            __m256i h1 = _mm256_add_epi16(load16(m + x - 1), load16(m + x + 1));
+            __m256i h2 = _mm256_add_epi16(load16(m + x - 2), load16(m + x + 2));
+            __m256i v1 = _mm256_add_epi16(load16(u1 + x), load16(d1 + x));
+            __m256i v2 = _mm256_add_epi16(load16(u2 + x), load16(d2 + x));
+            __m256i dg = _mm256_add_epi16(_mm256_add_epi16(load16(u1 + x - 1), load16(u1 + x + 1)),
+                                          _mm256_add_epi16(load16(d1 + x - 1), load16(d1 + x + 1)));
+            __m256i far = _mm256_add_epi16(h2, v2);
+            finish(_mm256_sub_epi16(_mm256_add_epi16(mul(c, 8), mul(_mm256_add_epi16(h1, v1), 4)), mul(far, 2)), &cross[x]);
+            __m256i common = _mm256_sub_epi16(mul(c, 10), mul(dg, 2));
+            finish(_mm256_add_epi16(_mm256_add_epi16(common, mul(h1, 8)), _mm256_sub_epi16(v2, mul(h2, 2))), &horiz[x]);
+            finish(_mm256_add_epi16(_mm256_add_epi16(common, mul(v1, 8)), _mm256_sub_epi16(h2, mul(v2, 2))), &vert[x]);
+            finish(_mm256_sub_epi16(_mm256_add_epi16(mul(c, 12), mul(dg, 4)), mul(far, 3)), &diag[x]);
+        }
+#endif
+        auto finish1 = [](int v) { return static_cast<unsigned char>(std::min(255, std::max(0, (v + 8) >> 4))); };
+        for (; x < width; ++x) {
+            const int c = m[x];
+            const int h1 = m[x - 1] + m[x + 1], h2 = m[x - 2] + m[x + 2];
+            const int v1 = u1[x] + d1[x], v2 = u2[x] + d2[x];
+            const int dg = u1[x - 1] + u1[x + 1] + d1[x - 1] + d1[x + 1];
+            cross[x] = finish1(8 * c + 4 * (h1 + v1) - 2 * (h2 + v2));
+            horiz[x] = finish1(10 * c + 8 * h1 - 2 * h2 - 2 * dg + v2);
+            vert[x] = finish1(10 * c + 8 * v1 - 2 * v2 - 2 * dg + h2);
+            diag[x] = finish1(12 * c + 4 * dg - 3 * (h2 + v2));
+        }
+    }
+
+    // Where R, G and B of a pixel of type `site` come from.
+    void sources(Site site, const unsigned char* self, const unsigned char* rgb[3]) const {
+        switch (site) {
+        case RED: rgb[0] = self; rgb[1] = cross.data(); rgb[2] = diag.data(); break;
+        case BLUE: rgb[0] = diag.data(); rgb[1] = cross.data(); rgb[2] = self; break;
+        case GREEN_ON_RED_ROW: rgb[0] = horiz.data(); rgb[1] = self; rgb[2] = vert.data(); break;
+        case GREEN_ON_BLUE_ROW: rgb[0] = vert.data(); rgb[1] = self; rgb[2] = horiz.data(); break;
+        }
+    }
+};
+
+// Interleaves one output row from the site's own sample and the interpolants.
+void assembleRow(const RowInterpolants& interp, const unsigned char* mid, const Site sites[2],
+                 unsigned char* out, int width) {
+    const unsigned char* even[3] = {};
+    const unsigned char* odd[3] = {};
+    interp.sources(sites[0], mid, even);
+    interp.sources(sites[1], mid, odd);
+    int x = 0;
+    for (; x + 1 < width; x += 2) {
+        out[3 * x] = even[0][x];
+        out[3 * x + 1] = even[1][x];
+        out[3 * x + 2] = even[2][x];
+        out[3 * x + 3] = odd[0][x + 1];
+        out[3 * x + 4] = odd[1][x + 1];
+        out[3 * x + 5] = odd[2][x + 1];
+    }
+    if (x < width) {
+        out[3 * x] = even[0][x];
+        out[3 * x + 1] = even[1][x];
+        out[3 * x + 2] = even[2][x];
+    }
+}
+
+// `bayer` itself when its border is wide enough, else a Reflect-padded copy.
+const GrayImage& withBorder(const GrayImage& bayer, int border, GrayImage& paddedCopy) {
+    if (bayer.border() >= border) return bayer;
+    paddedCopy = padded(bayer, border, BorderMode::Reflect);
+    return paddedCopy;
+}
+
+// Adaptive homogeneity-directed demosaic (Hirakawa & Parks), one row tile
+// at a time so both directional candidates stay in cache. Candidates are
+// kept planar (the green plane doubles as the G channel) so every pass runs
+// 16 pixels per step in 16-bit lanes, or 32 in bytes for the selection. Homogeneity is measured on
+// L = R + 2G + B and the L1 distance of (R - G, B - G) instead of CIELab,
+// which keeps every quantity within 16 bits.
+const int AHD_TILE_ROWS = 32;
+
+inline int clampByte(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+bool isGreen(Site site) {
+    return site == GREEN_ON_RED_ROW || site == GREEN_ON_BLUE_ROW;
+}
+
+// Green along one axis at a red/blue site: the two-tap mean plus a
+// Laplacian correction from the centre, limited to the two neighbours.
+inline int directionalGreen(int c, int n0, int n1, int f0, int f1) {
+    int g = (2 * (n0 + n1) + 2 * c - f0 - f1) >> 2;
+    int lo = n0 < n1 ? n0 : n1;
+    int hi = n0 < n1 ? n1 : n0;
+    return g < lo ? lo : (g > hi ? hi : g);
+}
+
+// Red (or blue when `red` is false) at a site, from the site's own sample
+// and the colour-difference interpolants along each axis.
+template <typename V>
+inline V pickColor(Site site, bool red, V self, V diag, V horiz, V vert) {
+    switch (site) {
+    case RED: return red ? self : diag;
+    case BLUE: return red ? diag : self;
+    case GREEN_ON_RED_ROW: return red ? horiz : vert;
+    default: return red ? vert : horiz;
+    }
+}
+
+#ifdef __AVX2__
+inline __m256i load16(const unsigned char* p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+inline void store16(unsigned char* p, __m256i v) {
+    __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), bytes);
+}
+
+// Byte mask selecting odd lanes (or even lanes) of a 16-pixel block.
+inline __m128i parityMask(bool oddLanes) {
+    return oddLanes ? _mm_set1_epi16(static_cast<short>(0xFF00)) : _mm_set1_epi16(0x00FF);
+}
+
+inline __m256i greenAxis(__m256i c, __m256i n0, __m256i n1, __m256i f0, __m256i f1) {
+    __m256i g = _mm256_slli_epi16(_mm256_add_epi16(n0, n1), 1);
+    g = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_add_epi16(g, _mm256_add_epi16(c, c)), _mm256_add_epi16(f0, f1)), 2);
+    return _mm256_min_epi16(_mm256_max_epi16(g, _mm256_min_epi16(n0, n1)), _mm256_max_epi16(n0, n1));
+}
+#endif
+
+void ahdGreen(const GrayImage& in, const Site quad[2][2], int y0, int tileRows, int width, AhdWorkspace& s) {
+    const int x0 = -3, x1 = width + 3;
+    for (int r = -3; r < tileRows + 3; ++r) {
+        const int y = y0 + r;
+        const unsigned char* u2 = in.row(y - 2);
+        const unsigned char* u1 = in.row(y - 1);
+        const unsigned char* m = in.row(y);
+        const unsigned char* d1 = in.row(y + 1);
+        const unsigned char* d2 = in.row(y + 2);
+        unsigned char* gh = s.green[0].row(r);
+        unsigned char* gv = s.green[1].row(r);
+        // Green sites keep their own sample in both directions.
+        const bool greenOnOdd = isGreen(quad[y & 1][1]);
+        int x = x0;
+#ifdef __AVX2__
+        const __m128i keep = parityMask(greenOnOdd != ((x0 & 1) != 0));
+        for (; x + 16 <= x1; x += 16) {
+            __m256i c = load16(m + x);
+            __m128i self = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + x));
+            __m256i h = greenAxis(c, load16(m + x - 1), load16(m + x + 1), load16(m + x - 2), load16(m + x + 2));
+            __m256i v = greenAxis(c, load16(u1 + x), load16(d1 + x), load16(u2 + x), load16(d2 + x));
+            store16(gh + x, h);
+            store16(gv + x, v);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(gh + x),
+                             _mm_blendv_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gh + x)), self, keep));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(gv + x),
+                             _mm_blendv_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gv + x)), self, keep));
+        }
+#endif
+        for (; x < x1; ++x) {
+            if (((x & 1) != 0) == greenOnOdd) {
+                gh[x] = gv[x] = m[x];
+            } else {
+                gh[x] = static_cast<unsigned char>(directionalGreen(m[x], m[x - 1], m[x + 1], m[x - 2], m[x + 2]));
+                gv[x] = static_cast<unsigned char>(directionalGreen(m[x], u1[x], d1[x], u2[x], d2[x]));
+            }
+        }
+    }
+}
+
+// Red and blue from the directional green by interpolating the colour
+// differences (sample - green) of the neighbours that carry them.
+void ahdColor(const GrayImage& in, const Site quad[2][2], int y0, int tileRows, int width, AhdWorkspace& s) {
+    const int x0 = -2, x1 = width + 2;
+    for (int d = 0; d < 2; ++d) {
+        for (int r = -2; r < tileRows + 2; ++r) {
+            const int y = y0 + r;
+            const Site even = quad[y & 1][0];
+            const Site odd = quad[y & 1][1];
+            const unsigned char* u = in.row(y - 1);
+            const unsigned char* m = in.row(y);
+            const unsigned char* dn = in.row(y + 1);
+            const unsigned char* gu = s.green[d].row(r - 1);
+            const unsigned char* g = s.green[d].row(r);
+            const unsigned char* gd = s.green[d].row(r + 1);
+            unsigned char* red = s.red[d].row(r);
+            unsigned char* blue = s.blue[d].row(r);
+            int x = x0;
+#ifdef __AVX2__
+            // x0 is even, so odd lanes are odd columns.
+            const __m128i oddLanes = parityMask(true);
+            auto diff = [](const unsigned char* a, const unsigned char* b) {
+                return _mm256_sub_epi16(load16(a), load16(b));
+            };
+            auto pack = [](__m256i v) {
+                return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            };
+            for (; x + 16 <= x1; x += 16) {
+                __m256i gc = load16(g + x);
+                __m256i dh = _mm256_srai_epi16(_mm256_add_epi16(diff(m + x - 1, g + x - 1), diff(m + x + 1, g + x + 1)), 1);
+                __m256i dv = _mm256_srai_epi16(_mm256_add_epi16(diff(u + x, gu + x), diff(dn + x, gd + x)), 1);
+                __m256i dd = _mm256_add_epi16(_mm256_add_epi16(diff(u + x - 1, gu + x - 1), diff(u + x + 1, gu + x + 1)),
+                                              _mm256_add_epi16(diff(dn + x - 1, gd + x - 1), diff(dn + x + 1, gd + x + 1)));
+                dd = _mm256_srai_epi16(dd, 2);
+                __m128i self = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + x));
+                __m128i cd = pack(_mm256_add_epi16(gc, dd));
+                __m128i ch = pack(_mm256_add_epi16(gc, dh));
+                __m128i cv = pack(_mm256_add_epi16(gc, dv));
+                __m128i r0 = pickColor(even, true, self, cd, ch, cv), r1 = pickColor(odd, true, self, cd, ch, cv);
+                __m128i b0 = pickColor(even, false, self, cd, ch, cv), b1 = pickColor(odd, false, self, cd, ch, cv);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(red + x), _mm_blendv_epi8(r0, r1, oddLanes));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(blue + x), _mm_blendv_epi8(b0, b1, oddLanes));
+            }
+#endif
+            for (; x < x1; ++x) {
+                const int dh = ((m[x - 1] - g[x - 1]) + (m[x + 1] - g[x + 1])) >> 1;
+                const int dv = ((u[x] - gu[x]) + (dn[x] - gd[x])) >> 1;
+                const int dd = ((u[x - 1] - gu[x - 1]) + (u[x + 1] - gu[x + 1]) +
+                                (dn[x - 1] - gd[x - 1]) + (dn[x + 1] - gd[x + 1])) >> 2;
+                const int self = m[x];
+                const int cd = clampByte(g[x] + dd), ch = clampByte(g[x] + dh), cv = clampByte(g[x] + dv);
+                const Site site = (x & 1) ? odd : even;
+                red[x] = static_cast<unsigned char>(pickColor(site, true, self, cd, ch, cv));
+                blue[x] = static_cast<unsigned char>(pickColor(site, false, self, cd, ch, cv));
+            }
+        }
+    }
+}
+
+// For every pixel and candidate, counts the 4-neighbours that are within
+// the luma and chroma tolerances. The tolerances come from each
+// candidate's own interpolation axis (left/right for the horizontal one,
+// up/down for the vertical one), as in the paper.
+void ahdHomogeneity(int tileRows, int width, AhdWorkspace& s) {
+    const int x0 = -1, x1 = width + 1;
+    for (int r = -1; r < tileRows + 1; ++r) {
+        const unsigned char* R[2][3];
+        const unsigned char* G[2][3];
+        const unsigned char* B[2][3];
+        for (int d = 0; d < 2; ++d) {
+            for (int k = 0; k < 3; ++k) {
+                R[d][k] = s.red[d].row(r - 1 + k);
+                G[d][k] = s.green[d].row(r - 1 + k);
+                B[d][k] = s.blue[d].row(r - 1 + k);
+            }
+        }
+        unsigned char* homog[2] = {s.homog[0].row(r), s.homog[1].row(r)};
+        int x = x0;
+#ifdef __AVX2__
+        // Neighbour n of the centre: 0 left, 1 right, 2 up, 3 down.
+        auto at = [&](int d, int n, int xx, __m256i& L, __m256i& A, __m256i& Bc) {
+            const int k = n == 2 ? 0 : (n == 3 ? 2 : 1);
+            const int dx = n == 0 ? -1 : (n == 1 ? 1 : 0);
+            __m256i rr = load16(R[d][k] + xx + dx), gg = load16(G[d][k] + xx + dx), bb = load16(B[d][k] + xx + dx);
+            L = _mm256_add_epi16(_mm256_add_epi16(rr, bb), _mm256_add_epi16(gg, gg));
+            A = _mm256_sub_epi16(rr, gg);
+            Bc = _mm256_sub_epi16(bb, gg);
+        };
+        for (; x + 16 <= x1; x += 16) {
+            __m256i ld[2][4], cd[2][4];
+            for (int d = 0; d < 2; ++d) {
+                __m256i L, A, Bc;
+                at(d, -1, x, L, A, Bc);
+                for (int n = 0; n < 4; ++n) {
+                    __m256i Ln, An, Bn;
+                    at(d, n, x, Ln, An, Bn);
+                    ld[d][n] = _mm256_abs_epi16(_mm256_sub_epi16(L, Ln));
+                    cd[d][n] = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(A, An)),
+                                                _mm256_abs_epi16(_mm256_sub_epi16(Bc, Bn)));
+                }
+            }
+            __m256i leps = _mm256_min_epi16(_mm256_max_epi16(ld[0][0], ld[0][1]), _mm256_max_epi16(ld[1][2], ld[1][3]));
+            __m256i ceps = _mm256_min_epi16(_mm256_max_epi16(cd[0][0], cd[0][1]), _mm256_max_epi16(cd[1][2], cd[1][3]));
+            for (int d = 0; d < 2; ++d) {
+                __m256i count = _mm256_setzero_si256();
+                for (int n = 0; n < 4; ++n) {
+                    __m256i over = _mm256_or_si256(_mm256_cmpgt_epi16(ld[d][n], leps), _mm256_cmpgt_epi16(cd[d][n], ceps));
+                    count = _mm256_sub_epi16(count, _mm256_andnot_si256(over, _mm256_set1_epi16(-1)));
+                }
+                store16(homog[d] + x, count);
+            }
+        }
+#endif
+        for (; x < x1; ++x) {
+            int ld[2][4], cd[2][4];
+            for (int d = 0; d < 2; ++d) {
+                auto luma = [&](int k, int xx) { return R[d][k][xx] + 2 * G[d][k][xx] + B[d][k][xx]; };
+                auto chromaA = [&](int k, int xx) { return R[d][k][xx] - G[d][k][xx]; };
+                auto chromaB = [&](int k, int xx) { return B[d][k][xx] - G[d][k][xx]; };
+                const int nk[4] = {1, 1, 0, 2};
+                const int nx[4] = {x - 1, x + 1, x, x};
+                for (int n = 0; n < 4; ++n) {
+                    ld[d][n] = std::abs(luma(1, x) - luma(nk[n], nx[n]));
+                    cd[d][n] = std::abs(chromaA(1, x) - chromaA(nk[n], nx[n])) +
+                               std::abs(chromaB(1, x) - chromaB(nk[n], nx[n]));
+                }
+            }
+            const int leps = std::min(std::max(ld[0][0], ld[0][1]), std::max(ld[1][2], ld[1][3]));
+            const int ceps = std::min(std::max(cd[0][0], cd[0][1]), std::max(cd[1][2], cd[1][3]));
+            for (int d = 0; d < 2; ++d) {
+                int count = 0;
+                for (int n = 0; n < 4; ++n) count += (ld[d][n] <= leps) & (cd[d][n] <= ceps);
+                homog[d][x] = static_cast<unsigned char>(count);
+            }
+        }
+    }
+}
+
+#ifdef __AVX2__
+// pshufb masks that place byte i of channel plane c at byte 3 i + c of 16
+// interleaved RGB pixels: scatter[k][c] fills chunk k (bytes 16 k to 16 k + 15).
+struct RgbScatter {
+    __m128i scatter[3][3];
+
+    RgbScatter() {
+        alignas(16) signed char m[16];
+        for (int k = 0; k < 3; ++k) {
+            for (int c = 0; c < 3; ++c) {
+                for (int j = 0; j < 16; ++j) {
+                    const int dst = 16 * k + j;
+                    m[j] = static_cast<signed char>(dst % 3 == c ? dst / 3 : -128);
+                }
+                scatter[k][c] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+            }
+        }
+    }
+
+    void store(unsigned char* out, __m128i r, __m128i g, __m128i b) const {
+        for (int k = 0; k < 3; ++k) {
+            const __m128i chunk = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(r, scatter[k][0]), _mm_shuffle_epi8(g, scatter[k][1])),
+                _mm_shuffle_epi8(b, scatter[k][2]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * k), chunk);
+        }
+    }
+};
+#endif
+
+// Picks, per pixel, the candidate with more homogeneous neighbours summed
+// over its 3x3 window; ties take the mean of both. The sums are at most 36,
+// so the vector path runs 32 pixels per step in byte lanes and interleaves
+// straight into the output row.
+void ahdSelect(RgbImage& rgb, int y0, int tileRows, int width, const AhdWorkspace& s) {
+    for (int r = 0; r < tileRows; ++r) {
+        const unsigned char* planes[2][3] = {{s.red[0].row(r), s.green[0].row(r), s.blue[0].row(r)},
+                                             {s.red[1].row(r), s.green[1].row(r), s.blue[1].row(r)}};
+        unsigned char* out = rgb.row(y0 + r);
+        int x = 0;
+#ifdef __AVX2__
+        static const RgbScatter interleave;
+        auto load = [](const unsigned char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); };
+        const __m256i one = _mm256_set1_epi8(1);
+        for (; x + 32 <= width; x += 32) {
+            __m256i score[2];
+            for (int d = 0; d < 2; ++d) {
+                __m256i sum = _mm256_setzero_si256();
+                for (int k = -1; k <= 1; ++k) {
+                    const unsigned char* hr = s.homog[d].row(r + k) + x;
+                    sum = _mm256_add_epi8(sum, _mm256_add_epi8(load(hr - 1), _mm256_add_epi8(load(hr), load(hr + 1))));
+                }
+                score[d] = sum;
+            }
+            const __m256i hWins = _mm256_cmpgt_epi8(score[0], score[1]);
+            const __m256i vWins = _mm256_cmpgt_epi8(score[1], score[0]);
+            __m256i v[3];
+            for (int c = 0; c < 3; ++c) {
+                const __m256i a = load(planes[0][c] + x), b = load(planes[1][c] + x);
+                // avg_epu8 rounds up; the scalar mean truncates.
+                v[c] = _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one));
+                v[c] = _mm256_blendv_epi8(v[c], a, hWins);
+                v[c] = _mm256_blendv_epi8(v[c], b, vWins);
+            }
+            interleave.store(out + 3 * x, _mm256_castsi256_si128(v[0]), _mm256_castsi256_si128(v[1]),
+                             _mm256_castsi256_si128(v[2]));
+            interleave.store(out + 3 * x + 48, _mm256_extracti128_si256(v[0], 1), _mm256_extracti128_si256(v[1], 1),
+                             _mm256_extracti128_si256(v[2], 1));
+        }
+#endif
+        for (; x < width; ++x) {
+            int score[2];
+            for (int d = 0; d < 2; ++d) {
+                int sum = 0;
+                for (int k = -1; k <= 1; ++k) {
+                    const unsigned char* hr = s.homog[d].row(r + k);
+                    sum += hr[x - 1] + hr[x] + hr[x + 1];
+                }
+                score[d] = sum;
+            }
+            for (int c = 0; c < 3; ++c) {
+                const int a = planes[0][c][x], b = planes[1][c][x];
+                const int v = score[0] > score[1] ? a : (score[1] > score[0] ? b : (a + b) >> 1);
+                out[3 * x + c] = static_cast<unsigned char>(v);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+void demosaicBilinear(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern) {
+    ProfileScope scope("demosaic bilinear");
+    GrayImage paddedCopy;
+    const GrayImage& in = withBorder(bayer, 1, paddedCopy);
+    rgb.resize(bayer.width(), bayer.height(), rgb.border());
+    scope.image(bayer, rgb);
+
+    Site quad[2][2];
+    quadSites(pattern, quad);
+    RowInterpolants interp(bayer.width());
+    for (int y = 0; y < bayer.height(); ++y) {
+        interp.computeBilinear(in.row(y - 1), in.row(y), in.row(y + 1), bayer.width());
+        assembleRow(interp, in.row(y), quad[y & 1], rgb.row(y), bayer.width());
+    }
+}
+
+void demosaicMalvar(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern) {
+    ProfileScope scope("demosaic malvar");
+    GrayImage paddedCopy;
+    const GrayImage& in = withBorder(bayer, 2, paddedCopy);
+    rgb.resize(bayer.width(), bayer.height(), rgb.border());
+    scope.image(bayer, rgb);
+
+    Site quad[2][2];
+    quadSites(pattern, quad);
+    RowInterpolants interp(bayer.width());
+    const unsigned char* rows[5];
+    for (int y = 0; y < bayer.height(); ++y) {
+        for (int k = 0; k < 5; ++k) rows[k] = in.row(y - 2 + k);
+        interp.computeMalvar(rows, bayer.width());
+        assembleRow(interp, in.row(y), quad[y & 1], rgb.row(y), bayer.width());
+    }
+}
+
+void demosaicAHD(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern, ThreadPool* pool,
+                 AhdWorkspace* workspace) {
+    ProfileScope scope("demosaic ahd");
+    const int width = bayer.width();
+    const int height = bayer.height();
+    GrayImage paddedCopy;
+    const GrayImage& in = withBorder(bayer, 5, paddedCopy);
+    rgb.resize(width, height, rgb.border());
+    scope.image(bayer, rgb);
+
+    Site quad[2][2];
+    quadSites(pattern, quad);
+    auto runTile = [&](int tile, AhdWorkspace& s) {
+        const int y0 = tile * AHD_TILE_ROWS;
+        const int rows = std::min(AHD_TILE_ROWS, height - y0);
+        ProfileScope tileScope("demosaic ahd", "tile");
+        tileScope.tile(tile).pixels(static_cast<uint64_t>(width) * rows);
+        for (int d = 0; d < 2; ++d) {
+            s.green[d].resize(width, AHD_TILE_ROWS, 3);
+            s.red[d].resize(width, AHD_TILE_ROWS, 2);
+            s.blue[d].resize(width, AHD_TILE_ROWS, 2);
+            s.homog[d].resize(width, AHD_TILE_ROWS, 1);
+        }
+        ahdGreen(in, quad, y0, rows, width, s);
+        ahdColor(in, quad, y0, rows, width, s);
+        ahdHomogeneity(rows, width, s);
+        ahdSelect(rgb, y0, rows, width, s);
+    };
+
+    const int tiles = (height + AHD_TILE_ROWS - 1) / AHD_TILE_ROWS;
+    if (pool) {
+        WorkerLocal<AhdWorkspace> scratch(*pool);
+        pool->parallelFor(0, tiles, 1, [&](int begin, int end, int slot) {
+            for (int t = begin; t < end; ++t) runTile(t, scratch[slot]);
+        });
+    } else {
+        AhdWorkspace local;
+        AhdWorkspace& scratch = workspace ? *workspace : local;
+        for (int t = 0; t < tiles; ++t) runTile(t, scratch);
+    }
+}
+
+bool parseDemosaicMethod(const std::string& name, DemosaicMethod& method) {
+    std::string lower(name);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (lower == "bilinear") method = DemosaicMethod::Bilinear;
+    else if (lower == "mhc" || lower == "malvar") method = DemosaicMethod::Malvar;
+    else if (lower == "ahd") method = DemosaicMethod::AHD;
+    else return false;
+    return true;
+}
+
+namespace {
+
+// The portable kernels: the same formulas as the 8-bit scalar tails above,
+// written once over PixelTraits so 16-bit and float frames need no
+// quantising pass. Sums are PixelWork (int for the integer types).
+template <typename T>
+struct Interpolants {
+    PixelWork<T> horiz, vert, cross, diag;
+};
+
+template <typename T>
+Interpolants<T> bilinearAt(const T* up, const T* mid, const T* down, int x) {
+    using W = PixelWork<T>;
+    return {scaleDown<T>(W(mid[x - 1]) + mid[x + 1], 1), scaleDown<T>(W(up[x]) + down[x], 1),
+            scaleDown<T>(W(up[x]) + down[x] + mid[x - 1] + mid[x + 1], 2),
+            scaleDown<T>(W(up[x - 1]) + up[x + 1] + down[x - 1] + down[x + 1], 2)};
+}
+
+// rows[k] is Bayer row y - 2 + k.
+template <typename T>
+Interpolants<T> malvarAt(const T* const* rows, int x) {
+    using W = PixelWork<T>;
+    const T* u2 = rows[0];
+    const T* u1 = rows[1];
+    const T* m = rows[2];
+    const T* d1 = rows[3];
+    const T* d2 = rows[4];
+    const W c = m[x];
+    const W h1 = W(m[x - 1]) + m[x + 1], h2 = W(m[x - 2]) + m[x + 2];
+    const W v1 = W(u1[x]) + d1[x], v2 = W(u2[x]) + d2[x];
+    const W dg = W(u1[x - 1]) + u1[x + 1] + d1[x - 1] + d1[x + 1];
+    // Sixteenths, rounded for the integer types.
+    const W half = PixelTraits<T>::integer ? 8 : 0;
+    auto finish = [half](W v) -> W { return clampPixel<T>(scaleDown<T>(v + half, 4)); };
+    return {finish(10 * c + 8 * h1 - 2 * h2 - 2 * dg + v2), finish(10 * c + 8 * v1 - 2 * v2 - 2 * dg + h2),
+            finish(8 * c + 4 * (h1 + v1) - 2 * (h2 + v2)), finish(12 * c + 4 * dg - 3 * (h2 + v2))};
+}
+
+template <typename T>
+void storeSite(Site site, T self, const Interpolants<T>& in, T* out) {
+    switch (site) {
+    case RED: out[0] = self; out[1] = static_cast<T>(in.cross); out[2] = static_cast<T>(in.diag); break;
+    case BLUE: out[0] = static_cast<T>(in.diag); out[1] = static_cast<T>(in.cross); out[2] = self; break;
+    case GREEN_ON_RED_ROW: out[0] = static_cast<T>(in.horiz); out[1] = self; out[2] = static_cast<T>(in.vert); break;
+    case GREEN_ON_BLUE_ROW: out[0] = static_cast<T>(in.vert); out[1] = self; out[2] = static_cast<T>(in.horiz); break;
+    }
+}
+
+template <typename T>
+PixelWork<T> directionalGreenAt(PixelWork<T> c, PixelWork<T> n0, PixelWork<T> n1, PixelWork<T> f0,
+                                PixelWork<T> f1) {
+    const PixelWork<T> g = scaleDown<T>(2 * (n0 + n1) + 2 * c - f0 - f1, 2);
+    const PixelWork<T> lo = std::min(n0, n1), hi = std::max(n0, n1);
+    return g < lo ? lo : (g > hi ? hi : g);
+}
+
+// demosaicAHD()'s passes on one row tile, as in the 8-bit kernels.
+template <typename T>
+struct PortableAhd {
+    Image<T, 1> green[2], red[2], blue[2];
+    GrayImage homog[2];
+
+    void run(const Image<T, 1>& in, const Site quad[2][2], int y0, int tileRows, Image<T, 3>& rgb) {
+        using W = PixelWork<T>;
+        const int width = in.width();
+        for (int d = 0; d < 2; ++d) {
+            green[d].resize(width, AHD_TILE_ROWS, 3);
+            red[d].resize(width, AHD_TILE_ROWS, 2);
+            blue[d].resize(width, AHD_TILE_ROWS, 2);
+            homog[d].resize(width, AHD_TILE_ROWS, 1);
+        }
+        for (int r = -3; r < tileRows + 3; ++r) {
+            const int y = y0 + r;
+            const T* u2 = in.row(y - 2);
+            const T* u1 = in.row(y - 1);
+            const T* m = in.row(y);
+            const T* d1 = in.row(y + 1);
+            const T* d2 = in.row(y + 2);
+            T* gh = green[0].row(r);
+            T* gv = green[1].row(r);
+            const bool greenOnOdd = isGreen(quad[y & 1][1]);
+            for (int x = -3; x < width + 3; ++x) {
+                if (((x & 1) != 0) == greenOnOdd) {
+                    gh[x] = gv[x] = m[x];
+                } else {
+                    gh[x] = static_cast<T>(directionalGreenAt<T>(m[x], m[x - 1], m[x + 1], m[x - 2], m[x + 2]));
+                    gv[x] = static_cast<T>(directionalGreenAt<T>(m[x], u1[x], d1[x], u2[x], d2[x]));
+                }
+            }
+        }
+        for (int d = 0; d < 2; ++d) {
+            for (int r = -2; r < tileRows + 2; ++r) {
+                const int y = y0 + r;
+                const T* u = in.row(y - 1);
+                const T* m = in.row(y);
+                const T* dn = in.row(y + 1);
+                const T* gu = green[d].row(r - 1);
+                const T* g = green[d].row(r);
+                const T* gd = green[d].row(r + 1);
+                T* rr = red[d].row(r);
+                T* bb = blue[d].row(r);
+                for (int x = -2; x < width + 2; ++x) {
+                    const W dh = scaleDown<T>((W(m[x - 1]) - g[x - 1]) + (W(m[x + 1]) - g[x + 1]), 1);
+                    const W dv = scaleDown<T>((W(u[x]) - gu[x]) + (W(dn[x]) - gd[x]), 1);
+                    const W dd = scaleDown<T>((W(u[x - 1]) - gu[x - 1]) + (W(u[x + 1]) - gu[x + 1]) +
+                                                  (W(dn[x - 1]) - gd[x - 1]) + (W(dn[x + 1]) - gd[x + 1]),
+                                              2);
+                    const T self = m[x];
+                    const T cd = clampPixel<T>(g[x] + dd), ch = clampPixel<T>(g[x] + dh);
+                    const T cv = clampPixel<T>(g[x] + dv);
+                    const Site site = quad[y & 1][x & 1];
+                    rr[x] = pickColor(site, true, self, cd, ch, cv);
+                    bb[x] = pickColor(site, false, self, cd, ch, cv);
+                }
+            }
+        }
+        for (int r = -1; r < tileRows + 1; ++r) {
+            for (int x = -1; x < width + 1; ++x) {
+                W ld[2][4], cd[2][4];
+                for (int d = 0; d < 2; ++d) {
+                    auto at = [&](int k, int xx, W& l, W& a, W& b) {
+                        const W R = red[d].row(r + k)[xx], G = green[d].row(r + k)[xx], B = blue[d].row(r + k)[xx];
+                        l = R + 2 * G + B;
+                        a = R - G;
+                        b = B - G;
+                    };
+                    W l, a, b;
+                    at(0, x, l, a, b);
+                    const int nk[4] = {0, 0, -1, 1};
+                    const int nx[4] = {x - 1, x + 1, x, x};
+                    for (int n = 0; n < 4; ++n) {
+                        W ln, an, bn;
+                        at(nk[n], nx[n], ln, an, bn);
+                        ld[d][n] = std::abs(l - ln);
+                        cd[d][n] = std::abs(a - an) + std::abs(b - bn);
+                    }
+                }
+                const W leps = std::min(std::max(ld[0][0], ld[0][1]), std::max(ld[1][2], ld[1][3]));
+                const W ceps = std::min(std::max(cd[0][0], cd[0][1]), std::max(cd[1][2], cd[1][3]));
+                for (int d = 0; d < 2; ++d) {
+                    int count = 0;
+                    for (int n = 0; n < 4; ++n) count += (ld[d][n] <= leps) & (cd[d][n] <= ceps);
+                    homog[d].row(r)[x] = static_cast<unsigned char>(count);
+                }
+            }
+        }
+        for (int r = 0; r < tileRows; ++r) {
+            T* out = rgb.row(y0 + r);
+            for (int x = 0; x < width; ++x) {
+                int score[2];
+                for (int d = 0; d < 2; ++d) {
+                    score[d] = 0;
+                    for (int k = -1; k <= 1; ++k) {
+                        const unsigned char* hr = homog[d].row(r + k);
+                        score[d] += hr[x - 1] + hr[x] + hr[x + 1];
+                    }
+                }
+                const T* planes[2][3] = {{red[0].row(r), green[0].row(r), blue[0].row(r)},
+                                         {red[1].row(r), green[1].row(r), blue[1].row(r)}};
+                for (int c = 0; c < 3; ++c) {
+                    const T a = planes[0][c][x], b = planes[1][c][x];
+                    const T mean = static_cast<T>(scaleDown<T>(W(a) + b, 1));
+                    out[3 * x + c] = score[0] > score[1] ? a : (score[1] > score[0] ? b : mean);
+                }
+            }
+        }
+    }
+};
+
+}  // namespace
+
+template <typename T>
+void demosaicPortable(const Image<T, 1>& bayer, Image<T, 3>& rgb, CfaPattern pattern, DemosaicMethod method,
+                      ThreadPool* pool) {
+    ProfileScope scope(method == DemosaicMethod::AHD      ? "demosaic ahd"
+                       : method == DemosaicMethod::Malvar ? "demosaic malvar"
+                                                          : "demosaic bilinear");
+    const int width = bayer.width();
+    const int height = bayer.height();
+    const int border = method == DemosaicMethod::AHD ? 5 : (method == DemosaicMethod::Malvar ? 2 : 1);
+    Image<T, 1> paddedCopy;
+    const Image<T, 1>* in = &bayer;
+    if (bayer.border() < border) {
+        paddedCopy = padded(bayer, border, BorderMode::Reflect);
+        in = &paddedCopy;
+    }
+    rgb.resize(width, height, rgb.border());
+    scope.image(bayer, rgb);
+    if (bayer.empty()) return;
+
+    Site quad[2][2];
+    quadSites(pattern, quad);
+    if (method == DemosaicMethod::AHD) {
+        const int tiles = (height + AHD_TILE_ROWS - 1) / AHD_TILE_ROWS;
+        auto runTile = [&](int t, PortableAhd<T>& s) {
+            const int rows = std::min(AHD_TILE_ROWS, height - t * AHD_TILE_ROWS);
+            ProfileScope tileScope("demosaic ahd", "tile");
+            tileScope.tile(t).pixels(static_cast<uint64_t>(width) * rows);
+            s.run(*in, quad, t * AHD_TILE_ROWS, rows, rgb);
+        };
+        if (pool) {
+            WorkerLocal<PortableAhd<T>> scratch(*pool);
+            pool->parallelFor(0, tiles, 1, [&](int begin, int end, int slot) {
+                for (int t = begin; t < end; ++t) runTile(t, scratch[slot]);
+            });
+        } else {
+            PortableAhd<T> scratch;
+            for (int t = 0; t < tiles; ++t) runTile(t, scratch);
+        }
+        return;
+    }
+
+    auto rows = [&](int y0, int y1, int) {
+        const T* window[5];
+        for (int y = y0; y < y1; ++y) {
+            T* out = rgb.row(y);
+            const T* mid = in->row(y);
+            for (int k = 0; k < 5; ++k) window[k] = method == DemosaicMethod::Malvar ? in->row(y - 2 + k) : nullptr;
+            for (int x = 0; x < width; ++x) {
+                const Interpolants<T> interp = method == DemosaicMethod::Malvar
+                                                   ? malvarAt(window, x)
+                                                   : bilinearAt(in->row(y - 1), mid, in->row(y + 1), x);
+                storeSite(quad[y & 1][x & 1], mid[x], interp, out + 3 * x);
+            }
+        }
+    };
+    if (pool) pool->parallelFor(0, height, 16, rows);
+    else rows(0, height, 0);
+}
+
+template <typename T>
+void demosaic(const Image<T, 1>& bayer, Image<T, 3>& rgb, CfaPattern pattern, DemosaicMethod method,
+              ThreadPool* pool) {
+    if constexpr (std::is_same_v<T, unsigned char>) {
+        switch (method) {
+        case DemosaicMethod::Bilinear: demosaicBilinear(bayer, rgb, pattern); break;
+        case DemosaicMethod::Malvar: demosaicMalvar(bayer, rgb, pattern); break;
+        case DemosaicMethod::AHD: demosaicAHD(bayer, rgb, pattern, pool); break;
+        }
+    } else {
+        demosaicPortable(bayer, rgb, pattern, method, pool);
+    }
+}
+
+template void demosaicPortable(const GrayImage&, RgbImage&, CfaPattern, DemosaicMethod, ThreadPool*);
+template void demosaicPortable(const GrayImage16&, RgbImage16&, CfaPattern, DemosaicMethod, ThreadPool*);
+template void demosaicPortable(const GrayImageF&, RgbImageF&, CfaPattern, DemosaicMethod, ThreadPool*);
+template void demosaic(const GrayImage&, RgbImage&, CfaPattern, DemosaicMethod, ThreadPool*);
+template void demosaic(const GrayImage16&, RgbImage16&, CfaPattern, DemosaicMethod, ThreadPool*);
+template void demosaic(const GrayImageF&, RgbImageF&, CfaPattern, DemosaicMethod, ThreadPool*);
+
+}  // namespace imgcore
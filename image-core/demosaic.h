@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+
+#include "image.h"
+#include "pixel.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// Colour filter array layouts, named by the top-left 2x2 quad read row by row.
+enum class CfaPattern { RGGB, BGGR, GRBG, GBRG };
+
+// Accepts "RGGB", "BGGR", "GRBG" or "GBRG" (any case); false otherwise.
+bool parseCfaPattern(const std::string& name, CfaPattern& pattern);
+
+// Bilinear demosaic in integer arithmetic, truncating like the original
+// float loop. The CFA layout is resolved once per row pair into per-column
+// source selections, so the inner loop has no parity branches; the 2- and
+// 4-tap averages run as whole-row SIMD passes (AVX2 when available).
+// `bayer` should carry a border of at least 1, filled with Reflect so the
+// mirrored neighbours keep their CFA colour; otherwise a copy is made.
+void demosaicBilinear(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern);
+
+// Malvar-He-Cutler gradient-corrected linear interpolation: the 5x5 kernels
+// of the paper in sixteenths, 16 pixels per step in 16-bit lanes. Needs a
+// border of 2 (Reflect), otherwise a copy is made. Removes most of the
+// bilinear zipper at about the same cost.
+void demosaicMalvar(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern);
+
+// Row-tile buffers of demosaicAHD(), for callers that demosaic many small
+// frames (or tiles of one) and want them allocated once.
+struct AhdWorkspace {
+    // Directional green, rows [-3, T + 3) and columns [-3, W + 3).
+    GrayImage green[2];
+    // Directional red and blue, rows and columns 2 beyond the tile.
+    GrayImage red[2], blue[2];
+    // Homogeneity counts (0-4), rows and columns 1 beyond the tile.
+    GrayImage homog[2];
+};
+
+// Adaptive homogeneity-directed demosaic: horizontal and vertical candidates
+// per pixel, the one with more homogeneous neighbours (in luma and chroma)
+// wins. Runs in 32-row tiles, on `pool` when given, otherwise in
+// `workspace` when given. Needs a border of 5 (Reflect), otherwise a copy
+// is made. Building and scoring two full candidates costs about 4x
+// demosaicBilinear() per thread (Malvar stays within 1.5x), so AHD is the
+// one mode outside the 2x budget; spread its tiles over a pool where that
+// matters.
+void demosaicAHD(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern, ThreadPool* pool = nullptr,
+                 AhdWorkspace* workspace = nullptr);
+
+enum class DemosaicMethod { Bilinear, Malvar, AHD };
+
+// Accepts "bilinear", "mhc" / "malvar" or "ahd" (any case); false otherwise.
+bool parseDemosaicMethod(const std::string& name, DemosaicMethod& method);
+
+// Any pixel type: 8-bit frames take the kernels above, 16-bit and float
+// frames demosaicPortable().
+template <typename T>
+void demosaic(const Image<T, 1>& bayer, Image<T, 3>& rgb, CfaPattern pattern, DemosaicMethod method,
+              ThreadPool* pool = nullptr);
+
+// The three methods per pixel on any pixel type, with the arithmetic of the
+// 8-bit kernels: integer types floor their means and clamp to their own
+// range, float divides exactly and clamps to [0, 1]. On 8-bit input the
+// result equals the SIMD kernels byte for byte. Needs the same borders;
+// row bands (AHD tiles) run on `pool` when given.
+template <typename T>
+void demosaicPortable(const Image<T, 1>& bayer, Image<T, 3>& rgb, CfaPattern pattern, DemosaicMethod method,
+                      ThreadPool* pool = nullptr);
+
+}  // namespace imgcore
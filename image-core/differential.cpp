@@ -0,0 +1,76 @@
+#include "differential.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace imgcore {
+
+namespace {
+
+// FNV-1a, so each check's seed depends only on its name.
+uint64_t hashName(const std::string& name) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (unsigned char c : name) h = (h ^ c) * 0x100000001B3ull;
+    return h;
+}
+
+// Empty when the trial is within the per-trial tolerances, otherwise what
+// it exceeded.
+std::string violation(const DiffTrial& trial, const DiffTolerance& tol) {
+    std::ostringstream why;
+    if (trial.maxAbsError > tol.maxAbsError) why << " max abs error " << trial.maxAbsError;
+    if (trial.hasClean && -trial.psnrDelta() > tol.maxPsnrDrop) why << " PSNR delta " << trial.psnrDelta() << " dB";
+    if (trial.scalarError > tol.maxScalarError) why << " scalar error " << trial.scalarError;
+    return why.str();
+}
+
+}  // namespace
+
+std::vector<DiffSummary> DifferentialHarness::run(int trials, uint64_t seed, const std::string& filter,
+                                                  ThreadPool* pool) const {
+    std::vector<DiffSummary> summaries;
+    for (const DiffCheck& check : checks_) {
+        if (!filter.empty() && check.name.find(filter) == std::string::npos) continue;
+        DiffSummary summary;
+        summary.name = check.name;
+        summary.reference = check.reference;
+        SplitMix64 rng(seed ^ hashName(check.name));
+        uint64_t mismatches = 0, samples = 0;
+        for (int t = 0; t < trials; ++t) {
+            DiffTrial trial;
+            check.run(rng, pool, trial);
+            ++summary.trials;
+            mismatches += trial.mismatches;
+            samples += trial.samples;
+            summary.maxAbsError = std::max(summary.maxAbsError, trial.maxAbsError);
+            summary.minPsnrVsReference = std::min(summary.minPsnrVsReference, trial.psnrVsReference);
+            summary.worstPsnrDelta = std::min(summary.worstPsnrDelta, trial.psnrDelta());
+            summary.maxScalarError = std::max(summary.maxScalarError, trial.scalarError);
+            const std::string why = violation(trial, check.tolerance);
+            if (!why.empty() && summary.failedTrials++ == 0) summary.firstFailure = trial.config + ":" + why;
+        }
+        summary.mismatchFraction = samples ? static_cast<double>(mismatches) / samples : 0.0;
+        summary.mismatchExceeded = summary.mismatchFraction > check.tolerance.maxMismatchFraction;
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+void printDiffSummaries(const std::vector<DiffSummary>& summaries, std::ostream& out) {
+    out << std::left << std::setw(30) << "fast path" << std::setw(48) << "reference" << std::right << std::setw(7)
+        << "trials" << std::setw(8) << "maxAbs" << std::setw(11) << "mismatch" << std::setw(10) << "PSNR ref"
+        << std::setw(10) << "dPSNR" << std::setw(10) << "scalar" << "  result" << std::endl;
+    for (const DiffSummary& s : summaries) {
+        out << std::left << std::setw(30) << s.name << std::setw(48) << s.reference << std::right << std::setw(7)
+            << s.trials << std::setw(8) << s.maxAbsError << std::fixed << std::setprecision(5) << std::setw(11)
+            << s.mismatchFraction << std::setprecision(2) << std::setw(10) << s.minPsnrVsReference
+            << std::setprecision(3) << std::setw(10) << s.worstPsnrDelta << std::scientific << std::setprecision(1)
+            << std::setw(10) << s.maxScalarError << "  " << (s.passed() ? "PASS" : "FAIL") << std::endl;
+        if (s.failedTrials) {
+            out << "    " << s.failedTrials << " failing trial(s), first: " << s.firstFailure << std::endl;
+        }
+        if (s.mismatchExceeded) out << "    mismatching samples above the tolerance" << std::endl;
+    }
+}
+
+}  // namespace imgcore
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "image.h"
+#include "metrics.h"
+#include "synthetic.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// How far an optimized path may stray from its reference kernel.
+struct DiffTolerance {
+    int maxAbsError = 0;  // largest |fast - reference| on any sample
+    // Share of samples allowed to differ at all, over every sample of every
+    // trial (a single small frame says little on its own).
+    double maxMismatchFraction = 1.0;
+    // Largest quality loss against the clean input, PSNR(reference, clean) -
+    // PSNR(fast, clean), in dB. Only checked for operators that have one.
+    double maxPsnrDrop = 0.0;
+    double maxScalarError = 0.0;  // side outputs such as means or gains
+};
+
+// Measurements of one randomized trial.
+struct DiffTrial {
+    std::string config;  // size, borders and parameters, enough to reproduce it
+    int maxAbsError = 0;
+    uint64_t mismatches = 0;
+    uint64_t samples = 0;
+    double psnrVsReference = 100.0;
+    bool hasClean = false;
+    double psnrReference = 0.0;  // reference output against the clean input
+    double psnrFast = 0.0;       // fast output against the clean input
+    double scalarError = 0.0;
+
+    double psnrDelta() const { return hasClean ? psnrFast - psnrReference : 0.0; }
+};
+
+// Fills the image measurements of `trial`. `clean` is the noise-free input
+// for denoisers (or null), so the trial also records what the fast path
+// gives up in quality, not just how far it is from the reference.
+template <typename T, int C>
+void compareOutputs(const Image<T, C>& fast, const Image<T, C>& ref, const Image<T, C>* clean, DiffTrial& trial) {
+    trial.samples += ref.sampleCount();
+    const int rowSamples = ref.width() * C;
+    for (int y = 0; y < ref.height(); ++y) {
+        const T* a = fast.row(y);
+        const T* b = ref.row(y);
+        for (int i = 0; i < rowSamples; ++i) {
+            const int diff = std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i]));
+            if (diff) ++trial.mismatches;
+            if (diff > trial.maxAbsError) trial.maxAbsError = diff;
+        }
+    }
+    trial.psnrVsReference = std::min(trial.psnrVsReference, calculatePSNR(ref, fast));
+    if (clean) {
+        trial.hasClean = true;
+        trial.psnrReference = calculatePSNR(*clean, ref);
+        trial.psnrFast = calculatePSNR(*clean, fast);
+    }
+}
+
+// An optimized path registered against its reference kernel. `run` draws a
+// configuration (size, borders, parameters) from `rng`, runs both kernels
+// and fills the trial, usually through compareOutputs().
+struct DiffCheck {
+    std::string name;       // the optimized path, e.g. "boxFilter"
+    std::string reference;  // the kernel it is held to, e.g. "reference::uniformFilter"
+    DiffTolerance tolerance;
+    std::function<void(SplitMix64& rng, ThreadPool* pool, DiffTrial& trial)> run;
+};
+
+// Worst case of a check over all its trials.
+struct DiffSummary {
+    std::string name;
+    std::string reference;
+    int trials = 0;
+    int failedTrials = 0;
+    int maxAbsError = 0;
+    double mismatchFraction = 0.0;  // over all samples of all trials
+    double minPsnrVsReference = 100.0;
+    double worstPsnrDelta = 0.0;  // most negative delta; 0 when there is no clean input
+    double maxScalarError = 0.0;
+    bool mismatchExceeded = false;  // mismatchFraction is above the tolerance
+    std::string firstFailure;       // config of the first failing trial
+    bool passed() const { return failedTrials == 0 && !mismatchExceeded; }
+};
+
+class DifferentialHarness {
+public:
+    void add(DiffCheck check) { checks_.push_back(std::move(check)); }
+    const std::vector<DiffCheck>& checks() const { return checks_; }
+
+    // Runs `trials` trials of every check whose name contains `filter`
+    // (all when empty). Each check draws from its own generator seeded by
+    // `seed` and its name, so a failure reproduces with --filter alone.
+    std::vector<DiffSummary> run(int trials, uint64_t seed, const std::string& filter = "",
+                                 ThreadPool* pool = nullptr) const;
+
+private:
+    std::vector<DiffCheck> checks_;
+};
+
+// One row per check: trials, max abs error, mismatch share, PSNR against
+// the reference, worst PSNR delta against the clean input, largest side
+// output error, PASS / FAIL.
+void printDiffSummaries(const std::vector<DiffSummary>& summaries, std::ostream& out);
+
+// Every optimized path in image-core against its reference kernel, with
+// its tolerance; defined next to the kernels in reference.cpp.
+void addReferenceChecks(DifferentialHarness& harness);
+
+}  // namespace imgcore
@@ -0,0 +1,346 @@
+#include "edge-preserving.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+
+using Plane = Image<float, 1>;
+
+// Rows per parallel task, and columns per task of the vertical passes.
+const int BAND_ROWS = 32;
+const int STRIP_COLUMNS = 64;
+
+// fn(y0, y1, slot) over bands of rows, on the pool when there is one;
+// slot indexes per-slot scratch and is 0 without a pool.
+template <typename Fn>
+void forRowBands(int height, ThreadPool* pool, Fn fn) {
+    const int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    auto run = [&](int begin, int end, int slot) {
+        for (int b = begin; b < end; ++b) fn(b * BAND_ROWS, std::min(height, (b + 1) * BAND_ROWS), slot);
+    };
+    if (pool) pool->parallelFor(0, bands, 1, run);
+    else run(0, bands, 0);
+}
+
+// fn(x0, x1) over strips of columns.
+template <typename Fn>
+void forColumnStrips(int width, ThreadPool* pool, Fn fn) {
+    const int strips = (width + STRIP_COLUMNS - 1) / STRIP_COLUMNS;
+    auto run = [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) fn(s * STRIP_COLUMNS, std::min(width, (s + 1) * STRIP_COLUMNS));
+    };
+    if (pool) pool->parallelFor(0, strips, 1, [&](int begin, int end, int) { run(begin, end); });
+    else run(0, strips);
+}
+
+// Grows the per-slot buffers to one per slot of `pool`.
+template <typename Buffer>
+void reserveSlots(std::vector<Buffer>& buffers, ThreadPool* pool) {
+    const size_t slots = pool ? pool->slots() : 1;
+    if (buffers.size() < slots) buffers.resize(slots);
+}
+
+// Number of taps of a (2r+1) window centred on i that fall inside [0, n).
+int clippedSpan(int i, int radius, int n) {
+    return std::min(i + radius, n - 1) - std::max(i - radius, 0) + 1;
+}
+
+// Mean of `in` over the (2r+1)^2 window clipped to the frame: row windows
+// from prefix sums into the workspace's `rows`, then running column sums
+// per band, rebuilt at the top of each band. Sums are kept in double so the
+// variance, a difference of two such means, does not drift.
+template <typename Workspace>
+void boxMean(const Plane& in, Plane& out, int radius, ThreadPool* pool, Workspace& ws) {
+    const int width = in.width();
+    const int height = in.height();
+    Plane& rows = ws.rows;
+    rows.resize(width, height, rows.border());
+    out.resize(width, height, out.border());
+    reserveSlots(ws.sums, pool);
+
+    // Row windows as differences of a prefix sum, prefix[x] holding the
+    // sum of the first x samples.
+    forRowBands(height, pool, [&](int y0, int y1, int slot) {
+        std::vector<double>& prefix = ws.sums[slot];
+        prefix.resize(width + 1);
+        for (int y = y0; y < y1; ++y) {
+            const float* s = in.row(y);
+            float* h = rows.row(y);
+            prefix[0] = 0.0;
+            for (int x = 0; x < width; ++x) prefix[x + 1] = prefix[x] + s[x];
+            for (int x = 0; x < width; ++x) {
+                h[x] = static_cast<float>(prefix[std::min(x + radius + 1, width)] - prefix[std::max(x - radius, 0)]);
+            }
+        }
+    });
+
+    std::vector<float>& columnScale = ws.columnScale;
+    columnScale.resize(width);
+    ws.zeros.assign(width, 0.0f);
+    for (int x = 0; x < width; ++x) columnScale[x] = 1.0f / clippedSpan(x, radius, width);
+    forRowBands(height, pool, [&](int y0, int y1, int slot) {
+        std::vector<double>& column = ws.sums[slot];
+        column.assign(width, 0.0);
+        for (int y = std::max(y0 - radius, 0); y <= std::min(y0 + radius, height - 1); ++y) {
+            const float* h = rows.row(y);
+            for (int x = 0; x < width; ++x) column[x] += h[x];
+        }
+        for (int y = y0; y < y1; ++y) {
+            // Rows entering and leaving the window on the way to y + 1.
+            const float* enter = y + radius + 1 < height ? rows.row(y + radius + 1) : ws.zeros.data();
+            const float* leave = y - radius >= 0 ? rows.row(y - radius) : ws.zeros.data();
+            const float rowScale = 1.0f / clippedSpan(y, radius, height);
+            float* o = out.row(y);
+            for (int x = 0; x < width; ++x) {
+                o[x] = static_cast<float>(column[x]) * rowScale * columnScale[x];
+                column[x] += static_cast<double>(enter[x]) - leave[x];
+            }
+        }
+    });
+}
+
+// Domain distance 1 + ratio * sum_c |I_c - J_c| between neighbours. 8-bit
+// frames keep the integer colour difference (at most 255 * C), which
+// DomainFeedback turns into a weight by table lookup; the other types
+// store the distance itself.
+template <typename T>
+using DomainDistance = typename EdgePreservingWorkspace<T, 1>::Distance;
+
+template <typename T>
+DomainDistance<T> domainDistance(PixelWork<T> difference, float ratio) {
+    if constexpr (std::is_same_v<T, unsigned char>) return static_cast<uint16_t>(difference);
+    else return 1.0f + ratio * static_cast<float>(difference);
+}
+
+// Feedback coefficient exp(logFeedback * distance) of one pass. 8-bit
+// frames fill `table` with it for every colour difference.
+template <typename T, int C>
+class DomainFeedback {
+public:
+    DomainFeedback(float logFeedback, float ratio, std::vector<float>& table)
+        : logFeedback_(logFeedback), table_(table) {
+        if constexpr (std::is_same_v<T, unsigned char>) {
+            table_.resize(255 * C + 1);
+            for (int k = 0; k <= 255 * C; ++k) table_[k] = std::exp(logFeedback * (1.0f + ratio * k));
+        }
+    }
+
+    float operator()(DomainDistance<T> distance) const {
+        if constexpr (std::is_same_v<T, unsigned char>) return table_[distance];
+        else return std::exp(logFeedback_ * distance);
+    }
+
+private:
+    float logFeedback_;
+    std::vector<float>& table_;
+};
+
+}  // namespace
+
+template <typename T, int C>
+void guidedFilter(const Image<T, C>& src, Image<T, C>& dst, int radius, double sigmaRange, ThreadPool* pool,
+                  EdgePreservingWorkspace<T, C>* workspace) {
+    ProfileScope scope("guided");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    if (src.empty()) return;
+
+    // The guide is scaled to [0, 1], so epsilon is sigmaRange in 8-bit
+    // levels taken to the same scale.
+    const float toUnit = 1.0f / PixelTraits<T>::maxValue;
+    const float epsilon = static_cast<float>((sigmaRange / 255.0) * (sigmaRange / 255.0));
+    EdgePreservingWorkspace<T, C> local;
+    EdgePreservingWorkspace<T, C>& ws = workspace ? *workspace : local;
+    Plane& guide = ws.guide;
+    Plane& squares = ws.squares;
+    guide.resize(width, height);
+    squares.resize(width, height);
+
+    for (int c = 0; c < C; ++c) {
+        forRowBands(height, pool, [&](int y0, int y1, int) {
+            for (int y = y0; y < y1; ++y) {
+                const T* s = src.row(y);
+                float* g = guide.row(y);
+                float* q = squares.row(y);
+                for (int x = 0; x < width; ++x) {
+                    g[x] = s[x * C + c] * toUnit;
+                    q[x] = g[x] * g[x];
+                }
+            }
+        });
+        boxMean(guide, ws.meanI, radius, pool, ws);
+        boxMean(squares, ws.meanII, radius, pool, ws);
+
+        // a and b of every window, written over meanII and meanI.
+        forRowBands(height, pool, [&](int y0, int y1, int) {
+            for (int y = y0; y < y1; ++y) {
+                float* m = ws.meanI.row(y);
+                float* mm = ws.meanII.row(y);
+                for (int x = 0; x < width; ++x) {
+                    const float variance = std::max(mm[x] - m[x] * m[x], 0.0f);
+                    const float a = variance / (variance + epsilon);
+                    mm[x] = a;
+                    m[x] -= a * m[x];
+                }
+            }
+        });
+        boxMean(ws.meanII, ws.meanA, radius, pool, ws);
+        boxMean(ws.meanI, ws.meanB, radius, pool, ws);
+
+        forRowBands(height, pool, [&](int y0, int y1, int) {
+            for (int y = y0; y < y1; ++y) {
+                const float* g = guide.row(y);
+                const float* a = ws.meanA.row(y);
+                const float* b = ws.meanB.row(y);
+                T* out = dst.row(y);
+                for (int x = 0; x < width; ++x) {
+                    out[x * C + c] = roundPixel<T>((a[x] * g[x] + b[x]) * PixelTraits<T>::maxValue);
+                }
+            }
+        });
+    }
+}
+
+template <typename T, int C>
+void domainTransformFilter(const Image<T, C>& src, Image<T, C>& dst, double sigmaSpatial, double sigmaRange,
+                           int iterations, ThreadPool* pool, EdgePreservingWorkspace<T, C>* workspace) {
+    ProfileScope scope("domain");
+    scope.image(src);
+    using Distance = DomainDistance<T>;
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    if (src.empty()) return;
+    iterations = std::max(iterations, 1);
+
+    // Distances between each sample and its left (horizontal) or upper
+    // (vertical) neighbour.
+    const float ratio = static_cast<float>(sigmaSpatial / std::max(sigmaRange, 1e-6)) *
+                        (255.0f / PixelTraits<T>::maxValue);
+    EdgePreservingWorkspace<T, C> local;
+    EdgePreservingWorkspace<T, C>& ws = workspace ? *workspace : local;
+    Image<float, C>& filtered = ws.filtered;
+    Image<Distance, 1>& distanceX = ws.distanceX;
+    Image<Distance, 1>& distanceY = ws.distanceY;
+    Plane& weightY = ws.weightY;
+    filtered.resize(width, height);
+    distanceX.resize(width, height);
+    distanceY.resize(width, height);
+    weightY.resize(width, height);
+    reserveSlots(ws.weightX, pool);
+    forRowBands(height, pool, [&](int y0, int y1, int) {
+        for (int y = y0; y < y1; ++y) {
+            const T* s = src.row(y);
+            const T* up = y > 0 ? src.row(y - 1) : s;
+            float* f = filtered.row(y);
+            Distance* dx = distanceX.row(y);
+            Distance* dy = distanceY.row(y);
+            for (int x = 0; x < width; ++x) {
+                PixelWork<T> horizontal = 0, vertical = 0;
+                for (int c = 0; c < C; ++c) {
+                    const PixelWork<T> v = s[x * C + c];
+                    f[x * C + c] = static_cast<float>(v);
+                    if (x > 0) horizontal += std::abs(v - s[(x - 1) * C + c]);
+                    vertical += std::abs(v - up[x * C + c]);
+                }
+                dx[x] = domainDistance<T>(horizontal, ratio);
+                dy[x] = domainDistance<T>(vertical, ratio);
+            }
+        }
+    });
+
+    for (int i = 0; i < iterations; ++i) {
+        // sigma_H of pass i, chosen so the passes add up to sigmaSpatial.
+        const double sigmaPass = sigmaSpatial * std::sqrt(3.0) * std::ldexp(1.0, iterations - i - 1) /
+                                 std::sqrt(std::ldexp(1.0, 2 * iterations) - 1.0);
+        const float logFeedback = static_cast<float>(-std::sqrt(2.0) / std::max(sigmaPass, 1e-6));
+        const DomainFeedback<T, C> feedback(logFeedback, ratio, ws.feedback);
+
+        forRowBands(height, pool, [&](int y0, int y1, int slot) {
+            std::vector<float>& wx = ws.weightX[slot];
+            wx.resize(width);
+            for (int y = y0; y < y1; ++y) {
+                const Distance* dx = distanceX.row(y);
+                const Distance* dy = distanceY.row(y);
+                float* wy = weightY.row(y);
+                for (int x = 0; x < width; ++x) {
+                    wx[x] = feedback(dx[x]);
+                    wy[x] = feedback(dy[x]);
+                }
+                float* f = filtered.row(y);
+                for (int x = 1; x < width; ++x) {
+                    for (int c = 0; c < C; ++c) f[x * C + c] += wx[x] * (f[(x - 1) * C + c] - f[x * C + c]);
+                }
+                for (int x = width - 2; x >= 0; --x) {
+                    for (int c = 0; c < C; ++c) f[x * C + c] += wx[x + 1] * (f[(x + 1) * C + c] - f[x * C + c]);
+                }
+            }
+        });
+
+        // Columns run top to bottom and back, a strip of them at a time so
+        // each step is a contiguous row segment.
+        forColumnStrips(width, pool, [&](int x0, int x1) {
+            for (int y = 1; y < height; ++y) {
+                const float* w = weightY.row(y);
+                const float* above = filtered.row(y - 1);
+                float* f = filtered.row(y);
+                for (int x = x0; x < x1; ++x) {
+                    for (int c = 0; c < C; ++c) f[x * C + c] += w[x] * (above[x * C + c] - f[x * C + c]);
+                }
+            }
+            for (int y = height - 2; y >= 0; --y) {
+                const float* w = weightY.row(y + 1);
+                const float* below = filtered.row(y + 1);
+                float* f = filtered.row(y);
+                for (int x = x0; x < x1; ++x) {
+                    for (int c = 0; c < C; ++c) f[x * C + c] += w[x] * (below[x * C + c] - f[x * C + c]);
+                }
+            }
+        });
+    }
+
+    forRowBands(height, pool, [&](int y0, int y1, int) {
+        for (int y = y0; y < y1; ++y) {
+            const float* f = filtered.row(y);
+            T* out = dst.row(y);
+            for (int s = 0; s < width * C; ++s) out[s] = roundPixel<T>(f[s]);
+        }
+    });
+}
+
+template void guidedFilter(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<unsigned char, 1>*);
+template void guidedFilter(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<unsigned char, 3>*);
+template void guidedFilter(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<uint16_t, 1>*);
+template void guidedFilter(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<uint16_t, 3>*);
+template void guidedFilter(const Image<float, 1>&, Image<float, 1>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<float, 1>*);
+template void guidedFilter(const Image<float, 3>&, Image<float, 3>&, int, double, ThreadPool*,
+                           EdgePreservingWorkspace<float, 3>*);
+template void domainTransformFilter(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, double, double, int,
+                                    ThreadPool*, EdgePreservingWorkspace<unsigned char, 1>*);
+template void domainTransformFilter(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, double, double, int,
+                                    ThreadPool*, EdgePreservingWorkspace<unsigned char, 3>*);
+template void domainTransformFilter(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, double, double, int, ThreadPool*,
+                                    EdgePreservingWorkspace<uint16_t, 1>*);
+template void domainTransformFilter(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, double, double, int, ThreadPool*,
+                                    EdgePreservingWorkspace<uint16_t, 3>*);
+template void domainTransformFilter(const Image<float, 1>&, Image<float, 1>&, double, double, int, ThreadPool*,
+                                    EdgePreservingWorkspace<float, 1>*);
+template void domainTransformFilter(const Image<float, 3>&, Image<float, 3>&, double, double, int, ThreadPool*,
+                                    EdgePreservingWorkspace<float, 3>*);
+
+}  // namespace imgcore
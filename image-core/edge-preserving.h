@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+#include "pixel.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// Edge-preserving smoothing whose cost per pixel does not grow with the
+// spatial extent, for where a brute-force bilateral window (radius^2 taps
+// per pixel) gets too wide, roughly radius > 5. Both filters take their
+// range sigma in 8-bit levels for every pixel type, as BilateralWeights
+// does, so a bilateral setting carries over. T is unsigned char, uint16_t
+// or float; `dst` must not alias `src` and keeps its own border.
+
+// Scratch of both filters: their full-frame float planes and row buffers
+// per pool slot. Passing the same workspace to every call keeps repeated
+// filtering (a video stream, a parameter sweep) off the allocator; without
+// one each call allocates its own. A workspace serves one call at a time.
+template <typename T, int C>
+struct EdgePreservingWorkspace {
+    // Neighbour distance of the domain transform: the integer colour
+    // difference on 8-bit frames (a table index), the distance itself on
+    // the other types.
+    using Distance = std::conditional_t<std::is_same_v<T, unsigned char>, uint16_t, float>;
+
+    // Guided filter: the scaled channel, its square, the four box means and
+    // the row windows behind them.
+    Image<float, 1> guide, squares, meanI, meanII, meanA, meanB, rows;
+    // Box mean column scales and a row of zeros, both one row wide.
+    std::vector<float> columnScale, zeros;
+    // Domain transform: the running result, the distances to the left and
+    // upper neighbours, the vertical weights of the current pass and its
+    // feedback table (8-bit frames).
+    Image<float, C> filtered;
+    Image<Distance, 1> distanceX, distanceY;
+    Image<float, 1> weightY;
+    std::vector<float> feedback;
+    // Per pool slot: box-mean prefix and column sums, horizontal weights.
+    std::vector<std::vector<double>> sums;
+    std::vector<std::vector<float>> weightX;
+};
+
+// Self-guided filter (He, Sun & Tang): in every (2r+1)^2 window the output
+// is the linear fit a * I + b with a = var / (var + sigmaRange^2), and
+// each pixel averages the fits of the windows covering it. Flat regions
+// (var << sigmaRange^2) are smoothed like a box filter, edges (var >>
+// sigmaRange^2) are kept. Six box means built from running sums make it
+// O(1) per pixel; windows are clipped at the frame edges and each channel
+// guides itself.
+template <typename T, int C>
+void guidedFilter(const Image<T, C>& src, Image<T, C>& dst, int radius, double sigmaRange,
+                  ThreadPool* pool = nullptr, EdgePreservingWorkspace<T, C>* workspace = nullptr);
+
+// Domain-transform recursive filter (Gastal & Oliveira, "RF"): each row
+// and then each column is smoothed by a first-order recursive filter run
+// forwards and backwards, whose feedback decays with the distance
+// 1 + sigmaSpatial / sigmaRange * sum_c |I_c(x) - I_c(x - 1)| between
+// neighbours, so edges stop the smoothing. `iterations` alternating
+// passes with shrinking sigmas (3 is the paper's choice) remove the
+// streaks of a single pass. sigmaSpatial is in pixels; the channels share
+// one transform, so colour edges are kept in every channel. Cost is a few
+// multiply-adds per pixel and pass, whatever sigmaSpatial.
+template <typename T, int C>
+void domainTransformFilter(const Image<T, C>& src, Image<T, C>& dst, double sigmaSpatial, double sigmaRange,
+                           int iterations = 3, ThreadPool* pool = nullptr,
+                           EdgePreservingWorkspace<T, C>* workspace = nullptr);
+
+}  // namespace imgcore
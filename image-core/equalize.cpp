@@ -0,0 +1,171 @@
+#include "equalize.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+
+// Tracks floor(rank * levels / n) as the rank is incremented, so the
+// per-pixel cost is an increment and a compare instead of a division.
+struct LevelCounter {
+    uint64_t rank, levels, n, level, next;
+
+    LevelCounter(uint64_t start, uint64_t levels, uint64_t n) : rank(start), levels(levels), n(n) {
+        level = rank * levels / n;
+        next = threshold();
+    }
+
+    // Smallest rank whose level is level + 1.
+    uint64_t threshold() const { return ((level + 1) * n + levels - 1) / levels; }
+
+    uint64_t take() {
+        uint64_t out = level < levels ? level : levels - 1;
+        if (++rank >= next) {
+            while (rank >= next) {
+                ++level;
+                next = threshold();
+            }
+        }
+        return out;
+    }
+};
+
+// 3x3 mean (Replicate borders) reduced to 8 bits, used as a secondary key.
+template <typename T>
+std::vector<uint8_t> localMeanKeys(const Image<T, 1>& src) {
+    const int width = src.width();
+    const int height = src.height();
+    const int shift = 8 * static_cast<int>(sizeof(T)) - 8;
+    Image<T, 1> in = padded(src, 1);
+    std::vector<uint8_t> keys(src.pixelCount());
+    for (int y = 0; y < height; ++y) {
+        const T* up = in.row(y - 1);
+        const T* mid = in.row(y);
+        const T* down = in.row(y + 1);
+        for (int x = 0; x < width; ++x) {
+            uint32_t sum = 0;
+            for (int k = -1; k <= 1; ++k) sum += up[x + k] + mid[x + k] + down[x + k];
+            keys[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((sum / 9) >> shift);
+        }
+    }
+    return keys;
+}
+
+}  // namespace
+
+template <typename T>
+void equalizeBucketFill(const Image<T, 1>& src, Image<T, 1>& dst, int outputLevels, TieBreak tieBreak) {
+    ProfileScope scope("histeq bucket-fill");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    const size_t buckets = static_cast<size_t>(std::numeric_limits<T>::max()) + 1;
+    const uint64_t n = src.pixelCount();
+    // More levels than T can hold would wrap in the final cast.
+    const uint64_t levels = outputLevels > 0 ? std::min<uint64_t>(outputLevels, buckets) : buckets;
+    dst.resize(width, height, dst.border());
+    if (n == 0) return;
+
+    // Pass 1: histogram, turned into the first rank of every value.
+    std::vector<uint64_t> start(buckets + 1, 0);
+    for (int y = 0; y < height; ++y) {
+        const T* in = src.row(y);
+        for (int x = 0; x < width; ++x) ++start[in[x] + 1];
+    }
+    for (size_t v = 1; v <= buckets; ++v) start[v] += start[v - 1];
+
+    if (tieBreak == TieBreak::Raster) {
+        // Pass 2: each value's pixels take consecutive ranks in scan order.
+        std::vector<LevelCounter> counters;
+        counters.reserve(buckets);
+        for (size_t v = 0; v < buckets; ++v) counters.emplace_back(start[v], levels, n);
+        for (int y = 0; y < height; ++y) {
+            const T* in = src.row(y);
+            T* out = dst.row(y);
+            for (int x = 0; x < width; ++x) out[x] = static_cast<T>(counters[in[x]].take());
+        }
+        return;
+    }
+
+    // LocalMean: stable counting sort by the mean key, then by value; the
+    // resulting order is (value, local mean, scan position).
+    std::vector<uint8_t> keys = localMeanKeys(src);
+    std::vector<uint32_t> byKey(n), byValue(n);
+    {
+        uint64_t keyStart[257] = {};
+        for (uint8_t k : keys) ++keyStart[k + 1];
+        for (int k = 1; k <= 256; ++k) keyStart[k] += keyStart[k - 1];
+        for (uint32_t i = 0; i < n; ++i) byKey[keyStart[keys[i]]++] = i;
+    }
+    std::vector<uint64_t> next(start.begin(), start.end() - 1);
+    for (uint32_t i : byKey) {
+        const T v = src.row(static_cast<int>(i / width))[i % width];
+        byValue[next[v]++] = i;
+    }
+    LevelCounter counter(0, levels, n);
+    for (uint32_t i : byValue) dst.row(static_cast<int>(i / width))[i % width] = static_cast<T>(counter.take());
+}
+
+template <typename T>
+void equalizeCdf(const Image<T, 1>& src, Image<T, 1>& dst) {
+    ProfileScope scope("histeq cdf");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    constexpr int bins = static_cast<int>(std::numeric_limits<T>::max()) + 1;
+    dst.resize(width, height, dst.border());
+    if (src.empty()) return;
+
+    // 8-bit tables live on the stack; 65536 bins are a 256 KB table per
+    // copy, so the 16-bit histogram is counted into one on the heap.
+    constexpr int copies = sizeof(T) == 1 ? 4 : 1;
+    constexpr bool small = sizeof(T) == 1;
+    std::conditional_t<small, std::array<uint32_t, copies * bins>, std::vector<uint32_t>> hist{};
+    std::conditional_t<small, std::array<T, bins>, std::vector<T>> lut{};
+    if constexpr (!small) {
+        hist.assign(static_cast<size_t>(copies) * bins, 0);
+        lut.resize(bins);
+    }
+    for (int y = 0; y < height; ++y) {
+        const T* in = src.row(y);
+        int x = 0;
+        if constexpr (copies == 4) {
+            for (; x + 4 <= width; x += 4) {
+                ++hist[in[x]];
+                ++hist[bins + in[x + 1]];
+                ++hist[2 * bins + in[x + 2]];
+                ++hist[3 * bins + in[x + 3]];
+            }
+        }
+        for (; x < width; ++x) ++hist[in[x]];
+    }
+
+    // round(top * cdf / n), halves up, in integers: 2 * top * cdf stays far
+    // below 2^64 for any image that fits in memory.
+    const uint64_t n = src.pixelCount();
+    const uint64_t top = bins - 1;
+    uint64_t cdf = 0;
+    for (int v = 0; v < bins; ++v) {
+        for (int k = 0; k < copies; ++k) cdf += hist[static_cast<size_t>(k) * bins + v];
+        lut[v] = static_cast<T>((2 * top * cdf + n) / (2 * n));
+    }
+    for (int y = 0; y < height; ++y) {
+        const T* in = src.row(y);
+        T* out = dst.row(y);
+        for (int x = 0; x < width; ++x) out[x] = lut[in[x]];
+    }
+}
+
+template void equalizeBucketFill<unsigned char>(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, int, TieBreak);
+template void equalizeBucketFill<uint16_t>(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, int, TieBreak);
+template void equalizeCdf<unsigned char>(const Image<unsigned char, 1>&, Image<unsigned char, 1>&);
+template void equalizeCdf<uint16_t>(const Image<uint16_t, 1>&, Image<uint16_t, 1>&);
+
+}  // namespace imgcore
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "image.h"
+
+namespace imgcore {
+
+// How pixels of equal value are ordered before they are spread over the
+// output levels.
+enum class TieBreak {
+    Raster,    // scan order, top-left first
+    LocalMean  // darker 3x3 neighbourhood first, then scan order
+};
+
+// Bucket-fill ("exact") histogram equalization: the pixel of rank r in the
+// value ordering gets level min(r * outputLevels / N, outputLevels - 1), so
+// every output level receives the same number of pixels. Ranks come from
+// the histogram's prefix offsets, so Raster costs two linear passes and no
+// extra per-pixel memory; LocalMean adds two counting-sort passes over a
+// 4-byte index per pixel. T is unsigned char (256 buckets) or uint16_t
+// (65536 buckets); outputLevels <= 0, or more levels than T holds, means
+// the full range of T.
+template <typename T>
+void equalizeBucketFill(const Image<T, 1>& src, Image<T, 1>& dst, int outputLevels = 0,
+                        TieBreak tieBreak = TieBreak::Raster);
+
+// Classic CDF equalization ("method A"): level v maps to
+// round(max * cdf(v) / N), computed exactly in integers. This is the
+// original float transfer function wherever float is exact (up to 65536
+// pixels at 8 bits); beyond that float misrounds. 8-bit histograms are
+// counted into four interleaved tables so runs of equal pixels do not
+// serialise on one counter, and the image is then mapped through a table
+// of one entry per level. T is unsigned char or uint16_t, as for
+// equalizeBucketFill().
+template <typename T>
+void equalizeCdf(const Image<T, 1>& src, Image<T, 1>& dst);
+
+}  // namespace imgcore
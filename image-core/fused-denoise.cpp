@@ -0,0 +1,89 @@
+#include "fused-denoise.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "median.h"
+#include "profile.h"
+
+namespace imgcore {
+
+// Per-core L2 budget for the rolling median buffer.
+const size_t L2_BUDGET_BYTES = 256 * 1024;
+
+template <typename T, int C>
+void medianBilateralFused(const Image<T, C>& src, Image<T, C>& dst, int medianRadius, const BilateralWeights& weights,
+                          bool roundToNearest, FusedDenoiseStats* stats) {
+    ProfileScope scope("fused");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    const int radius = weights.radius;
+    Image<T, C> paddedCopy;
+    const Image<T, C>* in = &src;
+    if (src.border() < medianRadius) {
+        paddedCopy = padded(src, medianRadius);
+        in = &paddedCopy;
+    }
+    dst.resize(width, height, dst.border());
+    if (src.empty()) return;
+
+    // Median row y lives in ring row y % ringRows. A band of output rows
+    // needs median rows [y0 - radius, y1 + radius), so a ring of
+    // band + 2 * radius rows is never overwritten while still in use.
+    const size_t rowBytes = sizeof(T) * (width + 2 * radius) * C;
+    int band = static_cast<int>(L2_BUDGET_BYTES / rowBytes) - 2 * radius;
+    band = std::min(std::max(band, 1), height);
+    const int ringRows = band + 2 * radius;
+    Image<T, C> ring(width, ringRows, radius);
+    auto medianRow = [&](int y) { return ring.row(std::min(std::max(y, 0), height - 1) % ringRows); };
+
+    std::vector<T*> medianOut(ringRows);
+    std::vector<const T*> window(2 * radius + 1);
+    int computed = 0;
+    for (int y0 = 0; y0 < height; y0 += band) {
+        const int y1 = std::min(height, y0 + band);
+        const int need = std::min(height, y1 + radius);
+        if (computed < need) {
+            for (int y = computed; y < need; ++y) medianOut[y - computed] = ring.row(y % ringRows);
+            medianRows(*in, medianRadius, computed, need, medianOut.data());
+            // Replicate the left and right edges for the bilateral taps.
+            for (int y = computed; y < need; ++y) {
+                T* r = ring.row(y % ringRows);
+                for (int x = 1; x <= radius; ++x) {
+                    for (int c = 0; c < C; ++c) {
+                        r[-x * C + c] = r[c];
+                        r[(width - 1 + x) * C + c] = r[(width - 1) * C + c];
+                    }
+                }
+            }
+            computed = need;
+        }
+        for (int y = y0; y < y1; ++y) {
+            for (int k = 0; k <= 2 * radius; ++k) window[k] = medianRow(y - radius + k);
+            bilateralRow<T, C>(window.data(), dst.row(y), width, weights, roundToNearest);
+        }
+    }
+
+    if (stats) {
+        stats->bandRows = band;
+        stats->scratchBytes = sizeof(T) * (ringRows + 2 * radius) * ring.stride();
+        stats->intermediateFrameBytes = sizeof(T) * (height + 2 * radius) * ring.stride();
+        stats->dramBytesAvoided = 2 * sizeof(T) * width * height * C;
+    }
+}
+
+template void medianBilateralFused(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+template void medianBilateralFused(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+template void medianBilateralFused(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+template void medianBilateralFused(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+template void medianBilateralFused(const Image<float, 1>&, Image<float, 1>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+template void medianBilateralFused(const Image<float, 3>&, Image<float, 3>&, int,
+                                   const BilateralWeights&, bool, FusedDenoiseStats*);
+
+}  // namespace imgcore
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+#include "bilateral.h"
+#include "image.h"
+
+namespace imgcore {
+
+// Memory accounting for one fused run.
+struct FusedDenoiseStats {
+    int bandRows = 0;                 // output rows filtered per band
+    size_t scratchBytes = 0;          // rolling median row buffer
+    size_t intermediateFrameBytes = 0;  // what a full median frame would take
+    // DRAM traffic the unfused pipeline spends on the intermediate frame: it
+    // is written once by the median pass and read back by the bilateral pass.
+    size_t dramBytesAvoided = 0;
+};
+
+// Median (radius `medianRadius`) followed by a bilateral filter, streamed
+// over a rolling buffer of median rows instead of a full intermediate
+// frame. Each band of output rows is median-filtered and then bilateral-
+// filtered while its rows are still cache resident; the band height is
+// chosen so the rolling buffer fits in L2. Edges behave exactly like
+// medianFilter() followed by padding the result with Replicate borders and
+// running bilateralFilter(). `src` should carry a border of at least
+// `medianRadius`; otherwise a replicated copy is made.
+template <typename T, int C>
+void medianBilateralFused(const Image<T, C>& src, Image<T, C>& dst, int medianRadius, const BilateralWeights& weights,
+                          bool roundToNearest = true, FusedDenoiseStats* stats = nullptr);
+
+}  // namespace imgcore
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace imgcore {
+
+// Every row starts on a cache line so SIMD loads never straddle two lines.
+constexpr size_t ROW_ALIGNMENT = 64;
+
+enum class BorderMode {
+    Replicate,  // clamp to the nearest edge pixel (aaa|abcd|ddd)
+    Reflect,    // mirror without repeating the edge (cba|abcd|cba)
+    Zero        // zero padding (000|abcd|000)
+};
+
+// Rectangle of an image; an empty one (width or height <= 0) means the
+// whole image.
+struct ImageRegion {
+    int x = 0, y = 0, width = 0, height = 0;
+
+    // The rectangle clipped to a width x height image, with the empty one
+    // expanded to all of it.
+    ImageRegion clippedTo(int imageWidth, int imageHeight) const {
+        if (width <= 0 || height <= 0) return {0, 0, imageWidth, imageHeight};
+        const int x0 = std::clamp(x, 0, imageWidth), y0 = std::clamp(y, 0, imageHeight);
+        const int x1 = std::clamp(x + width, x0, imageWidth), y1 = std::clamp(y + height, y0, imageHeight);
+        return {x0, y0, x1 - x0, y1 - y0};
+    }
+};
+
+// Image buffers allocated since start-up, so benchmarks can check that a
+// steady-state loop never reaches the allocator.
+struct ImageAllocationStats {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+inline ImageAllocationStats& imageAllocations() {
+    static ImageAllocationStats stats;
+    return stats;
+}
+
+// The same counts for the calling thread alone, so a profiled scope can
+// tell its own allocations from those of concurrent threads.
+struct ThreadAllocationStats {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+
+inline ThreadAllocationStats& threadImageAllocations() {
+    thread_local ThreadAllocationStats stats;
+    return stats;
+}
+
+inline int clampIndex(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+inline int borderIndex(int i, int n, BorderMode mode) {
+    if (mode == BorderMode::Replicate || n == 1) return clampIndex(i, n);
+    if (mode == BorderMode::Reflect) {
+        int period = 2 * (n - 1);
+        i %= period;
+        if (i < 0) i += period;
+        return i < n ? i : period - i;
+    }
+    return (i < 0 || i >= n) ? -1 : i;
+}
+
+// Runtime-sized interleaved image with an optional border of `border` pixels
+// on every side. Rows are padded so each one starts 64-byte aligned, which
+// means row(y) is valid for y in [-border, height + border) and row(y)[x * C]
+// for x in [-border, width + border). Kernels that read at most `border`
+// pixels away from the centre never need to clamp once fillBorder() ran.
+template <typename T, int Channels = 1>
+class Image {
+public:
+    static constexpr int CHANNELS = Channels;
+    using value_type = T;
+
+    Image() = default;
+
+    Image(int width, int height, int border = 0) { allocate(width, height, border); }
+
+    Image(const Image& other) {
+        allocate(other.width_, other.height_, other.border_);
+        if (bytes_) std::memcpy(buffer_, other.buffer_, bytes_);
+    }
+
+    Image(Image&& other) noexcept { swap(other); }
+
+    Image& operator=(Image other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~Image() { std::free(buffer_); }
+
+    void swap(Image& other) noexcept {
+        std::swap(buffer_, other.buffer_);
+        std::swap(origin_, other.origin_);
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        std::swap(border_, other.border_);
+        std::swap(stride_, other.stride_);
+        std::swap(bytes_, other.bytes_);
+    }
+
+    // Reallocates only when the geometry changes, so per-iteration output
+    // buffers can be reused across calls without touching the allocator.
+    void resize(int width, int height, int border = 0) {
+        if (width == width_ && height == height_ && border == border_) return;
+        Image tmp(width, height, border);
+        swap(tmp);
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int border() const { return border_; }
+    int channels() const { return Channels; }
+    // Distance between two rows in elements of T (not pixels).
+    ptrdiff_t stride() const { return stride_; }
+    size_t pixelCount() const { return static_cast<size_t>(width_) * height_; }
+    size_t sampleCount() const { return pixelCount() * Channels; }
+    bool empty() const { return width_ == 0 || height_ == 0; }
+    // True when the visible pixels form one dense block (no border, no row padding).
+    bool isContiguous() const { return border_ == 0 && stride_ == static_cast<ptrdiff_t>(width_) * Channels; }
+
+    T* row(int y) { return origin_ + y * stride_; }
+    const T* row(int y) const { return origin_ + y * stride_; }
+
+    T& at(int y, int x, int c = 0) { return row(y)[x * Channels + c]; }
+    const T& at(int y, int x, int c = 0) const { return row(y)[x * Channels + c]; }
+
+    // Pointer to the first visible sample; only dense when isContiguous().
+    T* data() { return origin_; }
+    const T* data() const { return origin_; }
+
+    void fill(T value) {
+        for (int y = -border_; y < height_ + border_; ++y) {
+            T* r = row(y) - border_ * Channels;
+            std::fill(r, r + (width_ + 2 * border_) * Channels, value);
+        }
+    }
+
+    // Populates the padding ring from the visible pixels.
+    void fillBorder(BorderMode mode = BorderMode::Replicate) {
+        if (border_ == 0 || empty()) return;
+        for (int y = 0; y < height_; ++y) {
+            T* r = row(y);
+            for (int x = -border_; x < 0; ++x) copyPixel(r, x, borderIndex(x, width_, mode));
+            for (int x = width_; x < width_ + border_; ++x) copyPixel(r, x, borderIndex(x, width_, mode));
+        }
+        const size_t rowBytes = static_cast<size_t>(width_ + 2 * border_) * Channels * sizeof(T);
+        for (int y = -border_; y < 0; ++y) copyRow(y, borderIndex(y, height_, mode), rowBytes);
+        for (int y = height_; y < height_ + border_; ++y) copyRow(y, borderIndex(y, height_, mode), rowBytes);
+    }
+
+    // Copies the visible pixels from an image or view of the same size (any
+    // border or stride).
+    template <typename Src>
+    void copyFrom(const Src& src) {
+        const size_t rowBytes = static_cast<size_t>(width_) * Channels * sizeof(T);
+        for (int y = 0; y < height_; ++y) std::memcpy(row(y), src.row(y), rowBytes);
+    }
+
+    // Copies the visible pixels from / into a dense interleaved buffer.
+    void copyFromDense(const T* src) {
+        const size_t rowSamples = static_cast<size_t>(width_) * Channels;
+        for (int y = 0; y < height_; ++y) std::memcpy(row(y), src + y * rowSamples, rowSamples * sizeof(T));
+    }
+
+    void copyToDense(T* dst) const {
+        const size_t rowSamples = static_cast<size_t>(width_) * Channels;
+        for (int y = 0; y < height_; ++y) std::memcpy(dst + y * rowSamples, row(y), rowSamples * sizeof(T));
+    }
+
+private:
+    void allocate(int width, int height, int border) {
+        width_ = width;
+        height_ = height;
+        border_ = border;
+        if (width <= 0 || height <= 0) {
+            width_ = height_ = border_ = 0;
+            return;
+        }
+        const size_t perLine = ROW_ALIGNMENT / sizeof(T);
+        size_t rowSamples = static_cast<size_t>(width + 2 * border) * Channels;
+        // Pad the left border so the first visible pixel of each row is aligned.
+        size_t lead = static_cast<size_t>(border) * Channels;
+        size_t leadPadded = (lead + perLine - 1) / perLine * perLine;
+        size_t tail = rowSamples - lead;
+        stride_ = static_cast<ptrdiff_t>((leadPadded + tail + perLine - 1) / perLine * perLine);
+        size_t rows = static_cast<size_t>(height) + 2 * border;
+        bytes_ = rows * stride_ * sizeof(T);
+        buffer_ = static_cast<T*>(std::aligned_alloc(ROW_ALIGNMENT, bytes_));
+        if (!buffer_) throw std::bad_alloc();
+        imageAllocations().count.fetch_add(1, std::memory_order_relaxed);
+        imageAllocations().bytes.fetch_add(bytes_, std::memory_order_relaxed);
+        ++threadImageAllocations().count;
+        threadImageAllocations().bytes += bytes_;
+        std::memset(buffer_, 0, bytes_);
+        origin_ = buffer_ + border * stride_ + leadPadded;
+    }
+
+    void copyPixel(T* r, int dstX, int srcX) {
+        for (int c = 0; c < Channels; ++c) r[dstX * Channels + c] = srcX < 0 ? T(0) : r[srcX * Channels + c];
+    }
+
+    void copyRow(int dstY, int srcY, size_t rowBytes) {
+        T* dst = row(dstY) - border_ * Channels;
+        if (srcY < 0) std::memset(dst, 0, rowBytes);
+        else std::memcpy(dst, row(srcY) - border_ * Channels, rowBytes);
+    }
+
+    T* buffer_ = nullptr;
+    T* origin_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int border_ = 0;
+    ptrdiff_t stride_ = 0;
+    size_t bytes_ = 0;
+};
+
+// Read-only, non-owning view of interleaved rows, e.g. a memory-mapped raw
+// file or the visible pixels of an Image. Has the same row()/at() interface
+// as Image, so metrics and other read-only code accept either.
+template <typename T, int Channels = 1>
+class ImageView {
+public:
+    static constexpr int CHANNELS = Channels;
+    using value_type = T;
+
+    ImageView() = default;
+
+    // `stride` is in elements of T; 0 means densely packed rows.
+    ImageView(const T* data, int width, int height, ptrdiff_t stride = 0)
+        : data_(data), width_(width), height_(height),
+          stride_(stride ? stride : static_cast<ptrdiff_t>(width) * Channels) {}
+
+    ImageView(const Image<T, Channels>& img)
+        : data_(img.data()), width_(img.width()), height_(img.height()), stride_(img.stride()) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int channels() const { return Channels; }
+    ptrdiff_t stride() const { return stride_; }
+    size_t pixelCount() const { return static_cast<size_t>(width_) * height_; }
+    size_t sampleCount() const { return pixelCount() * Channels; }
+    bool empty() const { return width_ == 0 || height_ == 0; }
+
+    const T* row(int y) const { return data_ + y * stride_; }
+    const T& at(int y, int x, int c = 0) const { return row(y)[x * Channels + c]; }
+    const T* data() const { return data_; }
+
+private:
+    const T* data_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    ptrdiff_t stride_ = 0;
+};
+
+using GrayImage = Image<unsigned char, 1>;
+using RgbImage = Image<unsigned char, 3>;
+using GrayView = ImageView<unsigned char, 1>;
+using RgbView = ImageView<unsigned char, 3>;
+// Sensor data of 10 to 16 bits, and normalised [0, 1] float frames.
+using GrayImage16 = Image<uint16_t, 1>;
+using RgbImage16 = Image<uint16_t, 3>;
+using GrayImageF = Image<float, 1>;
+using RgbImageF = Image<float, 3>;
+
+// Returns a copy of `src` surrounded by a `border`-pixel padding ring so
+// kernels with a radius up to `border` can index neighbours directly.
+template <typename T, int C>
+Image<T, C> padded(const Image<T, C>& src, int border, BorderMode mode = BorderMode::Replicate) {
+    Image<T, C> out(src.width(), src.height(), border);
+    out.copyFrom(src);
+    out.fillBorder(mode);
+    return out;
+}
+
+}  // namespace imgcore
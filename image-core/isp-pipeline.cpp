@@ -0,0 +1,247 @@
+#include "isp-pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "median.h"
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+
+// Demosaic halo around a tile core: the method's footprint (AHD reads 5
+// pixels away) rounded up to even, so every tile origin stays on the CFA
+// phase of the frame. It also covers the extra column and row the GrayEdge
+// gradients of the core read.
+int demosaicMargin(DemosaicMethod method) {
+    return method == DemosaicMethod::AHD ? 6 : 2;
+}
+
+// Rows of the last pass per parallelFor chunk.
+const int FINISH_BAND_ROWS = 16;
+
+struct Tile {
+    int x0, y0, x1, y1;
+};
+
+std::vector<Tile> tileGrid(int width, int height, int tileWidth, int tileHeight) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileHeight) {
+        for (int x = 0; x < width; x += tileWidth) {
+            tiles.push_back({x, y, std::min(width, x + tileWidth), std::min(height, y + tileHeight)});
+        }
+    }
+    return tiles;
+}
+
+int evenSize(int size) {
+    return std::max(2, (size + 1) & ~1);
+}
+
+template <int C>
+size_t imageBytes(const Image<unsigned char, C>& img) {
+    return static_cast<size_t>(img.stride()) * (img.height() + 2 * img.border());
+}
+
+// Runs fn(index, slot) for every index in [0, count), on `pool` when given.
+template <typename Fn>
+void forEach(int count, int grain, ThreadPool* pool, Fn fn) {
+    if (pool) {
+        pool->parallelFor(0, count, grain, [&](int begin, int end, int slot) {
+            for (int i = begin; i < end; ++i) fn(i, slot);
+        });
+    } else {
+        for (int i = 0; i < count; ++i) fn(i, 0);
+    }
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+IspPipeline::IspPipeline(const IspParams& params)
+    : params_(params), weights_(params.bilateralRadius, params.sigmaSpatial, params.sigmaRange) {}
+
+void IspPipeline::demosaicTile(const GrayImage& bayer, int x0, int y0, int x1, int y1, TileScratch& s) {
+    const int width = bayer.width();
+    const int height = bayer.height();
+    const int margin = demosaicMargin(params_.demosaic);
+    const int dx0 = x0 - margin, dy0 = y0 - margin;
+
+    // Every tile has the same geometry, so the scratch is allocated once;
+    // whatever lies past the frame is mirrored exactly as
+    // fillBorder(Reflect) would, plus the 5-pixel ring the demosaic reads.
+    const int ring = 5;
+    s.bayer.resize(tileWidth_ + 2 * margin, tileHeight_ + 2 * margin, ring);
+    const int lx0 = std::max(-ring, -dx0), lx1 = std::min(s.bayer.width() + ring, width - dx0);
+    for (int r = -ring; r < s.bayer.height() + ring; ++r) {
+        const unsigned char* in = bayer.row(borderIndex(dy0 + r, height, BorderMode::Reflect));
+        unsigned char* out = s.bayer.row(r);
+        std::memcpy(out + lx0, in + dx0 + lx0, lx1 - lx0);
+        for (int x = -ring; x < lx0; ++x) out[x] = in[borderIndex(dx0 + x, width, BorderMode::Reflect)];
+        for (int x = lx1; x < s.bayer.width() + ring; ++x) {
+            out[x] = in[borderIndex(dx0 + x, width, BorderMode::Reflect)];
+        }
+    }
+    if (params_.demosaic == DemosaicMethod::AHD) demosaicAHD(s.bayer, s.rgb, params_.pattern, nullptr, &s.ahd);
+    else demosaic(s.bayer, s.rgb, params_.pattern, params_.demosaic);
+
+    const int cw = x1 - x0, ch = y1 - y0;
+    for (int y = y0; y < y1; ++y) {
+        std::memcpy(demosaiced_.row(y) + 3 * x0, s.rgb.row(y - dy0) + 3 * margin, 3 * cw);
+    }
+
+    const WhiteBalanceEstimator estimator = params_.whiteBalance.estimator;
+    StatsSampling sampling;
+    sampling.region = ImageRegion{margin, margin, cw, ch};
+    gatherChannelStats(s.rgb, estimator, sampling, s.tileStats);
+    if (estimator == WhiteBalanceEstimator::GrayEdge) {
+        // The region's gradients stop at its edges; the frame's continue
+        // into the next tile to the right and below.
+        for (int c = 0; c < 3; ++c) {
+            uint64_t edge = 0;
+            if (x1 < width) {
+                for (int y = margin; y < margin + ch; ++y) {
+                    const unsigned char* p = s.rgb.row(y) + 3 * (margin + cw - 1) + c;
+                    edge += std::abs(p[3] - p[0]);
+                }
+            }
+            if (y1 < height) {
+                const unsigned char* last = s.rgb.row(margin + ch - 1) + 3 * margin + c;
+                const unsigned char* below = s.rgb.row(margin + ch) + 3 * margin + c;
+                for (int x = 0; x < cw; ++x) edge += std::abs(below[3 * x] - last[3 * x]);
+            }
+            s.tileStats.edgeSum[c] += edge;
+        }
+    }
+    s.stats.merge(s.tileStats);
+}
+
+void IspPipeline::denoiseTile(const GainLuts& luts, int x0, int y0, int x1, int y1, TileScratch& s) {
+    const int width = demosaiced_.width();
+    const int height = demosaiced_.height();
+    const int rm = params_.medianRadius;
+    const int rb = weights_.radius;
+    // The median covers the core plus the bilateral radius.
+    const int ox = x0 - rb, oy = y0 - rb;
+    const int mw = tileWidth_ + 2 * rb, mh = tileHeight_ + 2 * rb;
+
+    // White-balanced pixels under the median window, Replicate past the
+    // frame edges (the gains are per pixel, so replicating the balanced
+    // edge equals balancing the replicated one).
+    s.gained.resize(mw, mh, rm);
+    const int gx0 = std::max(-rm, -ox), gx1 = std::min(mw + rm, width - ox);
+    for (int r = -rm; r < mh + rm; ++r) {
+        unsigned char* out = s.gained.row(r);
+        applyGainLutsRow(demosaiced_.row(clampIndex(oy + r, height)) + 3 * (ox + gx0), out + 3 * gx0, gx1 - gx0, luts);
+        for (int x = -rm; x < gx0; ++x) std::memcpy(out + 3 * x, out + 3 * gx0, 3);
+        for (int x = gx1; x < mw + rm; ++x) std::memcpy(out + 3 * x, out + 3 * (gx1 - 1), 3);
+    }
+    s.median.resize(mw, mh, 0);
+    medianFilter(s.gained, s.median, rm);
+
+    // Past the frame the whole-frame pass replicates the median's edge
+    // rather than taking medians of replicated input.
+    const int lx0 = std::max(0, -ox), lx1 = std::min(mw, width - ox);
+    const int ly0 = std::max(0, -oy), ly1 = std::min(mh, height - oy);
+    if (lx0 > 0 || lx1 < mw) {
+        for (int y = ly0; y < ly1; ++y) {
+            unsigned char* r = s.median.row(y);
+            for (int x = 0; x < lx0; ++x) std::memcpy(r + 3 * x, r + 3 * lx0, 3);
+            for (int x = lx1; x < mw; ++x) std::memcpy(r + 3 * x, r + 3 * (lx1 - 1), 3);
+        }
+    }
+    for (int y = 0; y < ly0; ++y) std::memcpy(s.median.row(y), s.median.row(ly0), 3 * mw);
+    for (int y = ly1; y < mh; ++y) std::memcpy(s.median.row(y), s.median.row(ly1 - 1), 3 * mw);
+
+    const int cw = x1 - x0;
+    s.row.resize(3 * static_cast<size_t>(tileWidth_));
+    s.rows.resize(2 * rb + 1);
+    for (int y = y0; y < y1; ++y) {
+        for (int k = 0; k <= 2 * rb; ++k) s.rows[k] = s.median.row(y - y0 + k) + 3 * rb;
+        bilateralRow<unsigned char, 3>(s.rows.data(), s.row.data(), cw, weights_, params_.roundToNearest);
+        rgbToYuvRow(s.row.data(), yuv_.y.row(y) + x0, yuv_.u.row(y) + x0, yuv_.v.row(y) + x0, cw);
+    }
+}
+
+void IspPipeline::process(const GrayImage& bayer, RgbImage& rgb, ThreadPool* pool, IspReport* report) {
+    ProfileScope scope("isp");
+    const int width = bayer.width();
+    const int height = bayer.height();
+    rgb.resize(width, height, rgb.border());
+    scope.image(bayer, rgb);
+    if (bayer.empty()) return;
+
+    demosaiced_.resize(width, height, 0);
+    yuv_.y.resize(width, height, 0);
+    yuv_.u.resize(width, height, 0);
+    yuv_.v.resize(width, height, 0);
+    scratch_.resize(pool ? pool->slots() : 1);
+    // A frame smaller than a tile is one tile of its own size.
+    tileWidth_ = std::min(evenSize(params_.tileWidth), evenSize(width));
+    tileHeight_ = std::min(evenSize(params_.tileHeight), evenSize(height));
+    const std::vector<Tile> tiles = tileGrid(width, height, tileWidth_, tileHeight_);
+    const int count = static_cast<int>(tiles.size());
+
+    // Pass 1: demosaic and white-balance statistics, tile by tile.
+    auto start = std::chrono::steady_clock::now();
+    for (TileScratch& s : scratch_) s.stats = ChannelStats();
+    forEach(count, 1, pool, [&](int i, int slot) {
+        const Tile& t = tiles[i];
+        ProfileScope tileScope("isp demosaic", "tile");
+        tileScope.tile(i).pixels(static_cast<uint64_t>(t.x1 - t.x0) * (t.y1 - t.y0));
+        demosaicTile(bayer, t.x0, t.y0, t.x1, t.y1, scratch_[slot]);
+    });
+    ChannelStats stats;
+    for (const TileScratch& s : scratch_) stats.merge(s.stats);
+    const WhiteBalanceGains gains = estimateGains(stats, params_.whiteBalance);
+    const GainLuts luts(gains.gain);
+    const double demosaicMs = millisecondsSince(start);
+
+    // Pass 2: gains, median, bilateral and the forward YUV conversion.
+    start = std::chrono::steady_clock::now();
+    forEach(count, 1, pool, [&](int i, int slot) {
+        const Tile& t = tiles[i];
+        ProfileScope tileScope("isp denoise", "tile");
+        tileScope.tile(i).pixels(static_cast<uint64_t>(t.x1 - t.x0) * (t.y1 - t.y0));
+        denoiseTile(luts, t.x0, t.y0, t.x1, t.y1, scratch_[slot]);
+    });
+    const double denoiseMs = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    clahe_.build(yuv_.y, params_.clahe, pool);
+    const double claheLutMs = millisecondsSince(start);
+
+    // Pass 3: CLAHE blend and back to RGB, band by band.
+    start = std::chrono::steady_clock::now();
+    const int bands = (height + FINISH_BAND_ROWS - 1) / FINISH_BAND_ROWS;
+    forEach(bands, 1, pool, [&](int band, int slot) {
+        const int y0 = band * FINISH_BAND_ROWS, y1 = std::min(height, (band + 1) * FINISH_BAND_ROWS);
+        ProfileScope bandScope("isp finish", "tile");
+        bandScope.tile(band).pixels(static_cast<uint64_t>(width) * (y1 - y0));
+        std::vector<unsigned char>& row = scratch_[slot].row;
+        row.resize(width);
+        for (int y = y0; y < y1; ++y) {
+            clahe_.applyRow(yuv_.y.row(y), row.data(), y);
+            yuvToRgbRow(row.data(), yuv_.u.row(y), yuv_.v.row(y), rgb.row(y), width);
+        }
+    });
+    const double finishMs = millisecondsSince(start);
+
+    if (report) {
+        report->tiles = count;
+        report->gains = gains;
+        report->demosaicMs = demosaicMs;
+        report->denoiseMs = denoiseMs;
+        report->claheLutMs = claheLutMs;
+        report->finishMs = finishMs;
+        report->frameBytes = imageBytes(demosaiced_) + imageBytes(yuv_.y) + imageBytes(yuv_.u) + imageBytes(yuv_.v);
+    }
+}
+
+}  // namespace imgcore
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+
+#include "bilateral.h"
+#include "clahe.h"
+#include "color-convert.h"
+#include "demosaic.h"
+#include "image.h"
+#include "thread-pool.h"
+#include "white-balance.h"
+
+namespace imgcore {
+
+struct IspParams {
+    CfaPattern pattern = CfaPattern::GRBG;
+    DemosaicMethod demosaic = DemosaicMethod::Bilinear;
+    WhiteBalanceParams whiteBalance;
+    // Denoise: median, then bilateral, as medianBilateralFused().
+    int medianRadius = 1;
+    int bilateralRadius = 2;
+    double sigmaSpatial = 2.0;
+    double sigmaRange = 30.0;
+    bool roundToNearest = true;
+    // Contrast: CLAHE on the luma, as the CLAHE tool runs it.
+    ClaheParams clahe{4.0, 8, 8};
+    // Core size of the tiles of the demosaic and denoise passes, rounded up
+    // to even so every tile keeps the frame's CFA phase. Wide tiles keep
+    // the demosaic's halo small; 52 rows plus the AHD halo are exactly two
+    // of its 32-row bands. A tile's buffers stay well inside a 1 MB L2.
+    int tileWidth = 1024;
+    int tileHeight = 52;
+};
+
+// Wall time of each pass of one process() call, in milliseconds.
+struct IspReport {
+    int tiles = 0;
+    WhiteBalanceGains gains;
+    double demosaicMs = 0.0;  // demosaic and white-balance statistics, per tile
+    double denoiseMs = 0.0;   // gains, median, bilateral and RGB -> YUV, per tile
+    double claheLutMs = 0.0;  // CLAHE tile histograms and LUTs over the luma plane
+    double finishMs = 0.0;    // CLAHE blend and YUV -> RGB, per row band
+    // Full-frame buffers the pipeline keeps between passes (the demosaiced
+    // frame and the YUV planes); every other buffer is one tile.
+    size_t frameBytes = 0;
+};
+
+// Raw Bayer frame to display RGB: demosaic, white balance, median +
+// bilateral denoise and CLAHE on the luma, with the same output as running
+// demosaic(), whiteBalance(), medianBilateralFused() and clahe() (through
+// YUV) one after another on whole frames.
+//
+// The frame is cut into tiles that run on `pool`, each carrying the halo
+// its stages read: the demosaic footprint of mosaic, then the median plus
+// bilateral radius of balanced pixels. A tile passes through every stage of its pass
+// while it is cache resident. Two statistics are global and end a pass: the
+// white-balance gains need the statistics of the whole demosaiced frame, so
+// the first pass keeps that frame; the CLAHE tile LUTs need the whole luma
+// plane, so the second keeps the YUV planes. The last pass blends and
+// converts back in row bands. Frame edges get the borders the stages use on
+// whole frames (Reflect for the mosaic, Replicate for the denoise).
+class IspPipeline {
+public:
+    explicit IspPipeline(const IspParams& params = {});
+
+    const IspParams& params() const { return params_; }
+
+    // `bayer` may carry any border; only its visible pixels are read.
+    void process(const GrayImage& bayer, RgbImage& rgb, ThreadPool* pool = nullptr, IspReport* report = nullptr);
+
+private:
+    struct TileScratch {
+        GrayImage bayer;
+        AhdWorkspace ahd;
+        RgbImage rgb;
+        RgbImage gained;
+        RgbImage median;
+        std::vector<unsigned char> row;
+        std::vector<const unsigned char*> rows;
+        ChannelStats stats;
+        ChannelStats tileStats;
+    };
+
+    void demosaicTile(const GrayImage& bayer, int x0, int y0, int x1, int y1, TileScratch& s);
+    void denoiseTile(const GainLuts& luts, int x0, int y0, int x1, int y1, TileScratch& s);
+
+    IspParams params_;
+    BilateralWeights weights_;
+    int tileWidth_ = 0, tileHeight_ = 0;  // core size of the current frame's tiles
+    RgbImage demosaiced_;
+    YuvPlanes yuv_;
+    ClaheLuts<unsigned char> clahe_;
+    std::vector<TileScratch> scratch_;  // one per pool slot
+};
+
+}  // namespace imgcore
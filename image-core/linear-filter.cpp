@@ -0,0 +1,491 @@
+#include "linear-filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <type_traits>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+using FloatImage = Image<float, 1>;
+
+// `src` itself when it already carries `offset` border pixels (assumed
+// filled), otherwise a copy padded with `border`.
+template <typename T>
+static const Image<T, 1>& withPadding(const Image<T, 1>& src, int offset, BorderMode border,
+                                      Image<T, 1>& paddedCopy) {
+    if (src.border() >= offset) return src;
+    paddedCopy = padded(src, offset, border);
+    return paddedCopy;
+}
+
+std::vector<float> gaussianKernel1D(int size, double sigma) {
+    int offset = size / 2;
+    std::vector<double> taps(2 * offset + 1);
+    double sum = 0;
+    for (int i = -offset; i <= offset; ++i) {
+        taps[i + offset] = std::exp(-(i * i) / (2 * sigma * sigma));
+        sum += taps[i + offset];
+    }
+    std::vector<float> kernel(taps.size());
+    for (size_t i = 0; i < taps.size(); ++i) kernel[i] = static_cast<float>(taps[i] / sum);
+    return kernel;
+}
+
+// Window sums: 32 bits hold any 8-bit window, 16-bit ones take 64 bits
+// and float ones double, so the running sums do not drift.
+template <typename T>
+using BoxSum = std::conditional_t<std::is_same_v<T, unsigned char>, uint32_t,
+                                  std::conditional_t<std::is_same_v<T, float>, double, uint64_t>>;
+
+template <typename T>
+void boxFilter(const Image<T, 1>& src, Image<T, 1>& dst, int size, BorderMode border) {
+    ProfileScope scope("box");
+    scope.image(src);
+    using Sum = BoxSum<T>;
+    const int width = src.width();
+    const int height = src.height();
+    const int offset = size / 2;
+    const int span = width + 2 * offset;
+    // Matches the direct filter, which divides by size * size even for even sizes.
+    const Sum area = static_cast<Sum>(size * size);
+    // floor(sum / area + 0.5) in integers
+    auto mean = [area](Sum sum) {
+        if constexpr (PixelTraits<T>::integer) return static_cast<T>((2 * sum + area) / (2 * area));
+        else return static_cast<T>(sum / area);
+    };
+
+    Image<T, 1> paddedCopy;
+    const Image<T, 1>& in = withPadding(src, offset, border, paddedCopy);
+    dst.resize(width, height, dst.border());
+
+    // colSum[x] holds the vertical window sum of padded column x - offset.
+    std::vector<Sum> colSum(span, 0);
+    for (int ky = -offset; ky <= offset; ++ky) {
+        const T* row = in.row(ky) - offset;
+        for (int x = 0; x < span; ++x) colSum[x] += row[x];
+    }
+
+    for (int y = 0; y < height; ++y) {
+        if (y > 0) {
+            const T* enter = in.row(y + offset) - offset;
+            const T* leave = in.row(y - offset - 1) - offset;
+            for (int x = 0; x < span; ++x) colSum[x] += static_cast<Sum>(enter[x]) - static_cast<Sum>(leave[x]);
+        }
+
+        T* out = dst.row(y);
+        Sum sum = 0;
+        for (int x = 0; x <= 2 * offset; ++x) sum += colSum[x];
+        out[0] = mean(sum);
+        for (int x = 1; x < width; ++x) {
+            sum += colSum[x + 2 * offset] - colSum[x - 1];
+            out[x] = mean(sum);
+        }
+    }
+}
+
+template <typename T>
+Image<T, 1> boxFilter(const Image<T, 1>& src, int size, BorderMode border) {
+    Image<T, 1> output;
+    boxFilter(src, output, size, border);
+    return output;
+}
+
+// out[x] = sum_k kernel[k] * in[x + k - offset]; `in` must be readable from
+// -offset to width + offset.
+template <typename T>
+static void horizontalPass(const T* in, float* out, int width, const float* kernel, int offset) {
+    int x = 0;
+#ifdef __AVX2__
+    if constexpr (std::is_same_v<T, unsigned char>) {
+        for (; x + 8 <= width; x += 8) {
+            __m256 acc = _mm256_setzero_ps();
+            for (int k = -offset; k <= offset; ++k) {
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x + k));
+                __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(v, _mm256_set1_ps(kernel[k + offset])));
+            }
+            _mm256_storeu_ps(out + x, acc);
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        float acc = 0;
+        for (int k = -offset; k <= offset; ++k) acc += in[x + k] * kernel[k + offset];
+        out[x] = acc;
+    }
+}
+
+// out[x] = round(sum_k kernel[k] * rows[k][x]) for the 2 * offset + 1 rows
+// of horizontally filtered data centred on the output row.
+template <typename T>
+static void verticalPass(const float* const* rows, T* out, int width, const float* kernel, int taps) {
+    int x = 0;
+#ifdef __AVX2__
+    if constexpr (std::is_same_v<T, unsigned char>) {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 maxVal = _mm256_set1_ps(255.0f);
+        for (; x + 8 <= width; x += 8) {
+            __m256 acc = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + x), _mm256_set1_ps(kernel[k])));
+            }
+            acc = _mm256_min_ps(_mm256_add_ps(acc, half), maxVal);
+            __m256i v = _mm256_cvttps_epi32(acc);
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(packed, packed));
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        float acc = 0;
+        for (int k = 0; k < taps; ++k) acc += rows[k][x] * kernel[k];
+        out[x] = roundPixel<T>(acc);
+    }
+}
+
+template <typename T>
+void gaussianFilter(const Image<T, 1>& src, Image<T, 1>& dst, int size, double sigma, BorderMode border) {
+    ProfileScope scope("gaussian");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    const int offset = size / 2;
+    const int taps = 2 * offset + 1;
+    std::vector<float> kernel = gaussianKernel1D(size, sigma);
+
+    Image<T, 1> paddedCopy;
+    const Image<T, 1>& in = withPadding(src, offset, border, paddedCopy);
+    // Row r of `horizontal` is input row r - offset filtered along x.
+    FloatImage horizontal(width, height + 2 * offset);
+    for (int y = -offset; y < height + offset; ++y) {
+        horizontalPass(in.row(y), horizontal.row(y + offset), width, kernel.data(), offset);
+    }
+
+    dst.resize(width, height, dst.border());
+    std::vector<const float*> rows(taps);
+    for (int y = 0; y < height; ++y) {
+        for (int k = 0; k < taps; ++k) rows[k] = horizontal.row(y + k);
+        verticalPass(rows.data(), dst.row(y), width, kernel.data(), taps);
+    }
+}
+
+template <typename T>
+Image<T, 1> gaussianFilter(const Image<T, 1>& src, int size, double sigma, BorderMode border) {
+    Image<T, 1> output;
+    gaussianFilter(src, output, size, sigma, border);
+    return output;
+}
+
+// Horizontal taps have 14 fractional bits. Each product is a rounding
+// high-half multiply (sample << 7) * tap >> 15, so the rows hold 6
+// fractional bits and their sums stay within 16 bits. Vertical taps get 14
+// fractional bits too and accumulate in 32 bits.
+const int FIXED_H_BITS = 14;
+const int FIXED_ROW_BITS = FIXED_H_BITS + 7 - 15;
+const int FIXED_V_BITS = 14;
+const int FIXED_SHIFT = FIXED_ROW_BITS + FIXED_V_BITS;
+
+// Quantises the taps to `bits` fractional bits and pushes the rounding error
+// into the centre tap so the kernel still sums to exactly 1.0.
+static std::vector<uint16_t> fixedKernel(const std::vector<float>& kernel, int bits) {
+    const int one = 1 << bits;
+    std::vector<uint16_t> fixed(kernel.size());
+    int total = 0;
+    for (size_t i = 0; i < kernel.size(); ++i) {
+        fixed[i] = static_cast<uint16_t>(std::lround(kernel[i] * one));
+        total += fixed[i];
+    }
+    fixed[kernel.size() / 2] = static_cast<uint16_t>(fixed[kernel.size() / 2] + one - total);
+    return fixed;
+}
+
+static void horizontalPassFixed(const unsigned char* in, uint16_t* out, int width, const uint16_t* kernel, int offset) {
+    int x = 0;
+#ifdef __AVX2__
+    // Samples shifted up by 7 stay positive as int16, and the rounded
+    // products sum to about 255 * 64, so wrapping adds are safe.
+    for (; x + 16 <= width; x += 16) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int k = -offset; k <= offset; ++k) {
+            __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x + k)));
+            __m256i w = _mm256_set1_epi16(static_cast<short>(kernel[k + offset]));
+            acc = _mm256_add_epi16(acc, _mm256_mulhrs_epi16(_mm256_slli_epi16(v, 7), w));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), acc);
+    }
+#endif
+    for (; x < width; ++x) {
+        uint32_t acc = 0;
+        for (int k = -offset; k <= offset; ++k) acc += ((in[x + k] << 7) * kernel[k + offset] + (1 << 14)) >> 15;
+        out[x] = static_cast<uint16_t>(acc);
+    }
+}
+
+static void verticalPassFixed(const uint16_t* const* rows, unsigned char* out, int width, const uint16_t* kernel, int taps) {
+    int x = 0;
+#ifdef __AVX2__
+    const __m256i round = _mm256_set1_epi32(1 << (FIXED_SHIFT - 1));
+    for (; x + 16 <= width; x += 16) {
+        __m256i lo = round;
+        __m256i hi = round;
+        for (int k = 0; k < taps; ++k) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + x));
+            __m256i w = _mm256_set1_epi32(kernel[k]);
+            lo = _mm256_add_epi32(lo, _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), w));
+            hi = _mm256_add_epi32(hi, _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), w));
+        }
+        __m256i words = _mm256_packus_epi32(_mm256_srli_epi32(lo, FIXED_SHIFT), _mm256_srli_epi32(hi, FIXED_SHIFT));
+        words = _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), bytes);
+    }
+#endif
+    for (; x < width; ++x) {
+        uint32_t acc = 1 << (FIXED_SHIFT - 1);
+        for (int k = 0; k < taps; ++k) acc += rows[k][x] * kernel[k];
+        out[x] = static_cast<unsigned char>(std::min<uint32_t>(acc >> FIXED_SHIFT, 255));
+    }
+}
+
+void gaussianFilterFixed(const GrayImage& src, GrayImage& dst, int size, double sigma, BorderMode border) {
+    ProfileScope scope("gaussian fixed");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    const int offset = size / 2;
+    const int taps = 2 * offset + 1;
+    std::vector<float> taps1D = gaussianKernel1D(size, sigma);
+    std::vector<uint16_t> hKernel = fixedKernel(taps1D, FIXED_H_BITS);
+    std::vector<uint16_t> vKernel = fixedKernel(taps1D, FIXED_V_BITS);
+
+    GrayImage paddedCopy;
+    const GrayImage& in = withPadding(src, offset, border, paddedCopy);
+    Image<uint16_t, 1> horizontal(width, height + 2 * offset);
+    for (int y = -offset; y < height + offset; ++y) {
+        horizontalPassFixed(in.row(y), horizontal.row(y + offset), width, hKernel.data(), offset);
+    }
+
+    dst.resize(width, height, dst.border());
+    std::vector<const uint16_t*> rows(taps);
+    for (int y = 0; y < height; ++y) {
+        for (int k = 0; k < taps; ++k) rows[k] = horizontal.row(y + k);
+        verticalPassFixed(rows.data(), dst.row(y), width, vKernel.data(), taps);
+    }
+}
+
+GrayImage gaussianFilterFixed(const GrayImage& src, int size, double sigma, BorderMode border) {
+    GrayImage output;
+    gaussianFilterFixed(src, output, size, sigma, border);
+    return output;
+}
+
+namespace {
+
+// Deriche's (1993) fourth-order approximation of the Gaussian: for n >= 0
+// h(n) = (1.680 cos(0.6318 n / s) + 3.735 sin(0.6318 n / s)) exp(-1.783 n / s)
+//      - (0.6803 cos(1.997 n / s) + 0.2598 sin(1.997 n / s)) exp(-1.723 n / s),
+// and h(-n) = h(n). The output is the sum of a causal pass over h(0..) and
+// an anti-causal one over h(1..), both run on the input:
+//   causal[n] = n0 x[n] + ... + n3 x[n-3] - d1 causal[n-1] - ... - d4 causal[n-4]
+//   anti[n]   = m1 x[n+1] + ... + m4 x[n+4] - d1 anti[n+1] - ... - d4 anti[n+4]
+// with the numerators scaled so the whole kernel sums to one. Everything is
+// in double: for large sigma the poles crowd towards 1 and the denominator
+// sums to ~1e-7 at sigma = 100, which float coefficients cannot resolve.
+struct RecursiveCoefficients {
+    double n[4], m[5], d[5];  // m[0] and d[0] unused
+    // Output of either pass on a constant 1 signal (its steady state), so a
+    // replicated edge starts both passes exactly.
+    double causalGain, antiGain;
+
+    explicit RecursiveCoefficients(double sigma) {
+        using Complex = std::complex<double>;
+        const double a[2] = {1.680, -0.6803}, b[2] = {3.735, -0.2598};
+        const double decay[2] = {1.783, 1.723}, freq[2] = {0.6318, 1.997};
+        // h(n) = sum_k r[k] p[k]^n over two conjugate pole pairs.
+        Complex p[4], r[4];
+        for (int k = 0; k < 2; ++k) {
+            p[2 * k] = std::exp(Complex(-decay[k], freq[k]) / sigma);
+            p[2 * k + 1] = std::conj(p[2 * k]);
+            r[2 * k] = Complex(a[k], -b[k]) / 2.0;
+            r[2 * k + 1] = std::conj(r[2 * k]);
+        }
+        // Denominator prod_k (1 - p[k] z^-1) and numerator
+        // sum_k r[k] prod_{j != k} (1 - p[j] z^-1), as z^-1 polynomials.
+        Complex den[5] = {1.0}, num[4] = {};
+        for (int k = 0; k < 4; ++k) {
+            for (int i = 4; i > 0; --i) den[i] -= p[k] * den[i - 1];
+            Complex term[4] = {r[k]};
+            for (int j = 0, order = 0; j < 4; ++j) {
+                if (j == k) continue;
+                ++order;
+                for (int i = order; i > 0; --i) term[i] -= p[j] * term[i - 1];
+            }
+            for (int i = 0; i < 4; ++i) num[i] += term[i];
+        }
+        double causal[4], anti[5], denominator[5];
+        double causalSum = 0.0, antiSum = 0.0, denSum = 0.0;
+        for (int i = 0; i < 5; ++i) {
+            denominator[i] = den[i].real();
+            denSum += denominator[i];
+        }
+        for (int i = 0; i < 4; ++i) {
+            causal[i] = num[i].real();
+            causalSum += causal[i];
+        }
+        // h(1..) is h(0..) with h(0) = causal[0] taken out.
+        anti[0] = 0.0;
+        for (int i = 1; i < 5; ++i) {
+            anti[i] = (i < 4 ? causal[i] : 0.0) - causal[0] * denominator[i];
+            antiSum += anti[i];
+        }
+        const double scale = denSum / (causalSum + antiSum);
+        for (int i = 0; i < 4; ++i) n[i] = causal[i] * scale;
+        for (int i = 0; i < 5; ++i) {
+            m[i] = anti[i] * scale;
+            d[i] = denominator[i];
+        }
+        causalGain = causalSum * scale / denSum;
+        antiGain = antiSum * scale / denSum;
+    }
+};
+
+// Filters one row in place with Replicate edges; `tmp` holds the input.
+void recursiveRow(double* data, int width, const RecursiveCoefficients& c, std::vector<double>& tmp) {
+    tmp.assign(data, data + width);
+    const double* x = tmp.data();
+    const double first = x[0], last = x[width - 1];
+    auto in = [&](int i) { return x[clampIndex(i, width)]; };
+    double y1 = first * c.causalGain, y2 = y1, y3 = y1, y4 = y1;
+    for (int i = 0; i < width; ++i) {
+        const double y = c.n[0] * x[i] + c.n[1] * in(i - 1) + c.n[2] * in(i - 2) + c.n[3] * in(i - 3) -
+                        c.d[1] * y1 - c.d[2] * y2 - c.d[3] * y3 - c.d[4] * y4;
+        y4 = y3;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+        data[i] = y;
+    }
+    y1 = y2 = y3 = y4 = last * c.antiGain;
+    for (int i = width - 1; i >= 0; --i) {
+        const double y = c.m[1] * in(i + 1) + c.m[2] * in(i + 2) + c.m[3] * in(i + 3) + c.m[4] * in(i + 4) -
+                        c.d[1] * y1 - c.d[2] * y2 - c.d[3] * y3 - c.d[4] * y4;
+        y4 = y3;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+        data[i] += y;
+    }
+}
+
+// The vertical passes walk whole rows at a time so the inner loop is a
+// contiguous, vectorisable sweep over x. The causal pass goes into
+// `causal`; the anti-causal pass then walks back up, keeping the last four
+// input rows and its own last four rows in rings, and writes the sum in
+// place. Rows past either edge are the edge row (Replicate), whose steady
+// state seeds the passes.
+void recursiveColumns(Image<double, 1>& img, const RecursiveCoefficients& c) {
+    const int width = img.width();
+    const int height = img.height();
+    const size_t w = static_cast<size_t>(width);
+    Image<double, 1> causal(width, height);
+    std::vector<double> seed(w);
+    const double* first = img.row(0);
+    for (int x = 0; x < width; ++x) seed[x] = first[x] * c.causalGain;
+    auto input = [&](int y) { return img.row(clampIndex(y, height)); };
+    auto causalRow = [&](int y) -> const double* { return y < 0 ? seed.data() : causal.row(y); };
+    for (int y = 0; y < height; ++y) {
+        const double *x0 = input(y), *x1 = input(y - 1), *x2 = input(y - 2), *x3 = input(y - 3);
+        const double *y1 = causalRow(y - 1), *y2 = causalRow(y - 2), *y3 = causalRow(y - 3), *y4 = causalRow(y - 4);
+        double* out = causal.row(y);
+        for (int x = 0; x < width; ++x) {
+            out[x] = c.n[0] * x0[x] + c.n[1] * x1[x] + c.n[2] * x2[x] + c.n[3] * x3[x] - c.d[1] * y1[x] -
+                     c.d[2] * y2[x] - c.d[3] * y3[x] - c.d[4] * y4[x];
+        }
+    }
+
+    // Ring slot k holds row y + 1 + k of the input and of the anti-causal
+    // pass while row y is computed.
+    std::vector<double> inputRing(4 * w), antiRing(4 * w), anti(w);
+    const double* last = img.row(height - 1);
+    for (int k = 0; k < 4; ++k) {
+        for (int x = 0; x < width; ++x) {
+            inputRing[k * w + x] = last[x];
+            antiRing[k * w + x] = last[x] * c.antiGain;
+        }
+    }
+    int head = 0;  // ring slot of row y + 1
+    auto slot = [&](int k) { return static_cast<size_t>((head + k) & 3) * w; };
+    for (int y = height - 1; y >= 0; --y) {
+        const double *x1 = &inputRing[slot(0)], *x2 = &inputRing[slot(1)], *x3 = &inputRing[slot(2)],
+                    *x4 = &inputRing[slot(3)];
+        const double *y1 = &antiRing[slot(0)], *y2 = &antiRing[slot(1)], *y3 = &antiRing[slot(2)],
+                    *y4 = &antiRing[slot(3)];
+        for (int x = 0; x < width; ++x) {
+            anti[x] = c.m[1] * x1[x] + c.m[2] * x2[x] + c.m[3] * x3[x] + c.m[4] * x4[x] - c.d[1] * y1[x] -
+                      c.d[2] * y2[x] - c.d[3] * y3[x] - c.d[4] * y4[x];
+        }
+        // Row y becomes row y + 1 of the next step: it takes the oldest slot.
+        head = (head + 3) & 3;
+        double* row = img.row(y);
+        const double* sum = causal.row(y);
+        std::copy(row, row + width, &inputRing[slot(0)]);
+        std::copy(anti.begin(), anti.end(), &antiRing[slot(0)]);
+        for (int x = 0; x < width; ++x) row[x] = sum[x] + anti[x];
+    }
+}
+
+}  // namespace
+
+template <typename T>
+Image<T, 1> gaussianFilterRecursive(const Image<T, 1>& src, double sigma) {
+    ProfileScope scope("gaussian recursive");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    if (src.empty()) return Image<T, 1>(width, height);
+    RecursiveCoefficients coeffs(sigma);
+
+    Image<double, 1> work(width, height);
+    std::vector<double> tmp;
+    for (int y = 0; y < height; ++y) {
+        const T* in = src.row(y);
+        double* row = work.row(y);
+        for (int x = 0; x < width; ++x) row[x] = in[x];
+        recursiveRow(row, width, coeffs, tmp);
+    }
+    recursiveColumns(work, coeffs);
+
+    Image<T, 1> output(width, height);
+    for (int y = 0; y < height; ++y) {
+        const double* row = work.row(y);
+        T* out = output.row(y);
+        for (int x = 0; x < width; ++x) out[x] = roundPixel<T>(row[x]);
+    }
+    return output;
+}
+
+template void boxFilter(const GrayImage&, GrayImage&, int, BorderMode);
+template void boxFilter(const GrayImage16&, GrayImage16&, int, BorderMode);
+template void boxFilter(const GrayImageF&, GrayImageF&, int, BorderMode);
+template GrayImage boxFilter(const GrayImage&, int, BorderMode);
+template GrayImage16 boxFilter(const GrayImage16&, int, BorderMode);
+template GrayImageF boxFilter(const GrayImageF&, int, BorderMode);
+template void gaussianFilter(const GrayImage&, GrayImage&, int, double, BorderMode);
+template void gaussianFilter(const GrayImage16&, GrayImage16&, int, double, BorderMode);
+template void gaussianFilter(const GrayImageF&, GrayImageF&, int, double, BorderMode);
+template GrayImage gaussianFilter(const GrayImage&, int, double, BorderMode);
+template GrayImage16 gaussianFilter(const GrayImage16&, int, double, BorderMode);
+template GrayImageF gaussianFilter(const GrayImageF&, int, double, BorderMode);
+template GrayImage gaussianFilterRecursive(const GrayImage&, double);
+template GrayImage16 gaussianFilterRecursive(const GrayImage16&, double);
+template GrayImageF gaussianFilterRecursive(const GrayImageF&, double);
+
+}  // namespace imgcore
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include "image.h"
+#include "pixel.h"
+
+namespace imgcore {
+
+// Normalised 1-D Gaussian taps; the 2-D kernel exp(-(i^2 + j^2) / 2s^2) is
+// their outer product, which is what makes the separable passes exact.
+std::vector<float> gaussianKernel1D(int size, double sigma);
+
+// The filters below read `src` through a border of size / 2. When `src`
+// already carries one (filled, e.g. by padded()) it is used as is, which
+// lets several kernel sizes share one padded input; otherwise a copy is
+// padded with `border`. The `dst` overloads reuse dst's buffer when its
+// geometry matches; dst must not alias src. Except for the fixed-point
+// Gaussian, T is unsigned char, uint16_t or float; only the 8-bit
+// instantiations have AVX2 paths.
+
+// size x size mean filter built from running column and row sums, so the
+// cost per pixel does not depend on `size`. Bit-exact with the direct 2-D
+// sum rounded as (T)(sum / area + 0.5); float is not rounded.
+template <typename T>
+void boxFilter(const Image<T, 1>& src, Image<T, 1>& dst, int size, BorderMode border = BorderMode::Replicate);
+template <typename T>
+Image<T, 1> boxFilter(const Image<T, 1>& src, int size, BorderMode border = BorderMode::Replicate);
+
+// Truncated size x size Gaussian as a horizontal then a vertical float pass
+// (AVX2 when available): 2 * size multiply-adds per pixel instead of size^2.
+template <typename T>
+void gaussianFilter(const Image<T, 1>& src, Image<T, 1>& dst, int size, double sigma,
+                    BorderMode border = BorderMode::Replicate);
+template <typename T>
+Image<T, 1> gaussianFilter(const Image<T, 1>& src, int size, double sigma,
+                           BorderMode border = BorderMode::Replicate);
+
+// Same filter in fixed point (14-bit taps, rounded 16-bit products summed
+// into 16-bit rows, 32-bit vertical sums): twice the lanes of the float
+// path, at most one level off it and within 0.01 dB.
+void gaussianFilterFixed(const GrayImage& src, GrayImage& dst, int size, double sigma,
+                         BorderMode border = BorderMode::Replicate);
+GrayImage gaussianFilterFixed(const GrayImage& src, int size, double sigma,
+                              BorderMode border = BorderMode::Replicate);
+
+// Untruncated Gaussian via Deriche's fourth-order recursive filter. Cost is
+// constant in sigma, which makes it the mode of choice for large sigma.
+// Edges are Replicate exactly, and the output stays within one level of a
+// direct convolution for sigma from 0.5 to at least 100.
+template <typename T>
+Image<T, 1> gaussianFilterRecursive(const Image<T, 1>& src, double sigma);
+
+}  // namespace imgcore
@@ -0,0 +1,275 @@
+#include "median.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+namespace {
+
+using Comparator = std::pair<int, int>;
+
+// Batcher odd-even merge sort over the next power of two, with every
+// comparator that touches a wire >= n dropped (those wires act as +inf, so
+// their comparators never swap) and, walking backwards from the middle wire,
+// every comparator that cannot influence the median dropped as well.
+std::vector<Comparator> medianNetwork(int n) {
+    int p = 1;
+    while (p < n) p <<= 1;
+    std::vector<Comparator> full;
+    for (int k = 1; k < p; k <<= 1) {
+        for (int j = k; j >= 1; j >>= 1) {
+            for (int i = j % k; i + j < p; i += 2 * j) {
+                for (int a = 0; a < j && a + i + j < p; ++a) {
+                    int lo = a + i, hi = a + i + j;
+                    if (lo / (2 * k) == hi / (2 * k) && hi < n) full.push_back({lo, hi});
+                }
+            }
+        }
+    }
+    std::vector<bool> needed(n, false);
+    needed[n / 2] = true;
+    std::vector<Comparator> pruned;
+    for (auto it = full.rbegin(); it != full.rend(); ++it) {
+        if (!needed[it->first] && !needed[it->second]) continue;
+        needed[it->first] = needed[it->second] = true;
+        pruned.push_back(*it);
+    }
+    return std::vector<Comparator>(pruned.rbegin(), pruned.rend());
+}
+
+// The networks of the two radii that use one, built on first use; a
+// caller filtering many small tiles would otherwise rebuild one per call.
+const std::vector<Comparator>& cachedMedianNetwork(int radius) {
+    static const std::vector<Comparator> radius1 = medianNetwork(9);
+    static const std::vector<Comparator> radius2 = medianNetwork(25);
+    return radius == 1 ? radius1 : radius2;
+}
+
+// Samples per network block: one 256-bit vector of T.
+template <typename T>
+constexpr int LANES = 32 / static_cast<int>(sizeof(T));
+
+// Median of (2r+1)^2 taps for LANES consecutive samples starting at `s`;
+// rows[k] is input row y - radius + k. `wires` holds one LANES-wide vector
+// per tap. Wider types take the plain min/max loop, which compilers
+// vectorise for uint16_t and float alike.
+template <typename T, int C>
+void networkBlock(const T* const* rows, int s, int radius, const std::vector<Comparator>& network, T* wires,
+                  T* out) {
+    constexpr int lanes = LANES<T>;
+    int w = 0;
+    for (int m = -radius; m <= radius; ++m) {
+        const T* r = rows[m + radius] + s;
+        for (int n = -radius; n <= radius; ++n, ++w) std::memcpy(wires + w * lanes, r + n * C, sizeof(T) * lanes);
+    }
+    for (const Comparator& cmp : network) {
+        T* a = wires + cmp.first * lanes;
+        T* b = wires + cmp.second * lanes;
+#ifdef __AVX2__
+        if constexpr (std::is_same_v<T, unsigned char>) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(a), _mm256_min_epu8(va, vb));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(b), _mm256_max_epu8(va, vb));
+            continue;
+        }
+#endif
+        for (int k = 0; k < lanes; ++k) {
+            T lo = a[k] < b[k] ? a[k] : b[k];
+            T hi = a[k] < b[k] ? b[k] : a[k];
+            a[k] = lo;
+            b[k] = hi;
+        }
+    }
+    std::memcpy(out, wires + (w / 2) * lanes, sizeof(T) * lanes);
+}
+
+template <typename T, int C>
+void medianNetworkRows(const Image<T, C>& in, int radius, int y0, int y1, T* const* outRows) {
+    constexpr int lanes = LANES<T>;
+    const int taps = (2 * radius + 1) * (2 * radius + 1);
+    const std::vector<Comparator>& network = cachedMedianNetwork(radius);
+    const int samples = in.width() * C;
+    std::vector<T> wires(static_cast<size_t>(taps) * lanes);
+    std::vector<const T*> rows(2 * radius + 1);
+    T tail[lanes];
+
+    for (int y = y0; y < y1; ++y) {
+        for (int m = -radius; m <= radius; ++m) rows[m + radius] = in.row(y + m);
+        T* out = outRows[y - y0];
+        int s = 0;
+        for (; s + lanes <= samples; s += lanes) {
+            networkBlock<T, C>(rows.data(), s, radius, network, wires.data(), out + s);
+        }
+        if (s < samples) {
+            // Last partial block: step back so it ends on the final sample,
+            // or (for rows narrower than a block) read into the row padding,
+            // which stays inside the 64-byte aligned stride.
+            int start = samples >= lanes ? samples - lanes : 0;
+            networkBlock<T, C>(rows.data(), start, radius, network, wires.data(), tail);
+            std::memcpy(out + s, tail + (s - start), sizeof(T) * (samples - s));
+        }
+    }
+}
+
+// 256-bin histogram split into 16 coarse buckets so the median search reads
+// at most 32 counters instead of 256. Counts must hold the whole window:
+// 16 bits cover a column, or a kernel up to radius 127.
+template <typename Count>
+struct Histogram {
+    Count coarse[16];
+    Count fine[256];
+
+    void clear() {
+        std::memset(coarse, 0, sizeof(coarse));
+        std::memset(fine, 0, sizeof(fine));
+    }
+    template <typename Other>
+    void add(const Histogram<Other>& h) {
+        for (int i = 0; i < 16; ++i) coarse[i] = static_cast<Count>(coarse[i] + h.coarse[i]);
+        for (int i = 0; i < 256; ++i) fine[i] = static_cast<Count>(fine[i] + h.fine[i]);
+    }
+    template <typename Other>
+    void sub(const Histogram<Other>& h) {
+        for (int i = 0; i < 16; ++i) coarse[i] = static_cast<Count>(coarse[i] - h.coarse[i]);
+        for (int i = 0; i < 256; ++i) fine[i] = static_cast<Count>(fine[i] - h.fine[i]);
+    }
+    void insert(unsigned char v) { ++coarse[v >> 4]; ++fine[v]; }
+    void remove(unsigned char v) { --coarse[v >> 4]; --fine[v]; }
+
+    unsigned char median(int rank) const {
+        int bucket = 0;
+        int count = 0;
+        while (count + static_cast<int>(coarse[bucket]) <= rank) count += coarse[bucket++];
+        int v = bucket << 4;
+        while (count + static_cast<int>(fine[v]) <= rank) count += fine[v++];
+        return static_cast<unsigned char>(v);
+    }
+};
+
+// Perreault & Hebert (2007): one histogram per sample column, slid down one
+// row at a time, and one kernel histogram per channel, slid right by adding
+// the entering column and subtracting the leaving one. Both updates are a
+// fixed amount of work regardless of the radius. The column histograms are
+// seeded from the 2r rows above y0, so a band of rows costs 2r extra row
+// insertions on top of its own. `Count` is the kernel's counter type.
+template <typename Count, int C>
+void medianHistogramRows(const Image<unsigned char, C>& in, int radius, int y0, int y1, unsigned char* const* outRows) {
+    const int width = in.width();
+    const int span = width + 2 * radius;
+    const int rank = (2 * radius + 1) * (2 * radius + 1) / 2;
+
+    // columns[(x + radius) * C + c] covers column x of channel c.
+    std::vector<Histogram<uint16_t>> columns(static_cast<size_t>(span) * C);
+    for (Histogram<uint16_t>& h : columns) h.clear();
+    for (int m = -radius; m < radius; ++m) {
+        const unsigned char* r = in.row(y0 + m) - radius * C;
+        for (int i = 0; i < span * C; ++i) columns[i].insert(r[i]);
+    }
+
+    Histogram<Count> kernel[C];
+    for (int y = y0; y < y1; ++y) {
+        const unsigned char* enter = in.row(y + radius) - radius * C;
+        for (int i = 0; i < span * C; ++i) columns[i].insert(enter[i]);
+        if (y > y0) {
+            const unsigned char* leave = in.row(y - radius - 1) - radius * C;
+            for (int i = 0; i < span * C; ++i) columns[i].remove(leave[i]);
+        }
+
+        unsigned char* out = outRows[y - y0];
+        for (int c = 0; c < C; ++c) {
+            kernel[c].clear();
+            for (int k = 0; k < 2 * radius; ++k) kernel[c].add(columns[k * C + c]);
+        }
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < C; ++c) {
+                kernel[c].add(columns[(x + 2 * radius) * C + c]);
+                out[x * C + c] = kernel[c].median(rank);
+                kernel[c].sub(columns[x * C + c]);
+            }
+        }
+    }
+}
+
+// Larger radii on wider types: a histogram of 65536 bins per column would
+// not stay in cache, so each window is gathered and partially sorted.
+template <typename T, int C>
+void medianSelectRows(const Image<T, C>& in, int radius, int y0, int y1, T* const* outRows) {
+    const int width = in.width();
+    const int taps = (2 * radius + 1) * (2 * radius + 1);
+    std::vector<T> window(taps);
+    for (int y = y0; y < y1; ++y) {
+        T* out = outRows[y - y0];
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < C; ++c) {
+                int w = 0;
+                for (int m = -radius; m <= radius; ++m) {
+                    const T* r = in.row(y + m) + x * C + c;
+                    for (int n = -radius; n <= radius; ++n) window[w++] = r[n * C];
+                }
+                std::nth_element(window.begin(), window.begin() + taps / 2, window.end());
+                out[x * C + c] = window[taps / 2];
+            }
+        }
+    }
+}
+
+}  // namespace
+
+template <typename T, int C>
+void medianRows(const Image<T, C>& src, int radius, int y0, int y1, T* const* outRows) {
+    if (radius <= 0) {
+        const size_t rowBytes = sizeof(T) * src.width() * C;
+        for (int y = y0; y < y1; ++y) std::memcpy(outRows[y - y0], src.row(y), rowBytes);
+    } else if (radius <= 2) {
+        medianNetworkRows(src, radius, y0, y1, outRows);
+    } else if constexpr (std::is_same_v<T, unsigned char>) {
+        if (radius < 128) medianHistogramRows<uint16_t>(src, radius, y0, y1, outRows);
+        else medianHistogramRows<uint32_t>(src, radius, y0, y1, outRows);
+    } else {
+        medianSelectRows(src, radius, y0, y1, outRows);
+    }
+}
+
+template <typename T, int C>
+void medianFilter(const Image<T, C>& src, Image<T, C>& dst, int radius) {
+    ProfileScope scope("median");
+    scope.image(src);
+    Image<T, C> paddedCopy;
+    const Image<T, C>* in = &src;
+    if (src.border() < radius) {
+        paddedCopy = padded(src, radius);
+        in = &paddedCopy;
+    }
+    dst.resize(src.width(), src.height(), dst.border());
+
+    std::vector<T*> outRows(src.height());
+    for (int y = 0; y < src.height(); ++y) outRows[y] = dst.row(y);
+    medianRows(*in, radius, 0, src.height(), outRows.data());
+}
+
+template void medianRows(const Image<unsigned char, 1>&, int, int, int, unsigned char* const*);
+template void medianRows(const Image<unsigned char, 3>&, int, int, int, unsigned char* const*);
+template void medianRows(const Image<uint16_t, 1>&, int, int, int, uint16_t* const*);
+template void medianRows(const Image<uint16_t, 3>&, int, int, int, uint16_t* const*);
+template void medianRows(const Image<float, 1>&, int, int, int, float* const*);
+template void medianRows(const Image<float, 3>&, int, int, int, float* const*);
+template void medianFilter(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, int);
+template void medianFilter(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, int);
+template void medianFilter(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, int);
+template void medianFilter(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, int);
+template void medianFilter(const Image<float, 1>&, Image<float, 1>&, int);
+template void medianFilter(const Image<float, 3>&, Image<float, 3>&, int);
+
+}  // namespace imgcore
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "image.h"
+
+namespace imgcore {
+
+// (2r+1)^2 median filter, each channel filtered independently but all
+// interleaved channels in one pass over the row. Radii 1 and 2 (3x3, 5x5)
+// run a pruned sorting network over 32 samples at a time (AVX2 byte
+// min/max when available); larger radii use the Perreault-Hebert sliding
+// histogram, whose cost per pixel does not depend on the radius. `src`
+// should carry a border of at least `radius` (see padded()); otherwise a
+// replicated copy is made.
+//
+// uint16_t and float frames run the same networks with scalar min/max;
+// above radius 2 they select each window's median with nth_element, since
+// a sliding histogram of 65536 bins per column would not stay in cache.
+template <typename T, int C>
+void medianFilter(const Image<T, C>& src, Image<T, C>& dst, int radius);
+
+// Output rows [y0, y1) of the filter above, written to outRows[y - y0], for
+// streaming callers that filter a band at a time. Here `src` must already
+// carry a border of at least `radius`.
+template <typename T, int C>
+void medianRows(const Image<T, C>& src, int radius, int y0, int y1, T* const* outRows);
+
+}  // namespace imgcore
@@ -0,0 +1,402 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+namespace {
+
+// Row bands are cut into at most this many chunks, each with its own
+// partial result on the stack; merging them in chunk order makes the float
+// metrics independent of the thread count.
+constexpr int MAX_CHUNKS = 64;
+
+// Rows per chunk: enough chunks to balance a pool, but at least ~64K
+// samples each so the merge stays negligible.
+int chunkRows(int rows, int rowSamples) {
+    const int balanced = (rows + MAX_CHUNKS - 1) / MAX_CHUNKS;
+    const int large = (1 << 16) / std::max(rowSamples, 1);
+    return std::max({balanced, large, 1});
+}
+
+// Runs fn(y0, y1, partial, slot) over chunks of [begin, end) and merges
+// the partials in order.
+template <typename Result, typename Fn>
+void chunked(int begin, int end, int grain, ThreadPool* pool, Result& result, Fn fn) {
+    const int chunks = (end - begin + grain - 1) / grain;
+    Result partials[MAX_CHUNKS];
+    auto chunk = [&](int k, int slot) {
+        fn(begin + k * grain, std::min(end, begin + (k + 1) * grain), partials[k], slot);
+    };
+    if (pool && chunks > 1) {
+        pool->parallelFor(0, chunks, 1, [&](int k0, int k1, int slot) {
+            for (int k = k0; k < k1; ++k) chunk(k, slot);
+        });
+    } else {
+        for (int k = 0; k < chunks; ++k) chunk(k, 0);
+    }
+    for (int k = 0; k < chunks; ++k) result.merge(partials[k]);
+}
+
+// Adds the squared differences of `width` interleaved pixels to sums[c].
+template <int C>
+void ssdRow(const unsigned char* a, const unsigned char* b, int width, uint64_t* sums) {
+    const int n = width * C;
+    int i = 0;
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    auto squares = [&](__m256i va, __m256i vb, __m256i& lo, __m256i& hi) {
+        const __m256i dlo = _mm256_sub_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+        const __m256i dhi = _mm256_sub_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+        lo = dlo;
+        hi = dhi;
+    };
+    auto flush = [](__m256i& acc, uint64_t& sum) {
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        for (uint32_t v : lanes) sum += v;
+        acc = _mm256_setzero_si256();
+    };
+    if constexpr (C == 1) {
+        // A lane gains at most 4 * 255^2 per block: flush well before 2^31.
+        constexpr int FLUSH_BLOCKS = 8192;
+        __m256i acc = _mm256_setzero_si256();
+        int blocks = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i dlo, dhi;
+            squares(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)), dlo, dhi);
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(dlo, dlo), _mm256_madd_epi16(dhi, dhi)));
+            if (++blocks == FLUSH_BLOCKS) {
+                flush(acc, sums[0]);
+                blocks = 0;
+            }
+        }
+        flush(acc, sums[0]);
+    } else if constexpr (C == 3) {
+        // 96-byte blocks keep the channel of every byte position fixed; a
+        // 16-bit mask per (vector, half, channel) selects one channel's
+        // differences before the multiply-add. Masks come from running the
+        // same unpack on the channel index of each byte.
+        __m256i mask[3][2][3];
+        for (int v = 0; v < 3; ++v) {
+            alignas(32) unsigned char ids[32];
+            for (int k = 0; k < 32; ++k) ids[k] = static_cast<unsigned char>((32 * v + k) % 3);
+            const __m256i id = _mm256_load_si256(reinterpret_cast<const __m256i*>(ids));
+            const __m256i half[2] = {_mm256_unpacklo_epi8(id, zero), _mm256_unpackhi_epi8(id, zero)};
+            for (int h = 0; h < 2; ++h) {
+                for (int c = 0; c < 3; ++c) mask[v][h][c] = _mm256_cmpeq_epi16(half[h], _mm256_set1_epi16(c));
+            }
+        }
+        // Six multiply-adds of at most 2 * 255^2 reach a lane per block.
+        constexpr int FLUSH_BLOCKS = 2048;
+        __m256i acc[3] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+        int blocks = 0;
+        for (; i + 96 <= n; i += 96) {
+            for (int v = 0; v < 3; ++v) {
+                __m256i d[2];
+                squares(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32 * v)),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32 * v)), d[0], d[1]);
+                for (int h = 0; h < 2; ++h) {
+                    for (int c = 0; c < 3; ++c) {
+                        const __m256i selected = _mm256_and_si256(d[h], mask[v][h][c]);
+                        acc[c] = _mm256_add_epi32(acc[c], _mm256_madd_epi16(selected, d[h]));
+                    }
+                }
+            }
+            if (++blocks == FLUSH_BLOCKS) {
+                for (int c = 0; c < 3; ++c) flush(acc[c], sums[c]);
+                blocks = 0;
+            }
+        }
+        for (int c = 0; c < 3; ++c) flush(acc[c], sums[c]);
+    }
+#endif
+    // i is a multiple of C here, so the channel of sample i is i % C.
+    for (; i < n; ++i) {
+        const int d = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+        sums[i % C] += static_cast<uint64_t>(d * d);
+    }
+}
+
+// Normalised Gaussian taps of the SSIM window.
+void ssimTaps(const SsimParams& params, std::vector<float>& taps) {
+    taps.resize(2 * params.radius + 1);
+    double sum = 0.0;
+    for (int k = -params.radius; k <= params.radius; ++k) {
+        sum += std::exp(-(k * k) / (2.0 * params.sigma * params.sigma));
+    }
+    for (int k = -params.radius; k <= params.radius; ++k) {
+        taps[k + params.radius] = static_cast<float>(std::exp(-(k * k) / (2.0 * params.sigma * params.sigma)) / sum);
+    }
+}
+
+#ifdef __AVX2__
+inline __m256 load8(const unsigned char* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+inline __m256 load8(const float* p) { return _mm256_loadu_ps(p); }
+#endif
+
+// SSIM and cs for the window centres [x0, x1) x [y0, y1), all of whose
+// windows lie inside the frame. Per centre row, the vertical pass weights
+// the five moments (a, b, a^2, b^2, ab) of the 2r+1 rows into `scratch`,
+// over every interleaved sample the row's windows touch; the horizontal
+// pass then weights those columns C samples apart.
+template <typename T, int C>
+void ssimRows(const ImageView<T, C>& a, const ImageView<T, C>& b, const std::vector<float>& taps, float c1, float c2,
+              int x0, int x1, int y0, int y1, std::vector<float>& scratch, SsimResult<C>& result) {
+    const int radius = static_cast<int>(taps.size()) / 2;
+    const int span = static_cast<int>(taps.size());
+    const int n = (x1 - x0 + 2 * radius) * C;  // samples read per row
+    const int m = (x1 - x0) * C;               // samples scored per row
+    if (scratch.size() < static_cast<size_t>(5) * n) scratch.resize(static_cast<size_t>(5) * n);
+    float* va = scratch.data();
+    float* vb = va + n;
+    float* vaa = vb + n;
+    float* vbb = vaa + n;
+    float* vab = vbb + n;
+    const int offset = (x0 - radius) * C;
+
+    for (int y = y0; y < y1; ++y) {
+        std::fill(scratch.begin(), scratch.begin() + 5 * n, 0.0f);
+        for (int k = 0; k < span; ++k) {
+            const T* ra = a.row(y - radius + k) + offset;
+            const T* rb = b.row(y - radius + k) + offset;
+            const float w = taps[k];
+            int i = 0;
+#ifdef __AVX2__
+            const __m256 vw = _mm256_set1_ps(w);
+            for (; i + 8 <= n; i += 8) {
+                const __m256 fa = load8(ra + i);
+                const __m256 fb = load8(rb + i);
+                const __m256 wa = _mm256_mul_ps(vw, fa);
+                const __m256 wb = _mm256_mul_ps(vw, fb);
+                _mm256_storeu_ps(va + i, _mm256_add_ps(_mm256_loadu_ps(va + i), wa));
+                _mm256_storeu_ps(vb + i, _mm256_add_ps(_mm256_loadu_ps(vb + i), wb));
+                _mm256_storeu_ps(vaa + i, _mm256_add_ps(_mm256_loadu_ps(vaa + i), _mm256_mul_ps(wa, fa)));
+                _mm256_storeu_ps(vbb + i, _mm256_add_ps(_mm256_loadu_ps(vbb + i), _mm256_mul_ps(wb, fb)));
+                _mm256_storeu_ps(vab + i, _mm256_add_ps(_mm256_loadu_ps(vab + i), _mm256_mul_ps(wa, fb)));
+            }
+#endif
+            for (; i < n; ++i) {
+                const float fa = static_cast<float>(ra[i]);
+                const float fb = static_cast<float>(rb[i]);
+                const float wa = w * fa;
+                const float wb = w * fb;
+                va[i] += wa;
+                vb[i] += wb;
+                vaa[i] += wa * fa;
+                vbb[i] += wb * fb;
+                vab[i] += wa * fb;
+            }
+        }
+
+        double ssimSum[C] = {};
+        double csSum[C] = {};
+        int i = 0;
+#ifdef __AVX2__
+        // Accumulator j collects the vectors whose index is j mod C, so
+        // each of its lanes always holds the same channel.
+        __m256 ssimAcc[C], csAcc[C];
+        for (int j = 0; j < C; ++j) ssimAcc[j] = csAcc[j] = _mm256_setzero_ps();
+        const __m256 vc1 = _mm256_set1_ps(c1), vc2 = _mm256_set1_ps(c2), two = _mm256_set1_ps(2.0f);
+        for (int q = 0; i + 8 <= m; i += 8, ++q) {
+            __m256 ha = _mm256_setzero_ps(), hb = ha, haa = ha, hbb = ha, hab = ha;
+            for (int k = 0; k < span; ++k) {
+                const __m256 w = _mm256_set1_ps(taps[k]);
+                const int at = i + k * C;
+                ha = _mm256_add_ps(ha, _mm256_mul_ps(w, _mm256_loadu_ps(va + at)));
+                hb = _mm256_add_ps(hb, _mm256_mul_ps(w, _mm256_loadu_ps(vb + at)));
+                haa = _mm256_add_ps(haa, _mm256_mul_ps(w, _mm256_loadu_ps(vaa + at)));
+                hbb = _mm256_add_ps(hbb, _mm256_mul_ps(w, _mm256_loadu_ps(vbb + at)));
+                hab = _mm256_add_ps(hab, _mm256_mul_ps(w, _mm256_loadu_ps(vab + at)));
+            }
+            const __m256 muab = _mm256_mul_ps(ha, hb);
+            const __m256 mua2 = _mm256_mul_ps(ha, ha), mub2 = _mm256_mul_ps(hb, hb);
+            const __m256 sigmaSum = _mm256_sub_ps(_mm256_add_ps(haa, hbb), _mm256_add_ps(mua2, mub2));
+            const __m256 sigmaAb = _mm256_sub_ps(hab, muab);
+            const __m256 cs =
+                _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(two, sigmaAb), vc2), _mm256_add_ps(sigmaSum, vc2));
+            const __m256 l = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(two, muab), vc1),
+                                           _mm256_add_ps(_mm256_add_ps(mua2, mub2), vc1));
+            const int j = C == 1 ? 0 : q % C;
+            ssimAcc[j] = _mm256_add_ps(ssimAcc[j], _mm256_mul_ps(l, cs));
+            csAcc[j] = _mm256_add_ps(csAcc[j], cs);
+        }
+        for (int j = 0; j < C; ++j) {
+            alignas(32) float s[8], t[8];
+            _mm256_store_ps(s, ssimAcc[j]);
+            _mm256_store_ps(t, csAcc[j]);
+            for (int lane = 0; lane < 8; ++lane) {
+                ssimSum[(8 * j + lane) % C] += s[lane];
+                csSum[(8 * j + lane) % C] += t[lane];
+            }
+        }
+#endif
+        for (; i < m; ++i) {
+            float ha = 0.0f, hb = 0.0f, haa = 0.0f, hbb = 0.0f, hab = 0.0f;
+            for (int k = 0; k < span; ++k) {
+                const float w = taps[k];
+                const int at = i + k * C;
+                ha += w * va[at];
+                hb += w * vb[at];
+                haa += w * vaa[at];
+                hbb += w * vbb[at];
+                hab += w * vab[at];
+            }
+            const float muab = ha * hb, mua2 = ha * ha, mub2 = hb * hb;
+            const float cs = (2.0f * (hab - muab) + c2) / ((haa + hbb) - (mua2 + mub2) + c2);
+            const float l = (2.0f * muab + c1) / (mua2 + mub2 + c1);
+            ssimSum[i % C] += l * cs;
+            csSum[i % C] += cs;
+        }
+        for (int c = 0; c < C; ++c) {
+            result.ssimSum[c] += ssimSum[c];
+            result.csSum[c] += csSum[c];
+        }
+        result.windows += static_cast<uint64_t>(x1 - x0);
+    }
+}
+
+template <typename T, int C>
+SsimResult<C> ssimOver(const ImageView<T, C>& a, const ImageView<T, C>& b, const SsimParams& params,
+                       const ImageRegion& region, ThreadPool* pool, MetricsWorkspace<C>& workspace) {
+    SsimResult<C> result;
+    const int radius = params.radius;
+    const ImageRegion r = region.clippedTo(a.width(), a.height());
+    const int x0 = std::max(r.x, radius), x1 = std::min(r.x + r.width, a.width() - radius);
+    const int y0 = std::max(r.y, radius), y1 = std::min(r.y + r.height, a.height() - radius);
+    if (x0 >= x1 || y0 >= y1) return result;
+
+    ssimTaps(params, workspace.taps);
+    const float c1 = static_cast<float>((params.k1 * 255.0) * (params.k1 * 255.0));
+    const float c2 = static_cast<float>((params.k2 * 255.0) * (params.k2 * 255.0));
+    const int slots = pool ? pool->slots() : 1;
+    if (workspace.rows.size() < static_cast<size_t>(slots)) workspace.rows.resize(slots);
+    // Each row costs ~10 (2r+1) multiply-adds per sample, so chunks can be
+    // much shorter than for the SSD.
+    const int grain = std::max((y1 - y0 + MAX_CHUNKS - 1) / MAX_CHUNKS, 4);
+    chunked(y0, y1, grain, pool, result, [&](int b0, int b1, SsimResult<C>& partial, int slot) {
+        ssimRows(a, b, workspace.taps, c1, c2, x0, x1, b0, b1, workspace.rows[slot], partial);
+    });
+    return result;
+}
+
+// Each output pixel is the mean of a 2x2 block; an odd last row or column
+// is dropped.
+template <typename T, int C>
+void halve(const ImageView<T, C>& src, Image<float, C>& dst) {
+    dst.resize(src.width() / 2, src.height() / 2, dst.border());
+    for (int y = 0; y < dst.height(); ++y) {
+        const T* r0 = src.row(2 * y);
+        const T* r1 = src.row(2 * y + 1);
+        float* out = dst.row(y);
+        for (int x = 0; x < dst.width(); ++x) {
+            for (int c = 0; c < C; ++c) {
+                const int i = 2 * x * C + c;
+                out[x * C + c] = 0.25f * (static_cast<float>(r0[i]) + static_cast<float>(r0[i + C]) +
+                                          static_cast<float>(r1[i]) + static_cast<float>(r1[i + C]));
+            }
+        }
+    }
+}
+
+constexpr int MS_SSIM_SCALES = 5;
+constexpr double MS_SSIM_WEIGHTS[MS_SSIM_SCALES] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+}  // namespace
+
+template <int C>
+std::array<uint64_t, C> sumSquaredDifferences(const ImageView<unsigned char, C>& a,
+                                              const ImageView<unsigned char, C>& b, const ImageRegion& region,
+                                              ThreadPool* pool) {
+    return measurePsnr(a, b, region, pool).ssd;
+}
+
+template <int C>
+PsnrResult<C> measurePsnr(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                          const ImageRegion& region, ThreadPool* pool) {
+    PsnrResult<C> result;
+    const ImageRegion r = region.clippedTo(reference.width(), reference.height());
+    if (r.width == 0 || r.height == 0) return result;
+    const int grain = chunkRows(r.height, r.width * C);
+    chunked(r.y, r.y + r.height, grain, pool, result, [&](int y0, int y1, PsnrResult<C>& partial, int) {
+        for (int y = y0; y < y1; ++y) {
+            ssdRow<C>(reference.row(y) + r.x * C, test.row(y) + r.x * C, r.width, partial.ssd.data());
+        }
+        partial.pixels += static_cast<uint64_t>(y1 - y0) * r.width;
+    });
+    return result;
+}
+
+template <int C>
+SsimResult<C> measureSsim(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                          const SsimParams& params, const ImageRegion& region, ThreadPool* pool,
+                          MetricsWorkspace<C>* workspace) {
+    MetricsWorkspace<C> local;
+    return ssimOver(reference, test, params, region, pool, workspace ? *workspace : local);
+}
+
+template <int C>
+double measureMsSsim(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                     const SsimParams& params, ThreadPool* pool, MetricsWorkspace<C>* workspace) {
+    MetricsWorkspace<C> local;
+    MetricsWorkspace<C>& ws = workspace ? *workspace : local;
+    const int window = 2 * params.radius + 1;
+
+    SsimResult<C> scales[MS_SSIM_SCALES];
+    int used = 0;
+    for (int s = 0; s < MS_SSIM_SCALES; ++s) {
+        // Scale s > 0 lives in pyramid[2 (s - 1)] (reference) and the slot after it (test).
+        Image<float, C>* level = s > 0 ? &ws.pyramid[2 * (s - 1)] : nullptr;
+        if (s == 1) {
+            halve(reference, level[0]);
+            halve(test, level[1]);
+        } else if (s > 1) {
+            halve(ImageView<float, C>(ws.pyramid[2 * (s - 2)]), level[0]);
+            halve(ImageView<float, C>(ws.pyramid[2 * (s - 2) + 1]), level[1]);
+        }
+        const int width = s > 0 ? level[0].width() : reference.width();
+        const int height = s > 0 ? level[0].height() : reference.height();
+        if (width < window || height < window) break;
+        scales[s] = s > 0 ? ssimOver(ImageView<float, C>(level[0]), ImageView<float, C>(level[1]), params, {}, pool, ws)
+                          : ssimOver(reference, test, params, {}, pool, ws);
+        used = s + 1;
+    }
+    if (used == 0) return 1.0;
+
+    double weightSum = 0.0;
+    for (int s = 0; s < used; ++s) weightSum += MS_SSIM_WEIGHTS[s];
+    double total = 0.0;
+    for (int c = 0; c < C; ++c) {
+        double product = 1.0;
+        for (int s = 0; s < used; ++s) {
+            const double term = s + 1 < used ? scales[s].cs(c) : scales[s].ssim(c);
+            product *= std::pow(std::max(term, 0.0), MS_SSIM_WEIGHTS[s] / weightSum);
+        }
+        total += product;
+    }
+    return total / C;
+}
+
+template std::array<uint64_t, 1> sumSquaredDifferences<1>(const GrayView&, const GrayView&, const ImageRegion&,
+                                                          ThreadPool*);
+template std::array<uint64_t, 3> sumSquaredDifferences<3>(const RgbView&, const RgbView&, const ImageRegion&,
+                                                          ThreadPool*);
+template PsnrResult<1> measurePsnr(const GrayView&, const GrayView&, const ImageRegion&, ThreadPool*);
+template PsnrResult<3> measurePsnr(const RgbView&, const RgbView&, const ImageRegion&, ThreadPool*);
+template SsimResult<1> measureSsim(const GrayView&, const GrayView&, const SsimParams&, const ImageRegion&,
+                                   ThreadPool*, MetricsWorkspace<1>*);
+template SsimResult<3> measureSsim(const RgbView&, const RgbView&, const SsimParams&, const ImageRegion&,
+                                   ThreadPool*, MetricsWorkspace<3>*);
+template double measureMsSsim(const GrayView&, const GrayView&, const SsimParams&, ThreadPool*,
+                              MetricsWorkspace<1>*);
+template double measureMsSsim(const RgbView&, const RgbView&, const SsimParams&, ThreadPool*,
+                              MetricsWorkspace<3>*);
+
+}  // namespace imgcore
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// Exact per-channel sums of squared differences over `region` (clipped; the
+// empty one is the whole frame) of two equally sized images. Differences
+// are squared and paired in 16-bit lanes (AVX2 multiply-adds when
+// available) and widened to 64 bits before they can overflow, so nothing
+// is allocated and the sums do not depend on the thread count. Row bands
+// run on `pool` when given.
+template <int C>
+std::array<uint64_t, C> sumSquaredDifferences(const ImageView<unsigned char, C>& a,
+                                              const ImageView<unsigned char, C>& b, const ImageRegion& region = {},
+                                              ThreadPool* pool = nullptr);
+
+// Identical images report 100 dB instead of infinity.
+inline double psnrFromMse(double mse, double maxVal = 255.0) {
+    if (mse == 0) return 100.0;
+    return 10.0 * std::log10((maxVal * maxVal) / mse);
+}
+
+// Per-channel and overall PSNR of one comparison. The raw sums are kept, so
+// results for the tiles of a frame merge into exactly the whole-frame one.
+template <int C>
+struct PsnrResult {
+    std::array<uint64_t, C> ssd{};
+    uint64_t pixels = 0;
+
+    double mse(int c) const { return pixels ? static_cast<double>(ssd[c]) / pixels : 0.0; }
+    double psnr(int c) const { return psnrFromMse(mse(c)); }
+    double mse() const {
+        uint64_t total = 0;
+        for (int c = 0; c < C; ++c) total += ssd[c];
+        return pixels ? static_cast<double>(total) / (static_cast<double>(pixels) * C) : 0.0;
+    }
+    double psnr() const { return psnrFromMse(mse()); }
+
+    void merge(const PsnrResult& other) {
+        for (int c = 0; c < C; ++c) ssd[c] += other.ssd[c];
+        pixels += other.pixels;
+    }
+};
+
+template <int C>
+PsnrResult<C> measurePsnr(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                          const ImageRegion& region = {}, ThreadPool* pool = nullptr);
+
+// Mean squared error over the visible samples of two equally sized images.
+// Either argument may be an Image or an ImageView; 8-bit inputs take the
+// integer path above, which gives the same value as the double loop.
+template <typename A, typename B>
+double calculateMSE(const A& original, const B& filtered) {
+    if constexpr (std::is_same_v<typename A::value_type, unsigned char> &&
+                  std::is_same_v<typename B::value_type, unsigned char>) {
+        constexpr int C = A::CHANNELS;
+        return measurePsnr<C>(ImageView<unsigned char, C>(original), ImageView<unsigned char, C>(filtered)).mse();
+    } else {
+        double sum = 0.0;
+        const int rowSamples = original.width() * A::CHANNELS;
+        for (int y = 0; y < original.height(); ++y) {
+            const auto* a = original.row(y);
+            const auto* b = filtered.row(y);
+            for (int i = 0; i < rowSamples; ++i) {
+                double diff = static_cast<double>(a[i]) - static_cast<double>(b[i]);
+                sum += diff * diff;
+            }
+        }
+        return sum / static_cast<double>(original.sampleCount());
+    }
+}
+
+template <typename A, typename B>
+double calculatePSNR(const A& original, const B& filtered, double maxVal = 255.0) {
+    return psnrFromMse(calculateMSE(original, filtered), maxVal);
+}
+
+// SSIM with a Gaussian window (Wang et al. 2004): 2 * radius + 1 taps of
+// standard deviation sigma, 8-bit dynamic range.
+struct SsimParams {
+    int radius = 5;
+    double sigma = 1.5;
+    double k1 = 0.01;
+    double k2 = 0.03;
+};
+
+// Window sums of one comparison. Only windows that lie entirely inside the
+// frame are scored, so results for row bands of a frame (each given the
+// whole frame and its band as the region) merge into the whole-frame one.
+template <int C>
+struct SsimResult {
+    std::array<double, C> ssimSum{};
+    std::array<double, C> csSum{};  // contrast-structure term, used by MS-SSIM
+    uint64_t windows = 0;           // per channel
+
+    double ssim(int c) const { return windows ? ssimSum[c] / windows : 1.0; }
+    double cs(int c) const { return windows ? csSum[c] / windows : 1.0; }
+    // Mean over the channels.
+    double ssim() const {
+        double sum = 0.0;
+        for (int c = 0; c < C; ++c) sum += ssim(c);
+        return sum / C;
+    }
+
+    void merge(const SsimResult& other) {
+        for (int c = 0; c < C; ++c) {
+            ssimSum[c] += other.ssimSum[c];
+            csSum[c] += other.csSum[c];
+        }
+        windows += other.windows;
+    }
+};
+
+// Scratch for SSIM and MS-SSIM: window taps, filter rows per pool slot and
+// the MS-SSIM pyramid. Passing the same workspace to every call keeps
+// repeated evaluation (e.g. a parameter sweep) off the allocator.
+template <int C>
+struct MetricsWorkspace {
+    std::vector<float> taps;
+    std::vector<std::vector<float>> rows;
+    std::array<Image<float, C>, 8> pyramid;  // reference and test at scales 2 to 5
+};
+
+// Mean SSIM over the windows centred in `region` (clipped; the empty one is
+// the whole frame) that fit inside the frame. The window is applied
+// separably: a vertical then a horizontal float pass over the five moments
+// of the interleaved row (AVX2 when available), so all channels share one
+// pass. Row bands run on `pool` when given.
+template <int C>
+SsimResult<C> measureSsim(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                          const SsimParams& params = {}, const ImageRegion& region = {}, ThreadPool* pool = nullptr,
+                          MetricsWorkspace<C>* workspace = nullptr);
+
+// Multi-scale SSIM (Wang, Simoncelli & Bovik 2003): five scales, each half
+// the size of the previous one by 2x2 averaging, combined as
+// prod cs_j^w_j * ssim_5^w_5 with the paper's weights, per channel and then
+// averaged. Negative terms count as 0. Scales too small for a whole window
+// are dropped and the remaining weights renormalised.
+template <int C>
+double measureMsSsim(const ImageView<unsigned char, C>& reference, const ImageView<unsigned char, C>& test,
+                     const SsimParams& params = {}, ThreadPool* pool = nullptr,
+                     MetricsWorkspace<C>* workspace = nullptr);
+
+}  // namespace imgcore
@@ -0,0 +1,241 @@
+#include "nlm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+
+const int TILE_ROWS = 16;
+const int FIXED_LUT_SIZE = 4096;
+
+// Integral images of squared differences. They may wrap as long as every
+// patch sum fits: 32 bits do for 8-bit samples, 16-bit samples (up to
+// 2^32 per squared difference) take 64; float ones cannot wrap and sum in
+// double.
+template <typename T>
+using IntegralSum = std::conditional_t<std::is_same_v<T, unsigned char>, uint32_t,
+                                       std::conditional_t<std::is_same_v<T, float>, double, uint64_t>>;
+
+template <typename T>
+struct TileScratch {
+    std::vector<IntegralSum<T>> integral;
+    std::vector<float> numF, denF;
+    std::vector<uint32_t> numI, denI;
+};
+
+// exp(-d / h^2) tabulated over d in [0, dMax) for the fixed-point mode. The
+// weights get as many fractional bits as the accumulators allow: with N
+// search offsets the numerator reaches N * 255 * 2^bits.
+struct FixedWeightTable {
+    int bits;
+    uint64_t indexScale;  // index = (ssd * indexScale) >> 32
+    std::vector<uint32_t> table;
+
+    FixedWeightTable(float h, int patchArea, int offsets) {
+        bits = 0;
+        while (bits < 16 && (static_cast<uint64_t>(offsets) * 255) << (bits + 1) <= UINT32_MAX) ++bits;
+        const double h2 = std::max(1e-6, static_cast<double>(h) * h);
+        // Beyond dMax the weight is below half an LSB and rounds to zero.
+        const double dMax = h2 * (bits + 1) * std::log(2.0);
+        table.resize(FIXED_LUT_SIZE);
+        for (int i = 0; i < FIXED_LUT_SIZE; ++i) {
+            double d = (i + 0.5) * dMax / FIXED_LUT_SIZE;
+            table[i] = static_cast<uint32_t>(std::lround(std::exp(-d / h2) * (1 << bits)));
+        }
+        table[0] = 1u << bits;
+        indexScale = static_cast<uint64_t>(std::min(std::ldexp(FIXED_LUT_SIZE / (dMax * patchArea), 32), 0x1p62));
+    }
+
+    uint32_t operator()(uint32_t ssd) const {
+        uint64_t index = (static_cast<uint64_t>(ssd) * indexScale) >> 32;
+        return index < static_cast<uint64_t>(FIXED_LUT_SIZE) ? table[index] : 0;
+    }
+};
+
+// Fills `integral` ((rows + 1) x (cols + 1), zero first row and column)
+// with the running sums of (g(y, x) - g(y + dy, x + dx))^2 over the tile
+// rows [y0 - tr, y1 + tr) and columns [-tr, width + tr). Integer sums
+// wrap modulo the width of IntegralSum, which is harmless: every patch sum
+// taken from them fits, so the four-corner difference is still exact.
+template <typename T>
+void squaredDiffIntegral(const Image<T, 1>& g, int y0, int rows, int cols, int tr, int dy, int dx,
+                         IntegralSum<T>* integral) {
+    using Sum = IntegralSum<T>;
+    const int pitch = cols + 1;
+    std::fill(integral, integral + pitch, Sum(0));
+    for (int i = 0; i < rows; ++i) {
+        const T* a = g.row(y0 - tr + i) - tr;
+        const T* b = g.row(y0 - tr + i + dy) - tr + dx;
+        const Sum* above = integral + i * pitch;
+        Sum* cur = integral + (i + 1) * pitch;
+        cur[0] = 0;
+        Sum rowSum = 0;
+        for (int j = 0; j < cols; ++j) {
+            if constexpr (std::is_same_v<T, float>) {
+                const double d = static_cast<double>(a[j]) - b[j];
+                rowSum += d * d;
+            } else {
+                const int64_t d = static_cast<int64_t>(a[j]) - b[j];
+                rowSum += static_cast<Sum>(d * d);
+            }
+            cur[j + 1] = above[j + 1] + rowSum;
+        }
+    }
+}
+
+template <typename T, int C>
+void denoiseTile(const Image<T, C>& in, const std::vector<Image<T, 1>>& guides, Image<T, C>& dst,
+                 const NlmParams& params, const FixedWeightTable* fixed, int y0, int y1, TileScratch<T>& scratch) {
+    using Sum = IntegralSum<T>;
+    const int width = in.width();
+    const int tr = params.templateSize / 2;
+    const int sr = params.searchSize / 2;
+    const int rows = y1 - y0 + 2 * tr;
+    const int cols = width + 2 * tr;
+    const int pitch = cols + 1;
+    const int box = 2 * tr + 1;
+    const size_t planeSize = static_cast<size_t>(rows + 1) * pitch;
+    const size_t samples = static_cast<size_t>(y1 - y0) * width * C;
+    const int planes = static_cast<int>(guides.size());
+    const bool useFixed = fixed != nullptr;
+    // h is in 8-bit levels, so distances of wider types are scaled to them.
+    const float toLevels = 255.0f / PixelTraits<T>::maxValue;
+    const float invNorm =
+        toLevels * toLevels / (static_cast<float>(box * box) * std::max(1e-6f, params.h * params.h));
+
+    scratch.integral.resize(planeSize * planes);
+    if (useFixed) {
+        scratch.numI.assign(samples, 0);
+        scratch.denI.assign(samples, 0);
+    } else {
+        scratch.numF.assign(samples, 0.0f);
+        scratch.denF.assign(samples, 0.0f);
+    }
+
+    for (int dy = -sr; dy <= sr; ++dy) {
+        for (int dx = -sr; dx <= sr; ++dx) {
+            for (int k = 0; k < planes; ++k) {
+                squaredDiffIntegral(guides[k], y0, rows, cols, tr, dy, dx, &scratch.integral[k * planeSize]);
+            }
+            for (int y = y0; y < y1; ++y) {
+                const int t = y - y0;
+                const T* shifted = in.row(y + dy) + dx * C;
+                const size_t base = static_cast<size_t>(t) * width * C;
+                for (int c = 0; c < C; ++c) {
+                    const Sum* top = &scratch.integral[(planes == 1 ? 0 : c) * planeSize + t * pitch];
+                    const Sum* bottom = top + box * pitch;
+                    if (useFixed) {
+                        if constexpr (std::is_same_v<T, unsigned char>) {
+                            uint32_t* num = &scratch.numI[base];
+                            uint32_t* den = &scratch.denI[base];
+                            for (int x = 0; x < width; ++x) {
+                                uint32_t ssd = bottom[x + box] - top[x + box] - bottom[x] + top[x];
+                                uint32_t w = (*fixed)(ssd);
+                                num[x * C + c] += w * shifted[x * C + c];
+                                den[x * C + c] += w;
+                            }
+                        }
+                    } else {
+                        float* num = &scratch.numF[base];
+                        float* den = &scratch.denF[base];
+                        for (int x = 0; x < width; ++x) {
+                            Sum ssd = bottom[x + box] - top[x + box] - bottom[x] + top[x];
+                            float w = std::exp(-static_cast<float>(ssd) * invNorm);
+                            num[x * C + c] += w * shifted[x * C + c];
+                            den[x * C + c] += w;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        T* out = dst.row(y);
+        const size_t base = static_cast<size_t>(y - y0) * width * C;
+        for (int s = 0; s < width * C; ++s) {
+            if (useFixed) {
+                // The zero offset always contributes 2^bits, so den > 0.
+                uint32_t den = scratch.denI[base + s];
+                out[s] = static_cast<T>((scratch.numI[base + s] + den / 2) / den);
+            } else {
+                out[s] = roundPixel<T>(scratch.numF[base + s] / scratch.denF[base + s]);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+template <typename T, int C>
+void nlMeansDenoise(const Image<T, C>& src, Image<T, C>& dst, const NlmParams& params, ThreadPool* pool) {
+    ProfileScope scope("nlm");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    const int tr = params.templateSize / 2;
+    const int sr = params.searchSize / 2;
+    dst.resize(width, height, dst.border());
+    if (src.empty()) return;
+
+    Image<T, C> in = padded(src, sr + tr, BorderMode::Reflect);
+
+    // Distance planes: one per channel, or a single luma plane.
+    const bool luma = C == 3 && params.color == NlmColor::LumaGuided;
+    std::vector<Image<T, 1>> guides(luma ? 1 : C);
+    for (Image<T, 1>& g : guides) g = Image<T, 1>(width, height, sr + tr);
+    for (int y = -(sr + tr); y < height + sr + tr; ++y) {
+        const T* r = in.row(y);
+        for (int x = -(sr + tr); x < width + sr + tr; ++x) {
+            const T* p = r + x * C;
+            if (luma) {
+                if constexpr (PixelTraits<T>::integer) {
+                    guides[0].row(y)[x] = static_cast<T>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+                } else {
+                    guides[0].row(y)[x] = (77 * p[0] + 150 * p[1] + 29 * p[2]) / 256.0f;
+                }
+            } else {
+                for (int c = 0; c < C; ++c) guides[c].row(y)[x] = p[c];
+            }
+        }
+    }
+
+    const int box = 2 * tr + 1;
+    const int side = 2 * sr + 1;
+    FixedWeightTable table(params.h, box * box, side * side);
+    const bool useFixed = std::is_same_v<T, unsigned char> && params.weights == NlmWeights::Fixed;
+    const FixedWeightTable* fixed = useFixed ? &table : nullptr;
+
+    const int tiles = (height + TILE_ROWS - 1) / TILE_ROWS;
+    auto runTiles = [&](int begin, int end, TileScratch<T>& scratch) {
+        for (int t = begin; t < end; ++t) {
+            const int y0 = t * TILE_ROWS, y1 = std::min(height, (t + 1) * TILE_ROWS);
+            ProfileScope tileScope("nlm", "tile");
+            tileScope.tile(t).pixels(static_cast<uint64_t>(width) * (y1 - y0));
+            denoiseTile(in, guides, dst, params, fixed, y0, y1, scratch);
+        }
+    };
+    if (pool) {
+        WorkerLocal<TileScratch<T>> scratch(*pool);
+        pool->parallelFor(0, tiles, 1, [&](int begin, int end, int slot) { runTiles(begin, end, scratch[slot]); });
+    } else {
+        TileScratch<T> scratch;
+        runTiles(0, tiles, scratch);
+    }
+}
+
+template void nlMeansDenoise(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, const NlmParams&, ThreadPool*);
+template void nlMeansDenoise(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, const NlmParams&, ThreadPool*);
+template void nlMeansDenoise(const Image<uint16_t, 1>&, Image<uint16_t, 1>&, const NlmParams&, ThreadPool*);
+template void nlMeansDenoise(const Image<uint16_t, 3>&, Image<uint16_t, 3>&, const NlmParams&, ThreadPool*);
+template void nlMeansDenoise(const Image<float, 1>&, Image<float, 1>&, const NlmParams&, ThreadPool*);
+template void nlMeansDenoise(const Image<float, 3>&, Image<float, 3>&, const NlmParams&, ThreadPool*);
+
+}  // namespace imgcore
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "image.h"
+#include "pixel.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+enum class NlmWeights {
+    Float,  // exp() per weight, float accumulators
+    Fixed   // table-driven integer weights, 32-bit integer accumulators (8-bit frames only)
+};
+
+enum class NlmColor {
+    PerChannel,  // each channel uses its own patch distances
+    LumaGuided   // one distance on BT.601 luma weights every channel
+};
+
+struct NlmParams {
+    float h = 10.0f;        // filter strength in 8-bit levels, as in OpenCV's fastNlMeansDenoising
+    int templateSize = 7;   // odd patch size
+    int searchSize = 21;    // odd search window size
+    NlmWeights weights = NlmWeights::Float;
+    NlmColor color = NlmColor::PerChannel;
+};
+
+// Non-local means with the weight exp(-d / h^2), d being the mean squared
+// difference between the two patches (OpenCV's definition). For every
+// search offset the squared differences of the shifted image are summed
+// into an integral image, so a patch distance is four lookups whatever the
+// patch size. Borders are mirrored (Reflect). The frame is cut into row
+// tiles that run on `pool` when one is given, each with its own scratch.
+// For uint16_t and float frames the distances are scaled to 8-bit levels
+// so `h` keeps its meaning, the integral images are 64-bit (double for
+// float) and the weights are always Float.
+template <typename T, int C>
+void nlMeansDenoise(const Image<T, C>& src, Image<T, C>& dst, const NlmParams& params, ThreadPool* pool = nullptr);
+
+}  // namespace imgcore
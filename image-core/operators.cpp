@@ -0,0 +1,523 @@
+#include "operators.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <tuple>
+#include <type_traits>
+
+#include "bilateral.h"
+#include "clahe.h"
+#include "color-convert.h"
+#include "demosaic.h"
+#include "edge-preserving.h"
+#include "equalize.h"
+#include "fused-denoise.h"
+#include "isp-pipeline.h"
+#include "linear-filter.h"
+#include "median.h"
+#include "nlm.h"
+#include "profile.h"
+#include "white-balance.h"
+
+namespace imgcore {
+
+using StepFn = std::function<void(const Frame&, Frame&, ThreadPool*)>;
+
+constexpr unsigned depthBit(PixelDepth depth) {
+    return 1u << static_cast<int>(depth);
+}
+
+const unsigned ANY_DEPTH = depthBit(PixelDepth::U8) | depthBit(PixelDepth::U16) | depthBit(PixelDepth::Float);
+
+// A configured operator; see OperatorChain.
+struct OperatorStep {
+    std::string name;
+    const char* traceName = "";  // interned `name` for the step's profile scope
+    int input = 0;   // channels required; 0 takes either
+    int output = 0;  // channels produced; 0 keeps the input's
+    int border = 0;  // border the kernel reads around its input
+    unsigned depths = ANY_DEPTH;  // depthBit() of every depth it runs on
+    BorderMode borderMode = BorderMode::Replicate;
+    StepFn run;
+    double milliseconds = 0.0;
+};
+
+namespace {
+
+// Typed access to the options of one operator. Every getter validates its
+// value; finish() then reports the options nothing asked for, so a typo
+// fails instead of silently running with the default.
+class OptionReader {
+public:
+    OptionReader(const std::string& op, const OperatorOptions& options) : op_(op), options_(options) {}
+
+    int integer(const std::string& key, int fallback, int lo, int hi, bool odd = false) {
+        const std::string* value = find(key);
+        if (!value) return fallback;
+        char* end = nullptr;
+        const long v = std::strtol(value->c_str(), &end, 10);
+        if (end == value->c_str() || *end != '\0' || v < lo || v > hi || (odd && v % 2 == 0)) {
+            fail(key, *value) << "an " << (odd ? "odd " : "") << "integer in [" << lo << ", " << hi << "]"
+                              << std::endl;
+            return fallback;
+        }
+        return static_cast<int>(v);
+    }
+
+    double number(const std::string& key, double fallback, double lo, double hi) {
+        const std::string* value = find(key);
+        if (!value) return fallback;
+        char* end = nullptr;
+        const double v = std::strtod(value->c_str(), &end);
+        if (end == value->c_str() || *end != '\0' || !(v >= lo && v <= hi)) {
+            fail(key, *value) << "a number in [" << lo << ", " << hi << "]" << std::endl;
+            return fallback;
+        }
+        return v;
+    }
+
+    // One of `choices`, compared as given.
+    std::string choice(const std::string& key, const std::string& fallback, const std::vector<std::string>& choices) {
+        const std::string* value = find(key);
+        if (!value) return fallback;
+        for (const std::string& c : choices) {
+            if (*value == c) return c;
+        }
+        std::ostream& err = fail(key, *value) << "one of";
+        for (const std::string& c : choices) err << " " << c;
+        err << std::endl;
+        return fallback;
+    }
+
+    // Raw text for options parsed by their module (CFA pattern, estimator).
+    std::string text(const std::string& key, const std::string& fallback) {
+        const std::string* value = find(key);
+        return value ? *value : fallback;
+    }
+
+    void invalid(const std::string& key) {
+        std::cerr << op_ << ": invalid " << key << " " << text(key, "") << std::endl;
+        ok_ = false;
+    }
+
+    bool finish() {
+        for (const auto& option : options_) {
+            if (!used_.count(option.first)) {
+                std::cerr << op_ << ": unknown option " << option.first << std::endl;
+                ok_ = false;
+            }
+        }
+        return ok_;
+    }
+
+private:
+    const std::string* find(const std::string& key) {
+        used_.insert(key);
+        auto it = options_.find(key);
+        return it != options_.end() ? &it->second : nullptr;
+    }
+
+    std::ostream& fail(const std::string& key, const std::string& value) {
+        ok_ = false;
+        return std::cerr << op_ << ": " << key << "=" << value << " is not ";
+    }
+
+    const std::string& op_;
+    const OperatorOptions& options_;
+    std::set<std::string> used_;
+    bool ok_ = true;
+};
+
+// Runs fn(PixelTag<T>{}, in, out, pool) with the pixel type of the input;
+// the output keeps it.
+template <typename Fn>
+StepFn anyDepth(Fn fn) {
+    return [fn](const Frame& in, Frame& out, ThreadPool* pool) {
+        withPixelType(in.depth, [&](auto tag) { fn(tag, in, out, pool); });
+    };
+}
+
+// Runs a kernel templated on the pixel type and channel count on whichever
+// image of the frame is live.
+template <typename Fn>
+StepFn eitherLayout(Fn fn) {
+    return anyDepth([fn](auto tag, const Frame& in, Frame& out, ThreadPool* pool) {
+        using T = typename decltype(tag)::type;
+        if (in.channels == 1) fn(in.image<T, 1>(), out.image<T, 1>(), pool);
+        else fn(in.image<T, 3>(), out.image<T, 3>(), pool);
+    });
+}
+
+// Runs a single-plane kernel on a gray frame, or on the luma of an RGB
+// frame: forward to YUV, the kernel on Y, and back with the original U and
+// V, all in buffers owned by the step. The kernel is instantiated for the
+// integer depths only; the histogram operators built on it have no float
+// kernel, and the chain refuses float frames for them.
+template <typename T>
+struct LumaScratch {
+    BasicYuvPlanes<T> yuv;
+    Image<T, 1> y;
+};
+
+template <typename Fn>
+StepFn onLuma(Fn fn) {
+    auto scratch = std::make_shared<std::tuple<LumaScratch<unsigned char>, LumaScratch<uint16_t>>>();
+    return anyDepth([fn, scratch](auto tag, const Frame& in, Frame& out, ThreadPool* pool) {
+        using T = typename decltype(tag)::type;
+        if constexpr (PixelTraits<T>::integer) {
+            if (in.channels == 1) {
+                fn(in.image<T, 1>(), out.image<T, 1>(), pool);
+                return;
+            }
+            LumaScratch<T>& luma = std::get<LumaScratch<T>>(*scratch);
+            rgbToYuv(in.image<T, 3>(), luma.yuv);
+            fn(luma.yuv.y, luma.y, pool);
+            yuvToRgb(luma.y, luma.yuv.u, luma.yuv.v, out.image<T, 3>());
+        }
+    });
+}
+
+// Guided and domain-transform scratch owned by the step, one workspace per
+// depth and layout, so a stream of frames reuses the same planes.
+class EdgeScratch {
+public:
+    template <typename T, int C>
+    EdgePreservingWorkspace<T, C>* get(const Image<T, C>&) {
+        return &std::get<EdgePreservingWorkspace<T, C>>(workspaces_);
+    }
+
+private:
+    std::tuple<EdgePreservingWorkspace<unsigned char, 1>, EdgePreservingWorkspace<unsigned char, 3>,
+               EdgePreservingWorkspace<uint16_t, 1>, EdgePreservingWorkspace<uint16_t, 3>,
+               EdgePreservingWorkspace<float, 1>, EdgePreservingWorkspace<float, 3>>
+        workspaces_;
+};
+
+// Bilateral weights for the range tables each depth indexes: 256 entries
+// for 8-bit frames, built up front, and 65536 for the wider types, built
+// the first time such a frame arrives.
+class DepthWeights {
+public:
+    DepthWeights(int radius, double sigmaSpatial, double sigmaRange)
+        : radius_(radius), sigmaSpatial_(sigmaSpatial), sigmaRange_(sigmaRange),
+          narrow_(radius, sigmaSpatial, sigmaRange) {}
+
+    template <typename T>
+    const BilateralWeights& get() {
+        if constexpr (std::is_same_v<T, unsigned char>) {
+            return narrow_;
+        } else {
+            if (!wide_) {
+                wide_ = std::make_unique<BilateralWeights>(radius_, sigmaSpatial_, sigmaRange_,
+                                                           PixelTraits<T>::levels);
+            }
+            return *wide_;
+        }
+    }
+
+private:
+    int radius_;
+    double sigmaSpatial_, sigmaRange_;
+    BilateralWeights narrow_;
+    std::unique_ptr<BilateralWeights> wide_;
+};
+
+const std::vector<OperatorInfo> CATALOG = {
+    {"demosaic", "gray", "pattern=GRBG method=bilinear", "Bayer mosaic to RGB; method bilinear, mhc or ahd"},
+    {"awb", "rgb", "estimator=grayworld percentile=99", "white balance; grayworld, whitepatch or grayedge"},
+    {"luma", "rgb", "", "BT.601 luma plane of an RGB frame"},
+    {"median", "any", "radius=1", "(2r+1)^2 median"},
+    {"bilateral", "any", "radius=2 sigma-c=2 sigma-s=40 grid=0", "bilateral filter; grid=1 for the bilateral grid"},
+    {"guided", "any", "radius=8 sigma-s=20", "guided filter, O(1) in the radius"},
+    {"domain", "any", "sigma-c=8 sigma-s=40 iterations=3", "domain-transform recursive filter"},
+    {"fused", "any", "median=1 radius=2 sigma-c=2 sigma-s=40", "median then bilateral over a rolling row buffer"},
+    {"nlm", "any", "h=10 template=7 search=21 weights=float color=per-channel",
+     "non-local means; weights=fixed is 8-bit"},
+    {"box", "gray", "size=3", "size x size mean"},
+    {"gaussian", "gray", "size=5 sigma=1 mode=float", "Gaussian blur; mode float, fixed (8-bit) or recursive"},
+    {"histeq", "any", "method=cdf", "histogram equalization, cdf or bucket; on luma for RGB; integer depths"},
+    {"clahe", "any", "clip=40 tiles=8", "contrast-limited adaptive equalization; on luma for RGB; integer depths"},
+    {"isp", "gray",
+     "pattern=GRBG method=bilinear estimator=grayworld percentile=99 median=1 radius=2 sigma-c=2 sigma-s=30 clip=4 "
+     "tiles=8 tile=1024x52",
+     "demosaic, awb, fused and clahe on luma, tile by tile; 8-bit"},
+};
+
+// Fills `step` for operator `name`; false for an unknown name.
+bool buildStep(const std::string& name, OptionReader& options, OperatorStep& step) {
+    if (name == "demosaic") {
+        CfaPattern pattern = CfaPattern::GRBG;
+        DemosaicMethod method = DemosaicMethod::Bilinear;
+        if (!parseCfaPattern(options.text("pattern", "GRBG"), pattern)) options.invalid("pattern");
+        if (!parseDemosaicMethod(options.text("method", "bilinear"), method)) options.invalid("method");
+        step.input = 1;
+        step.output = 3;
+        // Reflect keeps the CFA parity of the mirrored samples; AHD reads
+        // the widest footprint.
+        step.border = method == DemosaicMethod::AHD ? 5 : (method == DemosaicMethod::Malvar ? 2 : 1);
+        step.borderMode = BorderMode::Reflect;
+        step.run = anyDepth([pattern, method](auto tag, const Frame& in, Frame& out, ThreadPool* pool) {
+            using T = typename decltype(tag)::type;
+            demosaic(in.image<T, 1>(), out.image<T, 3>(), pattern, method, pool);
+        });
+    } else if (name == "awb") {
+        WhiteBalanceParams params;
+        if (!parseWhiteBalanceEstimator(options.text("estimator", "grayworld"), params.estimator)) {
+            options.invalid("estimator");
+        }
+        params.percentile = options.number("percentile", params.percentile, 0.0, 100.0);
+        step.input = 3;
+        step.run = anyDepth([params](auto tag, const Frame& in, Frame& out, ThreadPool* pool) {
+            using T = typename decltype(tag)::type;
+            whiteBalance(in.image<T, 3>(), out.image<T, 3>(), params, nullptr, pool);
+        });
+    } else if (name == "luma") {
+        auto planes = std::make_shared<std::tuple<YuvPlanes, YuvPlanes16, YuvPlanesF>>();
+        step.input = 3;
+        step.output = 1;
+        step.run = anyDepth([planes](auto tag, const Frame& in, Frame& out, ThreadPool*) {
+            using T = typename decltype(tag)::type;
+            BasicYuvPlanes<T>& yuv = std::get<BasicYuvPlanes<T>>(*planes);
+            rgbToYuv(in.image<T, 3>(), yuv);
+            out.image<T, 1>().copyFrom(yuv.y);
+        });
+    } else if (name == "median") {
+        const int radius = options.integer("radius", 1, 1, 64);
+        step.border = radius;
+        step.run = eitherLayout([radius](const auto& src, auto& dst, ThreadPool*) { medianFilter(src, dst, radius); });
+    } else if (name == "bilateral") {
+        const int radius = options.integer("radius", 2, 1, 32);
+        const double sigmaSpatial = options.number("sigma-c", 2.0, 1e-3, 1e6);
+        const double sigmaRange = options.number("sigma-s", 40.0, 1e-3, 1e6);
+        if (options.integer("grid", 0, 0, 1)) {
+            step.run = eitherLayout([sigmaSpatial, sigmaRange](const auto& src, auto& dst, ThreadPool*) {
+                bilateralGrid(src, dst, sigmaSpatial, sigmaRange);
+            });
+        } else {
+            auto weights = std::make_shared<DepthWeights>(radius, sigmaSpatial, sigmaRange);
+            step.border = radius;
+            step.run = eitherLayout([weights](const auto& src, auto& dst, ThreadPool*) {
+                using T = typename std::decay_t<decltype(src)>::value_type;
+                bilateralFilter(src, dst, weights->get<T>());
+            });
+        }
+    } else if (name == "guided") {
+        const int radius = options.integer("radius", 8, 1, 256);
+        const double sigmaRange = options.number("sigma-s", 20.0, 1e-3, 1e6);
+        auto scratch = std::make_shared<EdgeScratch>();
+        step.run = eitherLayout([radius, sigmaRange, scratch](const auto& src, auto& dst, ThreadPool* pool) {
+            guidedFilter(src, dst, radius, sigmaRange, pool, scratch->get(src));
+        });
+    } else if (name == "domain") {
+        const double sigmaSpatial = options.number("sigma-c", 8.0, 1e-3, 1e6);
+        const double sigmaRange = options.number("sigma-s", 40.0, 1e-3, 1e6);
+        const int iterations = options.integer("iterations", 3, 1, 10);
+        auto scratch = std::make_shared<EdgeScratch>();
+        step.run = eitherLayout(
+            [sigmaSpatial, sigmaRange, iterations, scratch](const auto& src, auto& dst, ThreadPool* pool) {
+                domainTransformFilter(src, dst, sigmaSpatial, sigmaRange, iterations, pool, scratch->get(src));
+            });
+    } else if (name == "fused") {
+        const int medianRadius = options.integer("median", 1, 1, 64);
+        auto weights = std::make_shared<DepthWeights>(options.integer("radius", 2, 1, 32),
+                                                      options.number("sigma-c", 2.0, 1e-3, 1e6),
+                                                      options.number("sigma-s", 40.0, 1e-3, 1e6));
+        step.border = medianRadius;
+        step.run = eitherLayout([medianRadius, weights](const auto& src, auto& dst, ThreadPool*) {
+            using T = typename std::decay_t<decltype(src)>::value_type;
+            medianBilateralFused(src, dst, medianRadius, weights->get<T>());
+        });
+    } else if (name == "nlm") {
+        NlmParams params;
+        params.h = static_cast<float>(options.number("h", params.h, 1e-3, 1e6));
+        params.templateSize = options.integer("template", params.templateSize, 1, 31, true);
+        params.searchSize = options.integer("search", params.searchSize, 1, 101, true);
+        if (options.choice("weights", "float", {"float", "fixed"}) == "fixed") {
+            params.weights = NlmWeights::Fixed;
+            step.depths = depthBit(PixelDepth::U8);
+        }
+        if (options.choice("color", "per-channel", {"per-channel", "luma"}) == "luma") {
+            params.color = NlmColor::LumaGuided;
+        }
+        step.run = eitherLayout(
+            [params](const auto& src, auto& dst, ThreadPool* pool) { nlMeansDenoise(src, dst, params, pool); });
+    } else if (name == "box") {
+        const int size = options.integer("size", 3, 1, 255);
+        step.input = 1;
+        step.border = size / 2;
+        step.run = anyDepth([size](auto tag, const Frame& in, Frame& out, ThreadPool*) {
+            using T = typename decltype(tag)::type;
+            boxFilter(in.image<T, 1>(), out.image<T, 1>(), size);
+        });
+    } else if (name == "gaussian") {
+        const int size = options.integer("size", 5, 1, 255, true);
+        const double sigma = options.number("sigma", 1.0, 1e-3, 1e3);
+        const std::string mode = options.choice("mode", "float", {"float", "fixed", "recursive"});
+        step.input = 1;
+        if (mode == "recursive") {
+            step.run = anyDepth([sigma](auto tag, const Frame& in, Frame& out, ThreadPool*) {
+                using T = typename decltype(tag)::type;
+                out.image<T, 1>().copyFrom(gaussianFilterRecursive(in.image<T, 1>(), sigma));
+            });
+        } else if (mode == "fixed") {
+            // 8-bit samples only: 14 fractional bits per tap in both passes,
+            // with 16-bit rows carrying 6 fractional bits between them.
+            step.border = size / 2;
+            step.depths = depthBit(PixelDepth::U8);
+            step.run = [size, sigma](const Frame& in, Frame& out, ThreadPool*) {
+                gaussianFilterFixed(in.gray, out.gray, size, sigma);
+            };
+        } else {
+            step.border = size / 2;
+            step.run = anyDepth([size, sigma](auto tag, const Frame& in, Frame& out, ThreadPool*) {
+                using T = typename decltype(tag)::type;
+                gaussianFilter(in.image<T, 1>(), out.image<T, 1>(), size, sigma);
+            });
+        }
+    } else if (name == "histeq") {
+        step.depths = depthBit(PixelDepth::U8) | depthBit(PixelDepth::U16);
+        if (options.choice("method", "cdf", {"cdf", "bucket"}) == "bucket") {
+            step.run = onLuma([](const auto& src, auto& dst, ThreadPool*) { equalizeBucketFill(src, dst); });
+        } else {
+            step.run = onLuma([](const auto& src, auto& dst, ThreadPool*) { equalizeCdf(src, dst); });
+        }
+    } else if (name == "clahe") {
+        ClaheParams params;
+        params.clipLimit = options.number("clip", params.clipLimit, 1e-3, 1e6);
+        params.tilesX = params.tilesY = options.integer("tiles", params.tilesX, 1, 64);
+        step.depths = depthBit(PixelDepth::U8) | depthBit(PixelDepth::U16);
+        step.run = onLuma([params](const auto& src, auto& dst, ThreadPool* pool) { clahe(src, dst, params, pool); });
+    } else if (name == "isp") {
+        IspParams params;
+        if (!parseCfaPattern(options.text("pattern", "GRBG"), params.pattern)) options.invalid("pattern");
+        if (!parseDemosaicMethod(options.text("method", "bilinear"), params.demosaic)) options.invalid("method");
+        if (!parseWhiteBalanceEstimator(options.text("estimator", "grayworld"), params.whiteBalance.estimator)) {
+            options.invalid("estimator");
+        }
+        params.whiteBalance.percentile = options.number("percentile", params.whiteBalance.percentile, 0.0, 100.0);
+        params.medianRadius = options.integer("median", params.medianRadius, 1, 64);
+        params.bilateralRadius = options.integer("radius", params.bilateralRadius, 1, 32);
+        params.sigmaSpatial = options.number("sigma-c", params.sigmaSpatial, 1e-3, 1e6);
+        params.sigmaRange = options.number("sigma-s", params.sigmaRange, 1e-3, 1e6);
+        params.clahe.clipLimit = options.number("clip", params.clahe.clipLimit, 1e-3, 1e6);
+        params.clahe.tilesX = params.clahe.tilesY = options.integer("tiles", params.clahe.tilesX, 1, 64);
+        const std::string tile = options.text("tile", "1024x52");
+        if (std::sscanf(tile.c_str(), "%dx%d", &params.tileWidth, &params.tileHeight) != 2 || params.tileWidth < 1 ||
+            params.tileHeight < 1) {
+            options.invalid("tile");
+        }
+        auto pipeline = std::make_shared<IspPipeline>(params);
+        step.input = 1;
+        step.depths = depthBit(PixelDepth::U8);
+        step.output = 3;
+        step.run = [pipeline](const Frame& in, Frame& out, ThreadPool* pool) {
+            pipeline->process(in.gray, out.rgb, pool);
+        };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* layoutName(int channels) {
+    return channels == 1 ? "gray" : "RGB";
+}
+
+}  // namespace
+
+const std::vector<OperatorInfo>& operatorCatalog() {
+    return CATALOG;
+}
+
+void printOperatorCatalog(std::ostream& out) {
+    for (const OperatorInfo& op : CATALOG) {
+        out << "  " << std::left << std::setw(10) << op.name << std::setw(6) << op.input << op.summary << std::endl;
+        if (*op.options) out << "  " << std::setw(16) << "" << op.options << std::endl;
+    }
+    out << std::right;
+}
+
+OperatorChain::OperatorChain() = default;
+OperatorChain::~OperatorChain() = default;
+
+bool OperatorChain::add(const std::string& name, const OperatorOptions& options) {
+    auto step = std::make_unique<OperatorStep>();
+    step->name = name;
+    step->traceName = internProfileName(name);
+    OptionReader reader(name, options);
+    if (!buildStep(name, reader, *step)) {
+        std::cerr << "Unknown operator " << name << std::endl;
+        return false;
+    }
+    if (!reader.finish()) return false;
+    border_ = std::max(border_, step->border);
+    steps_.push_back(std::move(step));
+    return true;
+}
+
+int OperatorChain::outputChannels(int inputChannels, PixelDepth depth, std::ostream& err) const {
+    int channels = inputChannels;
+    for (const auto& step : steps_) {
+        if (!(step->depths & depthBit(depth))) {
+            err << step->name << " has no " << pixelDepthName(depth) << " kernel" << std::endl;
+            return 0;
+        }
+        if (step->input && step->input != channels) {
+            err << step->name << " needs " << layoutName(step->input) << " input, but gets " << layoutName(channels)
+                << std::endl;
+            return 0;
+        }
+        if (step->output) channels = step->output;
+    }
+    return channels;
+}
+
+int OperatorChain::inputBorder() const {
+    return steps_.empty() ? 0 : steps_.front()->border;
+}
+
+const Frame& OperatorChain::run(Frame& input, ThreadPool* pool) {
+    Frame* current = &input;
+    for (const auto& owned : steps_) {
+        OperatorStep& step = *owned;
+        const auto start = std::chrono::steady_clock::now();
+        ProfileScope scope(step.traceName, "step");
+        scope.pixels(static_cast<uint64_t>(current->width()) * current->height());
+        if (step.border > 0) {
+            // Only the caller's frame can be too narrow; the chain's own
+            // frames carry border_.
+            if (current->border() < step.border) {
+                padded_.channels = current->channels;
+                padded_.depth = current->depth;
+                padded_.resize(current->width(), current->height(), border_);
+                padded_.copyFrom(*current);
+                current = &padded_;
+            }
+            current->fillBorder(step.borderMode);
+        }
+        Frame* out = current == &frames_[0] ? &frames_[1] : &frames_[0];
+        out->channels = step.output ? step.output : current->channels;
+        out->depth = current->depth;
+        out->resize(current->width(), current->height(), border_);
+        step.run(*current, *out, pool);
+        current = out;
+        step.milliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return *current;
+}
+
+const std::string& OperatorChain::stepName(int i) const {
+    return steps_[i]->name;
+}
+
+double OperatorChain::stepMilliseconds(int i) const {
+    return steps_[i]->milliseconds;
+}
+
+}  // namespace imgcore
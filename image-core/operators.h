@@ -0,0 +1,146 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+#include "pixel.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// One frame between two operators of a chain: a single plane (gray, or a
+// Bayer mosaic before demosaic) or interleaved RGB, of 8-bit, 16-bit or
+// float pixels. Only the image that matches `channels` and `depth` is
+// meaningful; the others keep their buffers for reuse.
+struct Frame {
+    int channels = 1;
+    PixelDepth depth = PixelDepth::U8;
+    GrayImage gray;
+    RgbImage rgb;
+    GrayImage16 gray16;
+    RgbImage16 rgb16;
+    GrayImageF grayF;
+    RgbImageF rgbF;
+
+    // The image of T pixels and C channels, live or not.
+    template <typename T, int C>
+    Image<T, C>& image() {
+        if constexpr (std::is_same_v<T, unsigned char>) {
+            if constexpr (C == 1) return gray;
+            else return rgb;
+        } else if constexpr (std::is_same_v<T, uint16_t>) {
+            if constexpr (C == 1) return gray16;
+            else return rgb16;
+        } else {
+            if constexpr (C == 1) return grayF;
+            else return rgbF;
+        }
+    }
+    template <typename T, int C>
+    const Image<T, C>& image() const {
+        return const_cast<Frame*>(this)->image<T, C>();
+    }
+
+    // fn(image) on the live image.
+    template <typename Fn>
+    decltype(auto) visit(Fn&& fn) {
+        return withPixelType(depth, [&](auto tag) -> decltype(auto) {
+            using T = typename decltype(tag)::type;
+            return channels == 1 ? fn(image<T, 1>()) : fn(image<T, 3>());
+        });
+    }
+    template <typename Fn>
+    decltype(auto) visit(Fn&& fn) const {
+        return const_cast<Frame*>(this)->visit([&](const auto& img) -> decltype(auto) { return fn(img); });
+    }
+
+    int width() const { return visit([](const auto& img) { return img.width(); }); }
+    int height() const { return visit([](const auto& img) { return img.height(); }); }
+    int border() const { return visit([](const auto& img) { return img.border(); }); }
+    void resize(int width, int height, int border) {
+        visit([&](auto& img) { img.resize(width, height, border); });
+    }
+    void fillBorder(BorderMode mode) {
+        visit([mode](auto& img) { img.fillBorder(mode); });
+    }
+    // Copies the pixels of `other`, which has this frame's size, layout and
+    // depth.
+    void copyFrom(const Frame& other) {
+        visit([&](auto& img) {
+            using I = std::decay_t<decltype(img)>;
+            img.copyFrom(other.image<typename I::value_type, I::CHANNELS>());
+        });
+    }
+};
+
+struct OperatorStep;
+
+// key=value settings of one operator, e.g. {"radius", "2"}.
+using OperatorOptions = std::map<std::string, std::string>;
+
+// Usage line of a registered operator.
+struct OperatorInfo {
+    const char* name;
+    const char* input;    // "gray", "rgb" or "any"
+    const char* options;  // key=default pairs
+    const char* summary;
+};
+
+// Every operator OperatorChain::add() accepts, in the order they are listed
+// in usage text.
+const std::vector<OperatorInfo>& operatorCatalog();
+
+void printOperatorCatalog(std::ostream& out);
+
+// A sequence of image-core operators run in one process, frame to frame in
+// memory. The chain owns two frames that the steps write alternately; they
+// carry the widest border any step reads, and a step's kernel resizes its
+// output keeping that border, so after the first frame a chain of any
+// length runs on the same two buffers. Operators that work on one plane
+// (histeq, clahe) run on the luma of an RGB frame, converting through
+// YUV with the chroma planes passed back unchanged.
+class OperatorChain {
+public:
+    OperatorChain();
+    ~OperatorChain();
+
+    OperatorChain(const OperatorChain&) = delete;
+    OperatorChain& operator=(const OperatorChain&) = delete;
+
+    // Appends `name` configured by `options`. Prints the reason and returns
+    // false for an unknown operator, an unknown option or a bad value.
+    bool add(const std::string& name, const OperatorOptions& options = {});
+
+    // Channels the chain produces from an input of `inputChannels` and
+    // `depth` (every step keeps the depth), or 0 when some step cannot take
+    // what the previous one produces or has no kernel for the depth (the
+    // step is reported on `err`).
+    int outputChannels(int inputChannels, PixelDepth depth, std::ostream& err) const;
+
+    // Border the input frame should carry so the first step reads it in
+    // place; a narrower input is copied once per run.
+    int inputBorder() const;
+
+    // Runs every step on `input`, whose border ring (not its pixels) may be
+    // refilled. The result stays valid until the next run().
+    const Frame& run(Frame& input, ThreadPool* pool = nullptr);
+
+    int size() const { return static_cast<int>(steps_.size()); }
+    const std::string& stepName(int i) const;
+    // Wall time of each step during the last run().
+    double stepMilliseconds(int i) const;
+
+private:
+    std::vector<std::unique_ptr<OperatorStep>> steps_;
+    int border_ = 0;
+    Frame padded_;
+    Frame frames_[2];
+};
+
+}  // namespace imgcore
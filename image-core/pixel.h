@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "image.h"
+
+namespace imgcore {
+
+// What the kernels need to know about a pixel type. Every operator is
+// instantiated for unsigned char, uint16_t and float: the integer types
+// hold levels 0..max (10-, 12- and 14-bit sensor data travels in uint16_t
+// and is clamped to the type's range, not the sensor's), float holds
+// [0, 1]. 8-bit instantiations keep their LUT and SIMD paths; the wider
+// types take portable code sized from these traits.
+template <typename T>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<unsigned char> {
+    using Work = int;  // sums of a few samples and their differences
+    static constexpr bool integer = true;
+    static constexpr int levels = 256;  // histogram bins and LUT entries
+    static constexpr float maxValue = 255.0f;
+};
+
+template <>
+struct PixelTraits<uint16_t> {
+    using Work = int;
+    static constexpr bool integer = true;
+    static constexpr int levels = 65536;
+    static constexpr float maxValue = 65535.0f;
+};
+
+template <>
+struct PixelTraits<float> {
+    using Work = float;
+    static constexpr bool integer = false;
+    // Histograms quantise [0, 1] to as many bins as a 16-bit frame has.
+    static constexpr int levels = 65536;
+    static constexpr float maxValue = 1.0f;
+};
+
+// Pixel type of a frame chosen at run time, e.g. from a command line.
+enum class PixelDepth { U8, U16, Float };
+
+template <typename T>
+struct PixelTag {
+    using type = T;
+};
+
+// Calls fn(PixelTag<T>{}) with the T that stores `depth`.
+template <typename Fn>
+decltype(auto) withPixelType(PixelDepth depth, Fn&& fn) {
+    switch (depth) {
+    case PixelDepth::U16:
+        return fn(PixelTag<uint16_t>{});
+    case PixelDepth::Float:
+        return fn(PixelTag<float>{});
+    default:
+        return fn(PixelTag<unsigned char>{});
+    }
+}
+
+inline const char* pixelDepthName(PixelDepth depth) {
+    return depth == PixelDepth::U8 ? "8-bit" : (depth == PixelDepth::U16 ? "16-bit" : "float");
+}
+
+template <typename T>
+using PixelWork = typename PixelTraits<T>::Work;
+
+// v clamped to the range of T.
+template <typename T>
+T clampPixel(PixelWork<T> v) {
+    const PixelWork<T> hi = static_cast<PixelWork<T>>(PixelTraits<T>::maxValue);
+    return static_cast<T>(v < 0 ? 0 : (v > hi ? hi : v));
+}
+
+// v / 2^shift: floored for the integer types (the `>> shift` of the 8-bit
+// kernels), exact for float.
+template <typename T>
+PixelWork<T> scaleDown(PixelWork<T> v, int shift) {
+    if constexpr (PixelTraits<T>::integer) return v >> shift;
+    else return v / static_cast<float>(1 << shift);
+}
+
+// A float result as T: + 0.5 and truncated for the integer types, as the
+// 8-bit kernels round, and clamped to the range of T.
+template <typename T>
+T roundPixel(float v) {
+    if constexpr (PixelTraits<T>::integer) {
+        v += 0.5f;
+        return static_cast<T>(v < 0.0f ? 0.0f : (v > PixelTraits<T>::maxValue ? PixelTraits<T>::maxValue : v));
+    } else {
+        return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    }
+}
+
+// Histogram bin of a value, in [0, PixelTraits<T>::levels).
+template <typename T>
+int pixelBin(T v) {
+    if constexpr (PixelTraits<T>::integer) {
+        return v;
+    } else {
+        const float scaled = v * (PixelTraits<T>::levels - 1) + 0.5f;
+        return scaled <= 0.0f ? 0 : (scaled >= PixelTraits<T>::levels - 1 ? PixelTraits<T>::levels - 1
+                                                                          : static_cast<int>(scaled));
+    }
+}
+
+// dst = src * scale, rounded and clamped to the range of D; e.g. a 12-bit
+// frame to float with scale 1 / 4095.0, or back to 8 bits for display.
+template <typename S, typename D, int C>
+void convertPixels(const Image<S, C>& src, Image<D, C>& dst, float scale) {
+    dst.resize(src.width(), src.height(), dst.border());
+    for (int y = 0; y < src.height(); ++y) {
+        const S* in = src.row(y);
+        D* out = dst.row(y);
+        for (int i = 0; i < src.width() * C; ++i) out[i] = roundPixel<D>(in[i] * scale);
+    }
+}
+
+}  // namespace imgcore
@@ -0,0 +1,294 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+namespace imgcore {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Events of one thread. Only that thread appends, so the lock is taken by
+// a reader at most; buffers outlive their threads until the process ends.
+struct ThreadBuffer {
+    int index = 0;
+    const char* role = nullptr;
+    int roleIndex = -1;
+    std::mutex mutex;
+    std::vector<ProfileEvent> events;
+};
+
+struct Registry {
+    const Clock::time_point epoch = Clock::now();
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    std::set<std::string> names;
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+// Set by nameProfileThread(); the buffer is only created by the thread's
+// first event, so naming a thread costs nothing while profiling is off.
+thread_local const char* tlsRole = nullptr;
+thread_local int tlsRoleIndex = -1;
+thread_local std::shared_ptr<ThreadBuffer> tlsBuffer;
+
+ThreadBuffer& threadBuffer() {
+    std::shared_ptr<ThreadBuffer>& buffer = tlsBuffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        buffer->role = tlsRole;
+        buffer->roleIndex = tlsRoleIndex;
+        buffer->events.reserve(256);
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        buffer->index = static_cast<int>(r.threads.size());
+        r.threads.push_back(buffer);
+    }
+    return *buffer;
+}
+
+int64_t nanosSinceEpoch() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - registry().epoch).count();
+}
+
+// Names are identifiers and settings; only quotes, backslashes and control
+// characters need escaping.
+void writeJsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+struct ScopeTotals {
+    int calls = 0;
+    int64_t totalNs = 0;
+    int64_t maxNs = 0;
+    int maxTile = -1;
+    uint64_t pixels = 0;
+    uint64_t bytes = 0;
+    uint64_t allocations = 0;
+};
+
+// Length of the union of [start, start + duration) over `events`, which
+// are sorted by start; nested scopes are counted once.
+int64_t coveredNs(const std::vector<const ProfileEvent*>& events) {
+    int64_t covered = 0, end = INT64_MIN;
+    for (const ProfileEvent* e : events) {
+        const int64_t stop = e->startNs + e->durationNs;
+        if (stop <= end) continue;
+        covered += stop - std::max(e->startNs, end);
+        end = stop;
+    }
+    return covered;
+}
+
+}  // namespace
+
+void setProfiling(bool enabled) {
+    // Fixes the epoch before the first event is timed against it.
+    registry();
+    profilingFlag().store(enabled, std::memory_order_relaxed);
+}
+
+void clearProfile() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const auto& t : r.threads) {
+        std::lock_guard<std::mutex> threadLock(t->mutex);
+        t->events.clear();
+    }
+}
+
+void nameProfileThread(const char* role, int index) {
+    tlsRole = role;
+    tlsRoleIndex = index;
+    if (tlsBuffer) {
+        std::lock_guard<std::mutex> lock(tlsBuffer->mutex);
+        tlsBuffer->role = role;
+        tlsBuffer->roleIndex = index;
+    }
+}
+
+const char* internProfileName(const std::string& name) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.names.insert(name).first->c_str();
+}
+
+std::vector<ProfileEvent> profileEvents() {
+    std::vector<ProfileEvent> events;
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const auto& t : r.threads) {
+        std::lock_guard<std::mutex> threadLock(t->mutex);
+        events.insert(events.end(), t->events.begin(), t->events.end());
+    }
+    std::sort(events.begin(), events.end(), [](const ProfileEvent& a, const ProfileEvent& b) {
+        return std::tie(a.startNs, a.thread) < std::tie(b.startNs, b.thread);
+    });
+    return events;
+}
+
+std::string profileThreadName(int thread) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (thread >= 0 && thread < static_cast<int>(r.threads.size())) {
+        ThreadBuffer& t = *r.threads[thread];
+        std::lock_guard<std::mutex> threadLock(t.mutex);
+        if (t.role) return t.roleIndex >= 0 ? std::string(t.role) + " " + std::to_string(t.roleIndex) : t.role;
+    }
+    return "thread " + std::to_string(thread);
+}
+
+void ProfileScope::begin(const char* name, const char* category) {
+    active_ = true;
+    event_.name = name;
+    event_.category = category;
+    // Baselines until end() turns them into the scope's own counts.
+    event_.allocations = threadImageAllocations().count;
+    event_.allocationBytes = threadImageAllocations().bytes;
+    event_.startNs = nanosSinceEpoch();
+}
+
+void ProfileScope::end() {
+    event_.durationNs = nanosSinceEpoch() - event_.startNs;
+    event_.allocations = threadImageAllocations().count - event_.allocations;
+    event_.allocationBytes = threadImageAllocations().bytes - event_.allocationBytes;
+    ThreadBuffer& buffer = threadBuffer();
+    event_.thread = buffer.index;
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(event_);
+}
+
+void writeChromeTrace(std::ostream& out) {
+    const std::vector<ProfileEvent> events = profileEvents();
+    std::set<int> threads;
+    for (const ProfileEvent& e : events) threads.insert(e.thread);
+
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (int thread : threads) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+            << ",\"args\":{\"name\":";
+        writeJsonString(out, profileThreadName(thread));
+        out << "}}";
+        first = false;
+    }
+    // Timestamps and durations are in microseconds.
+    for (const ProfileEvent& e : events) {
+        out << (first ? "" : ",\n") << "{\"name\":";
+        writeJsonString(out, e.name);
+        out << ",\"cat\":";
+        writeJsonString(out, e.category);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread << ",\"ts\":" << e.startNs / 1e3
+            << ",\"dur\":" << e.durationNs / 1e3 << ",\"args\":{";
+        const char* sep = "";
+        auto arg = [&](const char* key, uint64_t value) {
+            if (!value) return;
+            out << sep << '"' << key << "\":" << value;
+            sep = ",";
+        };
+        if (e.tile >= 0) {
+            out << "\"tile\":" << e.tile;
+            sep = ",";
+        }
+        arg("pixels", e.pixels);
+        arg("bytes_read", e.bytesRead);
+        arg("bytes_written", e.bytesWritten);
+        arg("image_allocations", e.allocations);
+        arg("image_allocation_bytes", e.allocationBytes);
+        out << "}}";
+        first = false;
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+bool writeChromeTrace(const std::string& filename) {
+    std::ofstream file(filename);
+    if (!file) return false;
+    writeChromeTrace(file);
+    return static_cast<bool>(file);
+}
+
+void printProfileSummary(std::ostream& out) {
+    const std::vector<ProfileEvent> events = profileEvents();
+    if (events.empty()) {
+        out << "No profiled scopes" << std::endl;
+        return;
+    }
+    int64_t spanStart = INT64_MAX, spanEnd = INT64_MIN;
+    std::map<std::pair<std::string, std::string>, ScopeTotals> totals;
+    std::map<int, std::vector<const ProfileEvent*>> byThread;
+    for (const ProfileEvent& e : events) {
+        spanStart = std::min(spanStart, e.startNs);
+        spanEnd = std::max(spanEnd, e.startNs + e.durationNs);
+        ScopeTotals& t = totals[{e.category, e.name}];
+        ++t.calls;
+        t.totalNs += e.durationNs;
+        if (e.durationNs > t.maxNs) {
+            t.maxNs = e.durationNs;
+            t.maxTile = e.tile;
+        }
+        t.pixels += e.pixels;
+        t.bytes += e.bytesRead + e.bytesWritten;
+        t.allocations += e.allocations;
+        byThread[e.thread].push_back(&e);
+    }
+    const double span = static_cast<double>(std::max<int64_t>(spanEnd - spanStart, 1));
+
+    std::vector<std::pair<std::pair<std::string, std::string>, ScopeTotals>> rows(totals.begin(), totals.end());
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const auto& a, const auto& b) { return a.second.totalNs > b.second.totalNs; });
+
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << std::left << std::setw(10) << "category" << std::setw(22) << "scope" << std::right << std::setw(7)
+        << "calls" << std::setw(12) << "total ms" << std::setw(10) << "mean ms" << std::setw(10) << "max ms"
+        << std::setw(7) << "tile" << std::setw(8) << "span%" << std::setw(9) << "MP/s" << std::setw(10) << "MB/s"
+        << std::setw(8) << "allocs" << std::endl;
+    for (const auto& row : rows) {
+        const ScopeTotals& t = row.second;
+        const double seconds = t.totalNs * 1e-9;
+        out << std::left << std::setw(10) << row.first.first << std::setw(22) << row.first.second << std::right
+            << std::setw(7) << t.calls << std::setw(12) << t.totalNs * 1e-6 << std::setw(10)
+            << t.totalNs * 1e-6 / t.calls << std::setw(10) << t.maxNs * 1e-6 << std::setw(7)
+            << (t.maxTile >= 0 ? std::to_string(t.maxTile) : "-") << std::setw(8) << std::setprecision(1)
+            << 100.0 * t.totalNs / span << std::setw(9) << (seconds > 0 ? t.pixels / seconds * 1e-6 : 0.0)
+            << std::setw(10) << (seconds > 0 ? t.bytes / seconds * 1e-6 : 0.0) << std::setw(8) << t.allocations
+            << std::setprecision(3) << std::endl;
+    }
+    // Busy share: time inside any scope over the whole profiled span.
+    out << std::setprecision(1);
+    for (const auto& thread : byThread) {
+        out << "  " << std::left << std::setw(20) << profileThreadName(thread.first) << std::right << std::setw(6)
+            << 100.0 * coveredNs(thread.second) / span << "% busy, " << thread.second.size() << " scopes"
+            << std::endl;
+    }
+    out << "  span " << std::setprecision(3) << span * 1e-6 << " ms" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace imgcore
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace imgcore {
+
+// Scoped timers around the operators, the ISP tiles, the imgpipe steps and
+// the batch stages. Each thread appends to a buffer of its own, so a scope
+// costs two clock reads and an uncontended lock while profiling is on and
+// one relaxed load while it is off (the default). Building with
+// IMGCORE_NO_PROFILING removes even that.
+
+#ifdef IMGCORE_NO_PROFILING
+constexpr bool PROFILING_COMPILED = false;
+#else
+constexpr bool PROFILING_COMPILED = true;
+#endif
+
+// One closed scope. Names and categories are string literals or come from
+// internProfileName(), so they outlive the event.
+struct ProfileEvent {
+    const char* name = "";
+    const char* category = "";
+    int thread = 0;          // index in first-event order, see profileThreadName()
+    int tile = -1;           // tile or band of the enclosing operator, -1 for none
+    int64_t startNs = 0;     // since the profiler's first use
+    int64_t durationNs = 0;
+    uint64_t pixels = 0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    // Image buffers the scope's thread allocated inside it, nested scopes
+    // included.
+    uint64_t allocations = 0;
+    uint64_t allocationBytes = 0;
+};
+
+inline std::atomic<bool>& profilingFlag() {
+    static std::atomic<bool> flag{false};
+    return flag;
+}
+
+inline bool profilingEnabled() {
+    return PROFILING_COMPILED && profilingFlag().load(std::memory_order_relaxed);
+}
+
+// Turns recording on or off for every thread; events already recorded stay.
+void setProfiling(bool enabled);
+
+// Drops every recorded event (thread names are kept).
+void clearProfile();
+
+// Names the calling thread in traces, e.g. ("pool worker", 2). `role` must
+// be a literal.
+void nameProfileThread(const char* role, int index = -1);
+
+// A stable copy of `name` for scopes whose names are built at run time.
+const char* internProfileName(const std::string& name);
+
+// Every recorded event of every thread, ordered by start time. Threads may
+// keep recording while this runs.
+std::vector<ProfileEvent> profileEvents();
+
+// Name of thread index `thread` as set by nameProfileThread(), or
+// "thread <index>".
+std::string profileThreadName(int thread);
+
+// Chrome trace-event JSON ("X" complete events plus thread names), for
+// chrome://tracing or https://ui.perfetto.dev. Scope counters and the tile
+// index are the events' args.
+void writeChromeTrace(std::ostream& out);
+bool writeChromeTrace(const std::string& filename);
+
+// Per scope name: calls, total / mean / slowest time (with the slowest
+// tile), share of the profiled span, MP/s, MB/s and image allocations,
+// heaviest first; then the busy share of every thread.
+void printProfileSummary(std::ostream& out);
+
+// Times the enclosing block as one event. The counters are optional and
+// describe the work of the block, e.g. scope.image(src, dst) for an
+// operator that reads `src` and writes `dst` once.
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name, const char* category = "operator") {
+        if (profilingEnabled()) begin(name, category);
+    }
+    ~ProfileScope() {
+        if (active_) end();
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ProfileScope& tile(int index) {
+        event_.tile = index;
+        return *this;
+    }
+    ProfileScope& pixels(uint64_t count) {
+        event_.pixels += count;
+        return *this;
+    }
+    ProfileScope& reads(uint64_t bytes) {
+        event_.bytesRead += bytes;
+        return *this;
+    }
+    ProfileScope& writes(uint64_t bytes) {
+        event_.bytesWritten += bytes;
+        return *this;
+    }
+
+    // The pixels of `in`, its visible samples as read and those of `out` as
+    // written.
+    template <typename In, typename Out>
+    ProfileScope& image(const In& in, const Out& out) {
+        if (active_) {
+            pixels(in.pixelCount());
+            reads(in.sampleCount() * sizeof(typename In::value_type));
+            writes(out.sampleCount() * sizeof(typename Out::value_type));
+        }
+        return *this;
+    }
+
+    // The same for an operator whose output is shaped like its input.
+    template <typename Img>
+    ProfileScope& image(const Img& frame) {
+        return image(frame, frame);
+    }
+
+private:
+    void begin(const char* name, const char* category);
+    void end();
+
+    ProfileEvent event_;
+    bool active_ = false;
+};
+
+}  // namespace imgcore
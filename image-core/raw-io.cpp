@@ -0,0 +1,173 @@
+#include "raw-io.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace imgcore {
+
+namespace {
+
+void reportErrno(const std::string& what, const std::string& filename) {
+    std::cerr << what << " " << filename << ": " << std::strerror(errno) << std::endl;
+}
+
+// Makes the rename of a file in `filename`'s directory durable. Filesystems
+// that cannot sync a directory (EINVAL) have nothing more to flush.
+bool syncParentDirectory(const std::string& filename) {
+    const size_t slash = filename.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : filename.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        reportErrno("Cannot open directory", dir);
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0 || errno == EINVAL;
+    if (!ok) reportErrno("Cannot sync directory", dir);
+    ::close(fd);
+    return ok;
+}
+
+// Opens `filename` for reading and checks its size before anything is read.
+int openChecked(const std::string& filename, size_t expectedBytes) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        reportErrno("Cannot open", filename);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        reportErrno("Cannot stat", filename);
+        ::close(fd);
+        return -1;
+    }
+    if (static_cast<size_t>(st.st_size) != expectedBytes) {
+        std::cerr << filename << " is " << st.st_size << " bytes, expected " << expectedBytes
+                  << "; check the image dimensions and channel count" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}  // namespace
+
+bool MappedFile::open(const std::string& filename, size_t expectedBytes) {
+    close();
+    int fd = openChecked(filename, expectedBytes);
+    if (fd < 0) return false;
+    if (expectedBytes == 0) {
+        ::close(fd);
+        data_ = &empty_;
+        return true;
+    }
+    void* p = mmap(nullptr, expectedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        reportErrno("Cannot map", filename);
+        return false;
+    }
+    // Images are consumed front to back.
+    madvise(p, expectedBytes, MADV_SEQUENTIAL);
+    data_ = static_cast<const unsigned char*>(p);
+    size_ = expectedBytes;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_ && data_ != &empty_) munmap(const_cast<unsigned char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+RawRowWriter::~RawRowWriter() {
+    abandon();
+}
+
+bool RawRowWriter::open(const std::string& filename) {
+    abandon();
+    filename_ = filename;
+    partial_ = filename + ".partial";
+    fd_ = ::open(partial_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        reportErrno("Cannot create", partial_);
+        return false;
+    }
+    return true;
+}
+
+bool RawRowWriter::writeRow(const unsigned char* src, size_t bytes) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = ::write(fd_, src + done, bytes - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            reportErrno("Cannot write", partial_);
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool RawRowWriter::commit() {
+    if (fd_ < 0) return false;
+    // The data must be on disk before the rename is, or a crash can leave
+    // `filename` replaced by an empty or truncated file.
+    bool ok = ::fsync(fd_) == 0;
+    if (!ok) reportErrno("Cannot sync", partial_);
+    if (::close(fd_) != 0 && ok) {
+        reportErrno("Cannot write", partial_);
+        ok = false;
+    }
+    fd_ = -1;
+    if (ok && std::rename(partial_.c_str(), filename_.c_str()) != 0) {
+        reportErrno("Cannot replace", filename_);
+        ok = false;
+    }
+    if (!ok) {
+        ::unlink(partial_.c_str());
+        partial_.clear();
+        return false;
+    }
+    partial_.clear();
+    // The new file is in place; this makes the rename itself survive a crash.
+    return syncParentDirectory(filename_);
+}
+
+void RawRowWriter::abandon() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (!partial_.empty()) {
+        ::unlink(partial_.c_str());
+        partial_.clear();
+    }
+}
+
+bool readRawRows(const std::string& filename, unsigned char* dst, ptrdiff_t dstStrideBytes,
+                 size_t rowBytes, int rows) {
+    MappedFile file;
+    if (!file.open(filename, rowBytes * rows)) return false;
+    for (int y = 0; y < rows; ++y) std::memcpy(dst + y * dstStrideBytes, file.data() + y * rowBytes, rowBytes);
+    return true;
+}
+
+bool writeRawRows(const std::string& filename, const unsigned char* src, ptrdiff_t srcStrideBytes,
+                  size_t rowBytes, int rows) {
+    RawRowWriter writer;
+    if (!writer.open(filename)) return false;
+    for (int y = 0; y < rows; ++y) {
+        if (!writer.writeRow(src + y * srcStrideBytes, rowBytes)) return false;
+    }
+    return writer.commit();
+}
+
+}  // namespace imgcore
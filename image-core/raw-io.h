@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+
+#include "image.h"
+
+namespace imgcore {
+
+// Read-only memory mapping of a whole file. open() prints the reason and
+// returns false when the file cannot be opened or mapped, or when its size
+// is not exactly `expectedBytes`.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename, size_t expectedBytes);
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+    // Zero-length files are not mapped; data_ then points here.
+    unsigned char empty_ = 0;
+};
+
+// Sequential row writer that never leaves a partial file behind: rows go to
+// "<filename>.partial", which commit() syncs to disk and renames over
+// `filename` in one step, then syncs the directory so the rename is durable
+// too. Destroying an uncommitted writer deletes the partial file.
+class RawRowWriter {
+public:
+    RawRowWriter() = default;
+    ~RawRowWriter();
+
+    RawRowWriter(const RawRowWriter&) = delete;
+    RawRowWriter& operator=(const RawRowWriter&) = delete;
+
+    bool open(const std::string& filename);
+    bool writeRow(const unsigned char* src, size_t bytes);
+    bool commit();
+
+private:
+    void abandon();
+
+    std::string filename_;
+    std::string partial_;
+    int fd_ = -1;
+};
+
+// Reads exactly `bytes` bytes of headerless raw data into `dst`, row by row
+// when the destination is strided. Prints the reason and returns false when
+// the file cannot be opened or its size is not exactly rowBytes * rows.
+bool readRawRows(const std::string& filename, unsigned char* dst, ptrdiff_t dstStrideBytes,
+                 size_t rowBytes, int rows);
+// Writes atomically through RawRowWriter.
+bool writeRawRows(const std::string& filename, const unsigned char* src, ptrdiff_t srcStrideBytes,
+                  size_t rowBytes, int rows);
+
+// `img` must already be sized; its width/height/channels define the expected layout.
+template <typename T, int C>
+bool readRaw(const std::string& filename, Image<T, C>& img) {
+    return readRawRows(filename, reinterpret_cast<unsigned char*>(img.row(0)),
+                       img.stride() * static_cast<ptrdiff_t>(sizeof(T)),
+                       static_cast<size_t>(img.width()) * C * sizeof(T), img.height());
+}
+
+template <typename T, int C>
+bool writeRaw(const std::string& filename, const Image<T, C>& img) {
+    return writeRawRows(filename, reinterpret_cast<const unsigned char*>(img.row(0)),
+                        img.stride() * static_cast<ptrdiff_t>(sizeof(T)),
+                        static_cast<size_t>(img.width()) * C * sizeof(T), img.height());
+}
+
+// Maps `filename` and points `view` straight at it, without copying. The
+// view is valid for as long as `file` stays open.
+template <typename T, int C>
+bool mapRaw(const std::string& filename, int width, int height, MappedFile& file, ImageView<T, C>& view) {
+    const size_t bytes = static_cast<size_t>(width) * height * C * sizeof(T);
+    if (!file.open(filename, bytes)) return false;
+    view = ImageView<T, C>(reinterpret_cast<const T*>(file.data()), width, height);
+    return true;
+}
+
+}  // namespace imgcore
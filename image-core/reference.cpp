@@ -0,0 +1,1363 @@
+#include "reference.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "bilateral.h"
+#include "color-convert.h"
+#include "differential.h"
+#include "edge-preserving.h"
+#include "equalize.h"
+#include "fused-denoise.h"
+#include "isp-pipeline.h"
+#include "linear-filter.h"
+#include "median.h"
+#include "white-balance.h"
+
+namespace imgcore {
+
+namespace reference {
+
+namespace {
+
+// The original getPixel(), with the border rule as a parameter; Zero reads 0.
+template <int C>
+unsigned char sample(const Image<unsigned char, C>& img, int x, int y, int c, BorderMode border) {
+    const int bx = borderIndex(x, img.width(), border);
+    const int by = borderIndex(y, img.height(), border);
+    if (bx < 0 || by < 0) return 0;
+    return img.row(by)[bx * C + c];
+}
+
+// RGB index of the CFA colour at (x, y), for any x and y.
+int cfaColour(CfaPattern pattern, int x, int y) {
+    static const int quads[4][4] = {
+        {0, 1, 1, 2},  // RGGB
+        {2, 1, 1, 0},  // BGGR
+        {1, 0, 2, 1},  // GRBG
+        {1, 2, 0, 1},  // GBRG
+    };
+    return quads[static_cast<int>(pattern)][(y & 1) * 2 + (x & 1)];
+}
+
+}  // namespace
+
+void uniformFilter(const GrayImage& src, GrayImage& dst, int size, BorderMode border) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const int offset = size / 2;
+    const double area = static_cast<double>(size * size);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double sum = 0;
+            for (int ky = -offset; ky <= offset; ++ky) {
+                for (int kx = -offset; kx <= offset; ++kx) sum += sample(src, x + kx, y + ky, 0, border);
+            }
+            dst.at(y, x) = static_cast<unsigned char>(sum / area + 0.5);
+        }
+    }
+}
+
+void gaussianFilter(const GrayImage& src, GrayImage& dst, int size, double sigma, BorderMode border) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const int offset = size / 2;
+    std::vector<std::vector<double>> kernel(size, std::vector<double>(size));
+    double sumKernel = 0;
+    for (int i = -offset; i <= offset; ++i) {
+        for (int j = -offset; j <= offset; ++j) {
+            const double val = std::exp(-(i * i + j * j) / (2 * sigma * sigma));
+            kernel[i + offset][j + offset] = val;
+            sumKernel += val;
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double res = 0;
+            for (int ky = -offset; ky <= offset; ++ky) {
+                for (int kx = -offset; kx <= offset; ++kx) {
+                    res += sample(src, x + kx, y + ky, 0, border) * kernel[ky + offset][kx + offset];
+                }
+            }
+            dst.at(y, x) = static_cast<unsigned char>((res / sumKernel) + 0.5);
+        }
+    }
+}
+
+void bilateralFilterGray(const GrayImage& src, GrayImage& dst, int radius, double sigmaSpatial, double sigmaRange,
+                         BorderMode border) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const double twoSigmaCSq = 2 * sigmaSpatial * sigmaSpatial;
+    const double twoSigmaSSq = 2 * sigmaRange * sigmaRange;
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double sumWeights = 0.0;
+            double sumPixelValues = 0.0;
+            const double centre = static_cast<double>(sample(src, j, i, 0, border));
+            for (int m = -radius; m <= radius; m++) {
+                for (int n = -radius; n <= radius; n++) {
+                    const double neighbour = static_cast<double>(sample(src, j + n, i + m, 0, border));
+                    const double spatialDistSq = m * m + n * n;
+                    const double diff = centre - neighbour;
+                    const double weight = std::exp(-(spatialDistSq / twoSigmaCSq + diff * diff / twoSigmaSSq));
+                    sumPixelValues += neighbour * weight;
+                    sumWeights += weight;
+                }
+            }
+            double result = sumPixelValues / sumWeights;
+            if (result < 0.0) result = 0.0;
+            if (result > 255.0) result = 255.0;
+            dst.at(i, j) = static_cast<unsigned char>(result + 0.5);
+        }
+    }
+}
+
+void bilateralFilterColor(const RgbImage& src, RgbImage& dst, int radius, double sigmaSpatial, double sigmaRange,
+                          BorderMode border) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const int kernelSize = 2 * radius + 1;
+    std::vector<double> spatialWeights(kernelSize * kernelSize);
+    for (int ky = -radius; ky <= radius; ++ky) {
+        for (int kx = -radius; kx <= radius; ++kx) {
+            const double distSq = ky * ky + kx * kx;
+            spatialWeights[(ky + radius) * kernelSize + (kx + radius)] =
+                std::exp(-distSq / (2 * sigmaSpatial * sigmaSpatial));
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                double sumWeights = 0.0;
+                double sumValues = 0.0;
+                const double centre = static_cast<double>(src.at(y, x, c));
+                for (int ky = -radius; ky <= radius; ++ky) {
+                    for (int kx = -radius; kx <= radius; ++kx) {
+                        const double neighbour = static_cast<double>(sample(src, x + kx, y + ky, c, border));
+                        const double diff = centre - neighbour;
+                        const double rangeWeight = std::exp(-(diff * diff) / (2 * sigmaRange * sigmaRange));
+                        const double weight = spatialWeights[(ky + radius) * kernelSize + (kx + radius)] * rangeWeight;
+                        sumValues += neighbour * weight;
+                        sumWeights += weight;
+                    }
+                }
+                dst.at(y, x, c) = static_cast<unsigned char>(std::min(std::max(sumValues / sumWeights, 0.0), 255.0));
+            }
+        }
+    }
+}
+
+template <int C>
+void medianFilter(const Image<unsigned char, C>& src, Image<unsigned char, C>& dst, int radius, BorderMode border) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    for (int c = 0; c < C; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                std::vector<unsigned char> window;
+                for (int ky = -radius; ky <= radius; ++ky) {
+                    for (int kx = -radius; kx <= radius; ++kx) window.push_back(sample(src, x + kx, y + ky, c, border));
+                }
+                std::sort(window.begin(), window.end());
+                dst.at(y, x, c) = window[window.size() / 2];
+            }
+        }
+    }
+}
+
+void demosaicBilinear(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern, BorderMode border) {
+    const int width = bayer.width();
+    const int height = bayer.height();
+    rgb.resize(width, height, rgb.border());
+    auto at = [&](int y, int x) { return sample(bayer, x, y, 0, border); };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float value[3] = {0, 0, 0};
+            const int own = cfaColour(pattern, x, y);
+            value[own] = at(y, x);
+            if (own == 1) {
+                // Green site: the horizontal neighbours give one of red and
+                // blue, the vertical neighbours the other.
+                value[cfaColour(pattern, x + 1, y)] = (at(y, x - 1) + at(y, x + 1)) / 2.0f;
+                value[cfaColour(pattern, x, y + 1)] = (at(y - 1, x) + at(y + 1, x)) / 2.0f;
+            } else {
+                value[1] = (at(y - 1, x) + at(y + 1, x) + at(y, x - 1) + at(y, x + 1)) / 4.0f;
+                value[2 - own] = (at(y - 1, x - 1) + at(y - 1, x + 1) + at(y + 1, x - 1) + at(y + 1, x + 1)) / 4.0f;
+            }
+            for (int c = 0; c < 3; ++c) rgb.at(y, x, c) = static_cast<unsigned char>(value[c]);
+        }
+    }
+}
+
+void equalizeMethodA(const GrayImage& src, GrayImage& dst) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const int numPixels = static_cast<int>(src.pixelCount());
+    std::vector<int> hist(256, 0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) hist[src.at(y, x)]++;
+    }
+    std::vector<int> cdf(256, 0);
+    cdf[0] = hist[0];
+    for (int i = 1; i < 256; ++i) cdf[i] = cdf[i - 1] + hist[i];
+    std::vector<int> transferFunc(256);
+    for (int i = 0; i < 256; ++i) transferFunc[i] = std::round((float)(256 - 1) * cdf[i] / numPixels);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) dst.at(y, x) = static_cast<unsigned char>(transferFunc[src.at(y, x)]);
+    }
+}
+
+void equalizeMethodB(const GrayImage& src, GrayImage& dst) {
+    struct PixelInfo {
+        unsigned char value;
+        int originalIndex;
+    };
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const int numPixels = static_cast<int>(src.pixelCount());
+    std::vector<PixelInfo> pixels(numPixels);
+    for (int i = 0; i < numPixels; ++i) pixels[i] = {src.at(i / width, i % width), i};
+    std::stable_sort(pixels.begin(), pixels.end(),
+                     [](const PixelInfo& a, const PixelInfo& b) { return a.value < b.value; });
+    for (int i = 0; i < numPixels; ++i) {
+        int newVal = static_cast<int>(static_cast<int64_t>(i) * 256 / numPixels);
+        if (newVal > 255) newVal = 255;
+        const int index = pixels[i].originalIndex;
+        dst.at(index / width, index % width) = static_cast<unsigned char>(newVal);
+    }
+}
+
+void grayWorld(const RgbImage& src, RgbImage& dst, std::array<double, 3>* meansAfter) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const double totalPixels = static_cast<double>(src.pixelCount());
+    double sum[3] = {0, 0, 0};
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) sum[c] += src.at(y, x, c);
+        }
+    }
+    const double mu = (sum[0] / totalPixels + sum[1] / totalPixels + sum[2] / totalPixels) / 3.0;
+    double alpha[3];
+    for (int c = 0; c < 3; ++c) alpha[c] = mu / (sum[c] / totalPixels);
+    double sumAfter[3] = {0, 0, 0};
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                dst.at(y, x, c) = static_cast<unsigned char>(std::min(255.0, src.at(y, x, c) * alpha[c]));
+                sumAfter[c] += dst.at(y, x, c);
+            }
+        }
+    }
+    if (meansAfter) {
+        for (int c = 0; c < 3; ++c) (*meansAfter)[c] = sumAfter[c] / totalPixels;
+    }
+}
+
+void rgbToYuv(const RgbImage& rgb, GrayImage& y, GrayImage& u, GrayImage& v) {
+    const int width = rgb.width();
+    const int height = rgb.height();
+    y.resize(width, height, y.border());
+    u.resize(width, height, u.border());
+    v.resize(width, height, v.border());
+    for (int row = 0; row < height; ++row) {
+        for (int i = 0; i < width; ++i) {
+            const double r = rgb.at(row, i, 0);
+            const double g = rgb.at(row, i, 1);
+            const double b = rgb.at(row, i, 2);
+            const double yVal = 0.299 * r + 0.587 * g + 0.114 * b;
+            const double uVal = 0.492 * (b - yVal);
+            const double vVal = 0.877 * (r - yVal);
+            y.at(row, i) = static_cast<unsigned char>(std::clamp(yVal, 0.0, 255.0));
+            u.at(row, i) = static_cast<unsigned char>(std::clamp(uVal + 128.0, 0.0, 255.0));
+            v.at(row, i) = static_cast<unsigned char>(std::clamp(vVal + 128.0, 0.0, 255.0));
+        }
+    }
+}
+
+void yuvToRgb(const GrayImage& y, const GrayImage& u, const GrayImage& v, RgbImage& rgb) {
+    const int width = y.width();
+    const int height = y.height();
+    rgb.resize(width, height, rgb.border());
+    for (int row = 0; row < height; ++row) {
+        for (int i = 0; i < width; ++i) {
+            const double yVal = y.at(row, i);
+            const double uVal = static_cast<double>(u.at(row, i)) - 128.0;
+            const double vVal = static_cast<double>(v.at(row, i)) - 128.0;
+            const double r = yVal + 1.140 * vVal;
+            const double g = yVal - 0.395 * uVal - 0.581 * vVal;
+            const double b = yVal + 2.032 * uVal;
+            rgb.at(row, i, 0) = static_cast<unsigned char>(std::clamp(r, 0.0, 255.0));
+            rgb.at(row, i, 1) = static_cast<unsigned char>(std::clamp(g, 0.0, 255.0));
+            rgb.at(row, i, 2) = static_cast<unsigned char>(std::clamp(b, 0.0, 255.0));
+        }
+    }
+}
+
+template <int C>
+std::array<double, C> sumSquaredDifferences(const Image<unsigned char, C>& a, const Image<unsigned char, C>& b,
+                                            const ImageRegion& region) {
+    const ImageRegion r = region.clippedTo(a.width(), a.height());
+    std::array<double, C> sums{};
+    for (int y = r.y; y < r.y + r.height; ++y) {
+        for (int x = r.x; x < r.x + r.width; ++x) {
+            for (int c = 0; c < C; ++c) {
+                const double diff = static_cast<double>(a.at(y, x, c)) - static_cast<double>(b.at(y, x, c));
+                sums[c] += diff * diff;
+            }
+        }
+    }
+    return sums;
+}
+
+template <int C, typename T>
+void ssim(const Image<T, C>& a, const Image<T, C>& b, const SsimParams& params, const ImageRegion& region,
+          std::array<double, C>& ssimMean, std::array<double, C>& csMean) {
+    const int radius = params.radius;
+    const int size = 2 * radius + 1;
+    std::vector<double> window(size * size);
+    double total = 0.0;
+    for (int i = -radius; i <= radius; ++i) {
+        for (int j = -radius; j <= radius; ++j) {
+            window[(i + radius) * size + j + radius] = std::exp(-(i * i + j * j) / (2 * params.sigma * params.sigma));
+            total += window[(i + radius) * size + j + radius];
+        }
+    }
+    for (double& w : window) w /= total;
+    const double c1 = (params.k1 * 255.0) * (params.k1 * 255.0);
+    const double c2 = (params.k2 * 255.0) * (params.k2 * 255.0);
+
+    const ImageRegion r = region.clippedTo(a.width(), a.height());
+    ssimMean.fill(0.0);
+    csMean.fill(0.0);
+    uint64_t windows = 0;
+    for (int y = std::max(r.y, radius); y < std::min(r.y + r.height, a.height() - radius); ++y) {
+        for (int x = std::max(r.x, radius); x < std::min(r.x + r.width, a.width() - radius); ++x) {
+            for (int c = 0; c < C; ++c) {
+                double muA = 0, muB = 0, aa = 0, bb = 0, ab = 0;
+                for (int i = -radius; i <= radius; ++i) {
+                    for (int j = -radius; j <= radius; ++j) {
+                        const double w = window[(i + radius) * size + j + radius];
+                        const double va = a.at(y + i, x + j, c);
+                        const double vb = b.at(y + i, x + j, c);
+                        muA += w * va;
+                        muB += w * vb;
+                        aa += w * va * va;
+                        bb += w * vb * vb;
+                        ab += w * va * vb;
+                    }
+                }
+                const double cs = (2 * (ab - muA * muB) + c2) / (aa - muA * muA + bb - muB * muB + c2);
+                ssimMean[c] += (2 * muA * muB + c1) / (muA * muA + muB * muB + c1) * cs;
+                csMean[c] += cs;
+            }
+            ++windows;
+        }
+    }
+    for (int c = 0; c < C; ++c) {
+        ssimMean[c] = windows ? ssimMean[c] / windows : 1.0;
+        csMean[c] = windows ? csMean[c] / windows : 1.0;
+    }
+}
+
+template void medianFilter(const Image<unsigned char, 1>&, Image<unsigned char, 1>&, int, BorderMode);
+template void medianFilter(const Image<unsigned char, 3>&, Image<unsigned char, 3>&, int, BorderMode);
+template std::array<double, 1> sumSquaredDifferences<1>(const GrayImage&, const GrayImage&, const ImageRegion&);
+template std::array<double, 3> sumSquaredDifferences<3>(const RgbImage&, const RgbImage&, const ImageRegion&);
+template void ssim<1>(const GrayImage&, const GrayImage&, const SsimParams&, const ImageRegion&,
+                      std::array<double, 1>&, std::array<double, 1>&);
+template void ssim<3>(const RgbImage&, const RgbImage&, const SsimParams&, const ImageRegion&,
+                      std::array<double, 3>&, std::array<double, 3>&);
+template void ssim<1>(const Image<double, 1>&, const Image<double, 1>&, const SsimParams&, const ImageRegion&,
+                      std::array<double, 1>&, std::array<double, 1>&);
+template void ssim<3>(const Image<double, 3>&, const Image<double, 3>&, const SsimParams&, const ImageRegion&,
+                      std::array<double, 3>&, std::array<double, 3>&);
+
+}  // namespace reference
+
+// ---------------------------------------------------------------------------
+// Every optimized path against its reference. Each trial draws a size, a
+// noisy synthetic input, the border the fast path is handed (none, so it
+// pads itself, or a pre-filled one of random width and mode) and the
+// operator's parameters; outputs start with a random stale geometry so the
+// resize paths are exercised too.
+
+namespace {
+
+const char* borderName(BorderMode mode) {
+    return mode == BorderMode::Replicate ? "replicate" : (mode == BorderMode::Reflect ? "reflect" : "zero");
+}
+
+double uniform(SplitMix64& rng, double lo, double hi) {
+    return lo + (hi - lo) * static_cast<double>(rng.next() >> 11) / 9007199254740992.0;
+}
+
+int between(SplitMix64& rng, int lo, int hi) { return lo + static_cast<int>(rng.below(hi - lo + 1)); }
+
+// A clean scene and a noisy copy of it, Gaussian or impulse noise.
+template <int C>
+void noisyScene(SplitMix64& rng, int width, int height, Image<unsigned char, C>& clean,
+                Image<unsigned char, C>& noisy, std::ostream& config) {
+    syntheticScene(clean, width, height, rng.next());
+    noisy = clean;
+    if (rng.below(3) == 0) {
+        const double fraction = uniform(rng, 0.01, 0.1);
+        addImpulseNoise(noisy, fraction, rng.next());
+        config << " impulse " << fraction;
+    } else {
+        const double sigma = uniform(rng, 2.0, 30.0);
+        addGaussianNoise(noisy, sigma, rng.next());
+        config << " noise " << sigma;
+    }
+}
+
+// The input as the fast path gets it: without a border half of the time
+// (it pads with its own rule), else padded by `radius` plus up to 3 extra
+// pixels with a random mode from `modes`. Returns the rule the reference
+// must read out-of-frame pixels with.
+template <int C>
+BorderMode fastInput(SplitMix64& rng, const Image<unsigned char, C>& src, int radius, BorderMode own,
+                     std::initializer_list<BorderMode> modes, Image<unsigned char, C>& in, std::ostream& config) {
+    if (rng.below(2) == 0) {
+        in = src;
+        config << " border none";
+        return own;
+    }
+    const BorderMode mode = modes.begin()[rng.below(static_cast<uint32_t>(modes.size()))];
+    const int border = radius + static_cast<int>(rng.below(4));
+    in = padded(src, border, mode);
+    config << " border " << border << " " << borderName(mode);
+    return mode;
+}
+
+// An output buffer that may already hold a different geometry.
+template <int C>
+Image<unsigned char, C> staleOutput(SplitMix64& rng) {
+    if (rng.below(2) == 0) return {};
+    return Image<unsigned char, C>(between(rng, 1, 40), between(rng, 1, 40), static_cast<int>(rng.below(3)));
+}
+
+std::string sizeConfig(int width, int height) {
+    std::ostringstream out;
+    out << width << "x" << height;
+    return out.str();
+}
+
+const std::initializer_list<BorderMode> ALL_BORDERS = {BorderMode::Replicate, BorderMode::Reflect, BorderMode::Zero};
+
+// Odd kernel size in [3, 15] and a sigma, mostly in the useful range and
+// sometimes the "large sigma" of the original sweep.
+void gaussianParams(SplitMix64& rng, int& size, double& sigma) {
+    size = 3 + 2 * static_cast<int>(rng.below(7));
+    sigma = rng.below(5) == 0 ? 100.0 : uniform(rng, 0.5, 5.0);
+}
+
+template <typename Fast>
+void addGaussianCheck(DifferentialHarness& harness, const std::string& name, DiffTolerance tolerance, Fast fast) {
+    harness.add({name, "reference::gaussianFilter", tolerance, [fast](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 160), height = between(rng, 1, 120);
+                     config << sizeConfig(width, height);
+                     GrayImage clean, noisy, in, ref, out = staleOutput<1>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     int size;
+                     double sigma;
+                     gaussianParams(rng, size, sigma);
+                     const BorderMode mode = ALL_BORDERS.begin()[rng.below(3)];
+                     config << " size " << size << " sigma " << sigma << " mode " << borderName(mode);
+                     const BorderMode readAs = fastInput(rng, noisy, size / 2, mode, {mode}, in, config);
+                     fast(in, out, size, sigma, mode);
+                     reference::gaussianFilter(noisy, ref, size, sigma, readAs);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+template <int C>
+void addMedianCheck(DifferentialHarness& harness, const std::string& name) {
+    harness.add({name, "reference::medianFilter", {}, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 160), height = between(rng, 1, 120);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, in, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const int radius = between(rng, 1, 5);
+                     config << " radius " << radius;
+                     const BorderMode readAs = fastInput(rng, noisy, radius, BorderMode::Replicate, ALL_BORDERS, in,
+                                                         config);
+                     medianFilter(in, out, radius);
+                     reference::medianFilter(noisy, ref, radius, readAs);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// Bilateral parameters in the range the tools sweep.
+void bilateralParams(SplitMix64& rng, int& radius, double& sigmaSpatial, double& sigmaRange, std::ostream& config) {
+    radius = between(rng, 1, 4);
+    sigmaSpatial = uniform(rng, 0.5, 10.0);
+    sigmaRange = uniform(rng, 5.0, 150.0);
+    config << " radius " << radius << " sigma_s " << sigmaSpatial << " sigma_r " << sigmaRange;
+}
+
+template <int C>
+void referenceBilateral(const Image<unsigned char, C>& src, Image<unsigned char, C>& dst, int radius,
+                        double sigmaSpatial, double sigmaRange, BorderMode border) {
+    if constexpr (C == 1) reference::bilateralFilterGray(src, dst, radius, sigmaSpatial, sigmaRange, border);
+    else reference::bilateralFilterColor(src, dst, radius, sigmaSpatial, sigmaRange, border);
+}
+
+// The gray original rounds, the colour one truncates; the fast path is run
+// the same way as the reference it is held to.
+template <int C>
+void addBilateralCheck(DifferentialHarness& harness, const std::string& name) {
+    const std::string ref = C == 1 ? "reference::bilateralFilterGray" : "reference::bilateralFilterColor";
+    // Float weight tables against double exp(): within one step, but
+    // truncation flips on every sum that lands just below an integer.
+    DiffTolerance tolerance;
+    tolerance.maxAbsError = 1;
+    tolerance.maxMismatchFraction = C == 1 ? 0.001 : 0.05;
+    tolerance.maxPsnrDrop = 0.05;
+    harness.add({name, ref, tolerance, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 120), height = between(rng, 1, 90);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, in, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     int radius;
+                     double sigmaSpatial, sigmaRange;
+                     bilateralParams(rng, radius, sigmaSpatial, sigmaRange, config);
+                     const BorderMode readAs = fastInput(rng, noisy, radius, BorderMode::Replicate, ALL_BORDERS, in,
+                                                         config);
+                     bilateralFilter(in, out, BilateralWeights(radius, sigmaSpatial, sigmaRange), C == 1);
+                     referenceBilateral(noisy, ref, radius, sigmaSpatial, sigmaRange, readAs);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// The grid is an approximation, so it is held to quality, not to samples.
+template <int C>
+void addBilateralGridCheck(DifferentialHarness& harness, const std::string& name) {
+    const std::string ref = C == 1 ? "reference::bilateralFilterGray" : "reference::bilateralFilterColor";
+    DiffTolerance tolerance;
+    tolerance.maxAbsError = 255;
+    tolerance.maxPsnrDrop = 5.0;
+    harness.add({name, ref, tolerance, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 16, 160), height = between(rng, 16, 120);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const double sigmaSpatial = uniform(rng, 2.0, 6.0);
+                     const double sigmaRange = uniform(rng, 20.0, 60.0);
+                     const int radius = static_cast<int>(std::ceil(2.0 * sigmaSpatial));
+                     config << " sigma_s " << sigmaSpatial << " sigma_r " << sigmaRange << " radius " << radius;
+                     bilateralGrid(noisy, out, sigmaSpatial, sigmaRange);
+                     referenceBilateral(noisy, ref, radius, sigmaSpatial, sigmaRange, BorderMode::Replicate);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// No tool had a guided filter to keep, so its check runs the definition
+// directly: every window mean summed over its pixels in double, windows
+// clipped to the frame, a = var / (var + eps) and b = mean - a * mean per
+// window, then their window means applied to the pixel.
+template <int C>
+void directGuidedFilter(const Image<unsigned char, C>& src, Image<unsigned char, C>& dst, int radius,
+                        double sigmaRange) {
+    const int width = src.width();
+    const int height = src.height();
+    const double eps = (sigmaRange / 255.0) * (sigmaRange / 255.0);
+    dst.resize(width, height, dst.border());
+    std::vector<double> guide(static_cast<size_t>(width) * height), a(guide.size()), b(guide.size());
+    // Mean of plane p over the clipped window around (x, y).
+    auto windowMean = [&](const std::vector<double>& p, int x, int y, bool squared) {
+        double sum = 0.0;
+        int count = 0;
+        for (int j = std::max(y - radius, 0); j <= std::min(y + radius, height - 1); ++j) {
+            for (int i = std::max(x - radius, 0); i <= std::min(x + radius, width - 1); ++i) {
+                const double v = p[static_cast<size_t>(j) * width + i];
+                sum += squared ? v * v : v;
+                ++count;
+            }
+        }
+        return sum / count;
+    };
+    for (int c = 0; c < C; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) guide[static_cast<size_t>(y) * width + x] = src.row(y)[x * C + c] / 255.0;
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const double mean = windowMean(guide, x, y, false);
+                const double variance = std::max(windowMean(guide, x, y, true) - mean * mean, 0.0);
+                const size_t i = static_cast<size_t>(y) * width + x;
+                a[i] = variance / (variance + eps);
+                b[i] = mean - a[i] * mean;
+            }
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const double q = windowMean(a, x, y, false) * guide[static_cast<size_t>(y) * width + x] +
+                                 windowMean(b, x, y, false);
+                dst.row(y)[x * C + c] = static_cast<unsigned char>(std::min(std::max(q * 255.0 + 0.5, 0.0), 255.0));
+            }
+        }
+    }
+}
+
+// Float box means against double window sums: a rounding step apart on
+// the samples that land next to .5.
+template <int C>
+void addGuidedCheck(DifferentialHarness& harness, const std::string& name) {
+    DiffTolerance tolerance;
+    tolerance.maxAbsError = 1;
+    tolerance.maxMismatchFraction = 0.01;
+    tolerance.maxPsnrDrop = 0.05;
+    harness.add({name, "direct window sums", tolerance, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 120), height = between(rng, 1, 90);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const int radius = between(rng, 1, 8);
+                     const double sigmaRange = uniform(rng, 2.0, 150.0);
+                     config << " radius " << radius << " sigma_r " << sigmaRange;
+                     // Half the trials reuse a workspace left over from filtering the clean frame.
+                     EdgePreservingWorkspace<unsigned char, C> workspace;
+                     const bool reuse = rng.below(2) == 0;
+                     if (reuse) guidedFilter(clean, out, radius, sigmaRange, pool, &workspace);
+                     config << (reuse ? " reused workspace" : "");
+                     guidedFilter(noisy, out, radius, sigmaRange, pool, reuse ? &workspace : nullptr);
+                     directGuidedFilter(noisy, ref, radius, sigmaRange);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// The domain transform runs from its definition (Gastal & Oliveira RF) in
+// double: every pass a = exp(-sqrt(2) / sigma_i), sigma_i halving from pass
+// to pass so the passes add up to sigma_s, and each step mixes in its
+// neighbour with weight a^d, d = 1 + sigma_s / sigma_r * sum_c |dI_c|.
+// Rows run left to right and back, then columns top to bottom and back.
+template <int C>
+void directDomainTransform(const Image<unsigned char, C>& src, Image<unsigned char, C>& dst, double sigmaSpatial,
+                           double sigmaRange, int iterations) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    // Gradient sum between (x0, y0) and (x1, y1), taken from the input.
+    auto distance = [&](int x0, int y0, int x1, int y1) {
+        double sum = 0.0;
+        for (int c = 0; c < C; ++c) sum += std::abs(src.row(y0)[x0 * C + c] - src.row(y1)[x1 * C + c]);
+        return 1.0 + sigmaSpatial / sigmaRange * sum;
+    };
+    std::vector<double> f(static_cast<size_t>(width) * height * C);
+    auto at = [&](int x, int y, int c) -> double& { return f[(static_cast<size_t>(y) * width + x) * C + c]; };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < C; ++c) at(x, y, c) = src.row(y)[x * C + c];
+        }
+    }
+    for (int i = 0; i < iterations; ++i) {
+        const double sigma = sigmaSpatial * std::sqrt(3.0) * std::pow(2.0, iterations - i - 1) /
+                             std::sqrt(std::pow(4.0, iterations) - 1.0);
+        const double a = std::exp(-std::sqrt(2.0) / sigma);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 1; x < width; ++x) {
+                const double w = std::pow(a, distance(x, y, x - 1, y));
+                for (int c = 0; c < C; ++c) at(x, y, c) = (1.0 - w) * at(x, y, c) + w * at(x - 1, y, c);
+            }
+            for (int x = width - 2; x >= 0; --x) {
+                const double w = std::pow(a, distance(x + 1, y, x, y));
+                for (int c = 0; c < C; ++c) at(x, y, c) = (1.0 - w) * at(x, y, c) + w * at(x + 1, y, c);
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            for (int y = 1; y < height; ++y) {
+                const double w = std::pow(a, distance(x, y, x, y - 1));
+                for (int c = 0; c < C; ++c) at(x, y, c) = (1.0 - w) * at(x, y, c) + w * at(x, y - 1, c);
+            }
+            for (int y = height - 2; y >= 0; --y) {
+                const double w = std::pow(a, distance(x, y + 1, x, y));
+                for (int c = 0; c < C; ++c) at(x, y, c) = (1.0 - w) * at(x, y, c) + w * at(x, y + 1, c);
+            }
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < C; ++c) {
+                dst.row(y)[x * C + c] = static_cast<unsigned char>(std::min(std::max(at(x, y, c) + 0.5, 0.0), 255.0));
+            }
+        }
+    }
+}
+
+// Float recursion and exp tables against the double filter: a rounding
+// step apart on the samples that land next to .5.
+template <int C>
+void addDomainTransformCheck(DifferentialHarness& harness, const std::string& name) {
+    DiffTolerance tolerance;
+    tolerance.maxAbsError = 1;
+    tolerance.maxMismatchFraction = 0.001;
+    tolerance.maxPsnrDrop = 0.05;
+    harness.add({name, "direct recursive filter", tolerance, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 160), height = between(rng, 1, 120);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const double sigmaSpatial = uniform(rng, 1.0, 40.0);
+                     const double sigmaRange = uniform(rng, 10.0, 200.0);
+                     const int iterations = between(rng, 1, 4);
+                     config << " sigma_s " << sigmaSpatial << " sigma_r " << sigmaRange << " iterations " << iterations;
+                     EdgePreservingWorkspace<unsigned char, C> workspace;
+                     const bool reuse = rng.below(2) == 0;
+                     if (reuse) {
+                         domainTransformFilter(clean, out, sigmaSpatial, sigmaRange, iterations, pool, &workspace);
+                     }
+                     config << (reuse ? " reused workspace" : "");
+                     domainTransformFilter(noisy, out, sigmaSpatial, sigmaRange, iterations, pool,
+                                           reuse ? &workspace : nullptr);
+                     directDomainTransform(noisy, ref, sigmaSpatial, sigmaRange, iterations);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// Median then bilateral; the fused pass pads the median result with
+// Replicate whatever border its input came with.
+template <int C>
+void addFusedCheck(DifferentialHarness& harness, const std::string& name) {
+    const std::string ref = std::string("reference::medianFilter + ") +
+                            (C == 1 ? "bilateralFilterGray" : "bilateralFilterColor");
+    DiffTolerance tolerance;
+    tolerance.maxAbsError = 1;
+    tolerance.maxMismatchFraction = C == 1 ? 0.001 : 0.05;
+    tolerance.maxPsnrDrop = 0.05;
+    harness.add({name, ref, tolerance, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 120), height = between(rng, 1, 90);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy, in, median, ref, out = staleOutput<C>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const int medianRadius = between(rng, 1, 3);
+                     int radius;
+                     double sigmaSpatial, sigmaRange;
+                     bilateralParams(rng, radius, sigmaSpatial, sigmaRange, config);
+                     config << " median " << medianRadius;
+                     const BorderMode readAs = fastInput(rng, noisy, medianRadius, BorderMode::Replicate, ALL_BORDERS,
+                                                         in, config);
+                     medianBilateralFused(in, out, medianRadius, BilateralWeights(radius, sigmaSpatial, sigmaRange),
+                                          C == 1);
+                     reference::medianFilter(noisy, median, medianRadius, readAs);
+                     referenceBilateral(median, ref, radius, sigmaSpatial, sigmaRange, BorderMode::Replicate);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+// Half of the time the whole frame, otherwise a rectangle that may stick
+// out of it.
+ImageRegion randomRegion(SplitMix64& rng, int width, int height, std::ostream& config) {
+    if (rng.below(2) == 0) return {};
+    ImageRegion r{between(rng, -8, width), between(rng, -8, height), between(rng, 1, width + 8),
+                  between(rng, 1, height + 8)};
+    config << " region " << r.x << "," << r.y << " " << r.width << "x" << r.height;
+    return r;
+}
+
+// The region split into up to four row bands, as a streaming caller would
+// see it.
+std::vector<ImageRegion> rowBands(SplitMix64& rng, const ImageRegion& region, int width, int height) {
+    const ImageRegion r = region.clippedTo(width, height);
+    std::vector<ImageRegion> bands;
+    // A region that clips to nothing has no bands; an empty band would mean the whole frame.
+    if (r.width == 0 || r.height == 0) return bands;
+    int y = r.y;
+    while (y < r.y + r.height) {
+        const int rows = bands.size() == 3 ? r.y + r.height - y : between(rng, 1, r.height);
+        const int end = std::min(y + rows, r.y + r.height);
+        bands.push_back({r.x, y, r.width, end - y});
+        y = end;
+    }
+    return bands;
+}
+
+// Exact sums, so both the whole region and its bands must match the double
+// loop to the last bit.
+template <int C>
+void addPsnrCheck(DifferentialHarness& harness, const std::string& name) {
+    harness.add({name, "reference::sumSquaredDifferences", {}, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy;
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const ImageRegion region = randomRegion(rng, width, height, config);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << (threaded ? " pool" : " serial");
+                     ThreadPool* use = threaded ? pool : nullptr;
+                     const Image<unsigned char, C> a = rng.below(2) ? padded(clean, 3) : clean;
+                     const ImageView<unsigned char, C> va(a), vb(noisy);
+                     const PsnrResult<C> whole = measurePsnr(va, vb, region, use);
+                     PsnrResult<C> merged;
+                     for (const ImageRegion& band : rowBands(rng, region, width, height)) {
+                         merged.merge(measurePsnr(va, vb, band, use));
+                     }
+                     const std::array<double, C> ref = reference::sumSquaredDifferences(clean, noisy, region);
+                     trial.config = config.str();
+                     for (int c = 0; c < C; ++c) {
+                         trial.scalarError = std::max({trial.scalarError, std::abs(whole.ssd[c] - ref[c]),
+                                                       std::abs(merged.ssd[c] - ref[c])});
+                     }
+                 }});
+}
+
+// Float window sums against the double 2-D window.
+template <int C>
+void addSsimCheck(DifferentialHarness& harness, const std::string& name) {
+    DiffTolerance tolerance;
+    tolerance.maxScalarError = 1e-4;
+    harness.add({name, "reference::ssim", tolerance, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 4, 120), height = between(rng, 4, 90);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy;
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     SsimParams params;
+                     params.radius = between(rng, 1, 6);
+                     params.sigma = uniform(rng, 0.8, 2.5);
+                     config << " radius " << params.radius << " sigma " << params.sigma;
+                     const ImageRegion region = randomRegion(rng, width, height, config);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << (threaded ? " pool" : " serial");
+                     ThreadPool* use = threaded ? pool : nullptr;
+                     const ImageView<unsigned char, C> va(clean), vb(noisy);
+                     MetricsWorkspace<C> workspace;
+                     const SsimResult<C> whole = measureSsim(va, vb, params, region, use, &workspace);
+                     SsimResult<C> merged;
+                     for (const ImageRegion& band : rowBands(rng, region, width, height)) {
+                         merged.merge(measureSsim(va, vb, params, band, use, &workspace));
+                     }
+                     std::array<double, C> ssim, cs;
+                     reference::ssim<C>(clean, noisy, params, region, ssim, cs);
+                     trial.config = config.str();
+                     for (int c = 0; c < C; ++c) {
+                         trial.scalarError = std::max({trial.scalarError, std::abs(whole.ssim(c) - ssim[c]),
+                                                       std::abs(whole.cs(c) - cs[c]),
+                                                       std::abs(merged.ssim(c) - ssim[c])});
+                     }
+                 }});
+}
+
+}  // namespace
+
+// MS-SSIM from its definition: a double pyramid of 2x2 means (odd last
+// rows and columns dropped), the double-window SSIM at every scale that
+// still fits a window, and prod cs_j^w_j * ssim_last^w_last with the
+// paper's weights renormalised over those scales, averaged over channels.
+template <int C>
+double directMsSsim(const Image<unsigned char, C>& a, const Image<unsigned char, C>& b, const SsimParams& params) {
+    static const double weights[5] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+    const int window = 2 * params.radius + 1;
+    std::array<Image<double, C>, 2> level;
+    for (int i = 0; i < 2; ++i) {
+        const Image<unsigned char, C>& src = i == 0 ? a : b;
+        level[i].resize(src.width(), src.height());
+        for (int y = 0; y < src.height(); ++y) {
+            for (int x = 0; x < src.width(); ++x) {
+                for (int c = 0; c < C; ++c) level[i].at(y, x, c) = src.at(y, x, c);
+            }
+        }
+    }
+    std::array<std::array<double, C>, 5> ssim{}, cs{};
+    int used = 0;
+    for (int s = 0; s < 5; ++s) {
+        if (s > 0) {
+            for (Image<double, C>& img : level) {
+                Image<double, C> half(img.width() / 2, img.height() / 2);
+                for (int y = 0; y < half.height(); ++y) {
+                    for (int x = 0; x < half.width(); ++x) {
+                        for (int c = 0; c < C; ++c) {
+                            half.at(y, x, c) = (img.at(2 * y, 2 * x, c) + img.at(2 * y, 2 * x + 1, c) +
+                                                img.at(2 * y + 1, 2 * x, c) + img.at(2 * y + 1, 2 * x + 1, c)) /
+                                               4.0;
+                        }
+                    }
+                }
+                img = std::move(half);
+            }
+        }
+        if (level[0].width() < window || level[0].height() < window) break;
+        reference::ssim<C>(level[0], level[1], params, {}, ssim[s], cs[s]);
+        used = s + 1;
+    }
+    if (used == 0) return 1.0;
+    double weightSum = 0.0;
+    for (int s = 0; s < used; ++s) weightSum += weights[s];
+    double total = 0.0;
+    for (int c = 0; c < C; ++c) {
+        double product = 1.0;
+        for (int s = 0; s < used; ++s) {
+            const double term = s + 1 < used ? cs[s][c] : ssim[s][c];
+            product *= std::pow(std::max(term, 0.0), weights[s] / weightSum);
+        }
+        total += product;
+    }
+    return total / C;
+}
+
+// Float pyramid and window sums against the double ones.
+template <int C>
+void addMsSsimCheck(DifferentialHarness& harness, const std::string& name) {
+    DiffTolerance tolerance;
+    tolerance.maxScalarError = 1e-4;
+    harness.add({name, "direct pyramid", tolerance, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 4, 200), height = between(rng, 4, 150);
+                     config << sizeConfig(width, height);
+                     Image<unsigned char, C> clean, noisy;
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     SsimParams params;
+                     params.radius = between(rng, 1, 5);
+                     params.sigma = uniform(rng, 0.8, 2.5);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << " radius " << params.radius << " sigma " << params.sigma
+                            << (threaded ? " pool" : " serial");
+                     const ImageView<unsigned char, C> va(clean), vb(noisy);
+                     const double fast = measureMsSsim(va, vb, params, threaded ? pool : nullptr);
+                     trial.config = config.str();
+                     trial.scalarError = std::abs(fast - directMsSsim(clean, noisy, params));
+                 }});
+}
+
+// Malvar-He-Cutler from the paper's 5x5 kernels, in eighths, applied in
+// double at every pixel and rounded to nearest: green at red and blue
+// sites, the row colour and the column colour at green sites (one kernel
+// and its transpose), and the opposite colour at red and blue sites.
+// Out-of-frame samples are read with Reflect, which keeps their CFA colour.
+void directMalvar(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern) {
+    static const double greenAtRb[5][5] = {{0, 0, -1, 0, 0},
+                                           {0, 0, 2, 0, 0},
+                                           {-1, 2, 4, 2, -1},
+                                           {0, 0, 2, 0, 0},
+                                           {0, 0, -1, 0, 0}};
+    static const double rowColour[5][5] = {{0, 0, 0.5, 0, 0},
+                                           {0, -1, 0, -1, 0},
+                                           {-1, 4, 5, 4, -1},
+                                           {0, -1, 0, -1, 0},
+                                           {0, 0, 0.5, 0, 0}};
+    static const double opposite[5][5] = {{0, 0, -1.5, 0, 0},
+                                          {0, 2, 0, 2, 0},
+                                          {-1.5, 0, 6, 0, -1.5},
+                                          {0, 2, 0, 2, 0},
+                                          {0, 0, -1.5, 0, 0}};
+    const int width = bayer.width();
+    const int height = bayer.height();
+    rgb.resize(width, height, rgb.border());
+    // kernel[j][i] over the window around (x, y), transposed when asked.
+    auto apply = [&](const double (*kernel)[5], int x, int y, bool transpose) {
+        double sum = 0.0;
+        for (int j = 0; j < 5; ++j) {
+            for (int i = 0; i < 5; ++i) {
+                const int sx = borderIndex(x + i - 2, width, BorderMode::Reflect);
+                const int sy = borderIndex(y + j - 2, height, BorderMode::Reflect);
+                sum += (transpose ? kernel[i][j] : kernel[j][i]) * bayer.at(sy, sx);
+            }
+        }
+        return static_cast<unsigned char>(std::min(std::max(std::floor(sum / 8.0 + 0.5), 0.0), 255.0));
+    };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int own = reference::cfaColour(pattern, x, y);
+            unsigned char* out = &rgb.at(y, x);
+            out[own] = bayer.at(y, x);
+            if (own == 1) {
+                out[reference::cfaColour(pattern, x + 1, y)] = apply(rowColour, x, y, false);
+                out[reference::cfaColour(pattern, x, y + 1)] = apply(rowColour, x, y, true);
+            } else {
+                out[1] = apply(greenAtRb, x, y, false);
+                out[2 - own] = apply(opposite, x, y, false);
+            }
+        }
+    }
+}
+
+// White patch and gray edge from their definitions: each channel's
+// percentile value found by sorting it, or its mean absolute difference to
+// the right and lower neighbours, then gains mapping them to white or to
+// their common mean, and v * gain truncated and clamped at 255.
+void directWhiteBalance(const RgbImage& src, RgbImage& dst, const WhiteBalanceParams& params,
+                        std::array<double, 3>& gains) {
+    const int width = src.width();
+    const int height = src.height();
+    const double pixels = static_cast<double>(src.pixelCount());
+    std::array<double, 3> measure{};
+    for (int c = 0; c < 3; ++c) {
+        if (params.estimator == WhiteBalanceEstimator::WhitePatch) {
+            std::vector<int> values;
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) values.push_back(src.at(y, x, c));
+            }
+            std::sort(values.begin(), values.end());
+            // The smallest value with at least `percentile` % of the pixels at or below it.
+            const double fraction = std::clamp(params.percentile, 0.0, 100.0) / 100.0;
+            const size_t rank = std::max<size_t>(1, static_cast<size_t>(std::ceil(fraction * pixels)));
+            measure[c] = values.empty() ? 0.0 : values[std::min(rank, values.size()) - 1];
+        } else {
+            double sum = 0.0;
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const int v = src.at(y, x, c);
+                    if (x + 1 < width) sum += std::abs(src.at(y, x + 1, c) - v);
+                    if (y + 1 < height) sum += std::abs(src.at(y + 1, x, c) - v);
+                }
+            }
+            measure[c] = pixels > 0 ? sum / pixels : 0.0;
+        }
+    }
+    const double target = params.estimator == WhiteBalanceEstimator::WhitePatch
+                              ? 255.0
+                              : (measure[0] + measure[1] + measure[2]) / 3.0;
+    for (int c = 0; c < 3; ++c) gains[c] = measure[c] > 0.0 ? target / measure[c] : 1.0;
+    dst.resize(width, height, dst.border());
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                dst.at(y, x, c) = static_cast<unsigned char>(std::min(255.0, src.at(y, x, c) * gains[c]));
+            }
+        }
+    }
+}
+
+void addReferenceChecks(DifferentialHarness& harness) {
+    harness.add({"boxFilter", "reference::uniformFilter", {}, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 200), height = between(rng, 1, 150);
+                     config << sizeConfig(width, height);
+                     GrayImage clean, noisy, in, ref, out = staleOutput<1>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const int size = 1 + 2 * static_cast<int>(rng.below(12));
+                     const BorderMode mode = ALL_BORDERS.begin()[rng.below(3)];
+                     config << " size " << size << " mode " << borderName(mode);
+                     const BorderMode readAs = fastInput(rng, noisy, size / 2, mode, {mode}, in, config);
+                     boxFilter(in, out, size, mode);
+                     reference::uniformFilter(noisy, ref, size, readAs);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+
+    // Separable float taps against the 2-D double kernel: the sums agree
+    // to well under a unit, but the + 0.5 rounding can still flip.
+    DiffTolerance separable;
+    separable.maxAbsError = 1;
+    separable.maxMismatchFraction = 0.001;
+    separable.maxPsnrDrop = 0.01;
+    addGaussianCheck(harness, "gaussianFilter", separable,
+                     [](const GrayImage& in, GrayImage& out, int size, double sigma, BorderMode mode) {
+                         gaussianFilter(in, out, size, sigma, mode);
+                     });
+    // 14-bit taps and 6 fractional bits in the rows: each horizontal product
+    // rounds, so more samples sit a level off than on the float path.
+    DiffTolerance fixed;
+    fixed.maxAbsError = 1;
+    fixed.maxMismatchFraction = 0.02;
+    fixed.maxPsnrDrop = 0.01;
+    addGaussianCheck(harness, "gaussianFilterFixed", fixed,
+                     [](const GrayImage& in, GrayImage& out, int size, double sigma, BorderMode mode) {
+                         gaussianFilterFixed(in, out, size, sigma, mode);
+                     });
+    // Untruncated and recursive, held to a 4-sigma truncation of the
+    // reference; the kernel size follows sigma, so borders stay Replicate.
+    // Deriche's kernel tracks the sampled Gaussian closely enough that only
+    // samples next to a rounding boundary differ, by one level (under 0.5%
+    // of them over 1000 trials).
+    DiffTolerance recursive;
+    recursive.maxAbsError = 1;
+    recursive.maxMismatchFraction = 0.02;
+    recursive.maxPsnrDrop = 0.05;
+    harness.add({"gaussianFilterRecursive", "reference::gaussianFilter", recursive,
+                 [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 8, 160), height = between(rng, 8, 120);
+                     config << sizeConfig(width, height);
+                     GrayImage clean, noisy, ref;
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     const double sigma = uniform(rng, 0.5, 8.0);
+                     const int size = 2 * static_cast<int>(std::ceil(4.0 * sigma)) + 1;
+                     config << " sigma " << sigma << " size " << size;
+                     GrayImage out = gaussianFilterRecursive(noisy, sigma);
+                     reference::gaussianFilter(noisy, ref, size, sigma, BorderMode::Replicate);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+
+    addBilateralCheck<1>(harness, "bilateralFilter<1>");
+    addBilateralCheck<3>(harness, "bilateralFilter<3>");
+    addBilateralGridCheck<1>(harness, "bilateralGrid<1>");
+    addBilateralGridCheck<3>(harness, "bilateralGrid<3>");
+    addGuidedCheck<1>(harness, "guidedFilter<1>");
+    addGuidedCheck<3>(harness, "guidedFilter<3>");
+    addDomainTransformCheck<1>(harness, "domainTransformFilter<1>");
+    addDomainTransformCheck<3>(harness, "domainTransformFilter<3>");
+    addMedianCheck<1>(harness, "medianFilter<1>");
+    addMedianCheck<3>(harness, "medianFilter<3>");
+    addFusedCheck<1>(harness, "medianBilateralFused<1>");
+    addFusedCheck<3>(harness, "medianBilateralFused<3>");
+
+    harness.add({"demosaicBilinear", "reference::demosaicBilinear", {},
+                 [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 2, 200), height = between(rng, 2, 150);
+                     const CfaPattern pattern = static_cast<CfaPattern>(rng.below(4));
+                     static const char* names[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
+                     config << sizeConfig(width, height) << " " << names[static_cast<int>(pattern)];
+                     RgbImage clean, ref, out = staleOutput<3>(rng);
+                     GrayImage bayer, in;
+                     syntheticScene(clean, width, height, rng.next());
+                     mosaic(clean, bayer, pattern);
+                     fastInput(rng, bayer, 1, BorderMode::Reflect, {BorderMode::Reflect}, in, config);
+                     imgcore::demosaicBilinear(in, out, pattern);
+                     reference::demosaicBilinear(bayer, ref, pattern, BorderMode::Reflect);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+
+    // Integer sixteenths against the double kernels: every sum is a multiple
+    // of 1/16, so both round the same way and must agree exactly.
+    harness.add({"demosaicMalvar", "direct 5x5 kernels", {}, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 2, 200), height = between(rng, 2, 150);
+                     const CfaPattern pattern = static_cast<CfaPattern>(rng.below(4));
+                     static const char* names[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
+                     config << sizeConfig(width, height) << " " << names[static_cast<int>(pattern)];
+                     RgbImage clean, ref, out = staleOutput<3>(rng);
+                     GrayImage bayer, in;
+                     syntheticScene(clean, width, height, rng.next());
+                     mosaic(clean, bayer, pattern);
+                     fastInput(rng, bayer, 2, BorderMode::Reflect, {BorderMode::Reflect}, in, config);
+                     demosaicMalvar(in, out, pattern);
+                     directMalvar(bayer, ref, pattern);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+
+    // The per-pixel kernels the 16-bit and float frames take, instantiated
+    // for 8 bits: every method must reproduce the SIMD kernels exactly.
+    harness.add({"demosaicPortable", "demosaic", {}, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 2, 200), height = between(rng, 2, 150);
+                     const CfaPattern pattern = static_cast<CfaPattern>(rng.below(4));
+                     const DemosaicMethod method = static_cast<DemosaicMethod>(rng.below(3));
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << sizeConfig(width, height) << " pattern " << static_cast<int>(pattern) << " method "
+                            << static_cast<int>(method) << (threaded ? " pool" : " serial");
+                     RgbImage clean, ref, out = staleOutput<3>(rng);
+                     GrayImage bayer;
+                     syntheticScene(clean, width, height, rng.next());
+                     mosaic(clean, bayer, pattern);
+                     demosaicPortable(bayer, out, pattern, method, threaded ? pool : nullptr);
+                     demosaic(bayer, ref, pattern, method);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+
+    // Histogram operators: no clean target, only agreement with the original.
+    harness.add({"equalizeCdf", "reference::equalizeMethodA", {}, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     GrayImage clean, noisy, ref, out = staleOutput<1>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     equalizeCdf(noisy, out);
+                     reference::equalizeMethodA(noisy, ref);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, static_cast<const GrayImage*>(nullptr), trial);
+                 }});
+    harness.add({"equalizeBucketFill", "reference::equalizeMethodB", {},
+                 [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     GrayImage clean, noisy, ref, out = staleOutput<1>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     equalizeBucketFill(noisy, out, 256, TieBreak::Raster);
+                     reference::equalizeMethodB(noisy, ref);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, static_cast<const GrayImage*>(nullptr), trial);
+                 }});
+
+    // Gray world: the LUT pass must reproduce the double loop byte for
+    // byte, and the means it accumulates on the way must match too.
+    DiffTolerance means;
+    means.maxScalarError = 1e-9;
+    harness.add({"whiteBalance", "reference::grayWorld", means,
+                 [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     RgbImage clean, noisy, in, ref, out = staleOutput<3>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     fastInput(rng, noisy, 0, BorderMode::Replicate, ALL_BORDERS, in, config);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << (threaded ? " pool" : " serial");
+                     WhiteBalanceReport report;
+                     whiteBalance(in, out, {}, &report, threaded ? pool : nullptr);
+                     std::array<double, 3> meansAfter{};
+                     reference::grayWorld(noisy, ref, &meansAfter);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, static_cast<const RgbImage*>(nullptr), trial);
+                     for (int c = 0; c < 3; ++c) {
+                         const double error = std::abs(report.meansAfter[c] - meansAfter[c]);
+                         trial.scalarError = std::max(trial.scalarError, error);
+                     }
+                 }});
+
+    // The other estimators: histogram percentiles and SAD gradient sums
+    // against sorting and a plain loop, so outputs and gains match exactly.
+    DiffTolerance gains;
+    gains.maxScalarError = 1e-9;
+    harness.add({"whiteBalance estimators", "direct estimators", gains,
+                 [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     RgbImage clean, noisy, ref, out = staleOutput<3>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     WhiteBalanceParams params;
+                     const bool patch = rng.below(2) == 0;
+                     params.estimator = patch ? WhiteBalanceEstimator::WhitePatch : WhiteBalanceEstimator::GrayEdge;
+                     params.percentile = uniform(rng, 50.0, 100.0);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << (patch ? " white patch " : " gray edge ") << params.percentile
+                            << (threaded ? " pool" : " serial");
+                     WhiteBalanceReport report;
+                     whiteBalance(noisy, out, params, &report, threaded ? pool : nullptr);
+                     std::array<double, 3> gain{};
+                     directWhiteBalance(noisy, ref, params, gain);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, static_cast<const RgbImage*>(nullptr), trial);
+                     for (int c = 0; c < 3; ++c) {
+                         const double error = std::abs(report.gains.gain[c] - gain[c]);
+                         trial.scalarError = std::max(trial.scalarError, error);
+                     }
+                 }});
+
+    addPsnrCheck<1>(harness, "measurePsnr<1>");
+    addPsnrCheck<3>(harness, "measurePsnr<3>");
+    addSsimCheck<1>(harness, "measureSsim<1>");
+    addSsimCheck<3>(harness, "measureSsim<3>");
+    addMsSsimCheck<1>(harness, "measureMsSsim<1>");
+    addMsSsimCheck<3>(harness, "measureMsSsim<3>");
+
+    // Q15 coefficients against double: at most one step on any plane.
+    DiffTolerance yuv;
+    yuv.maxAbsError = 1;
+    yuv.maxMismatchFraction = 0.01;
+    harness.add({"rgbToYuv", "reference::rgbToYuv", yuv, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     RgbImage clean, noisy;
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     YuvPlanes fast;
+                     GrayImage y, u, v;
+                     rgbToYuv(noisy, fast);
+                     reference::rgbToYuv(noisy, y, u, v);
+                     trial.config = config.str();
+                     compareOutputs(fast.y, y, static_cast<const GrayImage*>(nullptr), trial);
+                     compareOutputs(fast.u, u, static_cast<const GrayImage*>(nullptr), trial);
+                     compareOutputs(fast.v, v, static_cast<const GrayImage*>(nullptr), trial);
+                 }});
+
+    // Q13 coefficients against the double yuv2rgb, on the planes of a real
+    // conversion; half the trials map Y through a random table first.
+    DiffTolerance rgb;
+    rgb.maxAbsError = 1;
+    rgb.maxMismatchFraction = 0.005;
+    harness.add({"yuvToRgb", "reference::yuvToRgb", rgb, [](SplitMix64& rng, ThreadPool*, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 1, 300), height = between(rng, 1, 200);
+                     config << sizeConfig(width, height);
+                     RgbImage clean, noisy, ref, out = staleOutput<3>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     GrayImage y, u, v, mapped;
+                     reference::rgbToYuv(noisy, y, u, v);
+                     std::vector<unsigned char> lut(256);
+                     const bool useLut = rng.below(2) == 0;
+                     for (unsigned char& entry : lut) entry = static_cast<unsigned char>(rng.below(256));
+                     config << (useLut ? " lut" : "");
+                     mapped = y;
+                     if (useLut) {
+                         for (int row = 0; row < height; ++row) {
+                             for (int x = 0; x < width; ++x) mapped.at(row, x) = lut[y.at(row, x)];
+                         }
+                     }
+                     yuvToRgb(y, u, v, out, useLut ? lut.data() : nullptr);
+                     reference::yuvToRgb(mapped, u, v, ref);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, static_cast<const RgbImage*>(nullptr), trial);
+                 }});
+
+    // The tiled pipeline against its stages run one after another on whole
+    // frames: tile halos and frame edges must not change a single byte.
+    harness.add({"IspPipeline", "whole-frame stages", {}, [](SplitMix64& rng, ThreadPool* pool, DiffTrial& trial) {
+                     std::ostringstream config;
+                     const int width = between(rng, 2, 200), height = between(rng, 2, 150);
+                     config << sizeConfig(width, height);
+                     RgbImage clean, noisy, out = staleOutput<3>(rng);
+                     noisyScene(rng, width, height, clean, noisy, config);
+                     IspParams params;
+                     params.pattern = static_cast<CfaPattern>(rng.below(4));
+                     params.demosaic = static_cast<DemosaicMethod>(rng.below(3));
+                     params.whiteBalance.estimator = static_cast<WhiteBalanceEstimator>(rng.below(3));
+                     params.medianRadius = between(rng, 1, 3);
+                     params.bilateralRadius = between(rng, 1, 3);
+                     params.sigmaRange = uniform(rng, 10.0, 60.0);
+                     params.clahe.tilesX = between(rng, 1, 8);
+                     params.clahe.tilesY = between(rng, 1, 8);
+                     params.tileWidth = between(rng, 1, 96);
+                     params.tileHeight = between(rng, 1, 64);
+                     const bool threaded = pool && rng.below(2) == 0;
+                     config << " pattern " << static_cast<int>(params.pattern) << " method "
+                            << static_cast<int>(params.demosaic) << " estimator "
+                            << static_cast<int>(params.whiteBalance.estimator) << " median " << params.medianRadius
+                            << " radius " << params.bilateralRadius << " sigma-s " << params.sigmaRange << " grid "
+                            << params.clahe.tilesX << "x" << params.clahe.tilesY << " tile " << params.tileWidth << "x"
+                            << params.tileHeight << (threaded ? " pool" : " serial");
+                     GrayImage bayer;
+                     mosaic(noisy, bayer, params.pattern);
+                     IspPipeline(params).process(bayer, out, threaded ? pool : nullptr);
+
+                     RgbImage rgb, balanced, denoised, ref;
+                     demosaic(bayer, rgb, params.pattern, params.demosaic);
+                     whiteBalance(rgb, balanced, params.whiteBalance);
+                     medianBilateralFused(balanced, denoised, params.medianRadius,
+                                          BilateralWeights(params.bilateralRadius, params.sigmaSpatial,
+                                                           params.sigmaRange),
+                                          params.roundToNearest);
+                     YuvPlanes yuv;
+                     GrayImage y;
+                     rgbToYuv(denoised, yuv);
+                     clahe(yuv.y, y, params.clahe);
+                     yuvToRgb(y, yuv.u, yuv.v, ref);
+                     trial.config = config.str();
+                     compareOutputs(out, ref, &clean, trial);
+                 }});
+}
+
+}  // namespace imgcore
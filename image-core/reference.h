@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+
+#include "demosaic.h"
+#include "image.h"
+#include "metrics.h"
+
+namespace imgcore {
+
+// Golden kernels: the straightforward scalar loops the tools started from,
+// kept verbatim in arithmetic (double or float accumulation, the original
+// rounding or truncation) and only moved onto Image. They are slow on
+// purpose and exist so every optimized path has something to be diffed
+// against (see differential.h). Neighbours outside the frame are read
+// through borderIndex(); the originals clamped, i.e. BorderMode::Replicate.
+// Borders of `src` are ignored and `dst` keeps its own.
+namespace reference {
+
+// applyUniformFilter: size x size mean in double, (unsigned char)(sum / area + 0.5).
+void uniformFilter(const GrayImage& src, GrayImage& dst, int size, BorderMode border = BorderMode::Replicate);
+
+// applyGaussianFilter: full 2-D double kernel exp(-(i^2 + j^2) / 2 sigma^2),
+// normalised by its sum and rounded with + 0.5.
+void gaussianFilter(const GrayImage& src, GrayImage& dst, int size, double sigma,
+                    BorderMode border = BorderMode::Replicate);
+
+// The gray applyBilateralFilter: weight exp(-(d_spatial^2 / 2 sigma_c^2 +
+// d_intensity^2 / 2 sigma_s^2)) in double, clamped and rounded with + 0.5.
+void bilateralFilterGray(const GrayImage& src, GrayImage& dst, int radius, double sigmaSpatial,
+                         double sigmaRange, BorderMode border = BorderMode::Replicate);
+
+// The colour applyBilateralFilter: per channel, a precomputed spatial
+// weight times exp(-d^2 / 2 sigma_r^2), clamped and truncated. The
+// original was fixed at radius 2.
+void bilateralFilterColor(const RgbImage& src, RgbImage& dst, int radius, double sigmaSpatial, double sigmaRange,
+                          BorderMode border = BorderMode::Replicate);
+
+// applyMedianFilter: per channel, the window sorted and its middle element
+// taken. The original was fixed at radius 1.
+template <int C>
+void medianFilter(const Image<unsigned char, C>& src, Image<unsigned char, C>& dst, int radius,
+                  BorderMode border = BorderMode::Replicate);
+
+// The bilinear demosaic loop in float, truncated. The original was written
+// for GRBG; here the CFA colour of each neighbour is looked up, which is the
+// same loop for GRBG. Out-of-frame neighbours only keep their CFA colour
+// with Reflect, which is what demosaicBilinear() pads with.
+void demosaicBilinear(const GrayImage& bayer, RgbImage& rgb, CfaPattern pattern,
+                      BorderMode border = BorderMode::Reflect);
+
+// methodA: histogram, CDF, transfer round((float)255 * cdf / N), lookup.
+void equalizeMethodA(const GrayImage& src, GrayImage& dst);
+
+// methodB: (value, index) pairs sorted by value, the i-th getting
+// min(i * 256 / N, 255). The original used std::sort, whose order among
+// equal values is unspecified; a stable sort makes ties go in raster order.
+void equalizeMethodB(const GrayImage& src, GrayImage& dst);
+
+// The gray-world loop: double channel sums, gains mu / mu_c, output
+// (unsigned char)min(255, v * gain); the output means go to `meansAfter`.
+void grayWorld(const RgbImage& src, RgbImage& dst, std::array<double, 3>* meansAfter = nullptr);
+
+// The original double rgb2yuv: each plane clamped to [0, 255] and truncated.
+void rgbToYuv(const RgbImage& rgb, GrayImage& y, GrayImage& u, GrayImage& v);
+
+// The original double yuv2rgb, clamped and truncated the same way.
+void yuvToRgb(const GrayImage& y, const GrayImage& u, const GrayImage& v, RgbImage& rgb);
+
+// The per-tool calculatePSNR loop: squared differences summed in double
+// over `region` (clipped; empty is the whole frame), per channel.
+template <int C>
+std::array<double, C> sumSquaredDifferences(const Image<unsigned char, C>& a, const Image<unsigned char, C>& b,
+                                            const ImageRegion& region = {});
+
+// SSIM and cs per channel with the full 2-D Gaussian window in double,
+// averaged over the window centres in `region` whose windows fit inside
+// the frame. T is unsigned char, or double for the coarser MS-SSIM scales;
+// the constants stay those of 8-bit samples.
+template <int C, typename T>
+void ssim(const Image<T, C>& a, const Image<T, C>& b, const SsimParams& params, const ImageRegion& region,
+          std::array<double, C>& ssimMean, std::array<double, C>& csMean);
+
+}  // namespace reference
+
+}  // namespace imgcore
@@ -0,0 +1,85 @@
+#include "stage-graph.h"
+
+namespace imgcore {
+
+int StageGraph::addNode(const std::string& key, const std::vector<int>& inputs, std::function<void(Node&)> compute,
+                        bool sink) {
+    const int id = static_cast<int>(nodes_.size());
+    auto node = std::make_unique<Node>();
+    node->key = key;
+    node->inputs = inputs;
+    node->compute = std::move(compute);
+    node->sink = sink;
+    for (int input : inputs) nodes_[input]->dependents.push_back(id);
+    nodes_.push_back(std::move(node));
+    if (!sink) ++stats_.nodes;
+    return id;
+}
+
+void StageGraph::release(Node& node) {
+    if (!node.value) return;
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    free_[node.type].push_back(std::move(node.value));
+}
+
+void StageGraph::execute(int id, ThreadPool* pool, TaskGroup* group) {
+    Node& node = *nodes_[id];
+    node.compute(node);
+
+    // Inputs go back to the pool once their last consumer has run.
+    for (int input : node.inputs) {
+        Node& in = *nodes_[input];
+        if (in.pendingConsumers.fetch_sub(1, std::memory_order_acq_rel) == 1) release(in);
+    }
+    if (node.pendingConsumers.load(std::memory_order_acquire) == 0) release(node);
+
+    if (!pool) return;
+    for (int dependent : node.dependents) {
+        Node& next = *nodes_[dependent];
+        if (!next.live) continue;
+        if (next.pendingInputs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pool->run(*group, [this, dependent, pool, group](int) { execute(dependent, pool, group); });
+        }
+    }
+}
+
+void StageGraph::run(ThreadPool* pool) {
+    // Nodes are appended after their inputs, so walking backwards from the
+    // sinks marks everything they depend on in one pass.
+    for (auto it = nodes_.rbegin(); it != nodes_.rend(); ++it) {
+        Node& node = **it;
+        if (node.sink) node.live = true;
+        if (!node.live) continue;
+        for (int input : node.inputs) nodes_[input]->live = true;
+    }
+
+    // A value is consumed once per live dependent edge (an input used twice
+    // by one stage counts twice, matching execute()).
+    for (auto& node : nodes_) {
+        node->pendingInputs.store(static_cast<int>(node->inputs.size()), std::memory_order_relaxed);
+        node->pendingConsumers.store(0, std::memory_order_relaxed);
+    }
+    for (auto& node : nodes_) {
+        if (!node->live) continue;
+        if (!node->sink) ++stats_.executed;
+        for (int input : node->inputs) nodes_[input]->pendingConsumers.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!pool) {
+        for (size_t id = 0; id < nodes_.size(); ++id) {
+            if (nodes_[id]->live) execute(static_cast<int>(id), nullptr, nullptr);
+        }
+        return;
+    }
+    TaskGroup group;
+    for (size_t id = 0; id < nodes_.size(); ++id) {
+        Node& node = *nodes_[id];
+        if (node.live && node.inputs.empty()) {
+            const int start = static_cast<int>(id);
+            pool->run(group, [this, start, pool, &group](int) { execute(start, pool, &group); });
+        }
+    }
+    pool->wait(group);
+}
+
+}  // namespace imgcore
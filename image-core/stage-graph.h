@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "thread-pool.h"
+
+namespace imgcore {
+
+// Typed reference to a node of a StageGraph.
+template <typename T>
+struct StageHandle {
+    int id = -1;
+};
+
+struct StageGraphStats {
+    int declared = 0;          // stage() calls, including deduplicated ones
+    int nodes = 0;             // distinct stages after deduplication
+    int executed = 0;          // stages that ran (stages no sink needs are skipped)
+    int buffersAllocated = 0;  // stage outputs that needed a fresh object
+    int buffersReused = 0;     // stage outputs served from the recycling pool
+};
+
+// Small DAG executor for programs that derive several variants from one
+// input. A stage is identified by its key, its output type and its inputs,
+// so declaring the same stage twice yields the same node and shared
+// prefixes run once. Stage outputs are recycled: once the last consumer of
+// a value has run, the object goes back to a per-type free list and the
+// next stage of that type receives it as its output argument. Image::resize
+// keeps the allocation when the geometry matches, so a long fan-out settles
+// into a fixed working set. Independent branches run concurrently on the
+// pool given to run().
+//
+//   StageGraph g;
+//   auto in = g.stage<GrayImage>("load", [](GrayImage& out) { ... });
+//   auto a = g.stage<GrayImage>("eqA", [](const GrayImage& src, GrayImage& out) { ... }, in);
+//   g.sink("writeA", [](const GrayImage& img) { ... }, a);
+//   g.run(&pool);
+class StageGraph {
+public:
+    StageGraph() = default;
+    StageGraph(const StageGraph&) = delete;
+    StageGraph& operator=(const StageGraph&) = delete;
+
+    // Declares fn(const In&... inputs, T& out). `out` may hold a recycled
+    // value from an earlier stage and should be resized, not assumed empty.
+    template <typename T, typename... In, typename Fn>
+    StageHandle<T> stage(const std::string& key, Fn fn, StageHandle<In>... inputs) {
+        ++stats_.declared;
+        const std::vector<int> ids{inputs.id...};
+        const auto identity = std::make_tuple(key, std::type_index(typeid(T)), ids);
+        auto found = index_.find(identity);
+        if (found != index_.end()) return {found->second};
+
+        auto compute = [this, fn, ids](Node& self) {
+            std::shared_ptr<T> out = acquire<T>();
+            invoke<T, In...>(fn, ids, *out, std::index_sequence_for<In...>{});
+            self.value = std::move(out);
+            self.type = std::type_index(typeid(T));
+        };
+        const int id = addNode(key, ids, std::move(compute), false);
+        index_.emplace(identity, id);
+        return {id};
+    }
+
+    // Declares fn(const In&... inputs) as a terminal consumer (write a file,
+    // print a metric). Only stages some sink depends on are executed.
+    template <typename... In, typename Fn>
+    void sink(const std::string& key, Fn fn, StageHandle<In>... inputs) {
+        ++stats_.declared;
+        const std::vector<int> ids{inputs.id...};
+        auto compute = [this, fn, ids](Node&) { invokeSink<In...>(fn, ids, std::index_sequence_for<In...>{}); };
+        addNode(key, ids, std::move(compute), true);
+    }
+
+    // Executes every stage needed by a sink, each once, in dependency order;
+    // on `pool` when given, otherwise in declaration order on this thread.
+    // Values are released as they are consumed, so run() may be called once.
+    void run(ThreadPool* pool = nullptr);
+
+    const StageGraphStats& stats() const { return stats_; }
+
+private:
+    struct Node {
+        std::string key;
+        std::vector<int> inputs;
+        std::vector<int> dependents;
+        std::function<void(Node&)> compute;
+        bool sink = false;
+        bool live = false;
+        std::shared_ptr<void> value;
+        std::type_index type = std::type_index(typeid(void));
+        std::atomic<int> pendingInputs{0};
+        std::atomic<int> pendingConsumers{0};
+    };
+
+    template <typename T>
+    const T& valueOf(int id) const {
+        return *static_cast<const T*>(nodes_[id]->value.get());
+    }
+
+    template <typename T, typename... In, typename Fn, size_t... I>
+    void invoke(Fn& fn, const std::vector<int>& ids, T& out, std::index_sequence<I...>) {
+        fn(valueOf<In>(ids[I])..., out);
+    }
+
+    template <typename... In, typename Fn, size_t... I>
+    void invokeSink(Fn& fn, const std::vector<int>& ids, std::index_sequence<I...>) {
+        fn(valueOf<In>(ids[I])...);
+    }
+
+    template <typename T>
+    std::shared_ptr<T> acquire() {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex_);
+            std::vector<std::shared_ptr<void>>& free = free_[std::type_index(typeid(T))];
+            if (!free.empty()) {
+                std::shared_ptr<void> v = std::move(free.back());
+                free.pop_back();
+                ++stats_.buffersReused;
+                return std::static_pointer_cast<T>(v);
+            }
+            ++stats_.buffersAllocated;
+        }
+        return std::make_shared<T>();
+    }
+
+    int addNode(const std::string& key, const std::vector<int>& inputs, std::function<void(Node&)> compute,
+                bool sink);
+    void execute(int id, ThreadPool* pool, TaskGroup* group);
+    void release(Node& node);
+
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::map<std::tuple<std::string, std::type_index, std::vector<int>>, int> index_;
+    std::unordered_map<std::type_index, std::vector<std::shared_ptr<void>>> free_;
+    std::mutex poolMutex_;
+    StageGraphStats stats_;
+};
+
+}  // namespace imgcore
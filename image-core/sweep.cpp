@@ -0,0 +1,160 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <set>
+
+namespace imgcore {
+
+SweepReporter::SweepReporter(std::ostream& out, Format format, const std::vector<SweepParameter>& params,
+                             const std::string& scoreName)
+    : out_(out), format_(format), scoreName_(scoreName) {
+    for (const SweepParameter& p : params) names_.push_back(p.name);
+    if (format_ == Format::Csv) {
+        for (const std::string& name : names_) out_ << name << ",";
+        out_ << scoreName_ << "\n";
+    } else {
+        out_ << "{\n  \"results\": [";
+    }
+    out_.flush();
+}
+
+void SweepReporter::add(const SweepResult& result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (format_ == Format::Csv) {
+        for (double v : result.values) out_ << v << ",";
+        out_ << result.score << "\n";
+    } else {
+        out_ << (first_ ? "\n    {" : ",\n    {");
+        for (size_t i = 0; i < names_.size(); ++i) out_ << "\"" << names_[i] << "\": " << result.values[i] << ", ";
+        out_ << "\"" << scoreName_ << "\": " << result.score << "}";
+    }
+    first_ = false;
+    out_.flush();
+}
+
+void SweepReporter::finish(const SweepResult& best) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (format_ == Format::Json) {
+        out_ << "\n  ],\n  \"best\": {";
+        for (size_t i = 0; i < names_.size(); ++i) out_ << "\"" << names_[i] << "\": " << best.values[i] << ", ";
+        out_ << "\"" << scoreName_ << "\": " << best.score << "}\n}\n";
+    }
+    out_.flush();
+}
+
+std::vector<SweepResult> ParameterSweep::evaluate(ThreadPool& pool, const Score& score,
+                                                  const std::vector<std::vector<int>>& points,
+                                                  SweepReporter* reporter) {
+    std::vector<SweepResult> results(points.size());
+    TaskGroup group;
+    for (size_t i = 0; i < points.size(); ++i) {
+        pool.run(group, [&, i](int slot) {
+            SweepResult& r = results[i];
+            r.indices = points[i];
+            for (size_t p = 0; p < params_.size(); ++p) r.values.push_back(params_[p].values[points[i][p]]);
+            r.score = score(r.values, slot);
+            if (reporter) reporter->add(r);
+        });
+    }
+    pool.wait(group);
+    return results;
+}
+
+std::vector<SweepResult> ParameterSweep::runGrid(ThreadPool& pool, const Score& score, SweepReporter* reporter) {
+    std::vector<std::vector<int>> points(1);
+    for (const SweepParameter& p : params_) {
+        std::vector<std::vector<int>> next;
+        for (const std::vector<int>& prefix : points) {
+            for (int i = 0; i < static_cast<int>(p.values.size()); ++i) {
+                next.push_back(prefix);
+                next.back().push_back(i);
+            }
+        }
+        points.swap(next);
+    }
+    std::vector<SweepResult> results = evaluate(pool, score, points, reporter);
+    if (reporter && !results.empty()) reporter->finish(best(results));
+    return results;
+}
+
+std::vector<SweepResult> ParameterSweep::runCoarseToFine(ThreadPool& pool, const Score& score, int coarsePoints,
+                                                         SweepReporter* reporter) {
+    // A parameter without values leaves no point to start from (runGrid()
+    // evaluates nothing either).
+    for (const SweepParameter& p : params_) {
+        if (p.values.empty()) return {};
+    }
+    const size_t dims = params_.size();
+    std::vector<int> steps(dims);
+    for (size_t p = 0; p < dims; ++p) {
+        int n = static_cast<int>(params_[p].values.size());
+        steps[p] = std::max(1, (n - 1) / std::max(1, coarsePoints - 1));
+    }
+
+    std::set<std::vector<int>> seen;
+    std::vector<SweepResult> all;
+    auto evaluateNew = [&](const std::vector<std::vector<int>>& candidates) {
+        std::vector<std::vector<int>> fresh;
+        for (const std::vector<int>& c : candidates) {
+            if (seen.insert(c).second) fresh.push_back(c);
+        }
+        std::vector<SweepResult> results = evaluate(pool, score, fresh, reporter);
+        all.insert(all.end(), results.begin(), results.end());
+    };
+
+    // Coarse lattice: every steps[p]-th value, always including the last one.
+    std::vector<std::vector<int>> lattice(1);
+    for (size_t p = 0; p < dims; ++p) {
+        int n = static_cast<int>(params_[p].values.size());
+        std::vector<int> axis;
+        for (int i = 0; i < n; i += steps[p]) axis.push_back(i);
+        if (axis.back() != n - 1) axis.push_back(n - 1);
+        std::vector<std::vector<int>> next;
+        for (const std::vector<int>& prefix : lattice) {
+            for (int i : axis) {
+                next.push_back(prefix);
+                next.back().push_back(i);
+            }
+        }
+        lattice.swap(next);
+    }
+    evaluateNew(lattice);
+
+    // Refine: evaluate the 3^dims neighbourhood of the incumbent at the
+    // current step, halve the step, and repeat until every step is 1 and
+    // the incumbent stops moving.
+    std::vector<int> center = best(all).indices;
+    while (true) {
+        std::vector<std::vector<int>> neighbourhood(1);
+        for (size_t p = 0; p < dims; ++p) {
+            int n = static_cast<int>(params_[p].values.size());
+            std::vector<std::vector<int>> next;
+            for (const std::vector<int>& prefix : neighbourhood) {
+                for (int d = -1; d <= 1; ++d) {
+                    int i = center[p] + d * steps[p];
+                    if (i < 0 || i >= n) continue;
+                    next.push_back(prefix);
+                    next.back().push_back(i);
+                }
+            }
+            neighbourhood.swap(next);
+        }
+        evaluateNew(neighbourhood);
+
+        std::vector<int> newCenter = best(all).indices;
+        bool finest = std::all_of(steps.begin(), steps.end(), [](int s) { return s == 1; });
+        if (finest && newCenter == center) break;
+        center = newCenter;
+        for (int& s : steps) s = std::max(1, s / 2);
+    }
+
+    if (reporter && !all.empty()) reporter->finish(best(all));
+    return all;
+}
+
+const SweepResult& ParameterSweep::best(const std::vector<SweepResult>& results) {
+    return *std::max_element(results.begin(), results.end(),
+                             [](const SweepResult& a, const SweepResult& b) { return a.score < b.score; });
+}
+
+}  // namespace imgcore
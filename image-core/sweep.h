@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "thread-pool.h"
+
+namespace imgcore {
+
+struct SweepParameter {
+    std::string name;
+    std::vector<double> values;
+};
+
+// One evaluated configuration; `indices` point into each parameter's values.
+struct SweepResult {
+    std::vector<int> indices;
+    std::vector<double> values;
+    double score;
+};
+
+// Streams results as they complete, from any worker. CSV writes a header
+// and one line per result; JSON writes one array and closes it in finish().
+class SweepReporter {
+public:
+    enum class Format { Csv, Json };
+
+    SweepReporter(std::ostream& out, Format format, const std::vector<SweepParameter>& params,
+                  const std::string& scoreName = "score");
+
+    void add(const SweepResult& result);
+    void finish(const SweepResult& best);
+
+private:
+    std::ostream& out_;
+    Format format_;
+    std::vector<std::string> names_;
+    std::string scoreName_;
+    std::mutex mutex_;
+    bool first_ = true;
+};
+
+// Evaluates configurations of a parameter grid on a ThreadPool. The score
+// function receives the parameter values plus the pool slot, so it can keep
+// per-slot output buffers; higher scores are better.
+class ParameterSweep {
+public:
+    using Score = std::function<double(const std::vector<double>& values, int slot)>;
+
+    explicit ParameterSweep(std::vector<SweepParameter> params) : params_(std::move(params)) {}
+
+    const std::vector<SweepParameter>& parameters() const { return params_; }
+
+    // Every point of the grid; results come back in grid (row-major) order.
+    std::vector<SweepResult> runGrid(ThreadPool& pool, const Score& score, SweepReporter* reporter = nullptr);
+
+    // Coarse-to-fine search: start from about `coarsePoints` values per
+    // parameter, then repeatedly halve the step around the best point until
+    // neighbouring grid values are reached. Evaluates a small fraction of
+    // the grid when the score is unimodal; returns every evaluated point, or
+    // none when a parameter has no values.
+    std::vector<SweepResult> runCoarseToFine(ThreadPool& pool, const Score& score, int coarsePoints = 3,
+                                             SweepReporter* reporter = nullptr);
+
+    static const SweepResult& best(const std::vector<SweepResult>& results);
+
+private:
+    std::vector<SweepResult> evaluate(ThreadPool& pool, const Score& score,
+                                      const std::vector<std::vector<int>>& points, SweepReporter* reporter);
+
+    std::vector<SweepParameter> params_;
+};
+
+}  // namespace imgcore
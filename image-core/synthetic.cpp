@@ -0,0 +1,133 @@
+#include "synthetic.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace imgcore {
+
+namespace {
+
+constexpr int SHAPES = 12;
+
+// RGB index of the CFA colour at (x, y).
+int cfaChannel(CfaPattern pattern, int x, int y) {
+    static const int quads[4][4] = {
+        {0, 1, 1, 2},  // RGGB
+        {2, 1, 1, 0},  // BGGR
+        {1, 0, 2, 1},  // GRBG
+        {1, 2, 0, 1},  // GBRG
+    };
+    return quads[static_cast<int>(pattern)][(y & 1) * 2 + (x & 1)];
+}
+
+}  // namespace
+
+template <int C>
+void syntheticScene(Image<unsigned char, C>& dst, int width, int height, uint64_t seed) {
+    dst.resize(width, height, dst.border());
+    if (dst.empty()) return;
+    SplitMix64 rng(seed);
+
+    // Gradient: each channel leans a different way so the means differ.
+    const int spanX = std::max(width - 1, 1);
+    const int spanY = std::max(height - 1, 1);
+    for (int y = 0; y < height; ++y) {
+        unsigned char* row = dst.row(y);
+        const int gy = y * 255 / spanY;
+        for (int x = 0; x < width; ++x) {
+            const int gx = x * 255 / spanX;
+            for (int c = 0; c < C; ++c) {
+                const int lean = C == 1 ? 2 : 3 - c;
+                row[x * C + c] = static_cast<unsigned char>(30 + (lean * gx + (4 - lean) * gy) * 150 / (4 * 255));
+            }
+        }
+    }
+
+    // Zone plate in the bottom-right quadrant; its local period reaches two
+    // pixels at the far corner.
+    const int cx = width / 2, cy = height / 2;
+    const double halfX = width - cx, halfY = height - cy;
+    const int64_t scale = std::max<int64_t>(1, 2 * static_cast<int64_t>(std::sqrt(halfX * halfX + halfY * halfY)));
+    for (int y = cy; y < height; ++y) {
+        unsigned char* row = dst.row(y);
+        const int64_t dy = y - cy;
+        for (int x = cx; x < width; ++x) {
+            const int64_t dx = x - cx;
+            const bool light = ((dx * dx + dy * dy) / scale) & 1;
+            for (int c = 0; c < C; ++c) row[x * C + c] = static_cast<unsigned char>(light ? 220 - 10 * c : 35 + 5 * c);
+        }
+    }
+
+    const int minSide = std::min(width, height);
+    for (int s = 0; s < SHAPES; ++s) {
+        const bool disc = rng.below(2) == 1;
+        const int px = static_cast<int>(rng.below(width));
+        const int py = static_cast<int>(rng.below(height));
+        const int radius = std::max(1, minSide / 20 + static_cast<int>(rng.below(std::max(1, minSide * 3 / 20))));
+        unsigned char colour[C];
+        for (int c = 0; c < C; ++c) colour[c] = static_cast<unsigned char>(rng.below(256));
+        const int64_t r2 = static_cast<int64_t>(radius) * radius;
+        for (int y = std::max(py - radius, 0); y < std::min(py + radius, height); ++y) {
+            unsigned char* row = dst.row(y);
+            for (int x = std::max(px - radius, 0); x < std::min(px + radius, width); ++x) {
+                const int64_t dx = x - px, dy = y - py;
+                if (disc && dx * dx + dy * dy > r2) continue;
+                for (int c = 0; c < C; ++c) row[x * C + c] = colour[c];
+            }
+        }
+    }
+}
+
+void mosaic(const RgbImage& rgb, GrayImage& bayer, CfaPattern pattern) {
+    bayer.resize(rgb.width(), rgb.height(), bayer.border());
+    for (int y = 0; y < rgb.height(); ++y) {
+        const unsigned char* in = rgb.row(y);
+        unsigned char* out = bayer.row(y);
+        for (int x = 0; x < rgb.width(); ++x) out[x] = in[3 * x + cfaChannel(pattern, x, y)];
+    }
+}
+
+template <int C>
+void addGaussianNoise(Image<unsigned char, C>& img, double sigma, uint64_t seed) {
+    SplitMix64 rng(seed);
+    // sum of 12 uniforms in [0, 65536) minus 6 * 65536 has variance 65536^2,
+    // so scaling by sigma / 65536 gives N(0, sigma^2). sigma is taken in Q8.
+    const int64_t sigmaQ8 = static_cast<int64_t>(std::lround(sigma * 256.0));
+    const int64_t denominator = int64_t(65536) * 256;
+    for (int y = 0; y < img.height(); ++y) {
+        unsigned char* row = img.row(y);
+        for (int i = 0; i < img.width() * C; ++i) {
+            int64_t sum = -6 * 65536;
+            for (int k = 0; k < 3; ++k) {
+                const uint64_t bits = rng.next();
+                for (int shift = 0; shift < 64; shift += 16) sum += static_cast<int64_t>((bits >> shift) & 0xFFFF);
+            }
+            const int64_t scaled = sum * sigmaQ8;
+            // Round half away from zero in integers.
+            const int64_t delta = (scaled >= 0 ? scaled + denominator / 2 : scaled - denominator / 2) / denominator;
+            row[i] = static_cast<unsigned char>(std::clamp<int64_t>(row[i] + delta, 0, 255));
+        }
+    }
+}
+
+template <int C>
+void addImpulseNoise(Image<unsigned char, C>& img, double fraction, uint64_t seed) {
+    SplitMix64 rng(seed);
+    const uint64_t threshold = static_cast<uint64_t>(std::clamp(fraction, 0.0, 1.0) * 4294967296.0);
+    for (int y = 0; y < img.height(); ++y) {
+        unsigned char* row = img.row(y);
+        for (int i = 0; i < img.width() * C; ++i) {
+            const uint64_t bits = rng.next();
+            if ((bits >> 32) < threshold) row[i] = (bits & 1) ? 255 : 0;
+        }
+    }
+}
+
+template void syntheticScene(Image<unsigned char, 1>&, int, int, uint64_t);
+template void syntheticScene(Image<unsigned char, 3>&, int, int, uint64_t);
+template void addGaussianNoise(Image<unsigned char, 1>&, double, uint64_t);
+template void addGaussianNoise(Image<unsigned char, 3>&, double, uint64_t);
+template void addImpulseNoise(Image<unsigned char, 1>&, double, uint64_t);
+template void addImpulseNoise(Image<unsigned char, 3>&, double, uint64_t);
+
+}  // namespace imgcore
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+#include "demosaic.h"
+#include "image.h"
+
+namespace imgcore {
+
+// SplitMix64: the same seed gives the same sequence with every compiler and
+// standard library, which std::*_distribution does not promise.
+class SplitMix64 {
+public:
+    explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, n) (n > 0), by multiply-shift; the bias is below 2^-32.
+    uint32_t below(uint32_t n) { return static_cast<uint32_t>(((next() >> 32) * n) >> 32); }
+
+private:
+    uint64_t state_;
+};
+
+// Deterministic test scene of the given size: a smooth two-axis gradient,
+// hard-edged rectangles and discs, and an integer zone plate whose rings
+// get finer towards the bottom-right corner (aliasing bait for demosaicing).
+// Everything is integer arithmetic, so a seed reproduces the same bytes on
+// every platform. C is 1 (gray) or 3 (RGB); `dst` keeps its border.
+template <int C>
+void syntheticScene(Image<unsigned char, C>& dst, int width, int height, uint64_t seed);
+
+// Samples `rgb` through a colour filter array: one sample per pixel.
+void mosaic(const RgbImage& rgb, GrayImage& bayer, CfaPattern pattern);
+
+// Adds zero-mean noise of standard deviation `sigma` to every visible
+// sample, saturating at 0 and 255. The deviates are Irwin-Hall sums of
+// twelve 16-bit uniforms in fixed point, so they are exactly reproducible.
+template <int C>
+void addGaussianNoise(Image<unsigned char, C>& img, double sigma, uint64_t seed);
+
+// Salt-and-pepper noise: each visible sample becomes 0 or 255 (even odds)
+// with probability `fraction`.
+template <int C>
+void addImpulseNoise(Image<unsigned char, C>& img, double fraction, uint64_t seed);
+
+}  // namespace imgcore
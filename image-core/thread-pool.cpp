@@ -0,0 +1,156 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+#include "profile.h"
+
+namespace imgcore {
+
+namespace {
+thread_local const ThreadPool* tlsPool = nullptr;
+thread_local int tlsSlot = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i <= threads; ++i) queues_.push_back(std::make_unique<Queue>());
+    for (int i = 0; i < threads; ++i) workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& t : workers_) t.join();
+}
+
+int ThreadPool::currentSlot() const {
+    return tlsPool == this ? tlsSlot : size();
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void(int)> task) {
+    group.pending_.fetch_add(1, std::memory_order_relaxed);
+    Queue& q = *queues_[currentSlot()];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back({std::move(task), &group});
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    // Taking the lock orders this notify after a worker's empty check.
+    bool waiters;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        ++events_;
+        waiters = waiters_ > 0;
+    }
+    wake_.notify_one();
+    // A waiter may be able to take the task if it belongs to its group.
+    if (waiters) waiting_.notify_all();
+}
+
+bool ThreadPool::popOwn(int slot, const TaskGroup* only, Task& task) {
+    Queue& q = *queues_[slot];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    for (auto it = q.tasks.rbegin(); it != q.tasks.rend(); ++it) {
+        if (only && it->group != only) continue;
+        task = std::move(*it);
+        q.tasks.erase(std::next(it).base());
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::steal(int slot, const TaskGroup* only, Task& task) {
+    const int n = static_cast<int>(queues_.size());
+    for (int i = 1; i < n; ++i) {
+        Queue& q = *queues_[(slot + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        for (auto it = q.tasks.begin(); it != q.tasks.end(); ++it) {
+            if (only && it->group != only) continue;
+            task = std::move(*it);
+            q.tasks.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(int slot, Task& task) {
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    const ThreadPool* prevPool = tlsPool;
+    int prevSlot = tlsSlot;
+    tlsPool = this;
+    tlsSlot = slot;
+    task.fn(slot);
+    tlsPool = prevPool;
+    tlsSlot = prevSlot;
+    // The group may be destroyed as soon as it reads done(); only the pool
+    // is touched after the last decrement.
+    if (task.group->pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    bool waiters;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        ++events_;
+        waiters = waiters_ > 0;
+    }
+    if (waiters) waiting_.notify_all();
+}
+
+bool ThreadPool::tryRun(int slot, const TaskGroup* only) {
+    Task task;
+    if (!popOwn(slot, only, task) && !steal(slot, only, task)) return false;
+    execute(slot, task);
+    return true;
+}
+
+void ThreadPool::workerLoop(int slot) {
+    tlsPool = this;
+    tlsSlot = slot;
+    nameProfileThread("pool worker", slot);
+    while (true) {
+        if (tryRun(slot, nullptr)) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+        if (stop_ && queued_.load() == 0) return;
+        lock.unlock();
+        // Another worker may have grabbed the task first; back off briefly
+        // instead of spinning on the condition variable.
+        if (!tryRun(slot, nullptr)) std::this_thread::yield();
+    }
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    const int slot = currentSlot();
+    while (!group.done()) {
+        if (tryRun(slot, &group)) continue;
+        // Search once more after the snapshot, so a task queued just after
+        // the empty search above is not slept through.
+        uint64_t seen;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            seen = events_;
+        }
+        if (tryRun(slot, &group)) continue;
+        // The group's remaining tasks run elsewhere: sleep until one of them
+        // finishes the group or new work is queued.
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        ++waiters_;
+        waiting_.wait(lock, [&] { return group.done() || events_ != seen; });
+        --waiters_;
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const std::function<void(int, int, int)>& fn) {
+    if (begin >= end) return;
+    grain = std::max(1, grain);
+    TaskGroup group;
+    for (int i = begin; i < end; i += grain) {
+        int chunkEnd = std::min(end, i + grain);
+        run(group, [&fn, i, chunkEnd](int slot) { fn(i, chunkEnd, slot); });
+    }
+    wait(group);
+}
+
+}  // namespace imgcore
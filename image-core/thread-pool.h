@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace imgcore {
+
+// Completion counter for a batch of tasks submitted with ThreadPool::run().
+class TaskGroup {
+public:
+    bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> pending_{0};
+};
+
+// Work-stealing pool. Each worker owns a deque: it pushes and pops its own
+// tasks at the back and steals from the front of the others when it runs
+// dry. Tasks receive a slot index in [0, slots()) that is unique among the
+// threads running concurrently, so callers can keep per-slot scratch
+// buffers (see WorkerLocal) instead of allocating per task. The last slot
+// belongs to the external thread that submits work and helps while waiting;
+// only one external thread should drive a pool at a time.
+class ThreadPool {
+public:
+    // threads <= 0 picks std::thread::hardware_concurrency().
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers_.size()); }
+    int slots() const { return size() + 1; }
+
+    void run(TaskGroup& group, std::function<void(int slot)> task);
+
+    // Blocks until every task of `group` has finished. The waiting thread
+    // only executes tasks of the same group, so a task may wait on a nested
+    // group without another task reusing its slot underneath it.
+    void wait(TaskGroup& group);
+
+    // Splits [begin, end) into chunks of at most `grain` and runs
+    // fn(chunkBegin, chunkEnd, slot) for each, returning when all are done.
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int, int)>& fn);
+
+private:
+    struct Task {
+        std::function<void(int)> fn;
+        TaskGroup* group;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(int slot);
+    bool tryRun(int slot, const TaskGroup* only);
+    bool popOwn(int slot, const TaskGroup* only, Task& task);
+    bool steal(int slot, const TaskGroup* only, Task& task);
+    void execute(int slot, Task& task);
+    int currentSlot() const;
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    // Threads blocked in wait() sleep on `waiting_` until a task is queued or
+    // a group finishes; both bump `events_`. Guarded by sleepMutex_.
+    std::condition_variable waiting_;
+    uint64_t events_ = 0;
+    int waiters_ = 0;
+    std::atomic<int> queued_{0};
+    std::atomic<bool> stop_{false};
+};
+
+// One T per pool slot, e.g. an output image each worker reuses across tasks.
+template <typename T>
+class WorkerLocal {
+public:
+    explicit WorkerLocal(const ThreadPool& pool) : items_(pool.slots()) {}
+    T& operator[](int slot) { return items_[slot]; }
+    std::vector<T>& all() { return items_; }
+
+private:
+    std::vector<T> items_;
+};
+
+}  // namespace imgcore
@@ -0,0 +1,517 @@
+#include "white-balance.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+#include "profile.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace imgcore {
+
+namespace {
+
+// Pixels per parallelFor chunk: large enough that the partial merge and the
+// task overhead vanish, small enough to balance a 1080p frame over a pool.
+constexpr int BAND_PIXELS = 1 << 16;
+
+int bandRows(int width) { return std::max(1, BAND_PIXELS / std::max(width, 1)); }
+
+#ifdef __AVX2__
+// 96 bytes are 32 RGB pixels, so every byte offset within such a block
+// keeps its channel. channel[k][c] selects the bytes of channel c in the
+// k-th 32-byte vector of the block.
+struct BlockMasks {
+    __m256i channel[3][3];
+
+    BlockMasks() {
+        alignas(32) unsigned char m[32];
+        for (int k = 0; k < 3; ++k) {
+            for (int c = 0; c < 3; ++c) {
+                for (int j = 0; j < 32; ++j) m[j] = (32 * k + j) % 3 == c ? 0xFF : 0;
+                channel[k][c] = _mm256_load_si256(reinterpret_cast<const __m256i*>(m));
+            }
+        }
+    }
+};
+
+inline __m256i absDiff(__m256i a, __m256i b) { return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a)); }
+
+inline uint64_t horizontalSum(__m256i v) {
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+// Sums (and gradient sums when `edges`) of one row; `below` is the next row
+// or null on the last one.
+void statsRow(const unsigned char* row, const unsigned char* below, int width, bool edges, ChannelStats& stats) {
+    const int samples = 3 * width;
+    int i = 0;
+#ifdef __AVX2__
+    static const BlockMasks masks;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum[3] = {zero, zero, zero};
+    __m256i edge[3] = {zero, zero, zero};
+    // The horizontal difference reads one pixel past the block.
+    const int blockEnd = samples - (edges ? 3 : 0);
+    for (; i + 96 <= blockEnd; i += 96) {
+        for (int k = 0; k < 3; ++k) {
+            const unsigned char* p = row + i + 32 * k;
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            for (int c = 0; c < 3; ++c) {
+                sum[c] = _mm256_add_epi64(sum[c], _mm256_sad_epu8(_mm256_and_si256(v, masks.channel[k][c]), zero));
+            }
+            if (!edges) continue;
+            __m256i d = absDiff(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 3)));
+            for (int c = 0; c < 3; ++c) {
+                edge[c] = _mm256_add_epi64(edge[c], _mm256_sad_epu8(_mm256_and_si256(d, masks.channel[k][c]), zero));
+            }
+            if (!below) continue;
+            d = absDiff(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(below + i + 32 * k)));
+            for (int c = 0; c < 3; ++c) {
+                edge[c] = _mm256_add_epi64(edge[c], _mm256_sad_epu8(_mm256_and_si256(d, masks.channel[k][c]), zero));
+            }
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        stats.sum[c] += horizontalSum(sum[c]);
+        stats.edgeSum[c] += horizontalSum(edge[c]);
+    }
+#endif
+    for (; i < samples; i += 3) {
+        for (int c = 0; c < 3; ++c) {
+            const int v = row[i + c];
+            stats.sum[c] += v;
+            if (!edges) continue;
+            if (i + 3 < samples) stats.edgeSum[c] += std::abs(row[i + 3 + c] - v);
+            if (below) stats.edgeSum[c] += std::abs(below[i + c] - v);
+        }
+    }
+}
+
+void histogramRow(const unsigned char* row, int width, ChannelStats& stats) {
+    for (int x = 0; x < width; ++x) {
+        ++stats.hist[0][row[3 * x]];
+        ++stats.hist[1][row[3 * x + 1]];
+        ++stats.hist[2][row[3 * x + 2]];
+    }
+}
+
+template <bool Sums>
+void applyRow(const unsigned char* in, unsigned char* out, int width, const unsigned char* table,
+              std::array<uint64_t, 3>& sums) {
+    const int samples = 3 * width;
+    int i = 0;
+#ifdef __AVX2__
+    // Eight pixels per step as three groups of eight samples; lane j of
+    // group k holds channel (8k + j) % 3 throughout the row.
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256i low = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                         0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i gatherLow = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    __m256i offset[3], acc[3];
+    for (int k = 0; k < 3; ++k) {
+        alignas(32) int lanes[8];
+        for (int j = 0; j < 8; ++j) lanes[j] = 256 * ((8 * k + j) % 3);
+        offset[k] = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+        acc[k] = _mm256_setzero_si256();
+    }
+    const int* base = reinterpret_cast<const int*>(table);
+    for (; i + 24 <= samples; i += 24) {
+        for (int k = 0; k < 3; ++k) {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i + 8 * k));
+            const __m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(bytes), offset[k]);
+            const __m256i value = _mm256_and_si256(_mm256_i32gather_epi32(base, index, 1), byteMask);
+            if (Sums) acc[k] = _mm256_add_epi32(acc[k], value);
+            const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(value, low), gatherLow);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i + 8 * k), _mm256_castsi256_si128(packed));
+        }
+    }
+    if (Sums) {
+        // A lane gains at most 255 per step, so 32 bits hold any row.
+        for (int k = 0; k < 3; ++k) {
+            alignas(32) uint32_t lanes[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc[k]);
+            for (int j = 0; j < 8; ++j) sums[(8 * k + j) % 3] += lanes[j];
+        }
+    }
+#endif
+    for (; i < samples; i += 3) {
+        for (int c = 0; c < 3; ++c) {
+            const unsigned char v = table[256 * c + in[i + c]];
+            out[i + c] = v;
+            if (Sums) sums[c] += v;
+        }
+    }
+}
+
+}  // namespace
+
+bool parseWhiteBalanceEstimator(const std::string& name, WhiteBalanceEstimator& estimator) {
+    std::string lower;
+    for (unsigned char c : name) {
+        if (c != '-' && c != '_') lower.push_back(static_cast<char>(std::tolower(c)));
+    }
+    if (lower == "grayworld") estimator = WhiteBalanceEstimator::GrayWorld;
+    else if (lower == "whitepatch") estimator = WhiteBalanceEstimator::WhitePatch;
+    else if (lower == "grayedge") estimator = WhiteBalanceEstimator::GrayEdge;
+    else return false;
+    return true;
+}
+
+int ChannelStats::percentileValue(int c, double percentile) const {
+    const double fraction = std::clamp(percentile, 0.0, 100.0) / 100.0;
+    const uint64_t needed = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * pixels)));
+    uint64_t seen = 0;
+    for (int v = 0; v < 256; ++v) {
+        seen += hist[c][v];
+        if (seen >= needed) return v;
+    }
+    return 255;
+}
+
+void ChannelStats::merge(const ChannelStats& other) {
+    pixels += other.pixels;
+    for (int c = 0; c < 3; ++c) {
+        sum[c] += other.sum[c];
+        edgeSum[c] += other.edgeSum[c];
+        for (int v = 0; v < 256; ++v) hist[c][v] += other.hist[c][v];
+    }
+}
+
+void gatherChannelStats(const RgbImage& img, WhiteBalanceEstimator estimator, ChannelStats& stats,
+                        ThreadPool* pool) {
+    gatherChannelStats(img, estimator, StatsSampling(), stats, pool);
+}
+
+void gatherChannelStats(const RgbImage& img, WhiteBalanceEstimator estimator, const StatsSampling& sampling,
+                        ChannelStats& stats, ThreadPool* pool) {
+    const StatsRegion r = sampling.region.clippedTo(img.width(), img.height());
+    const int x0 = r.x, y0 = r.y, y1 = r.y + r.height;
+    const int width = r.width;
+    const int step = std::max(sampling.rowStep, 1);
+    const int first = y0 + ((sampling.rowPhase % step) + step) % step;
+    const int rows = first < y1 ? (y1 - first + step - 1) / step : 0;
+
+    const bool edges = estimator == WhiteBalanceEstimator::GrayEdge;
+    const bool histograms = estimator == WhiteBalanceEstimator::WhitePatch;
+    auto band = [&](int k0, int k1, ChannelStats& partial) {
+        for (int k = k0; k < k1; ++k) {
+            const int y = first + k * step;
+            const unsigned char* row = img.row(y) + 3 * x0;
+            statsRow(row, y + 1 < y1 ? img.row(y + 1) + 3 * x0 : nullptr, width, edges, partial);
+            // The row is still in L1, so the histogram adds no memory traffic.
+            if (histograms) histogramRow(row, width, partial);
+        }
+        partial.pixels += static_cast<uint64_t>(k1 - k0) * width;
+    };
+
+    stats = ChannelStats();
+    if (width == 0 || rows == 0) return;
+    if (pool) {
+        WorkerLocal<ChannelStats> partials(*pool);
+        pool->parallelFor(0, rows, bandRows(width), [&](int k0, int k1, int slot) { band(k0, k1, partials[slot]); });
+        for (const ChannelStats& partial : partials.all()) stats.merge(partial);
+    } else {
+        band(0, rows, stats);
+    }
+}
+
+std::array<double, 3> estimatorMeasure(const ChannelStats& stats, const WhiteBalanceParams& params) {
+    std::array<double, 3> measure{};
+    for (int c = 0; c < 3; ++c) {
+        switch (params.estimator) {
+        case WhiteBalanceEstimator::GrayWorld: measure[c] = stats.mean(c); break;
+        case WhiteBalanceEstimator::WhitePatch: measure[c] = stats.percentileValue(c, params.percentile); break;
+        case WhiteBalanceEstimator::GrayEdge: measure[c] = stats.edgeMean(c); break;
+        }
+    }
+    return measure;
+}
+
+WhiteBalanceGains gainsFromMeasure(const std::array<double, 3>& measure, WhiteBalanceEstimator estimator,
+                                   double whiteLevel) {
+    WhiteBalanceGains result;
+    result.target = estimator == WhiteBalanceEstimator::WhitePatch ? whiteLevel
+                                                                   : (measure[0] + measure[1] + measure[2]) / 3.0;
+    for (int c = 0; c < 3; ++c) result.gain[c] = measure[c] > 0.0 ? result.target / measure[c] : 1.0;
+    return result;
+}
+
+WhiteBalanceGains estimateGains(const ChannelStats& stats, const WhiteBalanceParams& params) {
+    return gainsFromMeasure(estimatorMeasure(stats, params), params.estimator);
+}
+
+void GainLuts::build(const std::array<double, 3>& gains) {
+    for (int c = 0; c < 3; ++c) {
+        for (int v = 0; v < 256; ++v) table[256 * c + v] = static_cast<unsigned char>(std::min(255.0, v * gains[c]));
+    }
+}
+
+void applyGainLuts(const RgbImage& src, RgbImage& dst, const GainLuts& luts, std::array<double, 3>* meansAfter,
+                   ThreadPool* pool) {
+    const int width = src.width();
+    const int height = src.height();
+    dst.resize(width, height, dst.border());
+    const unsigned char* table = luts.table.data();
+    auto band = [&](int y0, int y1, std::array<uint64_t, 3>& sums) {
+        for (int y = y0; y < y1; ++y) {
+            if (meansAfter) applyRow<true>(src.row(y), dst.row(y), width, table, sums);
+            else applyRow<false>(src.row(y), dst.row(y), width, table, sums);
+        }
+    };
+
+    std::array<uint64_t, 3> sums{};
+    if (pool) {
+        WorkerLocal<std::array<uint64_t, 3>> partials(*pool);
+        for (auto& partial : partials.all()) partial.fill(0);
+        pool->parallelFor(0, height, bandRows(width), [&](int y0, int y1, int slot) { band(y0, y1, partials[slot]); });
+        for (const auto& partial : partials.all()) {
+            for (int c = 0; c < 3; ++c) sums[c] += partial[c];
+        }
+    } else {
+        band(0, height, sums);
+    }
+    if (meansAfter) {
+        const double pixels = static_cast<double>(src.pixelCount());
+        for (int c = 0; c < 3; ++c) (*meansAfter)[c] = pixels > 0 ? sums[c] / pixels : 0.0;
+    }
+}
+
+void applyGainLutsRow(const unsigned char* src, unsigned char* dst, int width, const GainLuts& luts) {
+    std::array<uint64_t, 3> unused{};
+    applyRow<false>(src, dst, width, luts.table.data(), unused);
+}
+
+void whiteBalance(const RgbImage& src, RgbImage& dst, const WhiteBalanceParams& params, WhiteBalanceReport* report,
+                  ThreadPool* pool) {
+    ProfileScope scope("awb");
+    scope.image(src);
+    ChannelStats stats;
+    gatherChannelStats(src, params.estimator, stats, pool);
+    const WhiteBalanceGains gains = estimateGains(stats, params);
+    applyGainLuts(src, dst, GainLuts(gains.gain), report ? &report->meansAfter : nullptr, pool);
+    if (report) {
+        for (int c = 0; c < 3; ++c) report->meansBefore[c] = stats.mean(c);
+        report->gains = gains;
+    }
+}
+
+namespace {
+
+// ChannelStats of a 16-bit or float frame: sums in double (exact for any
+// 16-bit frame below 2^37 pixels), histograms of PixelTraits<T>::levels
+// bins, allocated only for WhitePatch.
+struct WideChannelStats {
+    uint64_t pixels = 0;
+    std::array<double, 3> sum{}, edgeSum{};
+    std::array<std::vector<uint32_t>, 3> hist;
+
+    void merge(const WideChannelStats& other) {
+        pixels += other.pixels;
+        for (int c = 0; c < 3; ++c) {
+            sum[c] += other.sum[c];
+            edgeSum[c] += other.edgeSum[c];
+            if (hist[c].size() < other.hist[c].size()) hist[c].resize(other.hist[c].size());
+            for (size_t v = 0; v < other.hist[c].size(); ++v) hist[c][v] += other.hist[c][v];
+        }
+    }
+};
+
+template <typename T>
+void wideStatsRows(const Image<T, 3>& img, int y0, int y1, WhiteBalanceEstimator estimator, WideChannelStats& stats) {
+    const int width = img.width();
+    const int height = img.height();
+    const bool edges = estimator == WhiteBalanceEstimator::GrayEdge;
+    const bool histograms = estimator == WhiteBalanceEstimator::WhitePatch;
+    if (histograms) {
+        for (auto& h : stats.hist) h.resize(PixelTraits<T>::levels);
+    }
+    for (int y = y0; y < y1; ++y) {
+        const T* row = img.row(y);
+        const T* below = y + 1 < height ? img.row(y + 1) : nullptr;
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                const T v = row[3 * x + c];
+                stats.sum[c] += v;
+                if (histograms) ++stats.hist[c][pixelBin(v)];
+                if (!edges) continue;
+                if (x + 1 < width) stats.edgeSum[c] += std::abs(static_cast<double>(row[3 * x + 3 + c]) - v);
+                if (below) stats.edgeSum[c] += std::abs(static_cast<double>(below[3 * x + c]) - v);
+            }
+        }
+    }
+    stats.pixels += static_cast<uint64_t>(y1 - y0) * width;
+}
+
+// estimatorMeasure() in the units of T.
+template <typename T>
+std::array<double, 3> wideMeasure(const WideChannelStats& stats, const WhiteBalanceParams& params) {
+    std::array<double, 3> measure{};
+    if (stats.pixels == 0) return measure;
+    const double pixels = static_cast<double>(stats.pixels);
+    const double binWidth = PixelTraits<T>::maxValue / (PixelTraits<T>::levels - 1);
+    for (int c = 0; c < 3; ++c) {
+        switch (params.estimator) {
+        case WhiteBalanceEstimator::GrayWorld: measure[c] = stats.sum[c] / pixels; break;
+        case WhiteBalanceEstimator::GrayEdge: measure[c] = stats.edgeSum[c] / pixels; break;
+        case WhiteBalanceEstimator::WhitePatch: {
+            const double fraction = std::clamp(params.percentile, 0.0, 100.0) / 100.0;
+            const uint64_t needed = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * pixels)));
+            uint64_t seen = 0;
+            int v = 0;
+            for (; v < PixelTraits<T>::levels - 1; ++v) {
+                seen += stats.hist[c][v];
+                if (seen >= needed) break;
+            }
+            measure[c] = v * binWidth;
+            break;
+        }
+        }
+    }
+    return measure;
+}
+
+template <typename T>
+void wideWhiteBalance(const Image<T, 3>& src, Image<T, 3>& dst, const WhiteBalanceParams& params,
+                      WhiteBalanceReport* report, ThreadPool* pool) {
+    ProfileScope scope("awb");
+    scope.image(src);
+    const int width = src.width();
+    const int height = src.height();
+    WideChannelStats stats;
+    if (pool) {
+        WorkerLocal<WideChannelStats> partials(*pool);
+        pool->parallelFor(0, height, bandRows(width), [&](int y0, int y1, int slot) {
+            wideStatsRows(src, y0, y1, params.estimator, partials[slot]);
+        });
+        for (const WideChannelStats& partial : partials.all()) stats.merge(partial);
+    } else {
+        wideStatsRows(src, 0, height, params.estimator, stats);
+    }
+    const WhiteBalanceGains gains =
+        gainsFromMeasure(wideMeasure<T>(stats, params), params.estimator, PixelTraits<T>::maxValue);
+
+    // uint16_t takes a table per channel like GainLuts, 65536 entries each;
+    // float multiplies and clamps.
+    std::vector<T> table;
+    if constexpr (PixelTraits<T>::integer) {
+        table.resize(3 * static_cast<size_t>(PixelTraits<T>::levels));
+        for (int c = 0; c < 3; ++c) {
+            for (int v = 0; v < PixelTraits<T>::levels; ++v) {
+                table[PixelTraits<T>::levels * c + v] =
+                    static_cast<T>(std::min<double>(PixelTraits<T>::maxValue, v * gains.gain[c]));
+            }
+        }
+    }
+    const std::array<float, 3> gain = {static_cast<float>(gains.gain[0]), static_cast<float>(gains.gain[1]),
+                                       static_cast<float>(gains.gain[2])};
+    dst.resize(width, height, dst.border());
+    auto band = [&](int y0, int y1, std::array<double, 3>& sums) {
+        for (int y = y0; y < y1; ++y) {
+            const T* in = src.row(y);
+            T* out = dst.row(y);
+            for (int i = 0; i < 3 * width; i += 3) {
+                for (int c = 0; c < 3; ++c) {
+                    T v;
+                    if constexpr (PixelTraits<T>::integer) v = table[PixelTraits<T>::levels * c + in[i + c]];
+                    else v = std::min(1.0f, in[i + c] * gain[c]);
+                    out[i + c] = v;
+                    sums[c] += v;
+                }
+            }
+        }
+    };
+    std::array<double, 3> sums{};
+    if (pool) {
+        WorkerLocal<std::array<double, 3>> partials(*pool);
+        for (auto& partial : partials.all()) partial.fill(0.0);
+        pool->parallelFor(0, height, bandRows(width), [&](int y0, int y1, int slot) { band(y0, y1, partials[slot]); });
+        for (const auto& partial : partials.all()) {
+            for (int c = 0; c < 3; ++c) sums[c] += partial[c];
+        }
+    } else {
+        band(0, height, sums);
+    }
+    if (report) {
+        const double pixels = static_cast<double>(src.pixelCount());
+        for (int c = 0; c < 3; ++c) {
+            report->meansBefore[c] = pixels > 0 ? stats.sum[c] / pixels : 0.0;
+            report->meansAfter[c] = pixels > 0 ? sums[c] / pixels : 0.0;
+        }
+        report->gains = gains;
+    }
+}
+
+}  // namespace
+
+void whiteBalance(const RgbImage16& src, RgbImage16& dst, const WhiteBalanceParams& params,
+                  WhiteBalanceReport* report, ThreadPool* pool) {
+    wideWhiteBalance(src, dst, params, report, pool);
+}
+
+void whiteBalance(const RgbImageF& src, RgbImageF& dst, const WhiteBalanceParams& params, WhiteBalanceReport* report,
+                  ThreadPool* pool) {
+    wideWhiteBalance(src, dst, params, report, pool);
+}
+
+StreamingWhiteBalance::StreamingWhiteBalance(const StreamingWhiteBalanceParams& params) : params_(params) {}
+
+const WhiteBalanceFrame& StreamingWhiteBalance::process(const RgbImage& src, RgbImage& dst, ThreadPool* pool) {
+    ProfileScope scope("awb stream");
+    scope.image(src);
+    WhiteBalanceFrame frame;
+    frame.frame = static_cast<int>(trajectory_.size());
+
+    StatsSampling sampling;
+    sampling.region = params_.region;
+    sampling.rowStep = std::max(params_.rowStep, 1);
+    sampling.rowPhase = frame.frame % sampling.rowStep;
+    gatherChannelStats(src, params_.estimate.estimator, sampling, stats_, pool);
+    frame.sampledPixels = stats_.pixels;
+
+    const WhiteBalanceEstimator estimator = params_.estimate.estimator;
+    if (stats_.pixels > 0) {
+        const std::array<double, 3> measure = estimatorMeasure(stats_, params_.estimate);
+        frame.measured = gainsFromMeasure(measure, estimator).gain;
+        const double alpha = primed_ ? std::clamp(params_.smoothing, 0.0, 1.0) : 1.0;
+        for (int c = 0; c < 3; ++c) measure_[c] += alpha * (measure[c] - measure_[c]);
+        primed_ = true;
+    } else {
+        frame.measured = applied_;
+    }
+    frame.smoothed = primed_ ? gainsFromMeasure(measure_, estimator).gain : applied_;
+
+    double drift = 0.0;
+    for (int c = 0; c < 3; ++c) drift = std::max(drift, std::abs(frame.smoothed[c] / applied_[c] - 1.0));
+    if (rebuilds_ == 0 || drift > params_.driftThreshold) {
+        applied_ = frame.smoothed;
+        luts_.build(applied_);
+        frame.rebuilt = true;
+        ++rebuilds_;
+    }
+    frame.applied = applied_;
+    applyGainLuts(src, dst, luts_, nullptr, pool);
+
+    trajectory_.push_back(frame);
+    return trajectory_.back();
+}
+
+void StreamingWhiteBalance::writeTrajectoryCsv(std::ostream& out) const {
+    out << "Frame,Sampled_Pixels,Rebuilt,Measured_R,Measured_G,Measured_B,Smoothed_R,Smoothed_G,Smoothed_B,"
+           "Applied_R,Applied_G,Applied_B\n";
+    for (const WhiteBalanceFrame& f : trajectory_) {
+        out << f.frame << ',' << f.sampledPixels << ',' << (f.rebuilt ? 1 : 0);
+        for (const auto* gains : {&f.measured, &f.smoothed, &f.applied}) {
+            for (double g : *gains) out << ',' << g;
+        }
+        out << '\n';
+    }
+}
+
+}  // namespace imgcore
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "pixel.h"
+#include "thread-pool.h"
+
+namespace imgcore {
+
+enum class WhiteBalanceEstimator {
+    GrayWorld,   // channel means are equalised to their common mean
+    WhitePatch,  // each channel's percentile value is mapped to white (255 for 8 bits)
+    GrayEdge     // mean gradient magnitudes are equalised to their common mean
+};
+
+// Accepts "grayworld", "whitepatch" or "grayedge" (any case, '-' allowed);
+// false otherwise.
+bool parseWhiteBalanceEstimator(const std::string& name, WhiteBalanceEstimator& estimator);
+
+struct WhiteBalanceParams {
+    WhiteBalanceEstimator estimator = WhiteBalanceEstimator::GrayWorld;
+    double percentile = 99.0;  // WhitePatch: percentile of each channel taken as white
+};
+
+// Per-channel statistics of an RGB frame. Sums are exact 64-bit integers,
+// so means match a double accumulation bit for bit. The edge sums and the
+// histograms are only filled for the estimators that need them.
+struct ChannelStats {
+    uint64_t pixels = 0;
+    std::array<uint64_t, 3> sum{};
+    // Sum of |I(x+1, y) - I(x, y)| + |I(x, y+1) - I(x, y)| over the frame,
+    // differences that would leave the frame dropped.
+    std::array<uint64_t, 3> edgeSum{};
+    std::array<std::array<uint32_t, 256>, 3> hist{};
+
+    double mean(int c) const { return pixels ? static_cast<double>(sum[c]) / pixels : 0.0; }
+    double edgeMean(int c) const { return pixels ? static_cast<double>(edgeSum[c]) / pixels : 0.0; }
+    // Smallest value v of channel c with at least `percentile` % of the
+    // pixels at or below it; needs the histograms.
+    int percentileValue(int c, double percentile) const;
+
+    void merge(const ChannelStats& other);
+};
+
+// Rectangle of a frame, clipped to it when used; an empty one means the
+// whole frame.
+using StatsRegion = ImageRegion;
+
+// Which pixels a statistics pass reads: rows rowPhase, rowPhase + rowStep,
+// ... of the region. Gradients are taken inside the region, so a sampled
+// row still differences against the row below it.
+struct StatsSampling {
+    StatsRegion region;
+    int rowStep = 1;
+    int rowPhase = 0;
+};
+
+// One read pass over `img` gathering what `estimator` needs: the sums
+// always, gradient sums for GrayEdge and histograms for WhitePatch. Row
+// bands run on `pool` when given, each into its own partial stats that are
+// merged at the end. The sums use AVX2 byte masks and SAD when available.
+void gatherChannelStats(const RgbImage& img, WhiteBalanceEstimator estimator, ChannelStats& stats,
+                        ThreadPool* pool = nullptr);
+void gatherChannelStats(const RgbImage& img, WhiteBalanceEstimator estimator, const StatsSampling& sampling,
+                        ChannelStats& stats, ThreadPool* pool = nullptr);
+
+struct WhiteBalanceGains {
+    std::array<double, 3> gain{1.0, 1.0, 1.0};
+    double target = 0.0;  // the common value every channel statistic is scaled to
+};
+
+// The per-channel quantity the estimator equalises: channel means,
+// percentile values or mean gradients.
+std::array<double, 3> estimatorMeasure(const ChannelStats& stats, const WhiteBalanceParams& params);
+
+// Gains that scale each measure to the estimator's target, `whiteLevel`
+// for WhitePatch. A channel whose measure is zero keeps a gain of 1.
+WhiteBalanceGains gainsFromMeasure(const std::array<double, 3>& measure, WhiteBalanceEstimator estimator,
+                                   double whiteLevel = 255.0);
+
+// gainsFromMeasure(estimatorMeasure(stats, params), params.estimator).
+WhiteBalanceGains estimateGains(const ChannelStats& stats, const WhiteBalanceParams& params);
+
+// The gains as one 256-entry table per channel, entry v being
+// (unsigned char)min(255, v * gain) like a direct double evaluation.
+struct GainLuts {
+    // Channel c at [256 * c]; the spare bytes keep 32-bit gathers at the
+    // last entry inside the buffer.
+    alignas(64) std::array<unsigned char, 3 * 256 + 4> table{};
+
+    GainLuts() = default;
+    explicit GainLuts(const std::array<double, 3>& gains) { build(gains); }
+    void build(const std::array<double, 3>& gains);
+};
+
+// dst = luts(src) in one read/write pass. When `meansAfter` is given, the
+// output channel means are accumulated from the written values in the same
+// pass. With AVX2, eight samples are looked up per 32-bit gather.
+void applyGainLuts(const RgbImage& src, RgbImage& dst, const GainLuts& luts,
+                   std::array<double, 3>* meansAfter = nullptr, ThreadPool* pool = nullptr);
+
+// One row of applyGainLuts(), for callers that apply the gains a tile at a
+// time.
+void applyGainLutsRow(const unsigned char* src, unsigned char* dst, int width, const GainLuts& luts);
+
+struct WhiteBalanceReport {
+    std::array<double, 3> meansBefore{};
+    std::array<double, 3> meansAfter{};
+    WhiteBalanceGains gains;
+};
+
+// Estimate and apply: one statistics pass plus one LUT pass.
+void whiteBalance(const RgbImage& src, RgbImage& dst, const WhiteBalanceParams& params = {},
+                  WhiteBalanceReport* report = nullptr, ThreadPool* pool = nullptr);
+
+// The same for 16-bit and float frames, with means and gains in the
+// frame's own units and WhitePatch mapping the percentile to the type's
+// white (65535 or 1.0). Statistics come from one portable pass with
+// histograms of PixelTraits<T>::levels bins; uint16_t applies the gains
+// through a 65536-entry table per channel, float multiplies and clamps.
+void whiteBalance(const RgbImage16& src, RgbImage16& dst, const WhiteBalanceParams& params = {},
+                  WhiteBalanceReport* report = nullptr, ThreadPool* pool = nullptr);
+void whiteBalance(const RgbImageF& src, RgbImageF& dst, const WhiteBalanceParams& params = {},
+                  WhiteBalanceReport* report = nullptr, ThreadPool* pool = nullptr);
+
+struct StreamingWhiteBalanceParams {
+    WhiteBalanceParams estimate;
+    double smoothing = 0.2;        // weight of the newest frame in the running measure
+    int rowStep = 8;               // one row in rowStep is sampled per frame
+    double driftThreshold = 0.01;  // relative gain change that rebuilds the LUTs
+    StatsRegion region;            // where rows are sampled; empty means the whole frame
+};
+
+// One frame of a stream's gain trajectory.
+struct WhiteBalanceFrame {
+    int frame = 0;
+    uint64_t sampledPixels = 0;
+    bool rebuilt = false;              // the LUTs were rebuilt for this frame
+    std::array<double, 3> measured{};  // gains from this frame's samples alone
+    std::array<double, 3> smoothed{};  // gains from the running measure
+    std::array<double, 3> applied{};   // gains of the LUTs the frame was written with
+};
+
+// White balance for a sequence of frames. Each frame samples one row in
+// rowStep of the region, the phase advancing by one per frame so every row
+// is visited once per rowStep frames, and folds the estimator's measure
+// into an exponential moving average. The LUTs are rebuilt only when the
+// smoothed gains drift more than driftThreshold (relative) from the gains
+// they hold, so small fluctuations neither flicker nor cost a rebuild.
+// Frames must be passed in order.
+class StreamingWhiteBalance {
+public:
+    explicit StreamingWhiteBalance(const StreamingWhiteBalanceParams& params = {});
+
+    // Moves the sampled region, e.g. to follow a subject.
+    void setRegion(const StatsRegion& region) { params_.region = region; }
+
+    // Updates the running statistics from `src` and writes the balanced frame.
+    const WhiteBalanceFrame& process(const RgbImage& src, RgbImage& dst, ThreadPool* pool = nullptr);
+
+    const std::vector<WhiteBalanceFrame>& trajectory() const { return trajectory_; }
+    int lutRebuilds() const { return rebuilds_; }
+
+    // CSV, one line per frame: frame, sampled pixels, rebuilt flag, then the
+    // measured, smoothed and applied R, G, B gains.
+    void writeTrajectoryCsv(std::ostream& out) const;
+
+private:
+    StreamingWhiteBalanceParams params_;
+    ChannelStats stats_;
+    std::array<double, 3> measure_{};
+    bool primed_ = false;
+    GainLuts luts_;
+    std::array<double, 3> applied_{1.0, 1.0, 1.0};
+    int rebuilds_ = 0;
+    std::vector<WhiteBalanceFrame> trajectory_;
+};
+
+}  // namespace imgcore
@@ -1,139 +1,129 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <algorithm>
-#include <cmath>
-#include <opencv2/opencv.hpp>
+#include <array>
+#include <atomic>
 
-const int WIDTH = 1620;
-const int HEIGHT = 1080;
-const int NUM_PIXELS = WIDTH * HEIGHT;
-
-std::vector<unsigned char> readRaw(const std::string& filename) {
-    std::ifstream inFile(filename, std::ios::binary);
-    std::vector<unsigned char> img(std::istreambuf_iterator<char>(inFile), {});
-    inFile.close();
-    return img;
-}
-
-void writeRaw(const std::string& filename, const std::vector<unsigned char>& img) {
-    std::ofstream outFile(filename, std::ios::binary);
-    outFile.write(reinterpret_cast<const char*>(img.data()), img.size());
-    outFile.close();
-}
+#include "image.h"
+#include "color-convert.h"
+#include "raw-io.h"
+#include "batch.h"
+#include "equalize.h"
+#include "clahe.h"
+#include "stage-graph.h"
+#include "thread-pool.h"
 
-struct YUV {
-    std::vector<unsigned char> Y, U, V;
-};
+using namespace imgcore;
 
-YUV rgb2yuv(const std::vector<unsigned char>& rgb) {
-    YUV yuv;
-    yuv.Y.resize(NUM_PIXELS);
-    yuv.U.resize(NUM_PIXELS);
-    yuv.V.resize(NUM_PIXELS);
-
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        double r = rgb[3*i];
-        double g = rgb[3*i+1];
-        double b = rgb[3*i+2];
+const int WIDTH = 1620;
+const int HEIGHT = 1080;
 
-        double yVal = 0.299*r + 0.587*g + 0.114*b;
-        double uVal = 0.492*(b - yVal);
-        double vVal = 0.877*(r - yVal);
+// Method A is a point operator on Y, so it is returned as a LUT and applied
+// inside the YUV -> RGB pass instead of as a plane of its own.
+std::array<unsigned char, 256> methodALut(const GrayImage& channel) {
+    const int width = channel.width();
+    const int height = channel.height();
+    const double numPixels = (double)channel.pixelCount();
 
-        yuv.Y[i] = static_cast<unsigned char>(std::clamp(yVal, 0.0, 255.0));
-        yuv.U[i] = static_cast<unsigned char>(std::clamp(uVal + 128.0, 0.0, 255.0));
-        yuv.V[i] = static_cast<unsigned char>(std::clamp(vVal + 128.0, 0.0, 255.0));
+    std::vector<int> hist(256, 0);
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* in = channel.row(y);
+        for (int x = 0; x < width; ++x) hist[in[x]]++;
     }
-    return yuv;
-}
-
-std::vector<unsigned char> yuv2rgb(const YUV& yuv) {
-    std::vector<unsigned char> rgb(NUM_PIXELS * 3);
 
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        double y = yuv.Y[i];
-        double u = (double)yuv.U[i] - 128.0;
-        double v = (double)yuv.V[i] - 128.0;
-
-        double r = y + 1.140*v;
-        double g = y - 0.395*u - 0.581*v;
-        double b = y + 2.032*u;
-
-        rgb[3*i]     = static_cast<unsigned char>(std::clamp(r, 0.0, 255.0));
-        rgb[3*i + 1] = static_cast<unsigned char>(std::clamp(g, 0.0, 255.0));
-        rgb[3*i + 2] = static_cast<unsigned char>(std::clamp(b, 0.0, 255.0));
+    std::array<unsigned char, 256> lut;
+    int cdf = 0;
+    for (int i = 0; i < 256; ++i) {
+        cdf += hist[i];
+        lut[i] = static_cast<unsigned char>(255.0 * cdf / numPixels);
     }
-    return rgb;
+    return lut;
 }
 
-std::vector<unsigned char> applyMethodA(const std::vector<unsigned char>& channel) {
-    std::vector<int> hist(256, 0);
-    for (unsigned char val : channel) hist[val]++;
-
-    std::vector<int> cdf(256, 0);
-    cdf[0] = hist[0];
-    for (int i = 1; i < 256; ++i) cdf[i] = cdf[i-1] + hist[i];
-
-    std::vector<unsigned char> output(NUM_PIXELS);
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        output[i] = static_cast<unsigned char>(255.0 * cdf[channel[i]] / NUM_PIXELS);
-    }
-    return output;
+// Bucket-fill equalization onto levels i * 255 / N (ties in raster order).
+void applyMethodB(const GrayImage& channel, GrayImage& output) {
+    equalizeBucketFill(channel, output, 255, TieBreak::Raster);
 }
 
-struct PixelInfo { unsigned char val; int idx; };
-std::vector<unsigned char> applyMethodB(const std::vector<unsigned char>& channel) {
-    std::vector<PixelInfo> pixels(NUM_PIXELS);
-    for (int i = 0; i < NUM_PIXELS; ++i) pixels[i] = { channel[i], i };
-
-    std::sort(pixels.begin(), pixels.end(), [](const PixelInfo& a, const PixelInfo& b) {
-        return a.val < b.val;
-    });
-
-    std::vector<unsigned char> output(NUM_PIXELS);
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        int newVal = (i * 255) / NUM_PIXELS;
-        output[pixels[i].idx] = static_cast<unsigned char>(newVal);
-    }
-    return output;
+// Clip limit 4 on an 8x8 grid, the same output as cv::createCLAHE(4.0, Size(8, 8)).
+void applyCLAHE(const GrayImage& channel, GrayImage& output, ThreadPool& pool) {
+    ClaheParams params;
+    params.clipLimit = 4.0;
+    params.tilesX = 8;
+    params.tilesY = 8;
+    clahe(channel, output, params, &pool);
 }
 
-std::vector<unsigned char> applyCLAHE(const std::vector<unsigned char>& channel) {
-    cv::Mat src(HEIGHT, WIDTH, CV_8UC1, const_cast<unsigned char*>(channel.data()));
-    cv::Mat dst;
-
-    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(4.0, cv::Size(8, 8));
-    clahe->apply(src, dst);
-
-    std::vector<unsigned char> output(dst.begin<unsigned char>(), dst.end<unsigned char>());
-    return output;
+// --batch: CLAHE on the luma of every frame, written as <stem>_clahe.raw.
+// Frames run in parallel, one per compute worker, each with its own planes.
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    ClaheParams params;
+    params.clipLimit = options.option("clip", 4.0);
+    params.tilesX = static_cast<int>(options.option("tiles", 8.0));
+    params.tilesY = params.tilesX;
+
+    struct Scratch {
+        YuvPlanes yuv;
+        GrayImage y;
+    };
+    std::vector<Scratch> scratch(options.computeWorkers());
+    auto process = [&](const RgbImage& in, RgbImage& out, int worker) {
+        Scratch& s = scratch[worker];
+        rgbToYuv(in, s.yuv);
+        clahe(s.yuv.y, s.y, params);
+        yuvToRgb(s.y, s.yuv.u, s.yuv.v, out);
+    };
+    BatchReport report = runBatch<RgbImage, RgbImage>(options, "_clahe", process);
+    report.print(std::cout);
+    return report.failed ? -1 : 0;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
+
     std::string filename = "towers.raw";
-    std::vector<unsigned char> rgbImg = readRaw(filename);
-
-    YUV imgYUV = rgb2yuv(rgbImg);
-    
-    std::vector<unsigned char> Y_MethodA = applyMethodA(imgYUV.Y);
-    std::vector<unsigned char> Y_MethodB = applyMethodB(imgYUV.Y);
-    std::vector<unsigned char> Y_CLAHE   = applyCLAHE(imgYUV.Y);
-
-    YUV outA = imgYUV;
-    outA.Y = Y_MethodA;
-    std::vector<unsigned char> rgbA = yuv2rgb(outA);
-    writeRaw("towers_methodA.raw", rgbA);
-
-    YUV outB = imgYUV;
-    outB.Y = Y_MethodB;
-    std::vector<unsigned char> rgbB = yuv2rgb(outB);
-    writeRaw("towers_methodB.raw", rgbB);
-
-    YUV outC = imgYUV;
-    outC.Y = Y_CLAHE;
-    std::vector<unsigned char> rgbC = yuv2rgb(outC);
-    writeRaw("towers_clahe.raw", rgbC);
-
-    return 0;
+    RgbImage rgbImg(WIDTH, HEIGHT);
+    if (!readRaw(filename, rgbImg)) return -1;
+
+    // The forward conversion is shared by every variant; each one converts
+    // back in a single pass with its own Y and the shared U and V planes.
+    // Independent variants run side by side, and the RGB buffer of a written
+    // variant is recycled for the next.
+    // Sinks run on pool workers; any failed write fails the run.
+    std::atomic<bool> failed{false};
+    ThreadPool pool;
+    StageGraph graph;
+    auto input = graph.stage<RgbImage>("input", [&](RgbImage& out) { out = std::move(rgbImg); });
+    auto yuv = graph.stage<YuvPlanes>("rgbToYuv", [](const RgbImage& rgb, YuvPlanes& out) {
+        rgbToYuv(rgb, out);
+    }, input);
+    auto write = [&](const std::string& name, StageHandle<RgbImage> rgb) {
+        graph.sink("write", [name, &failed](const RgbImage& out) {
+            if (!writeRaw(name, out)) failed = true;
+        }, rgb);
+    };
+
+    using Lut = std::array<unsigned char, 256>;
+    auto lutA = graph.stage<Lut>("methodA", [](const YuvPlanes& in, Lut& out) { out = methodALut(in.y); }, yuv);
+    auto withLut = [](const YuvPlanes& in, const Lut& lut, RgbImage& out) {
+        yuvToRgb(in.y, in.u, in.v, out, lut.data());
+    };
+    write("towers_methodA.raw", graph.stage<RgbImage>("yuvToRgb", withLut, yuv, lutA));
+
+    auto withLuma = [](const YuvPlanes& in, const GrayImage& y, RgbImage& out) { yuvToRgb(y, in.u, in.v, out); };
+    auto yB = graph.stage<GrayImage>("methodB", [](const YuvPlanes& in, GrayImage& out) {
+        applyMethodB(in.y, out);
+    }, yuv);
+    write("towers_methodB.raw", graph.stage<RgbImage>("yuvToRgb", withLuma, yuv, yB));
+
+    auto yC = graph.stage<GrayImage>("clahe", [&pool](const YuvPlanes& in, GrayImage& out) {
+        applyCLAHE(in.y, out, pool);
+    }, yuv);
+    write("towers_clahe.raw", graph.stage<RgbImage>("yuvToRgb", withLuma, yuv, yC));
+
+    graph.run(&pool);
+
+    return failed ? -1 : 0;
 }
@@ -1,3 +1,4 @@
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -5,43 +6,36 @@
 #include <string>
 #include <cmath>
 
+#include "image.h"
+#include "raw-io.h"
+#include "batch.h"
+#include "equalize.h"
+#include "stage-graph.h"
+#include "thread-pool.h"
+
+using namespace imgcore;
+
 const int WIDTH = 1024;
 const int HEIGHT = 1024;
-const int NUM_PIXELS = WIDTH * HEIGHT;
 const int GRAY_LEVELS = 256;
 
-struct PixelInfo {
-    unsigned char value;
-    int originalIndex;
-};
-
-std::vector<unsigned char> readRaw(const std::string& filename) {
-    std::ifstream inFile(filename, std::ios::binary);
-    std::vector<unsigned char> img(std::istreambuf_iterator<char>(inFile), {});
-    inFile.close();
-    
-    return img;
-}
-
-void writeRaw(const std::string& filename, const std::vector<unsigned char>& img) {
-    std::ofstream outFile(filename, std::ios::binary);
-    outFile.write(reinterpret_cast<const char*>(img.data()), img.size());
-    outFile.close();
-}
-
-void saveCSV(const std::string& filename, const std::vector<int>& data, const std::string& header) {
+bool saveCSV(const std::string& filename, const std::vector<int>& data, const std::string& header) {
     std::ofstream file(filename);
     file << header << "\n";
-    for (int i = 0; i < data.size(); ++i) {
+    for (size_t i = 0; i < data.size(); ++i) {
         file << i << "," << data[i] << "\n";
     }
     file.close();
+    return static_cast<bool>(file);
 }
 
-std::vector<int> computeHistogram(const std::vector<unsigned char>& img) {
+std::vector<int> computeHistogram(const GrayImage& img) {
     std::vector<int> hist(GRAY_LEVELS, 0);
-    for (unsigned char val : img) {
-        hist[val]++;
+    for (int y = 0; y < img.height(); ++y) {
+        const unsigned char* row = img.row(y);
+        for (int x = 0; x < img.width(); ++x) {
+            hist[row[x]]++;
+        }
     }
     return hist;
 }
@@ -55,65 +49,93 @@ std::vector<int> computeCDF(const std::vector<int>& hist) {
     return cdf;
 }
 
-std::vector<unsigned char> methodA(const std::vector<unsigned char>& inputImg) {
-    std::vector<int> hist = computeHistogram(inputImg);
+std::vector<int> methodATransfer(const std::vector<int>& hist, int numPixels) {
     std::vector<int> cdf = computeCDF(hist);
-    
     std::vector<int> transferFunc(GRAY_LEVELS);
     for (int i = 0; i < GRAY_LEVELS; ++i) {
-        transferFunc[i] = std::round((float)(GRAY_LEVELS - 1) * cdf[i] / NUM_PIXELS);
-    }
-
-    saveCSV("methodA_transfer_function.csv", transferFunc, "Input_Intensity,Output_Intensity");
-
-    std::vector<unsigned char> outputImg(NUM_PIXELS);
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        outputImg[i] = static_cast<unsigned char>(transferFunc[inputImg[i]]);
+        transferFunc[i] = std::round((float)(GRAY_LEVELS - 1) * cdf[i] / numPixels);
     }
-    
-    return outputImg;
+    return transferFunc;
 }
 
-std::vector<unsigned char> methodB(const std::vector<unsigned char>& inputImg) {
-    std::vector<PixelInfo> pixels(NUM_PIXELS);
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        pixels[i] = { inputImg[i], i };
+void methodA(const GrayImage& inputImg, const std::vector<int>& transferFunc, GrayImage& outputImg) {
+    outputImg.resize(inputImg.width(), inputImg.height(), outputImg.border());
+    for (int y = 0; y < inputImg.height(); ++y) {
+        const unsigned char* in = inputImg.row(y);
+        unsigned char* out = outputImg.row(y);
+        for (int x = 0; x < inputImg.width(); ++x) {
+            out[x] = static_cast<unsigned char>(transferFunc[in[x]]);
+        }
     }
+}
 
-    std::sort(pixels.begin(), pixels.end(), [](const PixelInfo& a, const PixelInfo& b) {
-        return a.value < b.value;
-    });
-
-    std::vector<unsigned char> outputImg(NUM_PIXELS);
-    
-    for (int i = 0; i < NUM_PIXELS; ++i) {
-        int newVal = (i * GRAY_LEVELS) / NUM_PIXELS;
-        
-        if (newVal > 255) newVal = 255;
-
-        outputImg[pixels[i].originalIndex] = (unsigned char)(newVal);
-    }
+// Bucket-fill equalization: the i-th darkest pixel (ties in raster order)
+// gets level i * 256 / N, without sorting the pixels.
+void methodB(const GrayImage& inputImg, GrayImage& outputImg) {
+    equalizeBucketFill(inputImg, outputImg, GRAY_LEVELS, TieBreak::Raster);
+}
 
-    return outputImg;
+// --batch: Method A (--method A, the default) or Method B (--method B) on
+// every frame, written as <stem>_methodA.raw or <stem>_methodB.raw. Frames
+// need no transfer CSV, so Method A runs as the one-call equalizeCdf().
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    const bool useB = options.option("method", "A") == "B";
+    auto process = [useB](const GrayImage& in, GrayImage& out, int) {
+        if (useB) methodB(in, out);
+        else equalizeCdf(in, out);
+    };
+    BatchReport report = runBatch<GrayImage, GrayImage>(options, useB ? "_methodB" : "_methodA", process);
+    report.print(std::cout);
+    return report.failed ? -1 : 0;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
+
     std::string filename = "airplane.raw";
     
-    std::vector<unsigned char> img = readRaw(filename);
-
-    std::vector<int> originalHist = computeHistogram(img);
-    saveCSV("original_histogram.csv", originalHist, "Intensity,Pixel_Count");
-
-    std::vector<unsigned char> imgA = methodA(img);
-    writeRaw("airplane_methodA.raw", imgA);
-
-    std::vector<unsigned char> imgB = methodB(img);
-    writeRaw("airplane_methodB.raw", imgB);
-
-    std::vector<int> histB = computeHistogram(imgB);
-    std::vector<int> cdfB = computeCDF(histB);
-    saveCSV("methodB_cdf.csv", cdfB, "Intensity,Cumulative_Count");
-
-    return 0;
+    GrayImage img(WIDTH, HEIGHT);
+    if (!readRaw(filename, img)) return -1;
+    const int numPixels = static_cast<int>(img.pixelCount());
+
+    // The input histogram feeds both the CSV dump and Method A's transfer
+    // function, so it is declared by each and computed once.
+    // Sinks run on pool workers; any failed write fails the run.
+    std::atomic<bool> failed{false};
+    auto check = [&failed](bool ok) {
+        if (!ok) failed = true;
+    };
+    StageGraph graph;
+    auto input = graph.stage<GrayImage>("input", [&](GrayImage& out) { out = std::move(img); });
+    auto histogram = [&](StageHandle<GrayImage> of) {
+        return graph.stage<std::vector<int>>("histogram", [](const GrayImage& in, std::vector<int>& out) {
+            out = computeHistogram(in);
+        }, of);
+    };
+
+    graph.sink("originalCsv", [&](const std::vector<int>& hist) {
+        check(saveCSV("original_histogram.csv", hist, "Intensity,Pixel_Count"));
+    }, histogram(input));
+
+    auto transfer = graph.stage<std::vector<int>>("transferA",
+        [=](const std::vector<int>& hist, std::vector<int>& out) { out = methodATransfer(hist, numPixels); },
+        histogram(input));
+    graph.sink("transferCsv", [&](const std::vector<int>& transferFunc) {
+        check(saveCSV("methodA_transfer_function.csv", transferFunc, "Input_Intensity,Output_Intensity"));
+    }, transfer);
+    auto imgA = graph.stage<GrayImage>("methodA", methodA, input, transfer);
+    graph.sink("writeA", [&](const GrayImage& out) { check(writeRaw("airplane_methodA.raw", out)); }, imgA);
+
+    auto imgB = graph.stage<GrayImage>("methodB", methodB, input);
+    graph.sink("writeB", [&](const GrayImage& out) { check(writeRaw("airplane_methodB.raw", out)); }, imgB);
+    graph.sink("cdfCsv", [&](const std::vector<int>& histB) {
+        check(saveCSV("methodB_cdf.csv", computeCDF(histB), "Intensity,Cumulative_Count"));
+    }, histogram(imgB));
+
+    ThreadPool pool;
+    graph.run(&pool);
+
+    return failed ? -1 : 0;
 }
@@ -3,79 +3,66 @@
 #include <fstream>
 #include <string>
 
+#include "image.h"
+#include "raw-io.h"
+#include "demosaic.h"
+#include "batch.h"
+
+using namespace imgcore;
+
 const int WIDTH = 512;
 const int HEIGHT = 768;
 
-unsigned char getPixel(const std::vector<unsigned char>& img, int y, int x, int w, int h) {
-    if (y < 0) y = 0;
-    if (y >= h) y = h - 1;
-    if (x < 0) x = 0;
-    if (x >= w) x = w - 1;
-    return img[y * w + x];
+// --batch: demosaic every frame (--pattern, --method as below), written as
+// <stem>_demosaiced.raw. Frames run in parallel, one per compute worker.
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    CfaPattern pattern = CfaPattern::GRBG;
+    DemosaicMethod method = DemosaicMethod::Bilinear;
+    if (!parseCfaPattern(options.option("pattern", "GRBG"), pattern) ||
+        !parseDemosaicMethod(options.option("method", "bilinear"), method)) {
+        std::cerr << "Unknown CFA pattern or demosaic method" << std::endl;
+        return -1;
+    }
+    options.inputBorder = 5;
+    options.inputBorderMode = BorderMode::Reflect;
+    auto process = [=](const GrayImage& bayer, RgbImage& rgb, int) { demosaic(bayer, rgb, pattern, method); };
+    BatchReport report = runBatch<GrayImage, RgbImage>(options, "_demosaiced", process);
+    report.print(std::cout);
+    return report.failed ? -1 : 0;
 }
 
-int main() {
-    std::string inputFilename = "sailboats_cfa.raw";
-    std::string outputFilename = "sailboats_demosaiced.raw";
-
-    std::ifstream inFile(inputFilename, std::ios::binary);
-
-    std::vector<unsigned char> bayerImg(std::istreambuf_iterator<char>(inFile), {});
-    inFile.close();
+// Usage: image-demosaicing [RGGB|BGGR|GRBG|GBRG] [bilinear|mhc|ahd];
+// the sample sensor is GRBG and bilinear is the default method.
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
 
-    std::vector<unsigned char> rgbImg(WIDTH * HEIGHT * 3);
-    
-    for (int y = 0; y < HEIGHT; ++y) {
-        for (int x = 0; x < WIDTH; ++x) {
-            float red = 0, green = 0, blue = 0;
-            unsigned char currentVal = getPixel(bayerImg, y, x, WIDTH, HEIGHT);
+    CfaPattern pattern = CfaPattern::GRBG;
+    if (argc > 1 && !parseCfaPattern(argv[1], pattern)) {
+        std::cerr << "Unknown CFA pattern " << argv[1] << std::endl;
+        return -1;
+    }
+    DemosaicMethod method = DemosaicMethod::Bilinear;
+    if (argc > 2 && !parseDemosaicMethod(argv[2], method)) {
+        std::cerr << "Unknown demosaic method " << argv[2] << std::endl;
+        return -1;
+    }
 
-            if (y % 2 == 0) {
-                if (x % 2 == 0) { 
-                    green = currentVal;
-                    red = (getPixel(bayerImg, y, x - 1, WIDTH, HEIGHT) + getPixel(bayerImg, y, x + 1, WIDTH, HEIGHT)) / 2.0f;
-                    blue = (getPixel(bayerImg, y - 1, x, WIDTH, HEIGHT) + getPixel(bayerImg, y + 1, x, WIDTH, HEIGHT)) / 2.0f;
-                } else { 
-                    red = currentVal;
-                    green = (getPixel(bayerImg, y - 1, x, WIDTH, HEIGHT) + 
-                             getPixel(bayerImg, y + 1, x, WIDTH, HEIGHT) +
-                             getPixel(bayerImg, y, x - 1, WIDTH, HEIGHT) + 
-                             getPixel(bayerImg, y, x + 1, WIDTH, HEIGHT)) / 4.0f;
-                    blue = (getPixel(bayerImg, y - 1, x - 1, WIDTH, HEIGHT) + 
-                            getPixel(bayerImg, y - 1, x + 1, WIDTH, HEIGHT) + 
-                            getPixel(bayerImg, y + 1, x - 1, WIDTH, HEIGHT) + 
-                            getPixel(bayerImg, y + 1, x + 1, WIDTH, HEIGHT)) / 4.0f;
-                }
-            } else {
-                if (x % 2 == 0) {
+    std::string inputFilename = "sailboats_cfa.raw";
+    std::string outputFilename = "sailboats_demosaiced.raw";
 
-                    blue = currentVal;
-                    green = (getPixel(bayerImg, y - 1, x, WIDTH, HEIGHT) + 
-                             getPixel(bayerImg, y + 1, x, WIDTH, HEIGHT) +
-                             getPixel(bayerImg, y, x - 1, WIDTH, HEIGHT) + 
-                             getPixel(bayerImg, y, x + 1, WIDTH, HEIGHT)) / 4.0f;
-                    red = (getPixel(bayerImg, y - 1, x - 1, WIDTH, HEIGHT) + 
-                           getPixel(bayerImg, y - 1, x + 1, WIDTH, HEIGHT) + 
-                           getPixel(bayerImg, y + 1, x - 1, WIDTH, HEIGHT) + 
-                           getPixel(bayerImg, y + 1, x + 1, WIDTH, HEIGHT)) / 4.0f;
-                } else {
-                    green = currentVal;
-                    blue = (getPixel(bayerImg, y, x - 1, WIDTH, HEIGHT) + getPixel(bayerImg, y, x + 1, WIDTH, HEIGHT)) / 2.0f;
-                    red = (getPixel(bayerImg, y - 1, x, WIDTH, HEIGHT) + getPixel(bayerImg, y + 1, x, WIDTH, HEIGHT)) / 2.0f;
-                }
-            }
+    // A 5-pixel border covers the widest (AHD) footprint.
+    GrayImage bayerImg(WIDTH, HEIGHT, 5);
+    if (!readRaw(inputFilename, bayerImg)) return -1;
+    // Reflect keeps the CFA parity of the mirrored border samples.
+    bayerImg.fillBorder(BorderMode::Reflect);
 
-            int index = (y * WIDTH + x) * 3;
-            rgbImg[index]     = static_cast<unsigned char>(red);
-            rgbImg[index + 1] = static_cast<unsigned char>(green);
-            rgbImg[index + 2] = static_cast<unsigned char>(blue);
-        }
-    }
+    RgbImage rgbImg(WIDTH, HEIGHT);
+    ThreadPool pool;
+    demosaic(bayerImg, rgbImg, pattern, method, &pool);
 
-    std::ofstream outFile(outputFilename, std::ios::binary);
+    if (!writeRaw(outputFilename, rgbImg)) return -1;
 
-    outFile.write(reinterpret_cast<char*>(rgbImg.data()), rgbImg.size());
-    outFile.close();
-    
     return 0;
-}
\ No newline at end of file
+}
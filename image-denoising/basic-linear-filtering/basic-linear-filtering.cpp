@@ -5,138 +5,127 @@
 #include <algorithm>
 #include <iomanip>
 
+#include "image.h"
+#include "raw-io.h"
+#include "metrics.h"
+#include "linear-filter.h"
+#include "batch.h"
+#include "stage-graph.h"
+#include "thread-pool.h"
+
 using namespace std;
+using namespace imgcore;
 
 const int WIDTH = 768;
 const int HEIGHT = 512;
-const int MAX_VAL = 255;
-
 
-// Mirroring for boundary condition
-/*
-unsigned char getPixel(const vector<unsigned char>& data, int x, int y) {
-    // If x is -1, it becomes 1. If x is WIDTH, it becomes WIDTH - 2.
-    if (x < 0) x = -x;
-    if (x >= WIDTH) x = 2 * WIDTH - x - 2;
-    
-    if (y < 0) y = -y;
-    if (y >= HEIGHT) y = 2 * HEIGHT - y - 2;
-
-    return data[y * WIDTH + x];
-}
-*/
 
-
-// Zero Padding for boundary condition
-/*
-unsigned char getPixel(const vector<unsigned char>& data, int x, int y) {
-    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) return 0;
-    return data[y * WIDTH + x];
-}
-*/
-
-double calculatePSNR(const vector<unsigned char>& original, const vector<unsigned char>& filtered) {
-    double mse = 0;
-    for (int i = 0; i < WIDTH * HEIGHT; ++i) {
-        double diff = (double)original[i] - (double)filtered[i];
-        mse += diff * diff;
-    }
-    mse /= (WIDTH * HEIGHT);
-
-    return 10.0 * log10((MAX_VAL * MAX_VAL) / mse);
-}
-
-// Clamping
-unsigned char getPixel(const vector<unsigned char>& data, int x, int y) {
-    int nx = max(0, min(x, WIDTH - 1));
-    int ny = max(0, min(y, HEIGHT - 1));
-    return data[ny * WIDTH + nx];
-}
+// Boundary condition for the padded input: Replicate clamps to the edge,
+// Reflect mirrors (x = -1 becomes 1) and Zero pads with black.
+const BorderMode BORDER = BorderMode::Replicate;
 
 double getTheoreticalSigma(int size) {
     return 0.3 * ((size - 1) * 0.5 - 1) + 0.8;
 }
 
-vector<unsigned char> applyUniformFilter(const vector<unsigned char>& input, int size) {
-    vector<unsigned char> output(WIDTH * HEIGHT);
-    int offset = size / 2;
-    double area = (double)(size * size);
-
-    for (int y = 0; y < HEIGHT; ++y) {
-        for (int x = 0; x < WIDTH; ++x) {
-            double sum = 0;
-            for (int ky = -offset; ky <= offset; ++ky) {
-                for (int kx = -offset; kx <= offset; ++kx) {
-                    sum += getPixel(input, x + kx, y + ky);
-                }
-            }
-            // add 0.5 for rounding
-            output[y * WIDTH + x] = (unsigned char)(sum / area + 0.5);
-        }
-    }
-    return output;
+// Running-sum box filter: cost per pixel is independent of the kernel size.
+void applyUniformFilter(const GrayImage& input, GrayImage& output, int size) {
+    boxFilter(input, output, size, BORDER);
 }
 
-vector<unsigned char> applyGaussianFilter(const vector<unsigned char>& input, int size, double sigma) {
-    vector<unsigned char> output(WIDTH * HEIGHT);
-    int offset = size / 2;
-    vector<vector<double>> kernel(size, vector<double>(size));
-    double sum_kernel = 0;
-
-    for (int i = -offset; i <= offset; ++i) {
-        for (int j = -offset; j <= offset; ++j) {
-            double val = exp(-(i * i + j * j) / (2 * sigma * sigma));
-            kernel[i + offset][j + offset] = val;
-            sum_kernel += val;
-        }
-    }
-
-    for (int y = 0; y < HEIGHT; ++y) {
-        for (int x = 0; x < WIDTH; ++x) {
-            double res = 0;
-            for (int ky = -offset; ky <= offset; ++ky) {
-                for (int kx = -offset; kx <= offset; ++kx) {
-                    res += getPixel(input, x + kx, y + ky) * kernel[ky + offset][kx + offset];
-                }
-            }
-            // add 0.5 for rounding
-            output[y * WIDTH + x] = (unsigned char)((res / sum_kernel) + 0.5);
-        }
-    }
-    return output;
+// Separable row/column passes; the 2-D Gaussian is the outer product of
+// two 1-D kernels, so this matches the size x size convolution.
+void applyGaussianFilter(const GrayImage& input, GrayImage& output, int size, double sigma) {
+    gaussianFilter(input, output, size, sigma, BORDER);
 }
 
-int main() {
-    vector<unsigned char> original(WIDTH * HEIGHT);
-    vector<unsigned char> noisy(WIDTH * HEIGHT);
-
-    ifstream raw_orig("flower_gray.raw", ios::binary);
-    ifstream raw_noisy("flower_gray_noisy.raw", ios::binary);
+// --batch: one filter on every frame, written as <stem>_<filter><size>.raw.
+// --filter uniform|gaussian (default gaussian), --size (default 5), --sigma
+// (default: the theoretical sigma for the size).
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    const string filter = options.option("filter", "gaussian");
+    const int size = static_cast<int>(options.option("size", 5.0));
+    const double sigma = options.option("sigma", getTheoreticalSigma(size));
+    options.inputBorder = size / 2;
+    options.inputBorderMode = BORDER;
+    auto process = [&](const GrayImage& in, GrayImage& out, int) {
+        if (filter == "uniform") applyUniformFilter(in, out, size);
+        else applyGaussianFilter(in, out, size, sigma);
+    };
+    BatchReport report = runBatch<GrayImage, GrayImage>(options, "_" + filter + to_string(size), process);
+    report.print(cout);
+    return report.failed ? -1 : 0;
+}
 
-    raw_orig.read((char*)original.data(), WIDTH * HEIGHT);
-    raw_noisy.read((char*)noisy.data(), WIDTH * HEIGHT);
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
+
+    // The clean reference is only compared against, so it stays mapped.
+    MappedFile original_file;
+    GrayView original;
+    GrayImage noisy(WIDTH, HEIGHT);
+
+    if (!mapRaw("flower_gray.raw", WIDTH, HEIGHT, original_file, original) ||
+        !readRaw("flower_gray_noisy.raw", noisy)) return -1;
+
+    const vector<int> kernelSizes = {3, 5, 7, 9, 15};
+    struct Scores {
+        double sigma, uniform, gaussian, gaussianLarge;
+    };
+    vector<Scores> scores(kernelSizes.size());
+
+    // Every variant asks for the noisy input padded for the largest kernel;
+    // the graph builds it once, runs the filters side by side and recycles
+    // their output buffers once each PSNR has been taken.
+    const int border = *max_element(kernelSizes.begin(), kernelSizes.end()) / 2;
+    auto padNoisy = [&](GrayImage& out) {
+        out.resize(WIDTH, HEIGHT, border);
+        out.copyFrom(noisy);
+        out.fillBorder(BORDER);
+    };
+    auto psnrInto = [&](double& score) {
+        return [&original, &score](const GrayImage& filtered) { score = calculatePSNR(original, filtered); };
+    };
+
+    StageGraph graph;
+    for (size_t i = 0; i < kernelSizes.size(); ++i) {
+        const int kernel_size = kernelSizes[i];
+        const double sigma = getTheoreticalSigma(kernel_size);
+        const string size = to_string(kernel_size);
+        scores[i].sigma = sigma;
+
+        auto input = graph.stage<GrayImage>("pad", padNoisy);
+        auto uniform = graph.stage<GrayImage>("uniform" + size, [=](const GrayImage& in, GrayImage& out) {
+            applyUniformFilter(in, out, kernel_size);
+        }, input);
+        auto gaussian = graph.stage<GrayImage>("gaussian" + size, [=](const GrayImage& in, GrayImage& out) {
+            applyGaussianFilter(in, out, kernel_size, sigma);
+        }, input);
+        auto gaussianLarge = graph.stage<GrayImage>("gaussianLarge" + size, [=](const GrayImage& in, GrayImage& out) {
+            applyGaussianFilter(in, out, kernel_size, 100.0);
+        }, input);
+        graph.sink("psnr", psnrInto(scores[i].uniform), uniform);
+        graph.sink("psnr", psnrInto(scores[i].gaussian), gaussian);
+        graph.sink("psnr", psnrInto(scores[i].gaussianLarge), gaussianLarge);
+    }
+    ThreadPool pool;
+    graph.run(&pool);
 
     cout << fixed << setprecision(5);
     cout << "Initial Noisy PSNR: " << calculatePSNR(original, noisy) << " dB" << endl;
-    for (int kernel_size : {3, 5, 7, 9, 15}) {
-        
-        auto uniform = applyUniformFilter(noisy, kernel_size);
-        double psnr_uniform = calculatePSNR(original, uniform);
-
-        double sigma = getTheoreticalSigma(kernel_size);
-        auto gaussianTheoreticalSigma = applyGaussianFilter(noisy, kernel_size, sigma);
-        double psnr_gaussian = calculatePSNR(original, gaussianTheoreticalSigma);
-
-
-        auto gaussianLargeSigma = applyGaussianFilter(noisy, kernel_size, 100.0); 
-        double psnr_gaussian_large = calculatePSNR(original, gaussianLargeSigma);
-
-        cout << "Kernel " << kernel_size << "x" << kernel_size << " | Sigma: " << sigma << endl;
-        cout << "  Uniform PSNR:   " << psnr_uniform << " dB" << endl;
-        cout << "  Gaussian PSNR with Theoretical Sigma:  " << psnr_gaussian << " dB" << endl;
-        cout << "  Gaussian PSNR with Large Sigma:  " << psnr_gaussian_large << " dB" << endl;
-        
+    for (size_t i = 0; i < kernelSizes.size(); ++i) {
+        const int kernel_size = kernelSizes[i];
+        cout << "Kernel " << kernel_size << "x" << kernel_size << " | Sigma: " << scores[i].sigma << endl;
+        cout << "  Uniform PSNR:   " << scores[i].uniform << " dB" << endl;
+        cout << "  Gaussian PSNR with Theoretical Sigma:  " << scores[i].gaussian << " dB" << endl;
+        cout << "  Gaussian PSNR with Large Sigma:  " << scores[i].gaussianLarge << " dB" << endl;
     }
 
+    const StageGraphStats& stats = graph.stats();
+    cout << "Stages: " << stats.executed << " run of " << stats.declared << " declared, output buffers: "
+         << stats.buffersAllocated << " allocated, " << stats.buffersReused << " reused" << endl;
+
     return 0;
-}
\ No newline at end of file
+}
@@ -4,119 +4,217 @@
 #include <vector>
 #include <algorithm>
 #include <iomanip>
+#include <chrono>
+
+#include "image.h"
+#include "raw-io.h"
+#include "metrics.h"
+#include "bilateral.h"
+#include "edge-preserving.h"
+#include "sweep.h"
+#include "batch.h"
 
 using namespace std;
+using namespace imgcore;
 
 const int WIDTH = 768;
 const int HEIGHT = 512;
 
-inline unsigned char getPixel(const vector<unsigned char>& data, int x, int y, int width, int height) {
-    int c = max(0, min(x, width - 1));
-    int r = max(0, min(y, height - 1));
-    return data[r * width + c];
+// sigma_c is the spatial (closeness) sigma and sigma_s the range (similarity)
+// sigma. The weights are tabulated once per configuration; `src` should be
+// padded by kernel_radius so the engine does not have to copy it.
+void applyBilateralFilter(const GrayImage& src, GrayImage& dst,
+                          int kernel_radius, double sigma_c, double sigma_s) {
+    BilateralWeights weights(kernel_radius, sigma_c, sigma_s);
+    bilateralFilter(src, dst, weights);
 }
 
-vector<unsigned char> readRawImage(const string& filename, int width, int height) {
-    vector<unsigned char> img(width * height);
-    ifstream file(filename, ios::binary);
-    file.read(reinterpret_cast<char*>(img.data()), width * height);
-    file.close();
+// The large-radius modes take the same arguments so they can stand in for
+// the bilateral filter once its (2r+1)^2 window gets too slow (r > 5):
+// the guided filter smooths over the kernel_radius window with epsilon =
+// sigma_s^2 and ignores sigma_c; the domain transform smooths with
+// spatial sigma sigma_c and ignores kernel_radius. Neither needs `src`
+// padded, and their cost does not depend on the window size.
+void applyGuidedFilter(const GrayImage& src, GrayImage& dst,
+                       int kernel_radius, double, double sigma_s) {
+    guidedFilter(src, dst, kernel_radius, sigma_s);
+}
 
-    return img;
+void applyDomainTransform(const GrayImage& src, GrayImage& dst,
+                          int, double sigma_c, double sigma_s) {
+    domainTransformFilter(src, dst, sigma_c, sigma_s);
 }
 
-double calculatePSNR(const vector<unsigned char>& original, const vector<unsigned char>& denoised) {
-    double mse = 0.0;
-    long total_pixels = original.size();
-    for (size_t i = 0; i < total_pixels; ++i) {
-        double diff = (double)original[i] - (double)denoised[i];
-        mse += diff * diff;
+using FilterFn = void (*)(const GrayImage&, GrayImage&, int, double, double);
+
+// --batch: 5x5 bilateral on every frame with --sigma-c / --sigma-s
+// (defaults 2 and 40), written as <stem>_bilateral.raw. --filter guided
+// (--radius, default 8) or domain swaps in the large-radius modes,
+// written as <stem>_guided.raw or <stem>_domain.raw.
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    const string filter = options.option("filter", "bilateral");
+    const double sigma_c = options.option("sigma-c", 2.0);
+    const double sigma_s = options.option("sigma-s", 40.0);
+    BatchReport report;
+    if (filter == "bilateral") {
+        const int kernel_radius = 2;
+        const BilateralWeights weights(kernel_radius, sigma_c, sigma_s);
+        options.inputBorder = kernel_radius;
+        auto process = [&](const GrayImage& in, GrayImage& out, int) { bilateralFilter(in, out, weights); };
+        report = runBatch<GrayImage, GrayImage>(options, "_bilateral", process);
+    } else if (filter == "guided" || filter == "domain") {
+        const int kernel_radius = static_cast<int>(options.option("radius", 8.0));
+        const FilterFn apply = filter == "guided" ? applyGuidedFilter : applyDomainTransform;
+        auto process = [&](const GrayImage& in, GrayImage& out, int) {
+            apply(in, out, kernel_radius, sigma_c, sigma_s);
+        };
+        report = runBatch<GrayImage, GrayImage>(options, "_" + filter, process);
+    } else {
+        cerr << "Unknown filter " << filter << " (bilateral, guided or domain)" << endl;
+        return -1;
     }
-    mse /= (double)total_pixels;
-    if (mse == 0) return 100.0;
-    return 10.0 * log10((255.0 * 255.0) / mse);
+    report.print(cout);
+    return report.failed ? -1 : 0;
 }
 
-void applyBilateralFilter(const vector<unsigned char>& src, vector<unsigned char>& dst, 
-                          int width, int height, 
-                          int kernel_radius, double sigma_c, double sigma_s) {
-    dst.resize(src.size());
-    double two_sigma_c_sq = 2 * sigma_c * sigma_c;
-    double two_sigma_s_sq = 2 * sigma_s * sigma_s;
-
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            double sum_weights = 0.0;
-            double sum_pixel_values = 0.0;
-            double center_intensity = (double)getPixel(src, j, i, width, height);
-
-            for (int m = -kernel_radius; m <= kernel_radius; m++) {
-                for (int n = -kernel_radius; n <= kernel_radius; n++) {
-                    int neighbor_x = j + n;
-                    int neighbor_y = i + m;
-                    double neighbor_intensity = (double)getPixel(src, neighbor_x, neighbor_y, width, height);
-
-                    double spatial_dist_sq = m*m + n*n;
-                    double intensity_diff = center_intensity - neighbor_intensity;
-                    double intensity_diff_sq = intensity_diff * intensity_diff;
-
-                    double term_spatial = spatial_dist_sq / two_sigma_c_sq;
-                    double term_intensity = intensity_diff_sq / two_sigma_s_sq;
-                    double weight = exp(-(term_spatial + term_intensity));
-
-                    sum_pixel_values += neighbor_intensity * weight;
-                    sum_weights += weight;
-                }
-            }
-            double result_val = sum_pixel_values / sum_weights;
-            if (result_val < 0.0) result_val = 0.0;
-            if (result_val > 255.0) result_val = 255.0;
-            dst[i * width + j] = (unsigned char)(result_val + 0.5);
-        }
+// --filter guided / domain: the same PSNR sweep for a large-radius mode,
+// over (radius, sigma_s) or (sigma_c, sigma_s), streamed to
+// <filter>_sweep.csv, then both it and the bilateral filter timed on a
+// 17x17 window.
+int runLargeRadiusSweep(const string& filter, bool coarse_to_fine, const GrayView& img_original,
+                        const GrayImage& img_noisy) {
+    const bool guided = filter == "guided";
+    const FilterFn apply = guided ? applyGuidedFilter : applyDomainTransform;
+    vector<SweepParameter> parameters;
+    if (guided) {
+        parameters = {
+            {"radius", { 1.0, 2.0, 3.0, 4.0, 6.0, 8.0, 12.0, 16.0 }},
+            {"sigma_s", { 10.0, 30.0, 50.0, 80.0, 100.0, 120.0, 150.0, 200.0, 300.0 }}
+        };
+    } else {
+        parameters = {
+            {"sigma_c", { 0.5, 1.0, 2.0, 3.0, 4.0, 6.0, 8.0, 12.0, 16.0 }},
+            {"sigma_s", { 50.0, 100.0, 150.0, 200.0, 300.0, 400.0, 600.0, 800.0 }}
+        };
     }
+    ParameterSweep sweep(std::move(parameters));
+
+    ThreadPool pool;
+    WorkerLocal<GrayImage> result_imgs(pool);
+    auto score = [&](const vector<double>& params, int slot) {
+        apply(img_noisy, result_imgs[slot], static_cast<int>(params[0]), params[0], params[1]);
+        return calculatePSNR(img_original, result_imgs[slot]);
+    };
+
+    ofstream csv(filter + "_sweep.csv");
+    SweepReporter reporter(csv, SweepReporter::Format::Csv, sweep.parameters(), "psnr");
+    vector<SweepResult> results = coarse_to_fine ? sweep.runCoarseToFine(pool, score, 3, &reporter)
+                                                 : sweep.runGrid(pool, score, &reporter);
+    sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) { return a.indices < b.indices; });
+    const SweepResult& best_result = ParameterSweep::best(results);
+
+    cout << "--- " << filter << " ---" << endl;
+    cout << (guided ? "Radius" : "Sigma C") << "|Sigma S|PSNR (dB)|" << endl;
+    for (const SweepResult& r : results) {
+        cout << "| " << r.values[0] << " | " << r.values[1] << " | " << r.score << " |" << endl;
+    }
+    cout << "Best " << filter << " Config: " << (guided ? "Radius=" : "Sigma C=") << best_result.values[0]
+         << ", Sigma S=" << best_result.values[1] << " PSNR: " << best_result.score << " dB" << endl;
+
+    // Both filters on a window the brute-force one finds expensive
+    // (17x17, spatial sigma 4) at the best sigma_s of the sweep.
+    const int large_radius = 8;
+    const double large_sigma_c = 4.0;
+    const double sigma_s = best_result.values[1];
+    GrayImage img_noisy_padded = padded(img_noisy, large_radius);
+    GrayImage& result_img = result_imgs[0];
+    auto time_ms = [](const auto& run) {
+        const auto start = chrono::steady_clock::now();
+        run();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    const double fast_ms = time_ms([&] { apply(img_noisy, result_img, large_radius, large_sigma_c, sigma_s); });
+    const double fast_psnr = calculatePSNR(img_original, result_img);
+    const double bilateral_ms = time_ms([&] {
+        applyBilateralFilter(img_noisy_padded, result_img, large_radius, large_sigma_c, sigma_s);
+    });
+    cout << "Radius " << large_radius << ", Sigma C " << large_sigma_c << ", Sigma S " << sigma_s << ": " << filter
+         << " PSNR " << fast_psnr << " dB in " << fast_ms << " ms, bilateral PSNR "
+         << calculatePSNR(img_original, result_img) << " dB in " << bilateral_ms << " ms" << endl;
+    return 0;
 }
 
-struct TestResult {
-    double sigma_c;
-    double sigma_s;
-    double psnr;
-};
+// Runs the full 13 x 11 grid on all cores; pass --coarse-to-fine to search
+// the grid from a coarse lattice instead, and --filter guided or domain to
+// sweep a large-radius mode instead of the 5x5 bilateral. Every evaluated
+// point is also streamed to bilateral_sweep.csv as it completes.
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
+
+    bool coarse_to_fine = false;
+    string filter = "bilateral";
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--coarse-to-fine") {
+            coarse_to_fine = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--coarse-to-fine] [--filter bilateral|guided|domain]" << endl;
+            return -1;
+        }
+    }
+    if (filter != "bilateral" && filter != "guided" && filter != "domain") {
+        cerr << "Unknown filter " << filter << " (bilateral, guided or domain)" << endl;
+        return -1;
+    }
 
-int main() {
-    vector<unsigned char> img_original = readRawImage("flower_gray.raw", WIDTH, HEIGHT);
-    vector<unsigned char> img_noisy = readRawImage("flower_gray_noisy.raw", WIDTH, HEIGHT);
+    // The clean reference is only compared against, so it stays mapped.
+    MappedFile original_file;
+    GrayView img_original;
+    GrayImage img_noisy(WIDTH, HEIGHT);
 
-    if (img_original.empty() || img_noisy.empty()) return -1;
+    if (!mapRaw("flower_gray.raw", WIDTH, HEIGHT, original_file, img_original) ||
+        !readRaw("flower_gray_noisy.raw", img_noisy)) return -1;
+    if (filter != "bilateral") return runLargeRadiusSweep(filter, coarse_to_fine, img_original, img_noisy);
 
-    vector<unsigned char> result_img;
-    
     int kernel_radius = 2; 
+    GrayImage img_noisy_padded = padded(img_noisy, kernel_radius);
     
-    vector<double> sigma_c_values = { 0.5, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 8.0, 10.0, 20.0, 40.0, 80.0, 150.0 }; 
-    vector<double> sigma_s_values = { 10.0, 30.0, 40.0, 50.0, 60.0, 70.0, 80.0, 90.0, 100.0, 150.0, 300.0 };
-
-    vector<TestResult> results;
-    TestResult best_result = {0, 0, -1.0};
+    ParameterSweep sweep({
+        {"sigma_c", { 0.5, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 8.0, 10.0, 20.0, 40.0, 80.0, 150.0 }},
+        {"sigma_s", { 10.0, 30.0, 40.0, 50.0, 60.0, 70.0, 80.0, 90.0, 100.0, 150.0, 300.0 }}
+    });
+
+    ThreadPool pool;
+    // One output image per worker, reused across every configuration it runs.
+    WorkerLocal<GrayImage> result_imgs(pool);
+    auto score = [&](const vector<double>& params, int slot) {
+        applyBilateralFilter(img_noisy_padded, result_imgs[slot], kernel_radius, params[0], params[1]);
+        return calculatePSNR(img_original, result_imgs[slot]);
+    };
+
+    ofstream csv("bilateral_sweep.csv");
+    SweepReporter reporter(csv, SweepReporter::Format::Csv, sweep.parameters(), "psnr");
+    vector<SweepResult> results = coarse_to_fine ? sweep.runCoarseToFine(pool, score, 3, &reporter)
+                                                 : sweep.runGrid(pool, score, &reporter);
+    sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) { return a.indices < b.indices; });
+    const SweepResult& best_result = ParameterSweep::best(results);
 
     cout << "--- 5x5 ---" << endl;
     cout << "Sigma C|Sigma S|PSNR (dB)|" << endl;
 
-    for (double sc : sigma_c_values) {
-        for (double ss : sigma_s_values) {
-            
-            applyBilateralFilter(img_noisy, result_img, WIDTH, HEIGHT, kernel_radius, sc, ss);
-            double psnr = calculatePSNR(img_original, result_img);
-
-            TestResult current = {sc, ss, psnr};
-            results.push_back(current);
-
-            if (psnr > best_result.psnr) best_result = current;
-
-            cout << "| " << sc << " | " << ss << " | " << psnr << " |" << endl;
-        }
+    for (const SweepResult& r : results) {
+        cout << "| " << r.values[0] << " | " << r.values[1] << " | " << r.score << " |" << endl;
     }
 
-    cout << "Best 5x5 Config: Sigma C=" << best_result.sigma_c << ", Sigma S=" << best_result.sigma_s << "PSNR: " << best_result.psnr << " dB" << endl;
+    cout << "Best 5x5 Config: Sigma C=" << best_result.values[0] << ", Sigma S=" << best_result.values[1] << "PSNR: " << best_result.score << " dB" << endl;
+
+    GrayImage& result_img = result_imgs[0];
+    bilateralGrid(img_noisy, result_img, best_result.values[0], best_result.values[1]);
+    cout << "Bilateral grid (approximate) at best config PSNR: " << calculatePSNR(img_original, result_img) << " dB" << endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -5,100 +5,134 @@
 #include <vector>
 #include <iomanip>
 
+#include "image.h"
+#include "raw-io.h"
+#include "metrics.h"
+#include "sweep.h"
+#include "nlm.h"
+#include "batch.h"
+
 using namespace cv;
 using namespace std;
+using namespace imgcore;
 
 const int WIDTH = 768;
 const int HEIGHT = 512;
 const string CLEAN_FILE = "flower_gray.raw";
 const string NOISY_FILE = "flower_gray_noisy.raw";
 
-Mat readRawImage(const string& filename, int width, int height) {
-    Mat img(height, width, CV_8UC1);
-    ifstream file(filename, ios::binary);
-    file.read(reinterpret_cast<char*>(img.data), width * height);
-    file.close();
-    return img;
+// Wraps an Image in a Mat header without copying; OpenCV writes straight
+// into the Image when the destination already has the right size.
+Mat asMat(GrayImage& img) {
+    return Mat(img.height(), img.width(), CV_8UC1, img.data(), img.stride());
 }
 
-double calculatePSNR(const Mat& original, const Mat& denoised) {
-    Mat o_float, d_float;
-    original.convertTo(o_float, CV_32F);
-    denoised.convertTo(d_float, CV_32F);
-
-    Mat diff;
-    absdiff(o_float, d_float, diff);
-    diff = diff.mul(diff);
+// --batch: the in-project NLM engine on every frame with --h, --template,
+// --search (defaults 10, 7, 21) and --weights float|fixed, written as
+// <stem>_nlm.raw. Frames run in parallel, one per compute worker.
+int runBatchMode(int argc, char** argv) {
+    BatchOptions options;
+    if (!parseBatchArgs(argc, argv, options)) return -1;
+    NlmParams params;
+    params.h = static_cast<float>(options.option("h", 10.0));
+    params.templateSize = static_cast<int>(options.option("template", 7.0));
+    params.searchSize = static_cast<int>(options.option("search", 21.0));
+    params.weights = options.option("weights", "float") == "fixed" ? NlmWeights::Fixed : NlmWeights::Float;
+    auto process = [&](const GrayImage& in, GrayImage& out, int) { nlMeansDenoise(in, out, params); };
+    BatchReport report = runBatch<GrayImage, GrayImage>(options, "_nlm", process);
+    report.print(cout);
+    return report.failed ? -1 : 0;
+}
 
-    Scalar s = sum(diff);
-    double mse = s.val[0] / (double)(original.total());
+int main(int argc, char** argv) {
+    if (wantsBatch(argc, argv)) return runBatchMode(argc, argv);
 
-    if(mse == 0) return 100.0;
+    // The clean reference is only compared against, so it stays mapped.
+    MappedFile original_file;
+    GrayView img_original;
+    GrayImage img_noisy(WIDTH, HEIGHT);
 
-    double max_pixel = 255.0;
-    return 10.0 * log10((max_pixel * max_pixel) / mse);
-}
+    if (!mapRaw(CLEAN_FILE, WIDTH, HEIGHT, original_file, img_original) || !readRaw(NOISY_FILE, img_noisy)) return -1;
 
-int main() {
-    Mat img_original = readRawImage(CLEAN_FILE, WIDTH, HEIGHT);
-    Mat img_noisy = readRawImage(NOISY_FILE, WIDTH, HEIGHT);
-
-    if (img_original.empty() || img_noisy.empty()) return -1;
+    Mat noisy = asMat(img_noisy);
+    GrayImage result(WIDTH, HEIGHT);
+    Mat resultMat = asMat(result);
 
     cout << fixed << setprecision(2);
     cout << "Baseline (Noisy) PSNR: " << calculatePSNR(img_original, img_noisy) << " dB" << endl << endl;
 
-    float default_h = 10.0;
     int default_template = 7;
     int default_search = 21;
 
+    // The h and patch-size sweeps run one configuration per pool worker,
+    // each denoising into its own preallocated output. OpenCV's own
+    // threading is switched off while they run so the two do not fight.
+    ThreadPool pool;
+    WorkerLocal<GrayImage> outputs(pool);
+    for (GrayImage& out : outputs.all()) out.resize(WIDTH, HEIGHT);
+    int cv_threads = getNumThreads();
+    setNumThreads(1);
+
     cout << "--- Filter Strength (h) ---" << endl;
     cout << "Fixed: Patch=7, Search=21" << endl;
-    vector<float> h_values = {3, 5, 10, 15, 20, 25,30,35};
-    
-    double best_psnr = 0;
-    float best_h = 10;
-
-    for (float h : h_values) {
-        Mat result;
-        fastNlMeansDenoising(img_noisy, result, h, default_template, default_search);
-        double psnr = calculatePSNR(img_original, result);
-        
-        cout << "h=" << setw(2) << h << " -> PSNR: " << psnr << " dB";
-        if (psnr > best_psnr) {
-            best_psnr = psnr;
-            best_h = h;
-        }
-        cout << endl;
+    ParameterSweep h_sweep({{"h", {3, 5, 10, 15, 20, 25, 30, 35}}});
+    vector<SweepResult> h_results = h_sweep.runGrid(pool, [&](const vector<double>& params, int slot) {
+        Mat out = asMat(outputs[slot]);
+        fastNlMeansDenoising(noisy, out, static_cast<float>(params[0]), default_template, default_search);
+        return calculatePSNR(img_original, outputs[slot]);
+    });
+
+    for (const SweepResult& r : h_results) {
+        cout << "h=" << setw(2) << r.values[0] << " -> PSNR: " << r.score << " dB" << endl;
     }
+    float best_h = static_cast<float>(ParameterSweep::best(h_results).values[0]);
     cout << endl;
 
     cout << "--- Patch Size N' (Template Window) ---" << endl;
     cout << "Fixed: h=" << best_h << ", Search=21" << endl;
-    vector<int> template_sizes = {3, 5, 7, 9, 11}; // Must be odd
-
-    for (int t : template_sizes) {
-        Mat result;
-        fastNlMeansDenoising(img_noisy, result, best_h, t, default_search);
-        double psnr = calculatePSNR(img_original, result);
-        cout << "Patch Size=" << setw(2) << t << " -> PSNR: " << psnr << " dB" << endl;
+    ParameterSweep template_sweep({{"template", {3, 5, 7, 9, 11}}}); // Must be odd
+    vector<SweepResult> template_results = template_sweep.runGrid(pool, [&](const vector<double>& params, int slot) {
+        Mat out = asMat(outputs[slot]);
+        fastNlMeansDenoising(noisy, out, best_h, static_cast<int>(params[0]), default_search);
+        return calculatePSNR(img_original, outputs[slot]);
+    });
+
+    for (const SweepResult& r : template_results) {
+        cout << "Patch Size=" << setw(2) << static_cast<int>(r.values[0]) << " -> PSNR: " << r.score << " dB" << endl;
     }
     cout << endl;
 
+    setNumThreads(cv_threads);
+
+    // Search sizes stay serial: this sweep reports the wall time of each run.
+    // The in-project engine runs the same configuration on the pool, once
+    // with float and once with fixed-point weights.
     cout << "--- Search Window Size Aleph ---" << endl;
     cout << "Fixed: h=" << best_h << ", Patch=7" << endl;
     vector<int> search_sizes = {11, 21, 31, 41};
 
     for (int s : search_sizes) {
-        Mat result;
         double t = (double)getTickCount();
         
-        fastNlMeansDenoising(img_noisy, result, best_h, default_template, s);
+        fastNlMeansDenoising(noisy, resultMat, best_h, default_template, s);
         
         t = ((double)getTickCount() - t) / getTickFrequency();
         double psnr = calculatePSNR(img_original, result);
         
         cout << "Search Size=" << setw(2) << s << " -> PSNR: " << psnr << " dB" << " | Time: " << t << " sec" << endl;
+
+        NlmParams params;
+        params.h = best_h;
+        params.templateSize = default_template;
+        params.searchSize = s;
+        for (NlmWeights mode : {NlmWeights::Float, NlmWeights::Fixed}) {
+            params.weights = mode;
+            t = (double)getTickCount();
+            nlMeansDenoise(img_noisy, result, params, &pool);
+            t = ((double)getTickCount() - t) / getTickFrequency();
+            cout << "    NLM engine (" << (mode == NlmWeights::Float ? "float" : "fixed") << ") -> PSNR: "
+                 << calculatePSNR(img_original, result) << " dB" << " | Time: " << t << " sec" << endl;
+        }
     }
     cout << endl;
 
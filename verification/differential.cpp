@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "differential.h"
+#include "thread-pool.h"
+
+using namespace imgcore;
+
+namespace {
+
+struct DiffOptions {
+    int trials = 50;
+    uint64_t seed = 1;
+    std::string filter;
+    int threads = 0;  // pool workers for the paths that take one; 0 = hardware threads
+};
+
+bool parseArgs(int argc, char** argv, DiffOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--trials") {
+            options.trials = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value.c_str()));
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.threads == 0) options.threads = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+}  // namespace
+
+// Usage: differential [--trials 50] [--seed 1] [--filter text] [--threads N]
+// Runs every optimized path against its reference kernel on randomized
+// sizes, borders and parameters, and prints the worst max abs error and
+// PSNR delta per path. The exit status is 1 when any path exceeds its
+// tolerance; the failing configuration is printed so it can be replayed
+// with the same --seed and --filter.
+int main(int argc, char** argv) {
+    DiffOptions options;
+    if (!parseArgs(argc, argv, options)) return -1;
+
+    DifferentialHarness harness;
+    addReferenceChecks(harness);
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) pool = std::make_unique<ThreadPool>(options.threads - 1);
+    const auto summaries = harness.run(options.trials, options.seed, options.filter, pool.get());
+    printDiffSummaries(summaries, std::cout);
+    const bool failed =
+        std::any_of(summaries.begin(), summaries.end(), [](const DiffSummary& s) { return !s.passed(); });
+    return failed ? 1 : 0;
+}